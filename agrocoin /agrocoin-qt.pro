@@ -53,6 +53,14 @@ contains(USE_QRCODE, 1) {
     LIBS += -lqrencode
 }
 
+# use: qmake "USE_SECP256K1=1"
+# libsecp256k1 (https://github.com/bitcoin-core/secp256k1) must be installed for support
+contains(USE_SECP256K1, 1) {
+    message(Building with libsecp256k1 signature verification)
+    DEFINES += USE_SECP256K1
+    LIBS += -lsecp256k1
+}
+
 # use: qmake "USE_UPNP=1" ( enabled by default; default)
 #  or: qmake "USE_UPNP=0" (disabled by default)
 #  or: qmake "USE_UPNP=-" (not supported)
@@ -127,6 +135,10 @@ HEADERS += src/qt/bitcoingui.h \
     src/key.h \
     src/db.h \
     src/walletdb.h \
+    src/workcache.h \
+    src/walletjournal.h \
+    src/sha256.h \
+    src/txview.h \
     src/script.h \
     src/init.h \
     src/irc.h \
@@ -218,6 +230,10 @@ SOURCES += src/qt/bitcoin.cpp src/qt/bitcoingui.cpp \
     src/rpcdump.cpp \
     src/rpcnet.cpp \
     src/rpcrawtransaction.cpp \
+    src/workcache.cpp \
+    src/walletjournal.cpp \
+    src/sha256.cpp \
+    src/txview.cpp \
     src/qt/overviewpage.cpp \
     src/qt/csvmodelwriter.cpp \
     src/crypter.cpp \
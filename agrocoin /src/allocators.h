@@ -1,8 +1,11 @@
 
 #ifndef BITCOIN_ALLOCATORS_H
 #define BITCOIN_ALLOCATORS_H
+#include <stdlib.h>
 #include <string.h>
+#include <algorithm>
 #include <string>
+#include <new>
 #ifdef WIN32
 #ifdef _WIN32_WINNT
 #undef _WIN32_WINNT
@@ -100,6 +103,171 @@ struct zero_after_free_allocator : public std::allocator<T>
     }
 };
 
+
+
+//
+// Monotonic arena.  Allocations are carved one after the other out of large
+// chunks, so everything allocated while one arena is current sits together
+// in a few contiguous regions.  A chunk goes back to the heap when the last
+// allocation in it is freed, from whichever thread, so containers may
+// outlive the arena they came from.
+//
+class CAllocArena
+{
+private:
+    union Chunk
+    {
+        volatile int nRefs;
+        long long nAlign;
+    };
+    // Every allocation starts with the chunk it belongs to, NULL if it came
+    // straight from the heap
+    union Header
+    {
+        Chunk* pchunk;
+        long long nAlign;
+    };
+
+    Chunk* pchunk;
+    unsigned char* pnext;
+    unsigned char* pend;
+    size_t nNextSize;
+    size_t nMaxFirstChunk;
+    CAllocArena* pprev;
+
+    static CAllocArena*& Current()
+    {
+        static __thread CAllocArena* pcurrent = NULL;
+        return pcurrent;
+    }
+
+    static void Release(Chunk* p)
+    {
+        if (__sync_sub_and_fetch(&p->nRefs, 1) == 0)
+            free(p);
+    }
+
+    Header* AllocateFromChunk(size_t n)
+    {
+        if (pchunk == NULL || (size_t)(pend - pnext) < n)
+        {
+            // Without a hint the first request sizes the first chunk.  For
+            // a block that is the transaction array, and the inputs and
+            // outputs need about twice as much again.  The extra room stops
+            // at nMaxFirstChunk, so a count off the network that hasn't
+            // been checked yet doesn't get four times what it asked for.
+            if (nNextSize == 0)
+                nNextSize = std::max((size_t)4096, std::max(n, std::min(4 * n, nMaxFirstChunk)));
+            size_t nSize = std::max(nNextSize, n);
+            Chunk* p = (Chunk*)malloc(sizeof(Chunk) + nSize);
+            if (p == NULL)
+                throw std::bad_alloc();
+            p->nRefs = 1;
+            if (pchunk != NULL)
+                Release(pchunk);
+            pchunk = p;
+            pnext = (unsigned char*)(p + 1);
+            pend = pnext + nSize;
+            nNextSize = 2 * nSize;
+        }
+        Header* p = (Header*)pnext;
+        pnext += n;
+        __sync_add_and_fetch(&pchunk->nRefs, 1);
+        p->pchunk = pchunk;
+        return p;
+    }
+
+    CAllocArena(const CAllocArena&);
+    CAllocArena& operator=(const CAllocArena&);
+
+public:
+    // The arena is current for this thread until it is destroyed
+    explicit CAllocArena(size_t nFirstChunk=0, size_t nMaxFirstChunkIn=(size_t)-1) :
+        pchunk(NULL), pnext(NULL), pend(NULL), nNextSize(nFirstChunk), nMaxFirstChunk(nMaxFirstChunkIn)
+    {
+        pprev = Current();
+        Current() = this;
+    }
+
+    ~CAllocArena()
+    {
+        Current() = pprev;
+        if (pchunk != NULL)
+            Release(pchunk);
+    }
+
+    static bool IsActive()
+    {
+        return Current() != NULL;
+    }
+
+    // From the current arena if there is one, otherwise from the heap
+    static void* Allocate(size_t n)
+    {
+        if (n > ((size_t)-1) / 2)
+            throw std::bad_alloc();
+        n = sizeof(Header) + ((n + sizeof(Header) - 1) & ~(sizeof(Header) - 1));
+        Header* p;
+        if (Current() != NULL)
+            p = Current()->AllocateFromChunk(n);
+        else
+        {
+            p = (Header*)malloc(n);
+            if (p == NULL)
+                throw std::bad_alloc();
+            p->pchunk = NULL;
+        }
+        return p + 1;
+    }
+
+    static void Free(void* p)
+    {
+        if (p == NULL)
+            return;
+        Header* h = (Header*)p - 1;
+        if (h->pchunk != NULL)
+            Release(h->pchunk);
+        else
+            free(h);
+    }
+};
+
+//
+// Allocator for containers that can live in a CAllocArena: they allocate
+// from the thread's current arena, if any, and otherwise from the heap.
+//
+template<typename T>
+struct arena_allocator : public std::allocator<T>
+{
+    typedef std::allocator<T> base;
+    typedef typename base::size_type size_type;
+    typedef typename base::difference_type  difference_type;
+    typedef typename base::pointer pointer;
+    typedef typename base::const_pointer const_pointer;
+    typedef typename base::reference reference;
+    typedef typename base::const_reference const_reference;
+    typedef typename base::value_type value_type;
+    arena_allocator() throw() {}
+    arena_allocator(const arena_allocator& a) throw() : base(a) {}
+    template <typename U>
+    arena_allocator(const arena_allocator<U>& a) throw() : base(a) {}
+    ~arena_allocator() throw() {}
+    template<typename _Other> struct rebind
+    { typedef arena_allocator<_Other> other; };
+
+    T* allocate(std::size_t n, const void *hint = 0)
+    {
+        if (n > ((size_t)-1) / sizeof(T))
+            throw std::bad_alloc();
+        return (T*)CAllocArena::Allocate(sizeof(T) * n);
+    }
+
+    void deallocate(T* p, std::size_t n)
+    {
+        CAllocArena::Free(p);
+    }
+};
+
 typedef std::basic_string<char, std::char_traits<char>, secure_allocator<char> > SecureString;
 
 #endif
@@ -0,0 +1,56 @@
+#include "bench.h"
+
+#include <vector>
+#include <boost/foreach.hpp>
+
+using namespace std;
+
+static vector<pair<string, benchfn_type> >& Benchmarks()
+{
+    static vector<pair<string, benchfn_type> > vBenchmarks;
+    return vBenchmarks;
+}
+
+CBenchRegister::CBenchRegister(const char* pszName, benchfn_type fn)
+{
+    Benchmarks().push_back(make_pair(string(pszName), fn));
+}
+
+CBenchState::CBenchState(const string& strNameIn, int64 nMaxMillis) :
+    strName(strNameIn), nMaxMicros(nMaxMillis * 1000), nIterations(0)
+{
+    nStartMicros = nLastMicros = GetTimeMicros();
+}
+
+bool CBenchState::KeepRunning()
+{
+    // Reading the clock costs a few tens of nanoseconds; fine for anything
+    // worth benchmarking here.
+    nLastMicros = GetTimeMicros();
+    if (nIterations > 0 && nLastMicros - nStartMicros >= nMaxMicros)
+    {
+        int64 nElapsed = nLastMicros - nStartMicros;
+        printf("%-32s %10"PRI64u" iterations %10.3f ms %12.3f us/iter\n",
+                 strName.c_str(), nIterations, nElapsed / 1000.0, (double)nElapsed / nIterations);
+        return false;
+    }
+    nIterations++;
+    return true;
+}
+
+void CBenchState::Count(const string& strCounter, double dValue)
+{
+    printf("%-32s %s = %.2f\n", strName.c_str(), strCounter.c_str(), dValue);
+}
+
+void RunBenchmarks(const string& strFilter, int64 nMaxMillis)
+{
+    typedef pair<string, benchfn_type> BenchPair;
+    BOOST_FOREACH(const BenchPair& bench, Benchmarks())
+    {
+        if (bench.first.find(strFilter) == string::npos)
+            continue;
+        CBenchState state(bench.first, nMaxMillis);
+        bench.second(state);
+    }
+}
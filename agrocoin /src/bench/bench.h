@@ -0,0 +1,52 @@
+#ifndef BITCOIN_BENCH_BENCH_H
+#define BITCOIN_BENCH_BENCH_H
+
+#include <string>
+#include <boost/preprocessor/cat.hpp>
+
+#include "util.h"
+
+//
+// Minimal microbenchmark harness for bench_agrocoind.  A benchmark runs its
+// loop body for as long as KeepRunning() returns true:
+//
+//     static void HashTransaction(CBenchState& state)
+//     {
+//         CTransaction tx = ...;
+//         while (state.KeepRunning())
+//             tx.GetHash();
+//     }
+//     BENCHMARK(HashTransaction);
+//
+class CBenchState
+{
+private:
+    std::string strName;
+    int64 nStartMicros;
+    int64 nMaxMicros;
+    int64 nLastMicros;
+    uint64 nIterations;
+
+public:
+    CBenchState(const std::string& strNameIn, int64 nMaxMillis);
+
+    bool KeepRunning();
+
+    // Report a counter alongside the timing, e.g. calls of interest per iteration
+    void Count(const std::string& strCounter, double dValue);
+};
+
+typedef void (*benchfn_type)(CBenchState&);
+
+class CBenchRegister
+{
+public:
+    CBenchRegister(const char* pszName, benchfn_type fn);
+};
+
+#define BENCHMARK(n) static CBenchRegister BOOST_PP_CAT(benchregister_, n)(#n, n)
+
+// Runs every registered benchmark whose name contains strFilter
+void RunBenchmarks(const std::string& strFilter, int64 nMaxMillis);
+
+#endif
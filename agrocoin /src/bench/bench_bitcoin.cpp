@@ -0,0 +1,38 @@
+#include "bench.h"
+
+#include "main.h"
+#include "wallet.h"
+
+CWallet* pwalletMain;
+CClientUIInterface uiInterface;
+
+extern bool fPrintToConsole;
+extern void noui_connect();
+
+void Shutdown(void* parg)
+{
+  exit(0);
+}
+
+void StartShutdown()
+{
+  exit(0);
+}
+
+// Usage: bench_agrocoind [filter] [milliseconds per benchmark]
+int main(int argc, char* argv[])
+{
+    fPrintToConsole = true; // don't want to write to debug.log file
+    noui_connect();
+    printf("Using SHA256 implementation: %s\n", SHA256AutoDetect().c_str());
+    pwalletMain = new CWallet();
+    RegisterWallet(pwalletMain);
+
+    std::string strFilter = (argc > 1) ? argv[1] : "";
+    int64 nMaxMillis = (argc > 2) ? atoi64(argv[2]) : 1000;
+    RunBenchmarks(strFilter, nMaxMillis);
+
+    delete pwalletMain;
+    pwalletMain = NULL;
+    return 0;
+}
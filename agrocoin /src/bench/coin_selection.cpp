@@ -0,0 +1,50 @@
+#include "bench.h"
+
+#include "wallet.h"
+
+using namespace std;
+
+// A payout wallet: 10^5 confirmed outputs of assorted sizes
+static void MakeCoins(CWallet& wallet, vector<CWalletTx*>& vTx, vector<COutput>& vCoins)
+{
+    for (int i = 0; i < 100000; i++)
+    {
+        CTransaction tx;
+        tx.nLockTime = i;       // so all transactions get different hashes
+        tx.vout.resize(1);
+        tx.vout[0].nValue = 1000 + (int64)GetRand(50 * COIN);
+        vTx.push_back(new CWalletTx(&wallet, tx));
+        vCoins.push_back(COutput(vTx.back(), 0, 6*24));
+    }
+}
+
+static void SelectCoins(CBenchState& state, int64 nTargetValue)
+{
+    CWallet wallet;
+    vector<CWalletTx*> vTx;
+    vector<COutput> vCoins;
+    MakeCoins(wallet, vTx, vCoins);
+
+    set<pair<const CWalletTx*,unsigned int> > setCoinsRet;
+    int64 nValueRet;
+    while (state.KeepRunning())
+        wallet.SelectCoinsMinConf(nTargetValue, 1, 6, vCoins, setCoinsRet, nValueRet);
+    state.Count("coins", setCoinsRet.size());
+    state.Count("excess", nValueRet - nTargetValue);
+
+    BOOST_FOREACH(CWalletTx* pwtx, vTx)
+        delete pwtx;
+}
+
+static void SelectCoinsSmallPayout(CBenchState& state)
+{
+    SelectCoins(state, 12345678 * CENT / 100);
+}
+
+static void SelectCoinsLargePayout(CBenchState& state)
+{
+    SelectCoins(state, 1234567 * CENT);
+}
+
+BENCHMARK(SelectCoinsSmallPayout);
+BENCHMARK(SelectCoinsLargePayout);
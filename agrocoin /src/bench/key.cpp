@@ -0,0 +1,98 @@
+#include "bench.h"
+
+#include "key.h"
+#include "script.h"
+#include "keystore.h"
+
+using namespace std;
+
+// A block's worth of inputs spending from a few hundred addresses, so the
+// keys repeat the way they do on the chain
+class CBenchSignatures
+{
+public:
+    vector<vector<unsigned char> > vPubKeys;
+    vector<vector<unsigned char> > vSigs;
+    vector<uint256> vHashes;
+
+    CBenchSignatures()
+    {
+        vector<CKey> vKeys(200);
+        for (unsigned int i = 0; i < vKeys.size(); i++)
+            vKeys[i].MakeNewKey(i % 2 == 0);
+        for (unsigned int i = 0; i < 1000; i++)
+        {
+            CKey& key = vKeys[i % vKeys.size()];
+            uint256 hash = GetRandHash();
+            vector<unsigned char> vchSig;
+            key.Sign(hash, vchSig);
+            vPubKeys.push_back(key.GetPubKey().Raw());
+            vSigs.push_back(vchSig);
+            vHashes.push_back(hash);
+        }
+    }
+};
+
+// The way CheckSig verified before: parse into a fresh EC_KEY every time
+static void VerifyOpenSSL(CBenchState& state)
+{
+    CBenchSignatures sigs;
+    uint64 nFailed = 0;
+    while (state.KeepRunning())
+    {
+        for (unsigned int i = 0; i < sigs.vSigs.size(); i++)
+        {
+            CKey key;
+            if (!key.SetPubKey(CPubKey(sigs.vPubKeys[i])) || !key.Verify(sigs.vHashes[i], sigs.vSigs[i]))
+                nFailed++;
+        }
+    }
+    state.Count("sigs", sigs.vSigs.size());
+    state.Count("failed", nFailed);
+}
+
+// CPubKey::Verify, with the parsed key cache when built with USE_SECP256K1
+static void VerifyPubKey(CBenchState& state)
+{
+    CBenchSignatures sigs;
+    uint64 nFailed = 0;
+    while (state.KeepRunning())
+    {
+        for (unsigned int i = 0; i < sigs.vSigs.size(); i++)
+            if (!CPubKey(sigs.vPubKeys[i]).Verify(sigs.vHashes[i], sigs.vSigs[i]))
+                nFailed++;
+    }
+    state.Count("sigs", sigs.vSigs.size());
+    state.Count("failed", nFailed);
+}
+
+// A key pool's worth of keys in a plain key store, looked up the way
+// address listings and signing do
+static void KeyStoreLookups(CBenchState& state)
+{
+    CBasicKeyStore keystore;
+    for (int i = 0; i < 1000; i++)
+    {
+        CKey key;
+        key.MakeNewKey(true);
+        keystore.AddKey(key);
+    }
+    set<CKeyID> setKeys;
+    keystore.GetKeys(setKeys);
+
+    while (state.KeepRunning())
+    {
+        for (set<CKeyID>::const_iterator it = setKeys.begin(); it != setKeys.end(); ++it)
+        {
+            CPubKey pubkey;
+            keystore.GetPubKey(*it, pubkey);
+            CKey key;
+            keystore.GetKey(*it, key);
+        }
+    }
+    state.Count("keys", setKeys.size());
+}
+
+BENCHMARK(VerifyOpenSSL);
+BENCHMARK(VerifyPubKey);
+BENCHMARK(KeyStoreLookups);
@@ -0,0 +1,62 @@
+#include "bench.h"
+
+#include "bitcoinrpc.h"
+
+using namespace std;
+using namespace json_spirit;
+
+// A getwork poll, the most frequent request from pool software
+static const string strGetwork = "{\"method\":\"getwork\",\"params\":[],\"id\":1}\n";
+
+// A payout: sendmany with 200 recipients
+static string SendmanyRequest()
+{
+    string str = "{\"method\":\"sendmany\",\"params\":[\"payouts\",{";
+    for (int i = 0; i < 200; i++)
+        str += strprintf("%s\"AGRoX%035d\":%d.%08d", i ? "," : "", i, i % 7, i * 1234567 % 100000000);
+    str += "},1,\"pool payout\"],\"id\":\"payout-1\"}\n";
+    return str;
+}
+
+static void ParseGetworkSpirit(CBenchState& state)
+{
+    while (state.KeepRunning())
+    {
+        Value value;
+        read_string(strGetwork, value);
+    }
+}
+
+static void ParseGetworkFast(CBenchState& state)
+{
+    while (state.KeepRunning())
+    {
+        Value value;
+        ReadJSON(strGetwork, value);
+    }
+}
+
+static void ParseSendmanySpirit(CBenchState& state)
+{
+    string str = SendmanyRequest();
+    while (state.KeepRunning())
+    {
+        Value value;
+        read_string(str, value);
+    }
+}
+
+static void ParseSendmanyFast(CBenchState& state)
+{
+    string str = SendmanyRequest();
+    while (state.KeepRunning())
+    {
+        Value value;
+        ReadJSON(str, value);
+    }
+}
+
+BENCHMARK(ParseGetworkSpirit);
+BENCHMARK(ParseGetworkFast);
+BENCHMARK(ParseSendmanySpirit);
+BENCHMARK(ParseSendmanyFast);
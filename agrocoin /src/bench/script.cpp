@@ -0,0 +1,183 @@
+#include "bench.h"
+
+#include "main.h"
+#include "script.h"
+#include "json/json_spirit_reader_template.h"
+
+#include <fstream>
+#include <boost/algorithm/string.hpp>
+#include <boost/foreach.hpp>
+
+using namespace std;
+using namespace json_spirit;
+
+// The script_tests notation: numbers, 0x raw bytes, 'pushed strings' and
+// opcode names with or without OP_
+static CScript ParseTestScript(const string& s)
+{
+    static map<string, opcodetype> mapOpNames;
+    if (mapOpNames.empty())
+    {
+        for (int op = OP_NOP; op <= OP_NOP10; op++)
+        {
+            string strName(GetOpName((opcodetype)op));
+            if (strName == "OP_UNKNOWN")
+                continue;
+            mapOpNames[strName] = (opcodetype)op;
+            boost::algorithm::replace_first(strName, "OP_", "");
+            mapOpNames[strName] = (opcodetype)op;
+        }
+    }
+
+    CScript result;
+    vector<string> words;
+    boost::algorithm::split(words, s, boost::algorithm::is_any_of(" \t\n"), boost::algorithm::token_compress_on);
+    BOOST_FOREACH(const string& w, words)
+    {
+        if (w.empty())
+            continue;
+        string strDigits = (w[0] == '-') ? w.substr(1) : w;
+        if (!strDigits.empty() && boost::algorithm::all(strDigits, boost::algorithm::is_digit()))
+            result << atoi64(w);
+        else if (w.substr(0, 2) == "0x")
+        {
+            vector<unsigned char> raw = ParseHex(w.substr(2));
+            result.insert(result.end(), raw.begin(), raw.end());
+        }
+        else if (w.size() >= 2 && w[0] == '\'' && w[w.size()-1] == '\'')
+            result << vector<unsigned char>(w.begin() + 1, w.end() - 1);
+        else if (mapOpNames.count(w))
+            result << mapOpNames[w];
+    }
+    return result;
+}
+
+// The valid vectors from test/data/script_valid.json, as pairs of
+// scriptSig and scriptPubKey
+static bool ReadValidScripts(vector<pair<CScript, CScript> >& vScripts)
+{
+    ifstream ifs("test/data/script_valid.json");
+    Value v;
+    if (!read_stream(ifs, v) || v.type() != array_type)
+    {
+        printf("ReadValidScripts() : run from src/, test/data/script_valid.json not found\n");
+        return false;
+    }
+    BOOST_FOREACH(const Value& tv, v.get_array())
+    {
+        const Array& test = tv.get_array();
+        if (test.size() >= 2)
+            vScripts.push_back(make_pair(ParseTestScript(test[0].get_str()), ParseTestScript(test[1].get_str())));
+    }
+    return true;
+}
+
+// Every valid script_tests vector through VerifyScript, the way inputs are
+// checked, minus the signatures
+static void VerifyScriptValidVectors(CBenchState& state)
+{
+    vector<pair<CScript, CScript> > vScripts;
+    if (!ReadValidScripts(vScripts))
+        return;
+
+    CTransaction tx;
+    uint64 nFailed = 0;
+    while (state.KeepRunning())
+    {
+        for (unsigned int i = 0; i < vScripts.size(); i++)
+            if (!VerifyScript(vScripts[i].first, vScripts[i].second, tx, 0, true, SIGHASH_NONE))
+                nFailed++;
+    }
+    state.Count("scripts", vScripts.size());
+    state.Count("failed", nFailed);
+}
+
+// Numeric opcodes only: 200 increments and a comparison
+static void EvalScriptArithmetic(CBenchState& state)
+{
+    CScript script;
+    script << 1000;
+    for (int i = 0; i < 200; i++)
+        script << OP_1ADD;
+    script << 1200 << OP_NUMEQUAL;
+
+    CTransaction tx;
+    while (state.KeepRunning())
+    {
+        CScriptStack stack;
+        EvalScript(stack, script, tx, 0, SIGHASH_NONE, NULL);
+    }
+}
+
+// The signature-free part of a pay-to-pubkey-hash spend: copies and hashes
+// of a 65 byte key
+static void EvalScriptPubKeyHash(CBenchState& state)
+{
+    CKey key;
+    key.MakeNewKey(false);
+    vector<unsigned char> vchPubKey = key.GetPubKey().Raw();
+    CScript scriptSig;
+    scriptSig << vector<unsigned char>(72, 0x30) << vchPubKey;
+    CScript scriptPubKey;
+    scriptPubKey << OP_DUP << OP_HASH160 << key.GetPubKey().GetID() << OP_EQUALVERIFY << OP_DROP << OP_DROP << OP_TRUE;
+
+    CTransaction tx;
+    while (state.KeepRunning())
+        VerifyScript(scriptSig, scriptPubKey, tx, 0, true, SIGHASH_NONE);
+}
+
+// What a rescan does to every output before looking for its keys
+static void SolverStandard(CBenchState& state)
+{
+    CKey key[3];
+    for (int i = 0; i < 3; i++)
+        key[i].MakeNewKey(i != 0);
+    vector<CScript> vScripts(4);
+    vScripts[0] << OP_DUP << OP_HASH160 << key[0].GetPubKey().GetID() << OP_EQUALVERIFY << OP_CHECKSIG;
+    vScripts[1] << key[0].GetPubKey() << OP_CHECKSIG;
+    vScripts[2].SetDestination(CScriptID(Hash160(vScripts[0])));
+    vScripts[3] << OP_1 << key[0].GetPubKey() << key[1].GetPubKey() << key[2].GetPubKey() << OP_3 << OP_CHECKMULTISIG;
+
+    while (state.KeepRunning())
+    {
+        BOOST_FOREACH(const CScript& script, vScripts)
+        {
+            vector<vector<unsigned char> > vSolutions;
+            txnouttype whichType;
+            Solver(script, whichType, vSolutions);
+        }
+    }
+}
+
+// What the wallet does to every output it sees relayed or rescans: a key
+// store with a thousand keys, outputs paying strangers and, now and then, us
+static void IsMineOutputs(CBenchState& state)
+{
+    CBasicKeyStore keystore;
+    vector<CScript> vScripts(1000);
+    for (unsigned int i = 0; i < vScripts.size(); i++)
+    {
+        CKey key;
+        key.MakeNewKey(true);
+        keystore.AddKey(key);
+        if (i % 100 == 0)
+            vScripts[i].SetDestination(key.GetPubKey().GetID());
+        else
+            vScripts[i].SetDestination(CKeyID(Hash160(vScripts[i-1])));
+    }
+
+    uint64 nMine = 0;
+    while (state.KeepRunning())
+    {
+        BOOST_FOREACH(const CScript& script, vScripts)
+            if (IsMine(keystore, script))
+                nMine++;
+    }
+    state.Count("outputs", vScripts.size());
+}
+
+BENCHMARK(VerifyScriptValidVectors);
+BENCHMARK(EvalScriptArithmetic);
+BENCHMARK(EvalScriptPubKeyHash);
+BENCHMARK(SolverStandard);
+BENCHMARK(IsMineOutputs);
@@ -0,0 +1,113 @@
+#include "bench.h"
+
+#include "main.h"
+
+using namespace std;
+
+// An inv or getdata message of a thousand entries
+static vector<CInv> MakeInvs()
+{
+    vector<CInv> vInv;
+    for (unsigned int i = 0; i < 1000; i++)
+        vInv.push_back(CInv(MSG_TX, GetRandHash()));
+    return vInv;
+}
+
+static void SerializeInv(CBenchState& state)
+{
+    vector<CInv> vInv = MakeInvs();
+    while (state.KeepRunning())
+    {
+        CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+        ss << vInv;
+    }
+}
+
+// Reads straight out of a buffer, so that copying a CDataStream for every
+// iteration doesn't swamp what is being measured
+class CBufferReader
+{
+private:
+    const char* p;
+
+public:
+    explicit CBufferReader(const char* pIn) : p(pIn) { }
+
+    CBufferReader& read(char* pch, size_t nSize)
+    {
+        memcpy(pch, p, nSize);
+        p += nSize;
+        return *this;
+    }
+};
+
+static void DeserializeInv(CBenchState& state)
+{
+    CDataStream ssInv(SER_NETWORK, PROTOCOL_VERSION);
+    ssInv << MakeInvs();
+    while (state.KeepRunning())
+    {
+        CBufferReader reader(&ssInv[0]);
+        vector<CInv> vInv;
+        ::Unserialize(reader, vInv, SER_NETWORK, PROTOCOL_VERSION);
+    }
+}
+
+// A wallet transaction's merkle branch, read and written with the wallet
+static void SerializeMerkleBranch(CBenchState& state)
+{
+    vector<uint256> vMerkleBranch;
+    for (int i = 0; i < 12; i++)
+        vMerkleBranch.push_back(GetRandHash());
+    while (state.KeepRunning())
+    {
+        CDataStream ss(SER_DISK, CLIENT_VERSION);
+        ss << vMerkleBranch;
+        vector<uint256> v;
+        ss >> v;
+    }
+}
+
+// What CheckBlock and AcceptBlock ask of every block, here 1000 two-in,
+// two-out transactions
+static void GetSerializeSizeBlock(CBenchState& state)
+{
+    CBlock block;
+    block.vtx.resize(1000);
+    for (unsigned int i = 0; i < block.vtx.size(); i++)
+    {
+        CTransaction& tx = block.vtx[i];
+        tx.vin.resize(2);
+        tx.vout.resize(2);
+        for (int j = 0; j < 2; j++)
+        {
+            tx.vin[j].prevout = COutPoint(GetRandHash(), j);
+            tx.vin[j].scriptSig << vector<unsigned char>(72, 0x30) << vector<unsigned char>(33, 0x02);
+            tx.vout[j].nValue = COIN;
+            tx.vout[j].scriptPubKey.SetDestination(CKeyID(uint160(i * 2 + j)));
+        }
+    }
+    unsigned int nSize = 0;
+    while (state.KeepRunning())
+        nSize = ::GetSerializeSize(block, SER_NETWORK, PROTOCOL_VERSION);
+    state.Count("bytes", nSize);
+}
+
+// The spent pointers of a transaction index entry with 100 outputs
+static void SerializeTxIndex(CBenchState& state)
+{
+    CTxIndex txindex(CDiskTxPos(1, 2, 3), 100);
+    while (state.KeepRunning())
+    {
+        CDataStream ss(SER_DISK, CLIENT_VERSION);
+        ss << txindex;
+        CTxIndex txindex2;
+        ss >> txindex2;
+    }
+}
+
+BENCHMARK(SerializeInv);
+BENCHMARK(DeserializeInv);
+BENCHMARK(SerializeMerkleBranch);
+BENCHMARK(GetSerializeSizeBlock);
+BENCHMARK(SerializeTxIndex);
@@ -0,0 +1,43 @@
+#include "bench.h"
+
+#include "main.h"
+#include "sha256.h"
+
+using namespace std;
+
+// Plain SHA-256 over a megabyte, what a large block's hash costs
+static void SHA256Megabyte(CBenchState& state)
+{
+    vector<unsigned char> vch(1000000, 0x5a);
+    unsigned char hash[CSHA256::OUTPUT_SIZE];
+    while (state.KeepRunning())
+        CSHA256().Write(&vch[0], vch.size()).Finalize(hash);
+}
+
+// The inner nodes of a merkle tree: double SHA-256 of 64 bytes, a level
+// at a time
+static void SHA256D64Level(CBenchState& state)
+{
+    vector<unsigned char> vchIn(64 * 1024, 0x5a), vchOut(32 * 1024);
+    while (state.KeepRunning())
+        SHA256D64(&vchOut[0], &vchIn[0], 1024);
+    state.Count("hashes", 1024);
+}
+
+// The merkle root of a 2000 transaction block, transaction hashes cached
+static void BuildMerkleTreeLarge(CBenchState& state)
+{
+    CBlock block;
+    block.vtx.resize(2000);
+    for (unsigned int i = 0; i < block.vtx.size(); i++)
+    {
+        block.vtx[i].nLockTime = i;
+        block.vtx[i].GetHash();
+    }
+    while (state.KeepRunning())
+        block.BuildMerkleTree();
+}
+
+BENCHMARK(SHA256Megabyte);
+BENCHMARK(SHA256D64Level);
+BENCHMARK(BuildMerkleTreeLarge);
@@ -0,0 +1,125 @@
+#include "bench.h"
+
+#include "main.h"
+#include "txview.h"
+
+#include <boost/foreach.hpp>
+
+using namespace std;
+
+// A block as it comes off the wire: 500 two-in, two-out transactions
+static CDataStream MakeBlockStream()
+{
+    CBlock block;
+    block.vtx.resize(500);
+    for (unsigned int i = 0; i < block.vtx.size(); i++)
+    {
+        CTransaction& tx = block.vtx[i];
+        tx.vin.resize(2);
+        tx.vout.resize(2);
+        for (int j = 0; j < 2; j++)
+        {
+            tx.vin[j].prevout = COutPoint(GetRandHash(), j);
+            tx.vin[j].scriptSig << vector<unsigned char>(72, 0x30) << vector<unsigned char>(33, 0x02);
+            tx.vout[j].nValue = (i + 1) * COIN;
+            tx.vout[j].scriptPubKey.SetDestination(CKeyID(uint160(i * 2 + j)));
+        }
+    }
+    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+    ss << block;
+    return ss;
+}
+
+// The transaction hashes taken while a block is connected: CheckBlock's
+// duplicate check and merkle root, once from ProcessBlock and again from
+// ConnectBlock, the tx index entry, SyncWithWallets and mempool.remove
+static void ConnectBlockHashes(CBenchState& state)
+{
+    CDataStream ssBlock = MakeBlockStream();
+    unsigned int nCalls = 0;
+    while (state.KeepRunning())
+    {
+        CDataStream ss(ssBlock);
+        CBlock block;
+        ss >> block;
+        nCalls = 0;
+        for (int nCheck = 0; nCheck < 2; nCheck++)
+        {
+            set<uint256> uniqueTx;
+            BOOST_FOREACH(const CTransaction& tx, block.vtx)
+                uniqueTx.insert(tx.GetHash());
+            block.BuildMerkleTree();
+            nCalls += 2;
+        }
+        map<uint256, unsigned int> mapQueuedChanges;
+        BOOST_FOREACH(const CTransaction& tx, block.vtx)
+            mapQueuedChanges[tx.GetHash()] = tx.vout.size();
+        uint256 hashWallet = 0;
+        BOOST_FOREACH(const CTransaction& tx, block.vtx)
+            hashWallet ^= tx.GetHash();
+        BOOST_FOREACH(const CTransaction& tx, block.vtx)
+            hashWallet ^= tx.GetHash();
+        nCalls += 3;
+    }
+    state.Count("GetHash calls per tx", nCalls);
+}
+
+// Reading a block off the network or the disk and dropping it again, which
+// is mostly allocating and freeing its transactions, inputs and outputs
+static void DeserializeBlock(CBenchState& state)
+{
+    CDataStream ssBlock = MakeBlockStream();
+    while (state.KeepRunning())
+    {
+        CDataStream ss(ssBlock);
+        CBlock block;
+        ss >> block;
+    }
+}
+
+// What a rescan does with every block: hash each transaction and look at
+// each output, here by deserializing the block first
+static void ScanBlockDeserialize(CBenchState& state)
+{
+    CDataStream ssBlock = MakeBlockStream();
+    int64 nTotal = 0;
+    while (state.KeepRunning())
+    {
+        CDataStream ss(ssBlock);
+        CBlock block;
+        ss >> block;
+        nTotal = 0;
+        BOOST_FOREACH(const CTransaction& tx, block.vtx)
+        {
+            tx.GetHash();
+            BOOST_FOREACH(const CTxOut& txout, tx.vout)
+                nTotal += txout.nValue;
+        }
+    }
+    state.Count("total value", nTotal / COIN);
+}
+
+// The same scan straight over the serialized bytes
+static void ScanBlockView(CBenchState& state)
+{
+    CDataStream ssBlock = MakeBlockStream();
+    vector<unsigned char> vch(ssBlock.begin(), ssBlock.end());
+    int64 nTotal = 0;
+    while (state.KeepRunning())
+    {
+        CBlockView view(&vch[0], &vch[0] + vch.size());
+        nTotal = 0;
+        BOOST_FOREACH(const CTransactionView& tx, view)
+        {
+            tx.GetHash();
+            BOOST_FOREACH(const CTxOutView& txout, tx.GetOutputs())
+                nTotal += txout.GetValue();
+        }
+    }
+    state.Count("total value", nTotal / COIN);
+}
+
+BENCHMARK(ConnectBlockHashes);
+BENCHMARK(DeserializeBlock);
+BENCHMARK(ScanBlockDeserialize);
+BENCHMARK(ScanBlockView);
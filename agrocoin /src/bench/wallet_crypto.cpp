@@ -0,0 +1,89 @@
+#include "bench.h"
+
+#include "crypter.h"
+#include "keystore.h"
+#include "script.h"
+
+#include <boost/foreach.hpp>
+#include <openssl/rand.h>
+
+using namespace std;
+
+// An encrypted key store holding nKeys keys, unlocked
+class CBenchKeyStore : public CCryptoKeyStore
+{
+public:
+    CKeyingMaterial vMasterKeyBench;
+
+    CBenchKeyStore(int nKeys)
+    {
+        for (int i = 0; i < nKeys; i++)
+        {
+            CKey key;
+            key.MakeNewKey(true);
+            AddKey(key);
+        }
+        vMasterKeyBench.resize(WALLET_CRYPTO_KEY_SIZE);
+        RAND_bytes(&vMasterKeyBench[0], WALLET_CRYPTO_KEY_SIZE);
+        EncryptKeys(vMasterKeyBench);
+        Unlock(vMasterKeyBench);
+    }
+};
+
+// One sendmany payout to 200 addresses signs with the same handful of keys
+// over and over
+static void SignEncrypted(CBenchState& state)
+{
+    CBenchKeyStore keystore(20);
+    set<CKeyID> setKeys;
+    keystore.GetKeys(setKeys);
+    uint256 hash = GetRandHash();
+
+    uint64 nSigs = 0;
+    while (state.KeepRunning())
+    {
+        BOOST_FOREACH(const CKeyID& keyid, setKeys)
+        {
+            CKey key;
+            vector<unsigned char> vchSig;
+            if (keystore.GetKey(keyid, key) && key.Sign(hash, vchSig))
+                nSigs++;
+        }
+    }
+    state.Count("sigs", nSigs);
+}
+
+// Just getting the keys out, which used to decrypt every time
+static void GetKeyEncrypted(CBenchState& state)
+{
+    CBenchKeyStore keystore(20);
+    set<CKeyID> setKeys;
+    keystore.GetKeys(setKeys);
+
+    while (state.KeepRunning())
+    {
+        BOOST_FOREACH(const CKeyID& keyid, setKeys)
+        {
+            CKey key;
+            keystore.GetKey(keyid, key);
+        }
+    }
+    state.Count("keys", setKeys.size());
+}
+
+// walletpassphrase: deriving the key for one master key at the minimum
+// iteration count
+static void UnlockDerivation(CBenchState& state)
+{
+    SecureString strPassphrase("correct horse battery staple");
+    vector<unsigned char> vchSalt(WALLET_CRYPTO_SALT_SIZE, 7);
+    while (state.KeepRunning())
+    {
+        CCrypter crypter;
+        crypter.SetKeyFromPassphrase(strPassphrase, vchSalt, 25000, 0);
+    }
+}
+
+BENCHMARK(SignEncrypted);
+BENCHMARK(GetKeyEncrypted);
+BENCHMARK(UnlockDerivation);
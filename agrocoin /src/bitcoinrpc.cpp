@@ -9,6 +9,8 @@
 #include "ui_interface.h"
 #include "base58.h"
 #include "bitcoinrpc.h"
+#include "workcache.h"
+#include "txview.h"
 
 #undef printf
 #include <boost/asio.hpp>
@@ -21,6 +23,7 @@
 #include <boost/algorithm/string.hpp>
 #include <boost/lexical_cast.hpp>
 #include <boost/asio/ssl.hpp>
+#include <boost/function.hpp>
 #include <boost/filesystem/fstream.hpp>
 #include <boost/shared_ptr.hpp>
 #include <list>
@@ -34,6 +37,8 @@ using namespace json_spirit;
 
 void ThreadRPCServer2(void* parg);
 
+static const int64 RPC_WORKER_POLL_MILLIS = 500;
+
 static std::string strRPCUserColonPass;
 
 static int64 nWalletUnlockTime;
@@ -48,8 +53,11 @@ extern Value listunspent(const Array& params, bool fHelp);
 extern Value createrawtransaction(const Array& params, bool fHelp);
 extern Value decoderawtransaction(const Array& params, bool fHelp);
 extern Value signrawtransaction(const Array& params, bool fHelp);
+extern Value signrawtransactions(const Array& params, bool fHelp);
 extern Value sendrawtransaction(const Array& params, bool fHelp);
 
+static const unsigned int RPC_STREAM_CHUNK_SIZE = 65536;
+
 const Object emptyobj;
 
 void ThreadRPCServer3(void* parg);
@@ -192,31 +200,30 @@ string AccountFromValue(const Value& value)
     return strAccount;
 }
 
-Object blockToJSON(const CBlock& block, const CBlockIndex* blockindex)
-{
-    Object result;
-    result.push_back(Pair("hash", block.GetHash().GetHex()));
-    CMerkleTx txGen(block.vtx[0]);
-    txGen.SetMerkleBranch(&block);
-    result.push_back(Pair("confirmations", (int)txGen.GetDepthInMainChain()));
-    result.push_back(Pair("size", (int)::GetSerializeSize(block, SER_NETWORK, PROTOCOL_VERSION)));
-    result.push_back(Pair("height", blockindex->nHeight));
-    result.push_back(Pair("version", block.nVersion));
-    result.push_back(Pair("merkleroot", block.hashMerkleRoot.GetHex()));
-    Array txs;
-    BOOST_FOREACH(const CTransaction&tx, block.vtx)
-        txs.push_back(tx.GetHash().GetHex());
-    result.push_back(Pair("tx", txs));
-    result.push_back(Pair("time", (boost::int64_t)block.GetBlockTime()));
-    result.push_back(Pair("nonce", (boost::uint64_t)block.nNonce));
-    result.push_back(Pair("bits", HexBits(block.nBits)));
-    result.push_back(Pair("difficulty", GetDifficulty(blockindex)));
+void BlockToJSON(const CBlockView& block, const CBlockIndex* blockindex, CJSONStreamWriter& writer)
+{
+    writer.BeginObject();
+    writer.Write("hash", block.GetHash().GetHex());
+    writer.Write("confirmations", blockindex->IsInMainChain() ? nBestHeight - blockindex->nHeight + 1 : 0);
+    writer.Write("size", (int)block.size());
+    writer.Write("height", blockindex->nHeight);
+    writer.Write("version", block.GetVersion());
+    writer.Write("merkleroot", block.GetMerkleRoot().GetHex());
+    writer.Key("tx");
+    writer.BeginArray();
+    BOOST_FOREACH(const CTransactionView& tx, block)
+        writer.Write(tx.GetHash().GetHex());
+    writer.EndArray();
+    writer.Write("time", (boost::int64_t)block.GetBlockTime());
+    writer.Write("nonce", (boost::uint64_t)block.GetNonce());
+    writer.Write("bits", HexBits(block.GetBits()));
+    writer.Write("difficulty", GetDifficulty(blockindex));
 
     if (blockindex->pprev)
-        result.push_back(Pair("previousblockhash", blockindex->pprev->GetBlockHash().GetHex()));
+        writer.Write("previousblockhash", blockindex->pprev->GetBlockHash().GetHex());
     if (blockindex->pnext)
-        result.push_back(Pair("nextblockhash", blockindex->pnext->GetBlockHash().GetHex()));
-    return result;
+        writer.Write("nextblockhash", blockindex->pnext->GetBlockHash().GetHex());
+    writer.EndObject();
 }
 
 
@@ -801,36 +808,6 @@ Value getreceivedbyaccount(const Array& params, bool fHelp)
 }
 
 
-int64 GetAccountBalance(CWalletDB& walletdb, const string& strAccount, int nMinDepth)
-{
-    int64 nBalance = 0;
-
-    for (map<uint256, CWalletTx>::iterator it = pwalletMain->mapWallet.begin(); it != pwalletMain->mapWallet.end(); ++it)
-    {
-        const CWalletTx& wtx = (*it).second;
-        if (!wtx.IsFinal())
-            continue;
-
-        int64 nGenerated, nReceived, nSent, nFee;
-        wtx.GetAccountAmounts(strAccount, nGenerated, nReceived, nSent, nFee);
-
-        if (nReceived != 0 && wtx.GetDepthInMainChain() >= nMinDepth)
-            nBalance += nReceived;
-        nBalance += nGenerated - nSent - nFee;
-    }
-
-    nBalance += walletdb.GetAccountCreditDebit(strAccount);
-
-    return nBalance;
-}
-
-int64 GetAccountBalance(const string& strAccount, int nMinDepth)
-{
-    CWalletDB walletdb(pwalletMain->strWalletFile);
-    return GetAccountBalance(walletdb, strAccount, nMinDepth);
-}
-
-
 Value getbalance(const Array& params, bool fHelp)
 {
     if (fHelp || params.size() > 2)
@@ -846,36 +823,12 @@ Value getbalance(const Array& params, bool fHelp)
     if (params.size() > 1)
         nMinDepth = params[1].get_int();
 
-    if (params[0].get_str() == "*") {
-        int64 nBalance = 0;
-        for (map<uint256, CWalletTx>::iterator it = pwalletMain->mapWallet.begin(); it != pwalletMain->mapWallet.end(); ++it)
-        {
-            const CWalletTx& wtx = (*it).second;
-            if (!wtx.IsFinal())
-                continue;
-
-            int64 allGeneratedImmature, allGeneratedMature, allFee;
-            allGeneratedImmature = allGeneratedMature = allFee = 0;
-            string strSentAccount;
-            list<pair<CTxDestination, int64> > listReceived;
-            list<pair<CTxDestination, int64> > listSent;
-            wtx.GetAmounts(allGeneratedImmature, allGeneratedMature, listReceived, listSent, allFee, strSentAccount);
-            if (wtx.GetDepthInMainChain() >= nMinDepth)
-            {
-                BOOST_FOREACH(const PAIRTYPE(CTxDestination,int64)& r, listReceived)
-                    nBalance += r.second;
-            }
-            BOOST_FOREACH(const PAIRTYPE(CTxDestination,int64)& r, listSent)
-                nBalance -= r.second;
-            nBalance -= allFee;
-            nBalance += allGeneratedMature;
-        }
-        return  ValueFromAmount(nBalance);
-    }
+    if (params[0].get_str() == "*")
+        return ValueFromAmount(pwalletMain->GetAccountBalance("*", nMinDepth));
 
     string strAccount = AccountFromValue(params[0]);
 
-    int64 nBalance = GetAccountBalance(strAccount, nMinDepth);
+    int64 nBalance = pwalletMain->GetAccountBalance(strAccount, nMinDepth);
 
     return ValueFromAmount(nBalance);
 }
@@ -921,6 +874,8 @@ Value movecmd(const Array& params, bool fHelp)
 
     if (!walletdb.TxnCommit())
         throw JSONRPCError(-20, "database error");
+    pwalletMain->AddAccountingEntry(debit);
+    pwalletMain->AddAccountingEntry(credit);
 
     return true;
 }
@@ -952,7 +907,7 @@ Value sendfrom(const Array& params, bool fHelp)
 
     EnsureWalletIsUnlocked();
 
-    int64 nBalance = GetAccountBalance(strAccount, nMinDepth);
+    int64 nBalance = pwalletMain->GetAccountBalance(strAccount, nMinDepth);
     if (nAmount > nBalance)
         throw JSONRPCError(-6, "Account has insufficient funds");
 
@@ -1007,7 +962,7 @@ Value sendmany(const Array& params, bool fHelp)
 
     EnsureWalletIsUnlocked();
 
-    int64 nBalance = GetAccountBalance(strAccount, nMinDepth);
+    int64 nBalance = pwalletMain->GetAccountBalance(strAccount, nMinDepth);
     if (totalAmount > nBalance)
         throw JSONRPCError(-6, "Account has insufficient funds");
 
@@ -1305,7 +1260,17 @@ void AcentryToJSON(const CAccountingEntry& acentry, const string& strAccount, Ar
     }
 }
 
-Value listtransactions(const Array& params, bool fHelp)
+static void ListTxPair(const TxPair& item, const string& strAccount, Array& ret)
+{
+    CWalletTx *const pwtx = item.first;
+    if (pwtx != 0)
+        ListTransactions(*pwtx, strAccount, 0, true, ret);
+    CAccountingEntry *const pacentry = item.second;
+    if (pacentry != 0)
+        AcentryToJSON(*pacentry, strAccount, ret);
+}
+
+void streamlisttransactions(const Array& params, bool fHelp, CJSONStreamWriter& writer)
 {
     if (fHelp || params.size() > 3)
         throw runtime_error(
@@ -1327,52 +1292,45 @@ Value listtransactions(const Array& params, bool fHelp)
     if (nFrom < 0)
         throw JSONRPCError(-8, "Negative from");
 
-    Array ret;
-    CWalletDB walletdb(pwalletMain->strWalletFile);
-
-    typedef pair<CWalletTx*, CAccountingEntry*> TxPair;
-    typedef multimap<int64, TxPair > TxItems;
-    TxItems txByTime;
+    const TxItems& txByTime = pwalletMain->GetOrderedTxItems(strAccount);
 
-    for (map<uint256, CWalletTx>::iterator it = pwalletMain->mapWallet.begin(); it != pwalletMain->mapWallet.end(); ++it)
-    {
-        CWalletTx* wtx = &((*it).second);
-        txByTime.insert(make_pair(wtx->GetTxTime(), TxPair(wtx, (CAccountingEntry*)0)));
-    }
-    list<CAccountingEntry> acentries;
-    walletdb.ListAccountCreditDebit(strAccount, acentries);
-    BOOST_FOREACH(CAccountingEntry& entry, acentries)
+    // Walk newest-first until we have [from]+[count] entries, remembering
+    // how many entries each item produced.  Entries are numbered in that
+    // newest-first order.
+    vector<pair<TxPair, int> > vItems;
+    int nEntries = 0;
+    for (TxItems::const_reverse_iterator it = txByTime.rbegin(); it != txByTime.rend(); ++it)
     {
-        txByTime.insert(make_pair(entry.nTime, TxPair((CWalletTx*)0, &entry)));
+        Array entries;
+        ListTxPair((*it).second, strAccount, entries);
+        vItems.push_back(make_pair((*it).second, (int)entries.size()));
+        nEntries += entries.size();
+
+        if (nEntries >= (nCount+nFrom)) break;
     }
 
-    for (TxItems::reverse_iterator it = txByTime.rbegin(); it != txByTime.rend(); ++it)
+    // Replay the items oldest-first, regenerating one item's entries at a
+    // time and writing those that fall in [from, from+count) in reverse.
+    writer.BeginArray();
+    int nIndex = nEntries;
+    for (vector<pair<TxPair, int> >::reverse_iterator it = vItems.rbegin(); it != vItems.rend(); ++it)
     {
-        CWalletTx *const pwtx = (*it).second.first;
-        if (pwtx != 0)
-            ListTransactions(*pwtx, strAccount, 0, true, ret);
-        CAccountingEntry *const pacentry = (*it).second.second;
-        if (pacentry != 0)
-            AcentryToJSON(*pacentry, strAccount, ret);
+        nIndex -= (*it).second;
+        if (nIndex + (*it).second <= nFrom || nIndex >= nFrom + nCount)
+            continue;
 
-        if ((int)ret.size() >= (nCount+nFrom)) break;
+        Array entries;
+        ListTxPair((*it).first, strAccount, entries);
+        for (int i = entries.size() - 1; i >= 0; i--)
+            if (nIndex + i >= nFrom && nIndex + i < nFrom + nCount)
+                writer.Write(entries[i]);
     }
+    writer.EndArray();
+}
 
-    if (nFrom > (int)ret.size())
-        nFrom = ret.size();
-    if ((nFrom + nCount) > (int)ret.size())
-        nCount = ret.size() - nFrom;
-    Array::iterator first = ret.begin();
-    std::advance(first, nFrom);
-    Array::iterator last = ret.begin();
-    std::advance(last, nFrom+nCount);
-
-    if (last != ret.end()) ret.erase(last, ret.end());
-    if (first != ret.begin()) ret.erase(ret.begin(), first);
-
-    std::reverse(ret.begin(), ret.end()); 
-
-    return ret;
+Value listtransactions(const Array& params, bool fHelp)
+{
+    return RPCStreamToValue(&streamlisttransactions, params, fHelp);
 }
 
 Value listaccounts(const Array& params, bool fHelp)
@@ -1392,32 +1350,7 @@ Value listaccounts(const Array& params, bool fHelp)
             mapAccountBalances[entry.second] = 0;
     }
 
-    for (map<uint256, CWalletTx>::iterator it = pwalletMain->mapWallet.begin(); it != pwalletMain->mapWallet.end(); ++it)
-    {
-        const CWalletTx& wtx = (*it).second;
-        int64 nGeneratedImmature, nGeneratedMature, nFee;
-        string strSentAccount;
-        list<pair<CTxDestination, int64> > listReceived;
-        list<pair<CTxDestination, int64> > listSent;
-        wtx.GetAmounts(nGeneratedImmature, nGeneratedMature, listReceived, listSent, nFee, strSentAccount);
-        mapAccountBalances[strSentAccount] -= nFee;
-        BOOST_FOREACH(const PAIRTYPE(CTxDestination, int64)& s, listSent)
-            mapAccountBalances[strSentAccount] -= s.second;
-        if (wtx.GetDepthInMainChain() >= nMinDepth)
-        {
-            mapAccountBalances[""] += nGeneratedMature;
-            BOOST_FOREACH(const PAIRTYPE(CTxDestination, int64)& r, listReceived)
-                if (pwalletMain->mapAddressBook.count(r.first))
-                    mapAccountBalances[pwalletMain->mapAddressBook[r.first]] += r.second;
-                else
-                    mapAccountBalances[""] += r.second;
-        }
-    }
-
-    list<CAccountingEntry> acentries;
-    CWalletDB(pwalletMain->strWalletFile).ListAccountCreditDebit("*", acentries);
-    BOOST_FOREACH(const CAccountingEntry& entry, acentries)
-        mapAccountBalances[entry.strAccount] += entry.nCreditDebit;
+    pwalletMain->GetAccountBalances(nMinDepth, mapAccountBalances);
 
     Object ret;
     BOOST_FOREACH(const PAIRTYPE(string, int64)& accountBalance, mapAccountBalances) {
@@ -1426,7 +1359,7 @@ Value listaccounts(const Array& params, bool fHelp)
     return ret;
 }
 
-Value listsinceblock(const Array& params, bool fHelp)
+void streamlistsinceblock(const Array& params, bool fHelp, CJSONStreamWriter& writer)
 {
     if (fHelp)
         throw runtime_error(
@@ -1452,18 +1385,27 @@ Value listsinceblock(const Array& params, bool fHelp)
             throw JSONRPCError(-8, "Invalid parameter");
     }
 
-    int depth = pindex ? (1 + nBestHeight - pindex->nHeight) : -1;
+    writer.BeginObject();
+    writer.Key("transactions");
+    writer.BeginArray();
 
-    Array transactions;
+    vector<const CWalletTx*> vwtx;
+    if (pindex)
+        pwalletMain->GetTransactionsSinceHeight(pindex->nHeight, vwtx);
+    else
+        for (map<uint256, CWalletTx>::iterator it = pwalletMain->mapWallet.begin(); it != pwalletMain->mapWallet.end(); it++)
+            vwtx.push_back(&(*it).second);
 
-    for (map<uint256, CWalletTx>::iterator it = pwalletMain->mapWallet.begin(); it != pwalletMain->mapWallet.end(); it++)
+    BOOST_FOREACH(const CWalletTx* pwtx, vwtx)
     {
-        CWalletTx tx = (*it).second;
-
-        if (depth == -1 || tx.GetDepthInMainChain() < depth)
-            ListTransactions(tx, "*", 0, true, transactions);
+        Array entries;
+        ListTransactions(*pwtx, "*", 0, true, entries);
+        BOOST_FOREACH(const Value& entry, entries)
+            writer.Write(entry);
     }
 
+    writer.EndArray();
+
     uint256 lastblock;
 
     if (target_confirms == 1)
@@ -1482,11 +1424,13 @@ Value listsinceblock(const Array& params, bool fHelp)
         lastblock = block ? block->GetBlockHash() : 0;
     }
 
-    Object ret;
-    ret.push_back(Pair("transactions", transactions));
-    ret.push_back(Pair("lastblock", lastblock.GetHex()));
+    writer.Write("lastblock", lastblock.GetHex());
+    writer.EndObject();
+}
 
-    return ret;
+Value listsinceblock(const Array& params, bool fHelp)
+{
+    return RPCStreamToValue(&streamlistsinceblock, params, fHelp);
 }
 
 Value gettransaction(const Array& params, bool fHelp)
@@ -1539,17 +1483,25 @@ Value backupwallet(const Array& params, bool fHelp)
 
 Value keypoolrefill(const Array& params, bool fHelp)
 {
-    if (fHelp || params.size() > 0)
+    if (fHelp || params.size() > 1)
         throw runtime_error(
-            "keypoolrefill\n"
-            "Fills the keypool."
+            "keypoolrefill [new-size]\n"
+            "Fills the keypool, to [new-size] keys if given (default: -keypool)."
             + HelpRequiringPassphrase());
 
+    int64 nSize = GetArg("-keypool", 100);
+    if (params.size() > 0)
+    {
+        nSize = params[0].get_int64();
+        if (nSize < 0 || nSize > 1000000)
+            throw JSONRPCError(-8, "Invalid parameter, expected a size between 0 and 1000000");
+    }
+
     EnsureWalletIsUnlocked();
 
-    pwalletMain->TopUpKeyPool();
+    pwalletMain->TopUpKeyPool((unsigned int)nSize);
 
-    if (pwalletMain->GetKeyPoolSize() < GetArg("-keypool", 100))
+    if (pwalletMain->GetKeyPoolSize() < nSize)
         throw JSONRPCError(-4, "Error refreshing keypool.");
 
     return Value::null;
@@ -1781,12 +1733,174 @@ Value validateaddress(const Array& params, bool fHelp)
             Object detail = boost::apply_visitor(DescribeAddressVisitor(), dest);
             ret.insert(ret.end(), detail.begin(), detail.end());
         }
-        if (pwalletMain->mapAddressBook.count(dest))
-            ret.push_back(Pair("account", pwalletMain->mapAddressBook[dest]));
+        // Runs without cs_main/cs_wallet held (see vRPCCommands), so only
+        // hold the wallet lock for the address book lookup itself.
+        LOCK(pwalletMain->cs_wallet);
+        map<CTxDestination, string>::const_iterator mi = pwalletMain->mapAddressBook.find(dest);
+        if (mi != pwalletMain->mapAddressBook.end())
+            ret.push_back(Pair("account", mi->second));
     }
     return ret;
 }
 
+//
+// Long polling.  getwork clients ask for work at /LP (advertised with an
+// X-Long-Polling header) and getblocktemplate clients send back the
+// longpollid of their last template; either way the request is held until
+// there is new work to hand out.  A waiting client ties up an RPC worker
+// thread, so one worker is always left free for everything else.
+//
+static const int64 LONGPOLL_MEMPOOL_SECONDS = 60;
+static const int64 LONGPOLL_POLL_MILLIS = 500;
+static CCriticalSection cs_nLongPollers;
+static int nLongPollers = 0;
+
+// Wait until the best chain moves off hashPrevBlock, or until the memory
+// pool has changed since nTransactionsUpdatedLast and at least
+// LONGPOLL_MEMPOOL_SECONDS have passed.  Returns at once if every spare
+// RPC worker is already waiting.  hashBestChain is read under csWorkChange,
+// which SetBestChain holds when it changes it.
+static void WaitForNewWork(const uint256& hashPrevBlock, unsigned int nTransactionsUpdatedLast)
+{
+    {
+        LOCK(cs_nLongPollers);
+        if (nLongPollers >= GetArg("-rpcthreads", 4) - 1)
+            return;
+        nLongPollers++;
+    }
+
+    int64 nMempoolTime = GetTimeMillis() + LONGPOLL_MEMPOOL_SECONDS * 1000;
+    {
+        boost::unique_lock<CWaitableCriticalSection> lock(csWorkChange);
+        while (!fShutdown && hashBestChain == hashPrevBlock)
+        {
+            int64 nNow = GetTimeMillis();
+            if (nTransactionsUpdated != nTransactionsUpdatedLast && nNow >= nMempoolTime)
+                break;
+
+            // SetBestChain and the memory pool signal cvWorkChange; the
+            // timeout is only there to notice shutdown
+            int64 nWait = LONGPOLL_POLL_MILLIS;
+            if (nMempoolTime > nNow)
+                nWait = min(nWait, nMempoolTime - nNow);
+            cvWorkChange.timed_wait(lock, boost::posix_time::milliseconds(nWait));
+        }
+    }
+
+    LOCK(cs_nLongPollers);
+    nLongPollers--;
+}
+
+void WaitForNewGetWork()
+{
+    // A copy: the wait compares the live hashBestChain against it
+    uint256 hashPrevBlock;
+    unsigned int nTransactionsUpdatedLast;
+    {
+        LOCK(cs_main);
+        hashPrevBlock = hashBestChain;
+        nTransactionsUpdatedLast = nTransactionsUpdated;
+    }
+    WaitForNewWork(hashPrevBlock, nTransactionsUpdatedLast);
+}
+
+//
+// getwork/getworkex state.  Both commands run without cs_main held (see
+// vRPCCommands): cs_getwork guards the current block template and the
+// reserve key, and the work cache does its own locking.
+//
+static CCriticalSection cs_getwork;
+static CWorkCache workCache;
+
+static CReserveKey& GetWorkReserveKey()
+{
+    static CReserveKey reservekey(pwalletMain);
+    return reservekey;
+}
+
+// Cut a new unit of work from the current template, making a new template
+// first if the best chain moved or the memory pool has changed for a while.
+// headerRet gets the block header to hand to the miner.
+static void CreateWork(CWork& workRet, CBlock& headerRet)
+{
+    LOCK(cs_getwork);
+
+    static unsigned int nTransactionsUpdatedLast;
+    static CBlockIndex* pindexPrev;
+    static int64 nStart;
+    static unsigned int nExtraNonce;
+    static boost::shared_ptr<const CWorkTemplate> ptemplate;
+    if (pindexPrev != pindexBest ||
+        (nTransactionsUpdated != nTransactionsUpdatedLast && GetTime() - nStart > 60))
+    {
+        LOCK(cs_main);
+        if (pindexPrev != pindexBest)
+        {
+            // Work on the old tip can never be accepted now
+            workCache.Clear();
+            nExtraNonce = 0;
+        }
+        nTransactionsUpdatedLast = nTransactionsUpdated;
+        pindexPrev = pindexBest;
+        nStart = GetTime();
+
+        // Create new block
+        auto_ptr<CBlock> pblock(CreateNewBlock(GetWorkReserveKey()));
+        if (!pblock.get())
+            throw JSONRPCError(-7, "Out of memory");
+        ptemplate.reset(new CWorkTemplate(*pblock));
+    }
+    const CBlock& block = ptemplate->block;
+
+    headerRet.SetNull();
+    headerRet.nVersion = block.nVersion;
+    headerRet.hashPrevBlock = block.hashPrevBlock;
+    headerRet.nBits = block.nBits;
+    headerRet.UpdateTime(pindexPrev);
+
+    // Only the coinbase differs between units of the same template
+    workRet.ptemplate = ptemplate;
+    workRet.scriptSig = (CScript() << headerRet.nTime << CBigNum(++nExtraNonce)) + COINBASE_FLAGS;
+    assert(workRet.scriptSig.size() <= 100);
+    workRet.nBits = headerRet.nBits;
+
+    headerRet.hashMerkleRoot = workRet.GetMerkleRoot();
+    workCache.Add(headerRet.hashMerkleRoot, workRet);
+}
+
+// Check a solved header against the work it was cut from, and submit the
+// block if it meets the target.  ptxCoinbase replaces the work's own
+// coinbase when the miner built its own.
+static bool SubmitWork(CBlock* pdata, const CTransaction* ptxCoinbase)
+{
+    // Get saved work
+    CWork work;
+    if (!workCache.Get(pdata->hashMerkleRoot, work))
+        return false;
+
+    if (ptxCoinbase)
+        pdata->hashMerkleRoot = CBlock::CheckMerkleBranch(ptxCoinbase->GetHash(), work.ptemplate->vCoinbaseBranch, 0);
+
+    // Nearly every submission misses the block target; check the header
+    // alone before copying the block
+    uint256 hashTarget = CBigNum().SetCompact(work.nBits).getuint256();
+    if (pdata->GetPoWHash() > hashTarget)
+        return false;
+
+    CBlock block;
+    work.GetBlock(block);
+    if (ptxCoinbase)
+    {
+        block.vtx[0] = *ptxCoinbase;
+        block.hashMerkleRoot = block.BuildMerkleTree();
+    }
+    block.nTime = pdata->nTime;
+    block.nNonce = pdata->nNonce;
+
+    LOCK(cs_getwork);
+    return CheckWork(&block, *pwalletMain, GetWorkReserveKey());
+}
+
 Value getworkex(const Array& params, bool fHelp)
 {
     if (fHelp || params.size() > 2)
@@ -1801,54 +1915,23 @@ Value getworkex(const Array& params, bool fHelp)
     if (IsInitialBlockDownload())
         throw JSONRPCError(-10, "Agrocoin server is downloading blocks...");
 
-    typedef map<uint256, pair<CBlock*, CScript> > mapNewBlock_t;
-    static mapNewBlock_t mapNewBlock;
-    static vector<CBlock*> vNewBlock;
-    static CReserveKey reservekey(pwalletMain);
-
     if (params.size() == 0)
     {
-        static unsigned int nTransactionsUpdatedLast;
-        static CBlockIndex* pindexPrev;
-        static int64 nStart;
-        static CBlock* pblock;
-        if (pindexPrev != pindexBest ||
-            (nTransactionsUpdated != nTransactionsUpdatedLast && GetTime() - nStart > 60))
-        {
-            if (pindexPrev != pindexBest)
-            {
-                mapNewBlock.clear();
-                BOOST_FOREACH(CBlock* pblock, vNewBlock)
-                    delete pblock;
-                vNewBlock.clear();
-            }
-            nTransactionsUpdatedLast = nTransactionsUpdated;
-            pindexPrev = pindexBest;
-            nStart = GetTime();
-
-            pblock = CreateNewBlock(reservekey);
-            if (!pblock)
-                throw JSONRPCError(-7, "Out of memory");
-            vNewBlock.push_back(pblock);
-        }
-
-        pblock->nTime = max(pindexPrev->GetMedianTimePast()+1, GetAdjustedTime());
-        pblock->nNonce = 0;
-
-        static unsigned int nExtraNonce = 0;
-        IncrementExtraNonce(pblock, pindexPrev, nExtraNonce);
-
-        mapNewBlock[pblock->hashMerkleRoot] = make_pair(pblock, pblock->vtx[0].vin[0].scriptSig);
+        CWork work;
+        CBlock header;
+        CreateWork(work, header);
 
         char pmidstate[32];
         char pdata[128];
         char phash1[64];
-        FormatHashBuffers(pblock, pmidstate, pdata, phash1);
+        FormatHashBuffers(&header, pmidstate, pdata, phash1);
 
-        uint256 hashTarget = CBigNum().SetCompact(pblock->nBits).getuint256();
+        uint256 hashTarget = CBigNum().SetCompact(header.nBits).getuint256();
 
-        CTransaction coinbaseTx = pblock->vtx[0];
-        std::vector<uint256> merkle = pblock->GetMerkleBranch(0);
+        CTransaction coinbaseTx = work.ptemplate->block.vtx[0];
+        coinbaseTx.vin[0].scriptSig = work.scriptSig;
+        coinbaseTx.InvalidateHash();
+        const std::vector<uint256>& merkle = work.ptemplate->vCoinbaseBranch;
 
         Object result;
         result.push_back(Pair("data",     HexStr(BEGIN(pdata), END(pdata))));
@@ -1859,10 +1942,8 @@ Value getworkex(const Array& params, bool fHelp)
         result.push_back(Pair("coinbase", HexStr(ssTx.begin(), ssTx.end())));
 
         Array merkle_arr;
-        printf("DEBUG: merkle size %i\n", merkle.size());
 
         BOOST_FOREACH(uint256 merkleh, merkle) {
-            printf("%s\n", merkleh.ToString().c_str());
             merkle_arr.push_back(HexStr(BEGIN(merkleh), END(merkleh)));
         }
 
@@ -1887,21 +1968,12 @@ Value getworkex(const Array& params, bool fHelp)
         for (int i = 0; i < 128/4; i++)
             ((unsigned int*)pdata)[i] = ByteReverse(((unsigned int*)pdata)[i]);
 
-        if (!mapNewBlock.count(pdata->hashMerkleRoot))
-            return false;
-        CBlock* pblock = mapNewBlock[pdata->hashMerkleRoot].first;
-
-        pblock->nTime = pdata->nTime;
-        pblock->nNonce = pdata->nNonce;
-
         if(coinbase.size() == 0)
-            pblock->vtx[0].vin[0].scriptSig = mapNewBlock[pdata->hashMerkleRoot].second;
-        else
-            CDataStream(coinbase, SER_NETWORK, PROTOCOL_VERSION) >> pblock->vtx[0]; // FIXME - HACK!
-
-        pblock->hashMerkleRoot = pblock->BuildMerkleTree();
+            return SubmitWork(pdata, NULL);
 
-        return CheckWork(pblock, *pwalletMain, reservekey);
+        CTransaction txCoinbase;
+        CDataStream(coinbase, SER_NETWORK, PROTOCOL_VERSION) >> txCoinbase; // FIXME - HACK!
+        return SubmitWork(pdata, &txCoinbase);
     }
 }
 
@@ -1923,56 +1995,19 @@ Value getwork(const Array& params, bool fHelp)
     if (IsInitialBlockDownload())
         throw JSONRPCError(-10, "Agrocoin server is downloading blocks...");
 
-    typedef map<uint256, pair<CBlock*, CScript> > mapNewBlock_t;
-    static mapNewBlock_t mapNewBlock;    // FIXME: thread safety
-    static vector<CBlock*> vNewBlock;
-    static CReserveKey reservekey(pwalletMain);
-
     if (params.size() == 0)
     {
-        static unsigned int nTransactionsUpdatedLast;
-        static CBlockIndex* pindexPrev;
-        static int64 nStart;
-        static CBlock* pblock;
-        if (pindexPrev != pindexBest ||
-            (nTransactionsUpdated != nTransactionsUpdatedLast && GetTime() - nStart > 60))
-        {
-            if (pindexPrev != pindexBest)
-            {
-                mapNewBlock.clear();
-                BOOST_FOREACH(CBlock* pblock, vNewBlock)
-                    delete pblock;
-                vNewBlock.clear();
-            }
-            nTransactionsUpdatedLast = nTransactionsUpdated;
-            pindexPrev = pindexBest;
-            nStart = GetTime();
-
-            // Create new block
-            pblock = CreateNewBlock(reservekey);
-            if (!pblock)
-                throw JSONRPCError(-7, "Out of memory");
-            vNewBlock.push_back(pblock);
-        }
-
-        // Update nTime
-        pblock->UpdateTime(pindexPrev);
-        pblock->nNonce = 0;
-
-        // Update nExtraNonce
-        static unsigned int nExtraNonce = 0;
-        IncrementExtraNonce(pblock, pindexPrev, nExtraNonce);
-
-        // Save
-        mapNewBlock[pblock->hashMerkleRoot] = make_pair(pblock, pblock->vtx[0].vin[0].scriptSig);
+        CWork work;
+        CBlock header;
+        CreateWork(work, header);
 
         // Prebuild hash buffers
         char pmidstate[32];
         char pdata[128];
         char phash1[64];
-        FormatHashBuffers(pblock, pmidstate, pdata, phash1);
+        FormatHashBuffers(&header, pmidstate, pdata, phash1);
 
-        uint256 hashTarget = CBigNum().SetCompact(pblock->nBits).getuint256();
+        uint256 hashTarget = CBigNum().SetCompact(header.nBits).getuint256();
 
         Object result;
         result.push_back(Pair("midstate", HexStr(BEGIN(pmidstate), END(pmidstate)))); // deprecated
@@ -1994,17 +2029,7 @@ Value getwork(const Array& params, bool fHelp)
         for (int i = 0; i < 128/4; i++)
             ((unsigned int*)pdata)[i] = ByteReverse(((unsigned int*)pdata)[i]);
 
-        // Get saved block
-        if (!mapNewBlock.count(pdata->hashMerkleRoot))
-            return false;
-        CBlock* pblock = mapNewBlock[pdata->hashMerkleRoot].first;
-
-        pblock->nTime = pdata->nTime;
-        pblock->nNonce = pdata->nNonce;
-        pblock->vtx[0].vin[0].scriptSig = mapNewBlock[pdata->hashMerkleRoot].second;
-        pblock->hashMerkleRoot = pblock->BuildMerkleTree();
-
-        return CheckWork(pblock, *pwalletMain, reservekey);
+        return SubmitWork(pdata, NULL);
     }
 }
 
@@ -2029,6 +2054,7 @@ Value getblocktemplate(const Array& params, bool fHelp)
             "  \"sizelimit\" : limit of block size\n"
             "  \"bits\" : compressed target of next block\n"
             "  \"height\" : height of the next block\n"
+            "  \"longpollid\" : pass back as \"longpollid\" in [params] to wait for the next template\n"
             "If [params] does contain a \"data\" key, tries to solve the block and returns null if it was successful (and \"rejected\" if not)\n"
             "See https://en.bitcoin.it/wiki/BIP_0022 for full specification.");
 
@@ -2053,6 +2079,21 @@ Value getblocktemplate(const Array& params, bool fHelp)
         if (IsInitialBlockDownload())
             throw JSONRPCError(-10, "Agrocoin server is downloading blocks...");
 
+        // Long polling: wait, before taking any locks, until there is
+        // something newer than the template the client already has
+        const Value& lpval = find_value(oparam, "longpollid");
+        if (lpval.type() == str_type)
+        {
+            const string& strLongPollId = lpval.get_str();
+            if (strLongPollId.size() < 64)
+                throw JSONRPCError(-8, "Invalid longpollid");
+            uint256 hashPrevBlock(strLongPollId.substr(0, 64));
+            unsigned int nTransactionsUpdatedLast = strtoul(strLongPollId.substr(64).c_str(), NULL, 10);
+            WaitForNewWork(hashPrevBlock, nTransactionsUpdatedLast);
+        }
+
+        LOCK2(cs_main, pwalletMain->cs_wallet);
+
         static CReserveKey reservekey(pwalletMain);
 
         // Update block
@@ -2150,6 +2191,7 @@ Value getblocktemplate(const Array& params, bool fHelp)
         result.push_back(Pair("curtime", (int64_t)pblock->nTime));
         result.push_back(Pair("bits", HexBits(pblock->nBits)));
         result.push_back(Pair("height", (int64_t)(pindexPrev->nHeight+1)));
+        result.push_back(Pair("longpollid", pblock->hashPrevBlock.GetHex() + strprintf("%u", nTransactionsUpdatedLast)));
 
         return result;
     }
@@ -2161,6 +2203,7 @@ Value getblocktemplate(const Array& params, bool fHelp)
         CBlock pblock;
         ssBlock >> pblock;
 
+        LOCK2(cs_main, pwalletMain->cs_wallet);
         bool fAccepted = ProcessBlock(NULL, &pblock);
 
         return fAccepted ? Value::null : "rejected";
@@ -2169,7 +2212,7 @@ Value getblocktemplate(const Array& params, bool fHelp)
     throw JSONRPCError(-8, "Invalid mode");
 }
 
-Value getrawmempool(const Array& params, bool fHelp)
+void streamgetrawmempool(const Array& params, bool fHelp, CJSONStreamWriter& writer)
 {
     if (fHelp || params.size() != 0)
         throw runtime_error(
@@ -2179,11 +2222,15 @@ Value getrawmempool(const Array& params, bool fHelp)
     vector<uint256> vtxid;
     mempool.queryHashes(vtxid);
 
-    Array a;
+    writer.BeginArray();
     BOOST_FOREACH(const uint256& hash, vtxid)
-        a.push_back(hash.ToString());
+        writer.Write(hash.ToString());
+    writer.EndArray();
+}
 
-    return a;
+Value getrawmempool(const Array& params, bool fHelp)
+{
+    return RPCStreamToValue(&streamgetrawmempool, params, fHelp);
 }
 
 Value getblockhash(const Array& params, bool fHelp)
@@ -2204,7 +2251,7 @@ Value getblockhash(const Array& params, bool fHelp)
     return pblockindex->phashBlock->GetHex();
 }
 
-Value getblock(const Array& params, bool fHelp)
+void streamgetblock(const Array& params, bool fHelp, CJSONStreamWriter& writer)
 {
     if (fHelp || params.size() != 1)
         throw runtime_error(
@@ -2217,11 +2264,18 @@ Value getblock(const Array& params, bool fHelp)
     if (mapBlockIndex.count(hash) == 0)
         throw JSONRPCError(-5, "Block not found");
 
-    CBlock block;
+    // Read and shown without deserializing the transactions
     CBlockIndex* pblockindex = mapBlockIndex[hash];
-    block.ReadFromDisk(pblockindex, true);
+    vector<unsigned char> vchBlock;
+    if (!ReadRawBlockFromDisk(pblockindex, vchBlock))
+        throw JSONRPCError(-5, "Block not found on disk");
+
+    BlockToJSON(CBlockView(&vchBlock[0], &vchBlock[0] + vchBlock.size()), pblockindex, writer);
+}
 
-    return blockToJSON(block, pblockindex);
+Value getblock(const Array& params, bool fHelp)
+{
+    return RPCStreamToValue(&streamgetblock, params, fHelp);
 }
 
 
@@ -2236,64 +2290,76 @@ Value getblock(const Array& params, bool fHelp)
 
 
 static const CRPCCommand vRPCCommands[] =
-{ //  name                      function                 safe mode?
-  //  ------------------------  -----------------------  ----------
-    { "help",                   &help,                   true },
-    { "stop",                   &stop,                   true },
-    { "getblockcount",          &getblockcount,          true },
-    { "getconnectioncount",     &getconnectioncount,     true },
-    { "getpeerinfo",            &getpeerinfo,            true },
-    { "getdifficulty",          &getdifficulty,          true },
-    { "getnetworkhashps",       &getnetworkhashps,       true },
-    { "getgenerate",            &getgenerate,            true },
-    { "setgenerate",            &setgenerate,            true },
-    { "gethashespersec",        &gethashespersec,        true },
-    { "getinfo",                &getinfo,                true },
-    { "getmininginfo",          &getmininginfo,          true },
-    { "getnewaddress",          &getnewaddress,          true },
-    { "getaccountaddress",      &getaccountaddress,      true },
-    { "setaccount",             &setaccount,             true },
-    { "getaccount",             &getaccount,             false },
-    { "getaddressesbyaccount",  &getaddressesbyaccount,  true },
-    { "sendtoaddress",          &sendtoaddress,          false },
-    { "getreceivedbyaddress",   &getreceivedbyaddress,   false },
-    { "getreceivedbyaccount",   &getreceivedbyaccount,   false },
-    { "listreceivedbyaddress",  &listreceivedbyaddress,  false },
-    { "listreceivedbyaccount",  &listreceivedbyaccount,  false },
-    { "backupwallet",           &backupwallet,           true },
-    { "keypoolrefill",          &keypoolrefill,          true },
-    { "walletpassphrase",       &walletpassphrase,       true },
-    { "walletpassphrasechange", &walletpassphrasechange, false },
-    { "walletlock",             &walletlock,             true },
-    { "encryptwallet",          &encryptwallet,          false },
-    { "validateaddress",        &validateaddress,        true },
-    { "getbalance",             &getbalance,             false },
-    { "move",                   &movecmd,                false },
-    { "sendfrom",               &sendfrom,               false },
-    { "sendmany",               &sendmany,               false },
-    { "addmultisigaddress",     &addmultisigaddress,     false },
-    { "getrawmempool",          &getrawmempool,          true },
-    { "getblock",               &getblock,               false },
-    { "getblockhash",           &getblockhash,           false },
-    { "gettransaction",         &gettransaction,         false },
-    { "listtransactions",       &listtransactions,       false },
-    { "signmessage",            &signmessage,            false },
-    { "verifymessage",          &verifymessage,          false },
-    { "getwork",                &getwork,                true },
-    { "getworkex",              &getworkex,              true },
-    { "listaccounts",           &listaccounts,           false },
-    { "settxfee",               &settxfee,               false },
-    { "setmininput",            &setmininput,            false },
-    { "getblocktemplate",       &getblocktemplate,       true },
-    { "listsinceblock",         &listsinceblock,         false },
-    { "dumpprivkey",            &dumpprivkey,            false },
-    { "importprivkey",          &importprivkey,          false },
-    { "listunspent",            &listunspent,            false },
-    { "getrawtransaction",      &getrawtransaction,      false },
-    { "createrawtransaction",   &createrawtransaction,   false },
-    { "decoderawtransaction",   &decoderawtransaction,   false },
-    { "signrawtransaction",     &signrawtransaction,     false },
-    { "sendrawtransaction",     &sendrawtransaction,     false },
+{ //  name                      function                 safe mode?  threadsafe?
+  //  ------------------------  -----------------------  ----------  -----------
+    { "help",                   &help,                   true,       true },
+    { "stop",                   &stop,                   true,       true },
+    { "getblockcount",          &getblockcount,          true,       true },
+    { "getconnectioncount",     &getconnectioncount,     true,       true },
+    { "getpeerinfo",            &getpeerinfo,            true,       true },
+    { "getdifficulty",          &getdifficulty,          true,       false },
+    { "getnetworkhashps",       &getnetworkhashps,       true,       false },
+    { "getgenerate",            &getgenerate,            true,       true },
+    { "setgenerate",            &setgenerate,            true,       false },
+    { "gethashespersec",        &gethashespersec,        true,       true },
+    { "getinfo",                &getinfo,                true,       false },
+    { "getmininginfo",          &getmininginfo,          true,       false },
+    { "getnewaddress",          &getnewaddress,          true,       false },
+    { "getaccountaddress",      &getaccountaddress,      true,       false },
+    { "setaccount",             &setaccount,             true,       false },
+    { "getaccount",             &getaccount,             false,      false },
+    { "getaddressesbyaccount",  &getaddressesbyaccount,  true,       false },
+    { "sendtoaddress",          &sendtoaddress,          false,      false },
+    { "getreceivedbyaddress",   &getreceivedbyaddress,   false,      false },
+    { "getreceivedbyaccount",   &getreceivedbyaccount,   false,      false },
+    { "listreceivedbyaddress",  &listreceivedbyaddress,  false,      false },
+    { "listreceivedbyaccount",  &listreceivedbyaccount,  false,      false },
+    { "backupwallet",           &backupwallet,           true,       false },
+    { "keypoolrefill",          &keypoolrefill,          true,       false },
+    { "walletpassphrase",       &walletpassphrase,       true,       false },
+    { "walletpassphrasechange", &walletpassphrasechange, false,      false },
+    { "walletlock",             &walletlock,             true,       false },
+    { "encryptwallet",          &encryptwallet,          false,      false },
+    { "validateaddress",        &validateaddress,        true,       true },
+    { "getbalance",             &getbalance,             false,      false },
+    { "move",                   &movecmd,                false,      false },
+    { "sendfrom",               &sendfrom,               false,      false },
+    { "sendmany",               &sendmany,               false,      false },
+    { "addmultisigaddress",     &addmultisigaddress,     false,      false },
+    { "getrawmempool",          &getrawmempool,          true,       true },
+    { "getblock",               &getblock,               false,      false },
+    { "getblockhash",           &getblockhash,           false,      false },
+    { "gettransaction",         &gettransaction,         false,      false },
+    { "listtransactions",       &listtransactions,       false,      false },
+    { "signmessage",            &signmessage,            false,      false },
+    { "verifymessage",          &verifymessage,          false,      true },
+    { "getwork",                &getwork,                true,       true },
+    { "getworkex",              &getworkex,              true,       true },
+    { "listaccounts",           &listaccounts,           false,      false },
+    { "settxfee",               &settxfee,               false,      false },
+    { "setmininput",            &setmininput,            false,      false },
+    { "getblocktemplate",       &getblocktemplate,       true,       true },
+    { "listsinceblock",         &listsinceblock,         false,      false },
+    { "dumpprivkey",            &dumpprivkey,            false,      false },
+    { "importprivkey",          &importprivkey,          false,      true },
+    { "listunspent",            &listunspent,            false,      false },
+    { "getrawtransaction",      &getrawtransaction,      false,      false },
+    { "createrawtransaction",   &createrawtransaction,   false,      false },
+    { "decoderawtransaction",   &decoderawtransaction,   false,      true },
+    { "signrawtransaction",     &signrawtransaction,     false,      false },
+    { "signrawtransactions",    &signrawtransactions,    false,      false },
+    { "sendrawtransaction",     &sendrawtransaction,     false,      false },
+};
+
+// Commands that can also write their result incrementally to the HTTP
+// connection.  Each must have an entry in vRPCCommands too.
+static const CRPCStreamCommand vRPCStreamCommands[] =
+{ //  name                      function
+  //  ------------------------  -----------------------
+    { "listtransactions",       &streamlisttransactions },
+    { "listsinceblock",         &streamlistsinceblock },
+    { "getrawmempool",          &streamgetrawmempool },
+    { "getblock",               &streamgetblock },
 };
 
 CRPCTable::CRPCTable()
@@ -2306,6 +2372,13 @@ CRPCTable::CRPCTable()
         pcmd = &vRPCCommands[vcidx];
         mapCommands[pcmd->name] = pcmd;
     }
+    for (vcidx = 0; vcidx < (sizeof(vRPCStreamCommands) / sizeof(vRPCStreamCommands[0])); vcidx++)
+    {
+        const CRPCStreamCommand *pcmd;
+
+        pcmd = &vRPCStreamCommands[vcidx];
+        mapStreamCommands[pcmd->name] = pcmd;
+    }
 }
 
 const CRPCCommand *CRPCTable::operator[](string name) const
@@ -2353,7 +2426,7 @@ string rfc1123Time()
     return string(buffer);
 }
 
-static string HTTPReply(int nStatus, const string& strMsg, bool keepalive)
+static string HTTPReply(int nStatus, const string& strMsg, bool keepalive, const string& strHeaders = "")
 {
     if (nStatus == 401)
         return strprintf("HTTP/1.0 401 Authorization Required\r\n"
@@ -2378,6 +2451,7 @@ static string HTTPReply(int nStatus, const string& strMsg, bool keepalive)
     else if (nStatus == 403) cStatus = "Forbidden";
     else if (nStatus == 404) cStatus = "Not Found";
     else if (nStatus == 500) cStatus = "Internal Server Error";
+    else if (nStatus == 503) cStatus = "Service Unavailable";
     else cStatus = "";
     return strprintf(
             "HTTP/1.1 %d %s\r\n"
@@ -2386,6 +2460,7 @@ static string HTTPReply(int nStatus, const string& strMsg, bool keepalive)
             "Content-Length: %d\r\n"
             "Content-Type: application/json\r\n"
             "Server: agrocoin-json-rpc/%s\r\n"
+            "%s"
             "\r\n"
             "%s",
         nStatus,
@@ -2394,10 +2469,102 @@ static string HTTPReply(int nStatus, const string& strMsg, bool keepalive)
         keepalive ? "keep-alive" : "close",
         strMsg.size(),
         FormatFullVersion().c_str(),
+        strHeaders.c_str(),
         strMsg.c_str());
 }
 
-int ReadHTTPStatus(std::basic_istream<char>& stream, int &proto)
+static string HTTPChunkedReplyHeader(bool keepalive)
+{
+    return strprintf(
+            "HTTP/1.1 200 OK\r\n"
+            "Date: %s\r\n"
+            "Connection: %s\r\n"
+            "Transfer-Encoding: chunked\r\n"
+            "Content-Type: application/json\r\n"
+            "Server: agrocoin-json-rpc/%s\r\n"
+            "\r\n",
+        rfc1123Time().c_str(),
+        keepalive ? "keep-alive" : "close",
+        FormatFullVersion().c_str());
+}
+
+/**
+ * Output buffer for a streamed 200 reply.  Once the body outgrows the
+ * buffer it is sent with HTTP/1.1 chunked transfer encoding as it is
+ * produced; bodies that fit, and all bodies for HTTP/1.0 clients, are
+ * sent as a normal reply with Content-Length.  Nothing is sent unless
+ * Finish() is called or the buffer overflows.
+ */
+class CHTTPChunkedStreamBuf : public std::streambuf
+{
+private:
+    std::ostream& stream;
+    bool fKeepAlive;
+    bool fChunked;
+    bool fStarted;
+    std::string strBody;
+    std::vector<char> vBuf;
+
+    void SendChunk()
+    {
+        std::ptrdiff_t nLen = pptr() - pbase();
+        if (nLen == 0)
+            return;
+        if (!fStarted)
+        {
+            stream << HTTPChunkedReplyHeader(fKeepAlive);
+            fStarted = true;
+        }
+        stream << strprintf("%x\r\n", (unsigned int)nLen);
+        stream.write(pbase(), nLen);
+        stream << "\r\n";
+        setp(&vBuf[0], &vBuf[0] + vBuf.size());
+    }
+
+protected:
+    virtual int_type overflow(int_type ch)
+    {
+        if (fChunked)
+            SendChunk();
+        else
+        {
+            strBody.append(pbase(), pptr());
+            setp(&vBuf[0], &vBuf[0] + vBuf.size());
+        }
+        if (!traits_type::eq_int_type(ch, traits_type::eof()))
+        {
+            *pptr() = traits_type::to_char_type(ch);
+            pbump(1);
+        }
+        return traits_type::not_eof(ch);
+    }
+
+public:
+    CHTTPChunkedStreamBuf(std::ostream& streamIn, bool fKeepAliveIn, bool fChunkedIn) :
+        stream(streamIn), fKeepAlive(fKeepAliveIn), fChunked(fChunkedIn), fStarted(false), vBuf(RPC_STREAM_CHUNK_SIZE)
+    {
+        setp(&vBuf[0], &vBuf[0] + vBuf.size());
+    }
+
+    // True once any part of the reply has been sent
+    bool Started() const { return fStarted; }
+
+    void Finish()
+    {
+        if (fStarted)
+        {
+            SendChunk();
+            stream << "0\r\n\r\n" << std::flush;
+        }
+        else
+        {
+            strBody.append(pbase(), pptr());
+            stream << HTTPReply(200, strBody, fKeepAlive) << std::flush;
+        }
+    }
+};
+
+int ReadHTTPStatus(std::basic_istream<char>& stream, int &proto, string* pstrPathRet = NULL)
 {
     string str;
     getline(stream, str);
@@ -2405,6 +2572,9 @@ int ReadHTTPStatus(std::basic_istream<char>& stream, int &proto)
     boost::split(vWords, str, boost::is_any_of(" "));
     if (vWords.size() < 2)
         return 500;
+    // Second word of a request line is the path
+    if (pstrPathRet)
+        *pstrPathRet = vWords[1];
     proto = 0;
     const char *ver = strstr(str.c_str(), "HTTP/1.");
     if (ver != NULL)
@@ -2437,14 +2607,16 @@ int ReadHTTPHeader(std::basic_istream<char>& stream, map<string, string>& mapHea
     return nLen;
 }
 
-int ReadHTTP(std::basic_istream<char>& stream, map<string, string>& mapHeadersRet, string& strMessageRet)
+int ReadHTTP(std::basic_istream<char>& stream, map<string, string>& mapHeadersRet, string& strMessageRet, int* pnProtoRet = NULL, string* pstrPathRet = NULL)
 {
     mapHeadersRet.clear();
     strMessageRet = "";
 
     // Read status
     int nProto = 0;
-    int nStatus = ReadHTTPStatus(stream, nProto);
+    int nStatus = ReadHTTPStatus(stream, nProto, pstrPathRet);
+    if (pnProtoRet)
+        *pnProtoRet = nProto;
 
     // Read header
     int nLen = ReadHTTPHeader(stream, mapHeadersRet);
@@ -2492,25 +2664,301 @@ bool HTTPAuthorized(map<string, string>& mapHeaders)
 // http://www.codeproject.com/KB/recipes/JSON_Spirit.aspx
 //
 
-string JSONRPCRequest(const string& strMethod, const Array& params, const Value& id)
+//
+// Hand-written JSON reader for the request path.  json_spirit's reader runs
+// every token through Boost.Spirit semantic actions and copies each value at
+// least once on its way into the tree; this one fills values in place.  It
+// only handles plain well-formed JSON and gives up on anything unusual
+// (json_spirit's \x escapes, non-ASCII \u escapes, leading zeros, numbers
+// needing more than a double's exact fast path, ...), leaving those to
+// json_spirit so that the two never disagree about a document.
+//
+class CJSONReader
 {
-    Object request;
-    request.push_back(Pair("method", strMethod));
-    request.push_back(Pair("params", params));
-    request.push_back(Pair("id", id));
-    return write_string(Value(request), false) + "\n";
-}
+private:
+    const char* p;
+    const char* pend;
+    int nDepth;
 
-Object JSONRPCReplyObj(const Value& result, const Value& error, const Value& id)
-{
-    Object reply;
-    if (error.type() != null_type)
-        reply.push_back(Pair("result", Value::null));
-    else
-        reply.push_back(Pair("result", result));
-    reply.push_back(Pair("error", error));
-    reply.push_back(Pair("id", id));
-    return reply;
+    static const int MAX_DEPTH = 512;
+
+    void SkipSpace()
+    {
+        while (p != pend && isspace((unsigned char)*p))
+            p++;
+    }
+
+    bool ReadLiteral(const char* psz)
+    {
+        for (; *psz; psz++, p++)
+            if (p == pend || *p != *psz)
+                return false;
+        return true;
+    }
+
+    static int HexValue(char c)
+    {
+        if (c >= '0' && c <= '9') return c - '0';
+        if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+        if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+        return -1;
+    }
+
+    bool ReadNumber(Value& value)
+    {
+        bool fNegative = (*p == '-');
+        if (fNegative)
+            p++;
+        if (p == pend || !isdigit((unsigned char)*p))
+            return false;
+        if (*p == '0' && p + 1 != pend && isdigit((unsigned char)p[1]))
+            return false;
+
+        // Mantissa digits, at most 19 so they always fit
+        uint64 nMantissa = 0;
+        int nDigits = 0;
+        int nExponent = 0;
+        for (; p != pend && isdigit((unsigned char)*p); p++, nDigits++)
+            nMantissa = nMantissa * 10 + (*p - '0');
+
+        bool fReal = false;
+        if (p != pend && *p == '.')
+        {
+            fReal = true;
+            p++;
+            if (p == pend || !isdigit((unsigned char)*p))
+                return false;
+            for (; p != pend && isdigit((unsigned char)*p); p++, nDigits++, nExponent--)
+                nMantissa = nMantissa * 10 + (*p - '0');
+        }
+        if (nDigits > 19)
+            return false;
+        if (p != pend && (*p == 'e' || *p == 'E'))
+        {
+            fReal = true;
+            p++;
+            bool fExpNegative = false;
+            if (p != pend && (*p == '-' || *p == '+'))
+                fExpNegative = (*p++ == '-');
+            if (p == pend || !isdigit((unsigned char)*p))
+                return false;
+            int nExp = 0;
+            for (; p != pend && isdigit((unsigned char)*p); p++)
+            {
+                nExp = nExp * 10 + (*p - '0');
+                if (nExp > 1000)
+                    return false;
+            }
+            nExponent += fExpNegative ? -nExp : nExp;
+        }
+
+        if (!fReal)
+        {
+            if (fNegative)
+            {
+                if (nMantissa > (uint64)std::numeric_limits<int64>::max() + 1)
+                    return false;
+                value = (boost::int64_t)(0 - nMantissa);
+            }
+            else if (nMantissa > (uint64)std::numeric_limits<int64>::max())
+                value = (boost::uint64_t)nMantissa;
+            else
+                value = (boost::int64_t)nMantissa;
+            return true;
+        }
+
+        // Exactly representable mantissa and power of ten: one correctly
+        // rounded multiply or divide, independent of the C locale.
+        static const double pow10[] = {
+            1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+            1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+        };
+        if (nMantissa > ((uint64)1 << 53) || nExponent < -22 || nExponent > 22)
+            return false;
+        double d = (double)nMantissa;
+        d = (nExponent < 0) ? d / pow10[-nExponent] : d * pow10[nExponent];
+        value = fNegative ? -d : d;
+        return true;
+    }
+
+public:
+    explicit CJSONReader(const std::string& str) : p(str.data()), pend(str.data() + str.size()), nDepth(0) {}
+
+    bool Peek(char c)
+    {
+        SkipSpace();
+        return p != pend && *p == c;
+    }
+
+    bool Consume(char c)
+    {
+        if (!Peek(c))
+            return false;
+        p++;
+        return true;
+    }
+
+    bool ReadString(std::string& str)
+    {
+        if (!Consume('"'))
+            return false;
+
+        // Common case: no escapes, one assign
+        const char* pstart = p;
+        while (p != pend && *p != '"' && *p != '\\')
+            p++;
+        str.assign(pstart, p);
+
+        while (p != pend && *p != '"')
+        {
+            if (*p != '\\')
+            {
+                str += *p++;
+                continue;
+            }
+            if (++p == pend)
+                return false;
+            switch (*p)
+            {
+            case '"':  str += '"';  break;
+            case '\\': str += '\\'; break;
+            case '/':  str += '/';  break;
+            case 'b':  str += '\b'; break;
+            case 'f':  str += '\f'; break;
+            case 'n':  str += '\n'; break;
+            case 'r':  str += '\r'; break;
+            case 't':  str += '\t'; break;
+            case 'u':
+            {
+                if (pend - p < 5)
+                    return false;
+                int n = 0;
+                for (int i = 1; i <= 4; i++)
+                {
+                    int nDigit = HexValue(p[i]);
+                    if (nDigit < 0)
+                        return false;
+                    n = (n << 4) | nDigit;
+                }
+                if (n > 0x7f)
+                    return false;
+                str += (char)n;
+                p += 4;
+                break;
+            }
+            default:
+                return false;
+            }
+            p++;
+        }
+        if (p == pend)
+            return false;
+        p++;
+        return true;
+    }
+
+    bool ReadArray(Array& array)
+    {
+        if (!Consume('['))
+            return false;
+        array.clear();
+        if (Consume(']'))
+            return true;
+        if (++nDepth > MAX_DEPTH)
+            return false;
+        do
+        {
+            array.push_back(Value());
+            if (!ReadValue(array.back()))
+                return false;
+        } while (Consume(','));
+        nDepth--;
+        return Consume(']');
+    }
+
+    bool ReadObject(Object& obj)
+    {
+        if (!Consume('{'))
+            return false;
+        obj.clear();
+        if (Consume('}'))
+            return true;
+        if (++nDepth > MAX_DEPTH)
+            return false;
+        do
+        {
+            obj.push_back(Pair(string(), Value()));
+            Pair& pair = obj.back();
+            if (!ReadString(pair.name_) || !Consume(':') || !ReadValue(pair.value_))
+                return false;
+        } while (Consume(','));
+        nDepth--;
+        return Consume('}');
+    }
+
+    bool ReadValue(Value& value)
+    {
+        SkipSpace();
+        if (p == pend)
+            return false;
+        switch (*p)
+        {
+        case '"':
+        {
+            string str;
+            if (!ReadString(str))
+                return false;
+            value = str;
+            return true;
+        }
+        case '{':
+            value = Object();
+            return ReadObject(value.get_obj());
+        case '[':
+            value = Array();
+            return ReadArray(value.get_array());
+        case 't':
+            value = true;
+            return ReadLiteral("true");
+        case 'f':
+            value = false;
+            return ReadLiteral("false");
+        case 'n':
+            value = Value::null;
+            return ReadLiteral("null");
+        default:
+            return ReadNumber(value);
+        }
+    }
+};
+
+bool ReadJSON(const string& str, Value& valueRet)
+{
+    CJSONReader reader(str);
+    if (reader.ReadValue(valueRet))
+        return true;
+    return read_string(str, valueRet);
+}
+
+string JSONRPCRequest(const string& strMethod, const Array& params, const Value& id)
+{
+    Object request;
+    request.push_back(Pair("method", strMethod));
+    request.push_back(Pair("params", params));
+    request.push_back(Pair("id", id));
+    return write_string(Value(request), false) + "\n";
+}
+
+Object JSONRPCReplyObj(const Value& result, const Value& error, const Value& id)
+{
+    Object reply;
+    if (error.type() != null_type)
+        reply.push_back(Pair("result", Value::null));
+    else
+        reply.push_back(Pair("result", result));
+    reply.push_back(Pair("error", error));
+    reply.push_back(Pair("id", id));
+    return reply;
 }
 
 string JSONRPCReply(const Value& result, const Value& error, const Value& id)
@@ -2519,6 +2967,137 @@ string JSONRPCReply(const Value& result, const Value& error, const Value& id)
     return write_string(Value(reply), false) + "\n";
 }
 
+void CJSONStreamWriter::Separator()
+{
+    if (!pstream)
+        return;
+    if (fAfterKey)
+    {
+        fAfterKey = false;
+        return;
+    }
+    if (!vFirst.empty())
+    {
+        if (!vFirst.back())
+            *pstream << ',';
+        vFirst.back() = false;
+    }
+}
+
+// Adds a value to the innermost open container, or makes it the document.
+// Open containers are only ever appended to last, so the pointers to the
+// ones enclosing them stay valid.
+Value& CJSONStreamWriter::Insert(const Value& value)
+{
+    if (vOpen.empty())
+    {
+        *pvalue = value;
+        return *pvalue;
+    }
+    Value& container = *vOpen.back();
+    if (container.type() == obj_type)
+    {
+        container.get_obj().push_back(Pair(strKey, value));
+        return container.get_obj().back().value_;
+    }
+    container.get_array().push_back(value);
+    return container.get_array().back();
+}
+
+void CJSONStreamWriter::BeginObject()
+{
+    if (!pstream)
+    {
+        vOpen.push_back(&Insert(Object()));
+        return;
+    }
+    Separator();
+    *pstream << '{';
+    vFirst.push_back(true);
+}
+
+void CJSONStreamWriter::EndObject()
+{
+    if (!pstream)
+    {
+        vOpen.pop_back();
+        return;
+    }
+    vFirst.pop_back();
+    *pstream << '}';
+}
+
+void CJSONStreamWriter::BeginArray()
+{
+    if (!pstream)
+    {
+        vOpen.push_back(&Insert(Array()));
+        return;
+    }
+    Separator();
+    *pstream << '[';
+    vFirst.push_back(true);
+}
+
+void CJSONStreamWriter::EndArray()
+{
+    if (!pstream)
+    {
+        vOpen.pop_back();
+        return;
+    }
+    vFirst.pop_back();
+    *pstream << ']';
+}
+
+void CJSONStreamWriter::Key(const string& strKeyIn)
+{
+    if (!pstream)
+    {
+        strKey = strKeyIn;
+        return;
+    }
+    Separator();
+    write_stream(Value(strKeyIn), *pstream, false);
+    *pstream << ':';
+    fAfterKey = true;
+}
+
+void CJSONStreamWriter::Write(const Value& value)
+{
+    if (!pstream)
+    {
+        Insert(value);
+        return;
+    }
+    Separator();
+    write_stream(value, *pstream, false);
+}
+
+void CJSONStreamWriter::WriteRaw(const string& strJSON)
+{
+    if (!pstream)
+    {
+        Value value;
+        if (!read_string(strJSON, value))
+            throw runtime_error("CJSONStreamWriter::WriteRaw() : not valid JSON");
+        Insert(value);
+        return;
+    }
+    Separator();
+    *pstream << strJSON;
+}
+
+// For callers that need the result of a streaming command as a value tree
+// (batch requests, the GUI console, HTTP/1.0 clients via execute())
+Value RPCStreamToValue(rpcstreamfn_type actor, const Array& params, bool fHelp)
+{
+    Value value;
+    CJSONStreamWriter writer(value);
+    actor(params, fHelp, writer);
+    return value;
+}
+
 void ErrorReply(std::ostream& stream, const Object& objError, const Value& id)
 {
     // Send error reply from json-rpc error object
@@ -2614,6 +3193,21 @@ public:
     virtual std::iostream& stream() = 0;
     virtual std::string peer_address_to_string() const = 0;
     virtual void close() = 0;
+
+    // Invoke handler from the listener's io_service once the peer has sent
+    // more data (or hung up) on an idle keep-alive connection.
+    virtual void async_wait_request(const boost::function<void (const boost::system::error_code&)>& handler) = 0;
+
+    // True if a pipelined request has already been read off the socket and
+    // is sitting in our stream or SSL buffers, so waiting on the socket
+    // would never fire for it.
+    virtual bool has_buffered_input() = 0;
+
+    // Shut the socket down from the listener thread unless cancel_deadline
+    // is called within nSeconds, so that a client trickling in a request
+    // can't hold a worker blocked in ReadHTTP.
+    virtual void start_deadline(int64 nSeconds) = 0;
+    virtual void cancel_deadline() = 0;
 };
 
 template <typename Protocol>
@@ -2623,13 +3217,21 @@ public:
     AcceptedConnectionImpl(
             asio::io_service& io_service,
             ssl::context &context,
-            bool fUseSSL) :
+            bool fUseSSLIn) :
         sslStream(io_service, context),
-        _d(sslStream, fUseSSL),
-        _stream(_d)
+        fUseSSL(fUseSSLIn),
+        _d(sslStream, fUseSSLIn),
+        _stream(_d),
+        deadline(new CDeadline(&sslStream.next_layer())),
+        deadlineTimer(io_service)
     {
     }
 
+    virtual ~AcceptedConnectionImpl()
+    {
+        cancel_deadline();
+    }
+
     virtual std::iostream& stream()
     {
         return _stream;
@@ -2645,14 +3247,169 @@ public:
         _stream.close();
     }
 
+    virtual void async_wait_request(const boost::function<void (const boost::system::error_code&)>& handler)
+    {
+        sslStream.lowest_layer().async_read_some(asio::null_buffers(), handler);
+    }
+
+    virtual bool has_buffered_input()
+    {
+        if (_stream.rdbuf()->in_avail() > 0)
+            return true;
+        return fUseSSL && SSL_pending(sslStream.impl()->ssl) > 0;
+    }
+
+    virtual void start_deadline(int64 nSeconds)
+    {
+        unsigned int nGeneration;
+        {
+            boost::unique_lock<boost::mutex> lock(deadline->mutex);
+            deadline->fArmed = true;
+            nGeneration = ++deadline->nGeneration;
+        }
+        deadlineTimer.expires_from_now(posix_time::seconds(nSeconds));
+        deadlineTimer.async_wait(boost::bind(&AcceptedConnectionImpl::deadline_expired, deadline, nGeneration, boost::asio::placeholders::error));
+    }
+
+    virtual void cancel_deadline()
+    {
+        {
+            boost::unique_lock<boost::mutex> lock(deadline->mutex);
+            if (!deadline->fArmed)
+                return;
+            deadline->fArmed = false;
+        }
+        boost::system::error_code error;
+        deadlineTimer.cancel(error);
+    }
+
     typename Protocol::endpoint peer;
     asio::ssl::stream<typename Protocol::socket> sslStream;
 
 private:
+    // Shared with the timer's handler, which may run after the connection
+    // is gone: the socket is only touched while fArmed is set, under mutex
+    struct CDeadline
+    {
+        boost::mutex mutex;
+        bool fArmed;
+        unsigned int nGeneration;
+        typename Protocol::socket* psocket;
+
+        CDeadline(typename Protocol::socket* psocketIn) : fArmed(false), nGeneration(0), psocket(psocketIn) {}
+    };
+
+    static void deadline_expired(boost::shared_ptr<CDeadline> deadline, unsigned int nGeneration, const boost::system::error_code& error)
+    {
+        if (error == asio::error::operation_aborted)
+            return;
+        boost::unique_lock<boost::mutex> lock(deadline->mutex);
+        if (!deadline->fArmed || deadline->nGeneration != nGeneration)
+            return;
+        deadline->fArmed = false;
+        // The worker's blocked read sees end of file
+        boost::system::error_code ec;
+        deadline->psocket->shutdown(socket_base::shutdown_both, ec);
+    }
+
+    bool fUseSSL;
     SSLIOStreamDevice<Protocol> _d;
     iostreams::stream< SSLIOStreamDevice<Protocol> > _stream;
+    boost::shared_ptr<CDeadline> deadline;
+    asio::deadline_timer deadlineTimer;
+};
+
+//
+// Connections with a request ready to be read, waiting for one of the
+// -rpcthreads workers.  The queue is bounded so that a flood of clients
+// gets a quick 503 instead of piling up behind cs_main.
+//
+class CRPCWorkQueue
+{
+private:
+    boost::mutex mutex;
+    boost::condition_variable cond;
+    std::deque<AcceptedConnection*> queue;
+    unsigned int nMaxDepth;
+
+public:
+    CRPCWorkQueue() : nMaxDepth(16) {}
+
+    void SetMaxDepth(unsigned int nDepth)
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        nMaxDepth = std::max(nDepth, 1U);
+    }
+
+    bool Enqueue(AcceptedConnection* conn)
+    {
+        {
+            boost::unique_lock<boost::mutex> lock(mutex);
+            if (queue.size() >= nMaxDepth)
+                return false;
+            queue.push_back(conn);
+        }
+        cond.notify_one();
+        return true;
+    }
+
+    // Returns NULL if nothing arrived within nTimeoutMillis
+    AcceptedConnection* Dequeue(int64 nTimeoutMillis)
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        if (queue.empty())
+            cond.timed_wait(lock, boost::posix_time::milliseconds(nTimeoutMillis));
+        if (queue.empty())
+            return NULL;
+        AcceptedConnection* conn = queue.front();
+        queue.pop_front();
+        return conn;
+    }
+
+    void Clear()
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        BOOST_FOREACH(AcceptedConnection* conn, queue)
+            delete conn;
+        queue.clear();
+    }
 };
 
+static CRPCWorkQueue rpcWorkQueue;
+
+static void RPCRequestReady(AcceptedConnection* conn, const boost::system::error_code& error);
+
+/**
+ * Park an idle keep-alive connection on the listener's io_service until the
+ * client sends its next request.
+ */
+static void RPCWaitForRequest(AcceptedConnection* conn)
+{
+    conn->async_wait_request(boost::bind(&RPCRequestReady, conn, boost::asio::placeholders::error));
+}
+
+/**
+ * Runs on the listener thread: hand a readable connection to the workers.
+ */
+static void RPCRequestReady(AcceptedConnection* conn, const boost::system::error_code& error)
+{
+    if (error || fShutdown)
+    {
+        delete conn;
+        return;
+    }
+
+    if (!rpcWorkQueue.Enqueue(conn))
+    {
+        printf("ThreadRPCServer work queue depth exceeded, dropping connection from %s\n", conn->peer_address_to_string().c_str());
+        // Don't risk blocking the listener in an SSL handshake just to say no
+        if (!GetBoolArg("-rpcssl"))
+            conn->stream() << HTTPReply(503, "", false) << std::flush;
+        conn->close();
+        delete conn;
+    }
+}
+
 void ThreadRPCServer(void* parg)
 {
     IMPLEMENT_RANDOMIZE_STACK(ThreadRPCServer(parg));
@@ -2743,11 +3500,9 @@ static void RPCAcceptHandler(boost::shared_ptr< basic_socket_acceptor<Protocol,
         delete conn;
     }
 
-    // start HTTP client thread
-    else if (!CreateThread(ThreadRPCServer3, conn)) {
-        printf("Failed to create RPC server client thread\n");
-        delete conn;
-    }
+    // wait for the first request, then queue it for the worker threads
+    else
+        RPCWaitForRequest(conn);
 
     vnThreadsRunning[THREAD_RPCLISTENER]--;
 }
@@ -2857,11 +3612,35 @@ void ThreadRPCServer2(void* parg)
         return;
     }
 
+    rpcWorkQueue.SetMaxDepth(GetArg("-rpcworkqueue", 16));
+    boost::thread_group threadGroup;
+    int nThreads = std::max((int)GetArg("-rpcthreads", 4), 1);
+    for (int i = 0; i < nThreads; i++)
+    {
+        try
+        {
+            threadGroup.create_thread(boost::bind(&ThreadRPCServer3, (void*)NULL));
+        }
+        catch (boost::thread_resource_error& e)
+        {
+            printf("Failed to create RPC server worker thread\n");
+        }
+    }
+
     vnThreadsRunning[THREAD_RPCLISTENER]--;
     while (!fShutdown)
         io_service.run_one();
     vnThreadsRunning[THREAD_RPCLISTENER]++;
     StopRequests();
+
+    // Connections the workers hold reference io_service, and their read
+    // deadlines fire on it: keep it running until every worker has noticed
+    // fShutdown and returned, and only then tear it down.
+    boost::thread threadJoin(boost::bind(&boost::thread_group::join_all, &threadGroup));
+    io_service.reset();
+    while (!threadJoin.timed_join(posix_time::milliseconds(RPC_WORKER_POLL_MILLIS / 2)))
+        io_service.poll();
+    rpcWorkQueue.Clear();
 }
 
 class JSONRequest
@@ -2873,6 +3652,7 @@ public:
 
     JSONRequest() { id = Value::null; }
     void parse(const Value& valRequest);
+    void parseMethod(const Value& valMethod);
 };
 
 void JSONRequest::parse(const Value& valRequest)
@@ -2886,7 +3666,20 @@ void JSONRequest::parse(const Value& valRequest)
     id = find_value(request, "id");
 
     // Parse method
-    Value valMethod = find_value(request, "method");
+    parseMethod(find_value(request, "method"));
+
+    // Parse params
+    Value valParams = find_value(request, "params");
+    if (valParams.type() == array_type)
+        params = valParams.get_array();
+    else if (valParams.type() == null_type)
+        params = Array();
+    else
+        throw JSONRPCError(-32600, "Params must be an array");
+}
+
+void JSONRequest::parseMethod(const Value& valMethod)
+{
     if (valMethod.type() == null_type)
         throw JSONRPCError(-32600, "Missing method");
     if (valMethod.type() != str_type)
@@ -2894,15 +3687,70 @@ void JSONRequest::parse(const Value& valRequest)
     strMethod = valMethod.get_str();
     if (strMethod != "getwork" && strMethod != "getblocktemplate")
         printf("ThreadRPCServer method=%s\n", strMethod.c_str());
+}
 
-    // Parse params
-    Value valParams = find_value(request, "params");
-    if (valParams.type() == array_type)
-        params = valParams.get_array();
+/**
+ * Fast path for the usual single request object: read id, method and
+ * params straight into jreq instead of building the whole request as a
+ * value tree first.  Returns false for anything else (batches, or input
+ * CJSONReader leaves to json_spirit); use ReadJSON and JSONRequest::parse
+ * then.  Malformed request objects throw just like JSONRequest::parse.
+ */
+static bool ReadJSONRPCRequest(const string& strRequest, JSONRequest& jreq)
+{
+    CJSONReader reader(strRequest);
+    if (!reader.Consume('{'))
+        return false;
+
+    Value valId, valMethod, valParams;
+    Array params;
+    bool fHaveId = false, fHaveMethod = false, fHaveParams = false, fParamsArray = false;
+    if (!reader.Consume('}'))
+    {
+        do
+        {
+            // find_value() takes the first of duplicate names, so do we
+            string strName;
+            if (!reader.ReadString(strName) || !reader.Consume(':'))
+                return false;
+            bool fOk;
+            if (strName == "params" && !fHaveParams)
+            {
+                fHaveParams = true;
+                fParamsArray = reader.Peek('[');
+                fOk = fParamsArray ? reader.ReadArray(params) : reader.ReadValue(valParams);
+            }
+            else if (strName == "method" && !fHaveMethod)
+            {
+                fHaveMethod = true;
+                fOk = reader.ReadValue(valMethod);
+            }
+            else if (strName == "id" && !fHaveId)
+            {
+                fHaveId = true;
+                fOk = reader.ReadValue(valId);
+            }
+            else
+            {
+                Value valIgnored;
+                fOk = reader.ReadValue(valIgnored);
+            }
+            if (!fOk)
+                return false;
+        } while (reader.Consume(','));
+        if (!reader.Consume('}'))
+            return false;
+    }
+
+    jreq.id = valId;
+    jreq.parseMethod(valMethod);
+    if (fParamsArray)
+        jreq.params.swap(params);
     else if (valParams.type() == null_type)
-        params = Array();
+        jreq.params = Array();
     else
         throw JSONRPCError(-32600, "Params must be an array");
+    return true;
 }
 
 static Object JSONRPCExecOne(const Value& req)
@@ -2940,103 +3788,195 @@ static string JSONRPCExecBatch(const Array& vReq)
 
 static CCriticalSection cs_THREAD_RPCHANDLER;
 
-void ThreadRPCServer3(void* parg)
+/**
+ * Reply to a singleton request for a streaming command, sending the result
+ * while it is being produced, or once the command has released cs_main and
+ * cs_wallet if it runs under them.  Errors raised before any of the reply went
+ * out propagate to the caller as usual; after that the only option left is
+ * to drop the connection, signalled by returning false.
+ */
+static bool RPCStreamReply(AcceptedConnection* conn, const JSONRequest& jreq, bool fKeepAlive, bool fChunked)
 {
-    IMPLEMENT_RANDOMIZE_STACK(ThreadRPCServer3(parg));
+    CHTTPChunkedStreamBuf buf(conn->stream(), fKeepAlive, fChunked);
+    std::ostream os(&buf);
+    CJSONStreamWriter writer(os);
+    try
+    {
+        writer.BeginObject();
+        writer.Key("result");
+        tableRPC.executeStream(jreq.strMethod, jreq.params, writer);
+        writer.Write("error", Value::null);
+        writer.Write("id", jreq.id);
+        writer.EndObject();
+        os << "\n";
+        buf.Finish();
+    }
+    catch (...)
+    {
+        if (!buf.Started())
+            throw;
+        printf("ThreadRPCServer error while streaming %s reply, closing connection\n", jreq.strMethod.c_str());
+        return false;
+    }
+    return true;
+}
 
-    // Make this thread recognisable as the RPC handler
-    RenameThread("bitcoin-rpchand");
+/**
+ * Read and answer one HTTP request.  Returns true if the client asked to
+ * keep the connection open for further requests.
+ */
+static bool RPCServiceRequest(AcceptedConnection* conn)
+{
+    map<string, string> mapHeaders;
+    string strRequest;
+    int nProto = 0;
+    string strPath;
 
+    // Bound the time spent reading the request, but not running it
+    conn->start_deadline(GetArg("-rpctimeout", 30));
+    ReadHTTP(conn->stream(), mapHeaders, strRequest, &nProto, &strPath);
+    conn->cancel_deadline();
+
+    // Client hung up on an idle keep-alive connection, or was too slow
+    if (!conn->stream())
+        return false;
+
+    // Check authorization
+    if (mapHeaders.count("authorization") == 0)
     {
-        LOCK(cs_THREAD_RPCHANDLER);
-        vnThreadsRunning[THREAD_RPCHANDLER]++;
+        conn->stream() << HTTPReply(401, "", false) << std::flush;
+        return false;
+    }
+    if (!HTTPAuthorized(mapHeaders))
+    {
+        printf("ThreadRPCServer incorrect password attempt from %s\n", conn->peer_address_to_string().c_str());
+        /* Deter brute-forcing short passwords.
+           If this results in a DOS the user really
+           shouldn't have their RPC port exposed.*/
+        if (mapArgs["-rpcpassword"].size() < 20)
+            Sleep(250);
+
+        conn->stream() << HTTPReply(401, "", false) << std::flush;
+        return false;
     }
-    AcceptedConnection *conn = (AcceptedConnection *) parg;
+    bool fKeepAlive = (mapHeaders["connection"] != "close");
 
-    bool fRun = true;
-    loop {
-        if (fShutdown || !fRun)
+    JSONRequest jreq;
+    try
+    {
+        // Parse request
+        Value valRequest;
+        bool fSingleton = ReadJSONRPCRequest(strRequest, jreq);
+        if (!fSingleton)
         {
-            conn->close();
-            delete conn;
+            if (!ReadJSON(strRequest, valRequest))
+                throw JSONRPCError(-32700, "Parse error");
+            if (valRequest.type() == obj_type)
             {
-                LOCK(cs_THREAD_RPCHANDLER);
-                --vnThreadsRunning[THREAD_RPCHANDLER];
+                jreq.parse(valRequest);
+                fSingleton = true;
             }
-            return;
         }
-        map<string, string> mapHeaders;
-        string strRequest;
 
-        ReadHTTP(conn->stream(), mapHeaders, strRequest);
+        string strReply;
+        string strHeaders;
 
-        // Check authorization
-        if (mapHeaders.count("authorization") == 0)
-        {
-            conn->stream() << HTTPReply(401, "", false) << std::flush;
-            break;
-        }
-        if (!HTTPAuthorized(mapHeaders))
-        {
-            printf("ThreadRPCServer incorrect password attempt from %s\n", conn->peer_address_to_string().c_str());
-            /* Deter brute-forcing short passwords.
-               If this results in a DOS the user really
-               shouldn't have their RPC port exposed.*/
-            if (mapArgs["-rpcpassword"].size() < 20)
-                Sleep(250);
-
-            conn->stream() << HTTPReply(401, "", false) << std::flush;
-            break;
-        }
-        if (mapHeaders["connection"] == "close")
-            fRun = false;
+        // singleton request
+        if (fSingleton) {
+            // Large results go out as they are produced
+            if (tableRPC.isStreamable(jreq.strMethod))
+                return RPCStreamReply(conn, jreq, fKeepAlive, nProto >= 1) && fKeepAlive;
 
-        JSONRequest jreq;
-        try
-        {
-            // Parse request
-            Value valRequest;
-            if (!read_string(strRequest, valRequest))
-                throw JSONRPCError(-32700, "Parse error");
+            if (jreq.strMethod == "getwork")
+            {
+                // Long-polling getwork: hold the request until there is new work
+                if (strPath == "/LP" && jreq.params.empty())
+                    WaitForNewGetWork();
+                strHeaders = "X-Long-Polling: /LP\r\n";
+            }
 
-            string strReply;
+            Value result = tableRPC.execute(jreq.strMethod, jreq.params);
 
-            // singleton request
-            if (valRequest.type() == obj_type) {
-                jreq.parse(valRequest);
+            // Send reply
+            strReply = JSONRPCReply(result, Value::null, jreq.id);
 
-                Value result = tableRPC.execute(jreq.strMethod, jreq.params);
+        // array of requests
+        } else if (valRequest.type() == array_type)
+            strReply = JSONRPCExecBatch(valRequest.get_array());
+        else
+            throw JSONRPCError(-32700, "Top-level object parse error");
 
-                // Send reply
-                strReply = JSONRPCReply(result, Value::null, jreq.id);
+        conn->stream() << HTTPReply(200, strReply, fKeepAlive, strHeaders) << std::flush;
+    }
+    catch (Object& objError)
+    {
+        ErrorReply(conn->stream(), objError, jreq.id);
+        return false;
+    }
+    catch (std::exception& e)
+    {
+        ErrorReply(conn->stream(), JSONRPCError(-32700, e.what()), jreq.id);
+        return false;
+    }
+    return fKeepAlive;
+}
 
-            // array of requests
-            } else if (valRequest.type() == array_type)
-                strReply = JSONRPCExecBatch(valRequest.get_array());
-            else
-                throw JSONRPCError(-32700, "Top-level object parse error");
-                
-            conn->stream() << HTTPReply(200, strReply, fRun) << std::flush;
-        }
-        catch (Object& objError)
-        {
-            ErrorReply(conn->stream(), objError, jreq.id);
-            break;
-        }
-        catch (std::exception& e)
+void ThreadRPCServer3(void* parg)
+{
+    IMPLEMENT_RANDOMIZE_STACK(ThreadRPCServer3(parg));
+
+    // Make this thread recognisable as the RPC handler
+    RenameThread("bitcoin-rpchand");
+
+    {
+        LOCK(cs_THREAD_RPCHANDLER);
+        vnThreadsRunning[THREAD_RPCHANDLER]++;
+    }
+
+    while (!fShutdown)
+    {
+        AcceptedConnection *conn = rpcWorkQueue.Dequeue(RPC_WORKER_POLL_MILLIS);
+        if (!conn)
+            continue;
+
+        loop
         {
-            ErrorReply(conn->stream(), JSONRPCError(-32700, e.what()), jreq.id);
-            break;
+            if (!RPCServiceRequest(conn) || fShutdown)
+            {
+                conn->close();
+                delete conn;
+                break;
+            }
+
+            // Nothing pipelined behind this request: go back to waiting
+            // on the socket so this thread can serve other clients.
+            if (!conn->has_buffered_input())
+            {
+                RPCWaitForRequest(conn);
+                break;
+            }
+
+            // A pipelined request is already buffered.  Requeue it behind
+            // other clients if there is room, otherwise answer it now.
+            if (rpcWorkQueue.Enqueue(conn))
+                break;
         }
     }
 
-    delete conn;
     {
         LOCK(cs_THREAD_RPCHANDLER);
         vnThreadsRunning[THREAD_RPCHANDLER]--;
     }
 }
 
+static void RPCCheckSafeMode(const CRPCCommand *pcmd)
+{
+    string strWarning = GetWarnings("rpc");
+    if (strWarning != "" && !GetBoolArg("-disablesafemode") &&
+        !pcmd->okSafeMode)
+        throw JSONRPCError(-2, string("Safe mode: ") + strWarning);
+}
+
 json_spirit::Value CRPCTable::execute(const std::string &strMethod, const json_spirit::Array &params) const
 {
     // Find method
@@ -3045,15 +3985,15 @@ json_spirit::Value CRPCTable::execute(const std::string &strMethod, const json_s
         throw JSONRPCError(-32601, "Method not found");
 
     // Observe safe mode
-    string strWarning = GetWarnings("rpc");
-    if (strWarning != "" && !GetBoolArg("-disablesafemode") &&
-        !pcmd->okSafeMode)
-        throw JSONRPCError(-2, string("Safe mode: ") + strWarning);
+    RPCCheckSafeMode(pcmd);
 
     try
     {
         // Execute
         Value result;
+        if (pcmd->threadSafe)
+            result = pcmd->actor(params, false);
+        else
         {
             LOCK2(cs_main, pwalletMain->cs_wallet);
             result = pcmd->actor(params, false);
@@ -3066,6 +4006,47 @@ json_spirit::Value CRPCTable::execute(const std::string &strMethod, const json_s
     }
 }
 
+bool CRPCTable::isStreamable(const std::string &strMethod) const
+{
+    return mapStreamCommands.count(strMethod) && tableRPC[strMethod];
+}
+
+void CRPCTable::executeStream(const std::string &strMethod, const json_spirit::Array &params, CJSONStreamWriter& writer) const
+{
+    // Find method; locking and safe mode follow the vRPCCommands entry
+    map<string, const CRPCStreamCommand*>::const_iterator it = mapStreamCommands.find(strMethod);
+    const CRPCCommand *pcmd = tableRPC[strMethod];
+    if (it == mapStreamCommands.end() || !pcmd)
+        throw JSONRPCError(-32601, "Method not found");
+
+    // Observe safe mode
+    RPCCheckSafeMode(pcmd);
+
+    try
+    {
+        // Execute.  A command that needs cs_main and cs_wallet writes its
+        // result to a buffer while it holds them, and the buffer goes to
+        // the client only after they are released, so that a slow client
+        // can't hold up block processing or the wallet.
+        if (pcmd->threadSafe)
+            (*it).second->actor(params, false, writer);
+        else
+        {
+            ostringstream ss;
+            {
+                LOCK2(cs_main, pwalletMain->cs_wallet);
+                CJSONStreamWriter writerLocked(ss);
+                (*it).second->actor(params, false, writerLocked);
+            }
+            writer.WriteRaw(ss.str());
+        }
+    }
+    catch (std::exception& e)
+    {
+        throw JSONRPCError(-1, e.what());
+    }
+}
+
 
 Object CallRPC(const string& strMethod, const Array& params)
 {
@@ -3173,6 +4154,7 @@ Array RPCConvertValues(const std::string &strMethod, const std::vector<std::stri
     if (strMethod == "listaccounts"           && n > 0) ConvertTo<boost::int64_t>(params[0]);
     if (strMethod == "walletpassphrase"       && n > 1) ConvertTo<boost::int64_t>(params[1]);
     if (strMethod == "getblocktemplate"       && n > 0) ConvertTo<Object>(params[0]);
+    if (strMethod == "keypoolrefill"          && n > 0) ConvertTo<boost::int64_t>(params[0]);
     if (strMethod == "listsinceblock"         && n > 1) ConvertTo<boost::int64_t>(params[1]);
     if (strMethod == "sendmany"               && n > 1) ConvertTo<Object>(params[1]);
     if (strMethod == "sendmany"               && n > 2) ConvertTo<boost::int64_t>(params[2]);
@@ -3185,6 +4167,9 @@ Array RPCConvertValues(const std::string &strMethod, const std::vector<std::stri
     if (strMethod == "createrawtransaction"   && n > 1) ConvertTo<Object>(params[1]);
     if (strMethod == "signrawtransaction"     && n > 1) ConvertTo<Array>(params[1]);
     if (strMethod == "signrawtransaction"     && n > 2) ConvertTo<Array>(params[2]);
+    if (strMethod == "signrawtransactions"    && n > 0) ConvertTo<Array>(params[0]);
+    if (strMethod == "signrawtransactions"    && n > 1) ConvertTo<Array>(params[1]);
+    if (strMethod == "signrawtransactions"    && n > 2) ConvertTo<Array>(params[2]);
 
     return params;
 }
@@ -4,6 +4,8 @@
 #include <string>
 #include <list>
 #include <map>
+#include <vector>
+#include <ostream>
 
 #include "json/json_spirit_reader_template.h"
 #include "json/json_spirit_writer_template.h"
@@ -11,9 +13,20 @@
 
 json_spirit::Object JSONRPCError(int code, const std::string& message);
 
+/**
+ * Parse a JSON document like json_spirit::read_string, but with a
+ * hand-written reader that builds values in place.  Anything outside plain
+ * well-formed JSON is handed to read_string, so both accept the same input.
+ */
+bool ReadJSON(const std::string& str, json_spirit::Value& valueRet);
+
 void ThreadRPCServer(void* parg);
 int CommandLineRPC(int argc, char *argv[]);
 
+// Holds a getwork long-poll (/LP) until there is work newer than the best
+// chain and memory pool as they are now
+void WaitForNewGetWork();
+
 
 json_spirit::Array RPCConvertValues(const std::string &strMethod, const std::vector<std::string> &strParams);
 
@@ -23,7 +36,44 @@ void RPCTypeCheck(const json_spirit::Array& params,
 void RPCTypeCheck(const json_spirit::Object& o,
                   const std::map<std::string, json_spirit::Value_type>& typesExpected);
 
+/**
+ * Writes a JSON document straight to an output stream, one token at a time,
+ * so that large RPC results never exist as a json_spirit value tree.
+ * Small sub-values can still be built as json_spirit::Value and written
+ * in one go with Write().  Callers that do want the tree can have the
+ * writer build it in place instead.
+ */
+class CJSONStreamWriter
+{
+private:
+    std::ostream* pstream;      // NULL when building pvalue
+    json_spirit::Value* pvalue;
+    std::vector<json_spirit::Value*> vOpen; // containers being built, innermost last
+    std::string strKey;         // key of the next member of an object being built
+    std::vector<bool> vFirst;   // per open container: nothing written yet
+    bool fAfterKey;
+
+    void Separator();
+    json_spirit::Value& Insert(const json_spirit::Value& value);
+
+public:
+    explicit CJSONStreamWriter(std::ostream& streamIn) : pstream(&streamIn), pvalue(NULL), fAfterKey(false) {}
+    explicit CJSONStreamWriter(json_spirit::Value& valueOut) : pstream(NULL), pvalue(&valueOut), fAfterKey(false) {}
+
+    void BeginObject();
+    void EndObject();
+    void BeginArray();
+    void EndArray();
+    void Key(const std::string& strKey);
+    void Write(const json_spirit::Value& value);
+    void Write(const std::string& strKey, const json_spirit::Value& value) { Key(strKey); Write(value); }
+
+    // Writes a value that is already serialized JSON
+    void WriteRaw(const std::string& strJSON);
+};
+
 typedef json_spirit::Value(*rpcfn_type)(const json_spirit::Array& params, bool fHelp);
+typedef void(*rpcstreamfn_type)(const json_spirit::Array& params, bool fHelp, CJSONStreamWriter& writer);
 
 class CRPCCommand
 {
@@ -31,6 +81,15 @@ public:
     std::string name;
     rpcfn_type actor;
     bool okSafeMode;
+    bool threadSafe;    // actor does its own locking; run without cs_main/cs_wallet
+};
+
+
+class CRPCStreamCommand
+{
+public:
+    std::string name;
+    rpcstreamfn_type actor;
 };
 
 
@@ -38,6 +97,7 @@ class CRPCTable
 {
 private:
     std::map<std::string, const CRPCCommand*> mapCommands;
+    std::map<std::string, const CRPCStreamCommand*> mapStreamCommands;
 public:
     CRPCTable();
     const CRPCCommand* operator[](std::string name) const;
@@ -45,8 +105,17 @@ public:
 
    
     json_spirit::Value execute(const std::string &method, const json_spirit::Array &params) const;
+
+    /**
+     * Commands with potentially huge results can also write them
+     * incrementally, without building the result as a value tree.
+     */
+    bool isStreamable(const std::string &method) const;
+    void executeStream(const std::string &method, const json_spirit::Array &params, CJSONStreamWriter& writer) const;
 };
 
+json_spirit::Value RPCStreamToValue(rpcstreamfn_type actor, const json_spirit::Array& params, bool fHelp);
+
 extern const CRPCTable tableRPC;
 
 #endif
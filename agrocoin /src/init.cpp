@@ -62,6 +62,7 @@ void Shutdown(void* parg)
         nTransactionsUpdated++;
         bitdb.Flush(false);
         StopNode();
+        FlushWalletJournals();
         bitdb.Flush(true);
         boost::filesystem::remove(GetPidFile());
         UnregisterWallet(pwalletMain);
@@ -244,10 +245,16 @@ std::string HelpMessage()
         "  -rpcport=<port>        " + _("Listen for JSON-RPC connections on <port> (default: 56775)") + "\n" +
         "  -rpcallowip=<ip>       " + _("Allow JSON-RPC connections from specified IP address") + "\n" +
         "  -rpcconnect=<ip>       " + _("Send commands to node running on <ip> (default: 127.0.0.1)") + "\n" +
+        "  -rpcthreads=<n>        " + _("Set the number of threads to service RPC calls (default: 4)") + "\n" +
+        "  -rpcworkqueue=<n>      " + _("Set the depth of the queue of pending RPC requests (default: 16)") + "\n" +
+        "  -rpctimeout=<n>        " + _("Seconds a client has to send an RPC request before it is disconnected (default: 30)") + "\n" +
         "  -blocknotify=<cmd>     " + _("Execute command when the best block changes (%s in cmd is replaced by block hash)") + "\n" +
         "  -upgradewallet         " + _("Upgrade wallet to latest format") + "\n" +
         "  -keypool=<n>           " + _("Set key pool size to <n> (default: 100)") + "\n" +
         "  -rescan                " + _("Rescan the block chain for missing wallet transactions") + "\n" +
+        "  -rescanthreads=<n>     " + _("Number of threads reading blocks during a rescan (default: number of cores)") + "\n" +
+        "  -walletjournal         " + _("Log wallet changes to an append-only journal that is merged into the wallet file in the background (default: 1)") + "\n" +
+        "  -walletjournalsync=<n> " + _("Sync the wallet journal to disk at most every <n> milliseconds, 0 to sync every change (default: 100)") + "\n" +
         "  -checkblocks=<n>       " + _("How many blocks to check at startup (default: 2500, 0 = all)") + "\n" +
         "  -checklevel=<n>        " + _("How thorough the block verification is (0-6, default: 1)") + "\n" +
         "  -loadblock=<file>      " + _("Imports blocks from external blk000?.dat file") + "\n" +
@@ -408,6 +415,7 @@ bool AppInit2()
     printf("Startup time: %s\n", DateTimeStrFormat("%x %H:%M:%S", GetTime()).c_str());
     printf("Default data directory %s\n", GetDefaultDataDir().string().c_str());
     printf("Used data directory %s\n", GetDataDir().string().c_str());
+    printf("Using SHA256 implementation: %s\n", SHA256AutoDetect().c_str());
     std::ostringstream strErrors;
 
     if (fDaemon)
@@ -570,9 +578,8 @@ bool AppInit2()
         for (map<uint256, CBlockIndex*>::iterator mi = mapBlockIndex.begin(); mi != mapBlockIndex.end(); ++mi)
         {
             CBlockIndex* pindex = (*mi).second;
-            CBlock block;
-            block.ReadFromDisk(pindex);
-            block.BuildMerkleTree();
+            // Header fields only, which the index has without a disk read
+            CBlock block = pindex->GetBlockHeader();
             fprintf(file, "%d,%s,%s,%d,%f,%u\n",
                 pindex->nHeight, 
                 block.GetHash().ToString().c_str(),
@@ -643,14 +650,21 @@ bool AppInit2()
     RegisterWallet(pwalletMain);
 
     CBlockIndex *pindexRescan = pindexBest;
-    if (GetBoolArg("-rescan"))
-        pindexRescan = pindexGenesisBlock;
-    else
     {
         CWalletDB walletdb("wallet.dat");
         CBlockLocator locator;
-        if (walletdb.ReadBestBlock(locator))
+        if (GetBoolArg("-rescan"))
+            pindexRescan = pindexGenesisBlock;
+        else if (walletdb.ReadBestBlock(locator))
             pindexRescan = locator.GetBlockIndex();
+
+        // Finish a rescan that was interrupted last time
+        if (walletdb.ReadRescanProgress(locator))
+        {
+            CBlockIndex* pindexResume = locator.GetBlockIndex();
+            if (GetBoolArg("-rescan") || pindexResume->nHeight < pindexRescan->nHeight)
+                pindexRescan = pindexResume;
+        }
     }
     if (pindexBest != pindexRescan)
     {
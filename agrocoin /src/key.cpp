@@ -4,6 +4,11 @@
 
 #include "key.h"
 
+#ifdef USE_SECP256K1
+#include <secp256k1.h>
+#include "sync.h"
+#endif
+
 int EC_KEY_regenerate_key(EC_KEY *eckey, BIGNUM *priv_key)
 {
     int ok = 0;
@@ -343,6 +348,103 @@ bool CKey::Verify(uint256 hash, const std::vector<unsigned char>& vchSig)
     return true;
 }
 
+#ifdef USE_SECP256K1
+// libsecp256k1 only ever says yes to a strict DER signature that is valid
+// for the key, and OpenSSL agrees with it on those.  Everything it can't
+// parse (lax DER, odd key encodings) is left to OpenSSL, so consensus stays
+// whatever OpenSSL decides.
+class CSecp256k1Verifier
+{
+private:
+    secp256k1_context* ctx;
+
+    // Parsed keys, the same ones come back with every spend of an address
+    typedef std::map<std::vector<unsigned char>, secp256k1_pubkey> pubkeymap_type;
+    pubkeymap_type mapPubKeys;
+    CCriticalSection cs_pubkeys;
+
+    static const unsigned int nMaxPubKeys = 50000;
+
+    bool ParsePubKey(const std::vector<unsigned char>& vchPubKey, secp256k1_pubkey& pubkey)
+    {
+        {
+            LOCK(cs_pubkeys);
+            pubkeymap_type::const_iterator mi = mapPubKeys.find(vchPubKey);
+            if (mi != mapPubKeys.end())
+            {
+                pubkey = (*mi).second;
+                return true;
+            }
+        }
+        if (!secp256k1_ec_pubkey_parse(ctx, &pubkey, &vchPubKey[0], vchPubKey.size()))
+            return false;
+
+        LOCK(cs_pubkeys);
+        if (mapPubKeys.size() >= nMaxPubKeys)
+        {
+            // Every key starts with 0x02, 0x03 or 0x04, so a random key only
+            // lands on a random entry when it has one of those prefixes too
+            uint256 randomHash = GetRandHash();
+            std::vector<unsigned char> vchRandom(1, vchPubKey[0]);
+            vchRandom.insert(vchRandom.end(), randomHash.begin(), randomHash.end());
+            pubkeymap_type::iterator it = mapPubKeys.lower_bound(vchRandom);
+            if (it == mapPubKeys.end())
+                it = mapPubKeys.begin();
+            mapPubKeys.erase(it);
+        }
+        mapPubKeys.insert(std::make_pair(vchPubKey, pubkey));
+        return true;
+    }
+
+public:
+    CSecp256k1Verifier()
+    {
+        ctx = secp256k1_context_create(SECP256K1_CONTEXT_VERIFY);
+    }
+
+    ~CSecp256k1Verifier()
+    {
+        secp256k1_context_destroy(ctx);
+    }
+
+    // 1 valid, 0 invalid, -1 can't tell
+    int Verify(uint256 hash, const std::vector<unsigned char>& vchSig, const std::vector<unsigned char>& vchPubKey)
+    {
+        if (vchSig.empty() || (vchPubKey.size() != 33 && vchPubKey.size() != 65))
+            return -1;
+        secp256k1_ecdsa_signature sig;
+        if (!secp256k1_ecdsa_signature_parse_der(ctx, &sig, &vchSig[0], vchSig.size()))
+            return -1;
+        secp256k1_pubkey pubkey;
+        if (!ParsePubKey(vchPubKey, pubkey))
+            return -1;
+        // OpenSSL takes either S, libsecp256k1 only the low one
+        secp256k1_ecdsa_signature_normalize(ctx, &sig, &sig);
+        return secp256k1_ecdsa_verify(ctx, &sig, hash.begin(), &pubkey) ? 1 : 0;
+    }
+};
+
+static CSecp256k1Verifier secp256k1Verifier;
+
+int CPubKey::VerifySecp256k1(uint256 hash, const std::vector<unsigned char>& vchSig) const
+{
+    return secp256k1Verifier.Verify(hash, vchSig, vchPubKey);
+}
+#endif
+
+bool CPubKey::Verify(uint256 hash, const std::vector<unsigned char>& vchSig) const
+{
+#ifdef USE_SECP256K1
+    int nResult = VerifySecp256k1(hash, vchSig);
+    if (nResult >= 0)
+        return nResult == 1;
+#endif
+    CKey key;
+    if (!key.SetPubKey(*this))
+        return false;
+    return key.Verify(hash, vchSig);
+}
+
 bool CKey::VerifyCompact(uint256 hash, const std::vector<unsigned char>& vchSig)
 {
     CKey key;
@@ -354,6 +456,28 @@ bool CKey::VerifyCompact(uint256 hash, const std::vector<unsigned char>& vchSig)
     return true;
 }
 
+CRawKey::CRawKey(const CKey& key)
+{
+    bool fCompressed;
+    vchSecret = key.GetSecret(fCompressed);
+    vchPubKey = key.GetPubKey();
+}
+
+bool CRawKey::GetKey(CKey& keyOut) const
+{
+    if (vchSecret.size() != 32)
+        return false;
+    keyOut.Reset();
+    if (!keyOut.SetPubKey(vchPubKey))
+        return false;
+    BIGNUM *bn = BN_bin2bn(&vchSecret[0], 32, NULL);
+    if (bn == NULL)
+        return false;
+    bool fOk = EC_KEY_set_private_key(keyOut.pkey, bn);
+    BN_clear_free(bn);
+    return fOk;
+}
+
 bool CKey::IsValid()
 {
     if (!fSet)
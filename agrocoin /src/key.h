@@ -36,6 +36,7 @@ class CPubKey {
 private:
     std::vector<unsigned char> vchPubKey;
     friend class CKey;
+    friend class CRawKey;
 
 public:
     CPubKey() { }
@@ -67,6 +68,16 @@ public:
     std::vector<unsigned char> Raw() const {
         return vchPubKey;
     }
+
+    // Checks a DER signature of hash by this key, accepting exactly what
+    // CKey::SetPubKey() followed by CKey::Verify() accepts
+    bool Verify(uint256 hash, const std::vector<unsigned char>& vchSig) const;
+
+#ifdef USE_SECP256K1
+    // libsecp256k1's answer alone: 1 valid, 0 invalid, -1 if it leaves the
+    // signature to OpenSSL
+    int VerifySecp256k1(uint256 hash, const std::vector<unsigned char>& vchSig) const;
+#endif
 };
 
 
@@ -79,6 +90,7 @@ protected:
     EC_KEY* pkey;
     bool fSet;
     bool fCompressedPubKey;
+    friend class CRawKey;
 
     void SetCompressedPubKey();
 
@@ -117,4 +129,27 @@ public:
     bool IsValid();
 };
 
+// A private key the way key stores hold thousands of them: the secret and
+// its serialized public key, without an OpenSSL EC_KEY.  GetKey() makes the
+// CKey when there is something to sign.
+class CRawKey
+{
+private:
+    CSecret vchSecret;
+    CPubKey vchPubKey;
+
+public:
+    CRawKey() { }
+    CRawKey(const CSecret& vchSecretIn, const CPubKey& vchPubKeyIn) : vchSecret(vchSecretIn), vchPubKey(vchPubKeyIn) { }
+    explicit CRawKey(const CKey& key);
+
+    const CSecret& GetSecret() const { return vchSecret; }
+    const CPubKey& GetPubKey() const { return vchPubKey; }
+    bool IsCompressed() const { return vchPubKey.IsCompressed(); }
+
+    // Sets the private key without deriving the public key from it again;
+    // the pair must come from a CKey or have been checked like one
+    bool GetKey(CKey& keyOut) const;
+};
+
 #endif
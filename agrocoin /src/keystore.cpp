@@ -1,6 +1,77 @@
 #include "keystore.h"
 #include "script.h"
 
+static const unsigned int FINGERPRINT_SET_MIN_SLOTS = 64;
+
+CFingerprintSet::CTable* CFingerprintSet::NewTable(unsigned int nSlots)
+{
+    CTable* table = new CTable;
+    table->nMask = nSlots - 1;
+    table->pslots = new uint64[nSlots];
+    memset(table->pslots, 0, nSlots * sizeof(uint64));
+    return table;
+}
+
+void CFingerprintSet::Place(CTable* table, uint64 n)
+{
+    unsigned int i = n & table->nMask;
+    while (table->pslots[i] != 0)
+        i = (i + 1) & table->nMask;
+    __atomic_store_n(&table->pslots[i], n, __ATOMIC_RELEASE);
+}
+
+CFingerprintSet::CFingerprintSet()
+{
+    ptable = NewTable(FINGERPRINT_SET_MIN_SLOTS);
+    nCount = 0;
+}
+
+CFingerprintSet::~CFingerprintSet()
+{
+    CTable* table = ptable;
+    vRetired.push_back(table);
+    BOOST_FOREACH(CTable* tableRetired, vRetired)
+    {
+        delete[] tableRetired->pslots;
+        delete tableRetired;
+    }
+}
+
+void CFingerprintSet::Insert(uint64 n)
+{
+    if (n == 0)
+        n = 1;
+    if (Contains(n))
+        return;
+
+    // Kept at most half full, so a miss is usually settled within a slot
+    // or two
+    CTable* table = ptable;
+    if ((nCount + 1) * 2 > table->nMask + 1)
+    {
+        CTable* tableNew = NewTable((table->nMask + 1) * 2);
+        for (unsigned int i = 0; i <= table->nMask; i++)
+            if (table->pslots[i] != 0)
+                Place(tableNew, table->pslots[i]);
+        Place(tableNew, n);
+        // Readers must not see the new table before its contents
+        __atomic_store_n(&ptable, tableNew, __ATOMIC_RELEASE);
+        vRetired.push_back(table);
+    }
+    else
+        Place(table, n);
+    nCount++;
+}
+
+// The first eight bytes of a key ID, script ID or public key (after its
+// prefix byte); they are as good as random
+static uint64 GetFingerprint(const unsigned char* pch)
+{
+    uint64 n;
+    memcpy(&n, pch, sizeof(n));
+    return n;
+}
+
 bool CKeyStore::GetPubKey(const CKeyID &address, CPubKey &vchPubKeyOut) const
 {
     CKey key;
@@ -10,26 +81,89 @@ bool CKeyStore::GetPubKey(const CKeyID &address, CPubKey &vchPubKeyOut) const
     return true;
 }
 
+void CBasicKeyStore::AddFingerprints(const CPubKey& vchPubKey)
+{
+    CKeyID keyID = vchPubKey.GetID();
+    setFingerprints.Insert(GetFingerprint(keyID.begin()));
+    std::vector<unsigned char> vch = vchPubKey.Raw();
+    if (vch.size() >= 1 + sizeof(uint64))
+        setFingerprints.Insert(GetFingerprint(&vch[1]));
+}
+
 bool CBasicKeyStore::AddKey(const CKey& key)
 {
-    bool fCompressed = false;
-    CSecret secret = key.GetSecret(fCompressed);
+    return AddRawKey(CRawKey(key));
+}
+
+bool CBasicKeyStore::AddRawKey(const CRawKey& key)
+{
     {
         LOCK(cs_KeyStore);
-        mapKeys[key.GetPubKey().GetID()] = make_pair(secret, fCompressed);
+        mapKeys[key.GetPubKey().GetID()] = key;
+        AddFingerprints(key.GetPubKey());
     }
     return true;
 }
 
+void CBasicKeyStore::RemoveKey(const CKeyID &address)
+{
+    LOCK(cs_KeyStore);
+    mapKeys.erase(address);
+}
+
+bool CBasicKeyStore::GetPubKey(const CKeyID &address, CPubKey &vchPubKeyOut) const
+{
+    {
+        LOCK(cs_KeyStore);
+        KeyMap::const_iterator mi = mapKeys.find(address);
+        if (mi != mapKeys.end())
+        {
+            vchPubKeyOut = (*mi).second.GetPubKey();
+            return true;
+        }
+    }
+    return false;
+}
+
+bool CBasicKeyStore::GetSecret(const CKeyID &address, CSecret& vchSecret, bool &fCompressed) const
+{
+    {
+        LOCK(cs_KeyStore);
+        KeyMap::const_iterator mi = mapKeys.find(address);
+        if (mi != mapKeys.end())
+        {
+            vchSecret = (*mi).second.GetSecret();
+            fCompressed = (*mi).second.IsCompressed();
+            return true;
+        }
+    }
+    return false;
+}
+
 bool CBasicKeyStore::AddCScript(const CScript& redeemScript)
 {
+    CScriptID scriptID = redeemScript.GetID();
     {
         LOCK(cs_KeyStore);
-        mapScripts[redeemScript.GetID()] = redeemScript;
+        mapScripts[scriptID] = redeemScript;
+        setFingerprints.Insert(GetFingerprint(scriptID.begin()));
     }
     return true;
 }
 
+bool CBasicKeyStore::MayHaveScript(const CScript& scriptPubKey) const
+{
+    unsigned int nSize = scriptPubKey.size();
+    if (nSize == 25 && scriptPubKey[0] == OP_DUP && scriptPubKey[1] == OP_HASH160 && scriptPubKey[2] == 20 &&
+        scriptPubKey[23] == OP_EQUALVERIFY && scriptPubKey[24] == OP_CHECKSIG)
+        return setFingerprints.Contains(GetFingerprint(&scriptPubKey[3]));
+    if (nSize == 23 && scriptPubKey[0] == OP_HASH160 && scriptPubKey[1] == 20 && scriptPubKey[22] == OP_EQUAL)
+        return setFingerprints.Contains(GetFingerprint(&scriptPubKey[2]));
+    if (((nSize == 35 && scriptPubKey[0] == 33) || (nSize == 67 && scriptPubKey[0] == 65)) && scriptPubKey[nSize-1] == OP_CHECKSIG)
+        return setFingerprints.Contains(GetFingerprint(&scriptPubKey[2]));
+    return true;
+}
+
 bool CBasicKeyStore::HaveCScript(const CScriptID& hash) const
 {
     bool result;
@@ -55,6 +189,20 @@ bool CBasicKeyStore::GetCScript(const CScriptID &hash, CScript& redeemScriptOut)
     return false;
 }
 
+void CBasicKeyStore::GetCScripts(std::set<CScriptID> &setScripts) const
+{
+    setScripts.clear();
+    {
+        LOCK(cs_KeyStore);
+        ScriptMap::const_iterator mi = mapScripts.begin();
+        while (mi != mapScripts.end())
+        {
+            setScripts.insert((*mi).first);
+            mi++;
+        }
+    }
+}
+
 bool CCryptoKeyStore::SetCrypted()
 {
     {
@@ -76,6 +224,7 @@ bool CCryptoKeyStore::Lock()
     {
         LOCK(cs_KeyStore);
         vMasterKey.clear();
+        mapDecryptedSecrets.clear();
     }
 
     NotifyStatusChanged(this);
@@ -112,23 +261,22 @@ bool CCryptoKeyStore::Unlock(const CKeyingMaterial& vMasterKeyIn)
     return true;
 }
 
-bool CCryptoKeyStore::AddKey(const CKey& key)
+bool CCryptoKeyStore::AddRawKey(const CRawKey& key)
 {
     {
         LOCK(cs_KeyStore);
         if (!IsCrypted())
-            return CBasicKeyStore::AddKey(key);
+            return CBasicKeyStore::AddRawKey(key);
 
         if (IsLocked())
             return false;
 
         std::vector<unsigned char> vchCryptedSecret;
-        CPubKey vchPubKey = key.GetPubKey();
-        bool fCompressed;
-        if (!EncryptSecret(vMasterKey, key.GetSecret(fCompressed), vchPubKey.GetHash(), vchCryptedSecret))
+        const CPubKey& vchPubKey = key.GetPubKey();
+        if (!EncryptSecret(vMasterKey, key.GetSecret(), vchPubKey.GetHash(), vchCryptedSecret))
             return false;
 
-        if (!AddCryptedKey(key.GetPubKey(), vchCryptedSecret))
+        if (!AddCryptedKey(vchPubKey, vchCryptedSecret))
             return false;
     }
     return true;
@@ -143,10 +291,24 @@ bool CCryptoKeyStore::AddCryptedKey(const CPubKey &vchPubKey, const std::vector<
             return false;
 
         mapCryptedKeys[vchPubKey.GetID()] = make_pair(vchPubKey, vchCryptedSecret);
+        AddFingerprints(vchPubKey);
     }
     return true;
 }
 
+void CCryptoKeyStore::RemoveKey(const CKeyID &address)
+{
+    LOCK(cs_KeyStore);
+    if (!IsCrypted())
+    {
+        CBasicKeyStore::RemoveKey(address);
+        return;
+    }
+
+    mapCryptedKeys.erase(address);
+    mapDecryptedSecrets.erase(address);
+}
+
 bool CCryptoKeyStore::GetKey(const CKeyID &address, CKey& keyOut) const
 {
     {
@@ -158,15 +320,18 @@ bool CCryptoKeyStore::GetKey(const CKeyID &address, CKey& keyOut) const
         if (mi != mapCryptedKeys.end())
         {
             const CPubKey &vchPubKey = (*mi).second.first;
-            const std::vector<unsigned char> &vchCryptedSecret = (*mi).second.second;
-            CSecret vchSecret;
-            if (!DecryptSecret(vMasterKey, vchCryptedSecret, vchPubKey.GetHash(), vchSecret))
-                return false;
-            if (vchSecret.size() != 32)
-                return false;
-            keyOut.SetPubKey(vchPubKey);
-            keyOut.SetSecret(vchSecret);
-            return true;
+            std::map<CKeyID, CSecret>::const_iterator miSecret = mapDecryptedSecrets.find(address);
+            if (miSecret == mapDecryptedSecrets.end())
+            {
+                const std::vector<unsigned char> &vchCryptedSecret = (*mi).second.second;
+                CSecret vchSecret;
+                if (!DecryptSecret(vMasterKey, vchCryptedSecret, vchPubKey.GetHash(), vchSecret))
+                    return false;
+                if (vchSecret.size() != 32)
+                    return false;
+                miSecret = mapDecryptedSecrets.insert(make_pair(address, vchSecret)).first;
+            }
+            return CRawKey((*miSecret).second, vchPubKey).GetKey(keyOut);
         }
     }
     return false;
@@ -177,7 +342,7 @@ bool CCryptoKeyStore::GetPubKey(const CKeyID &address, CPubKey& vchPubKeyOut) co
     {
         LOCK(cs_KeyStore);
         if (!IsCrypted())
-            return CKeyStore::GetPubKey(address, vchPubKeyOut);
+            return CBasicKeyStore::GetPubKey(address, vchPubKeyOut);
 
         CryptedKeyMap::const_iterator mi = mapCryptedKeys.find(address);
         if (mi != mapCryptedKeys.end())
@@ -189,6 +354,16 @@ bool CCryptoKeyStore::GetPubKey(const CKeyID &address, CPubKey& vchPubKeyOut) co
     return false;
 }
 
+bool CCryptoKeyStore::GetSecret(const CKeyID &address, CSecret& vchSecret, bool &fCompressed) const
+{
+    {
+        LOCK(cs_KeyStore);
+        if (!IsCrypted())
+            return CBasicKeyStore::GetSecret(address, vchSecret, fCompressed);
+    }
+    return CKeyStore::GetSecret(address, vchSecret, fCompressed);
+}
+
 bool CCryptoKeyStore::EncryptKeys(CKeyingMaterial& vMasterKeyIn)
 {
     {
@@ -199,13 +374,9 @@ bool CCryptoKeyStore::EncryptKeys(CKeyingMaterial& vMasterKeyIn)
         fUseCrypto = true;
         BOOST_FOREACH(KeyMap::value_type& mKey, mapKeys)
         {
-            CKey key;
-            if (!key.SetSecret(mKey.second.first, mKey.second.second))
-                return false;
-            const CPubKey vchPubKey = key.GetPubKey();
+            const CPubKey& vchPubKey = mKey.second.GetPubKey();
             std::vector<unsigned char> vchCryptedSecret;
-            bool fCompressed;
-            if (!EncryptSecret(vMasterKeyIn, key.GetSecret(fCompressed), vchPubKey.GetHash(), vchCryptedSecret))
+            if (!EncryptSecret(vMasterKeyIn, mKey.second.GetSecret(), vchPubKey.GetHash(), vchCryptedSecret))
                 return false;
             if (!AddCryptedKey(vchPubKey, vchCryptedSecret))
                 return false;
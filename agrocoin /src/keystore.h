@@ -7,6 +7,57 @@
 
 class CScript;
 
+/** Insert-only set of 64-bit fingerprints that readers probe without a lock.
+ *
+ * Inserts have to be serialized by the owner.  The open-addressed table is
+ * only ever changed by filling empty slots; growing builds a bigger copy and
+ * publishes it, and replaced tables are kept until the set goes away, so a
+ * reader still probing one is safe.  A lookup racing an insert may or may
+ * not see it, as with any lock.  The table pointer and the slots are read
+ * and written with atomic acquire loads and release stores, so a reader
+ * sees a new table's slots filled in, and a 64-bit slot can't tear on
+ * 32-bit targets.
+ */
+class CFingerprintSet
+{
+private:
+    struct CTable
+    {
+        unsigned int nMask;
+        uint64* pslots;                 // 0 is an empty slot
+    };
+
+    CTable* ptable;
+    std::vector<CTable*> vRetired;
+    unsigned int nCount;
+
+    CFingerprintSet(const CFingerprintSet&);
+    CFingerprintSet& operator=(const CFingerprintSet&);
+
+    static CTable* NewTable(unsigned int nSlots);
+    static void Place(CTable* table, uint64 n);
+
+public:
+    CFingerprintSet();
+    ~CFingerprintSet();
+
+    void Insert(uint64 n);
+    bool Contains(uint64 n) const
+    {
+        if (n == 0)
+            n = 1;
+        const CTable* table = __atomic_load_n(&ptable, __ATOMIC_ACQUIRE);
+        for (unsigned int i = n & table->nMask; ; i = (i + 1) & table->nMask)
+        {
+            uint64 nSlot = __atomic_load_n(&table->pslots[i], __ATOMIC_ACQUIRE);
+            if (nSlot == n)
+                return true;
+            if (nSlot == 0)
+                return false;
+        }
+    }
+};
+
 class CKeyStore
 {
 protected:
@@ -24,6 +75,10 @@ public:
     virtual bool HaveCScript(const CScriptID &hash) const =0;
     virtual bool GetCScript(const CScriptID &hash, CScript& redeemScriptOut) const =0;
 
+    // False only if scriptPubKey is a standard pay-to-pubkey, pubkey-hash or
+    // script-hash output for a key or script that isn't in here
+    virtual bool MayHaveScript(const CScript& scriptPubKey) const { return true; }
+
     virtual bool GetSecret(const CKeyID &address, CSecret& vchSecret, bool &fCompressed) const
     {
         CKey key;
@@ -34,7 +89,7 @@ public:
     }
 };
 
-typedef std::map<CKeyID, std::pair<CSecret, bool> > KeyMap;
+typedef std::map<CKeyID, CRawKey> KeyMap;
 typedef std::map<CScriptID, CScript > ScriptMap;
 
 class CBasicKeyStore : public CKeyStore
@@ -43,8 +98,19 @@ protected:
     KeyMap mapKeys;
     ScriptMap mapScripts;
 
+    // Fingerprints of every key's ID and public key and every script's ID,
+    // so outputs paying somebody else are turned down without locking
+    CFingerprintSet setFingerprints;
+
+    void AddFingerprints(const CPubKey& vchPubKey);
+
+    // Takes back a key that never made it to the wallet file.  Its
+    // fingerprints stay, which only costs an occasional false positive.
+    void RemoveKey(const CKeyID &address);
+
 public:
     bool AddKey(const CKey& key);
+    virtual bool AddRawKey(const CRawKey& key);
     bool HaveKey(const CKeyID &address) const
     {
         bool result;
@@ -73,17 +139,17 @@ public:
             LOCK(cs_KeyStore);
             KeyMap::const_iterator mi = mapKeys.find(address);
             if (mi != mapKeys.end())
-            {
-                keyOut.Reset();
-                keyOut.SetSecret((*mi).second.first, (*mi).second.second);
-                return true;
-            }
+                return (*mi).second.GetKey(keyOut);
         }
         return false;
     }
+    bool GetPubKey(const CKeyID &address, CPubKey& vchPubKeyOut) const;
+    bool GetSecret(const CKeyID &address, CSecret& vchSecret, bool &fCompressed) const;
     virtual bool AddCScript(const CScript& redeemScript);
     virtual bool HaveCScript(const CScriptID &hash) const;
     virtual bool GetCScript(const CScriptID &hash, CScript& redeemScriptOut) const;
+    void GetCScripts(std::set<CScriptID> &setScripts) const;
+    bool MayHaveScript(const CScript& scriptPubKey) const;
 };
 
 typedef std::map<CKeyID, std::pair<CPubKey, std::vector<unsigned char> > > CryptedKeyMap;
@@ -95,6 +161,11 @@ private:
 
     CKeyingMaterial vMasterKey;
 
+    // Secrets decrypted since the wallet was unlocked, so signing with the
+    // same keys again doesn't decrypt them again.  CSecret keeps them in
+    // locked memory; Lock() wipes them.
+    mutable std::map<CKeyID, CSecret> mapDecryptedSecrets;
+
     bool fUseCrypto;
 
 protected:
@@ -104,6 +175,8 @@ protected:
 
     bool Unlock(const CKeyingMaterial& vMasterKeyIn);
 
+    void RemoveKey(const CKeyID &address);
+
 public:
     CCryptoKeyStore() : fUseCrypto(false)
     {
@@ -129,7 +202,7 @@ public:
     bool Lock();
 
     virtual bool AddCryptedKey(const CPubKey &vchPubKey, const std::vector<unsigned char> &vchCryptedSecret);
-    bool AddKey(const CKey& key);
+    bool AddRawKey(const CRawKey& key);
     bool HaveKey(const CKeyID &address) const
     {
         {
@@ -142,6 +215,7 @@ public:
     }
     bool GetKey(const CKeyID &address, CKey& keyOut) const;
     bool GetPubKey(const CKeyID &address, CPubKey& vchPubKeyOut) const;
+    bool GetSecret(const CKeyID &address, CSecret& vchSecret, bool &fCompressed) const;
     void GetKeys(std::set<CKeyID> &setAddress) const
     {
         if (!IsCrypted())
@@ -3,6 +3,7 @@
 #include "net.h"
 #include "init.h"
 #include "ui_interface.h"
+#include "txview.h"
 #include <boost/algorithm/string/replace.hpp>
 #include <boost/filesystem.hpp>
 #include <boost/filesystem/fstream.hpp>
@@ -19,6 +20,8 @@ CCriticalSection cs_main;
 
 CTxMemPool mempool;
 unsigned int nTransactionsUpdated = 0;
+CWaitableCriticalSection csWorkChange;
+CConditionVariable cvWorkChange;
 
 map<uint256, CBlockIndex*> mapBlockIndex;
 uint256 hashGenesisBlock("0xd3e775371fcd45b9894ff58fe909a5050742a12e14f99172a1eee0aca45a6b8e");
@@ -27,7 +30,7 @@ CBlockIndex* pindexGenesisBlock = NULL;
 int nBestHeight = -1;
 CBigNum bnBestChainWork = 0;
 CBigNum bnBestInvalidWork = 0;
-uint256 hashBestChain = 0;
+uint256 hashBestChain = 0;                 // written holding cs_main and csWorkChange
 CBlockIndex* pindexBest = NULL;
 int64 nTimeBestReceived = 0;
 
@@ -96,6 +99,18 @@ void SyncWithWallets(const CTransaction& tx, const CBlock* pblock, bool fUpdate)
         pwallet->AddToWalletIfInvolvingMe(tx, pblock, fUpdate);
 }
 
+void static DisconnectFromWallets(const uint256& hashBlock)
+{
+    BOOST_FOREACH(CWallet* pwallet, setpwalletRegistered)
+        pwallet->DisconnectBlock(hashBlock);
+}
+
+void static FileConnectedTxsInWallets()
+{
+    BOOST_FOREACH(CWallet* pwallet, setpwalletRegistered)
+        pwallet->FileConnectedTxs();
+}
+
 void static SetBestChain(const CBlockLocator& loc)
 {
     BOOST_FOREACH(CWallet* pwallet, setpwalletRegistered)
@@ -529,6 +544,16 @@ bool CTransaction::AcceptToMemoryPool(CTxDB& txdb, bool fCheckInputs, bool* pfMi
     return mempool.accept(txdb, *this, fCheckInputs, pfMissingInputs);
 }
 
+// Wake anyone waiting on cvWorkChange (long-polling miners) after the best
+// chain or the memory pool has changed
+static void NotifyWorkChanged()
+{
+    {
+        boost::lock_guard<CWaitableCriticalSection> lock(csWorkChange);
+    }
+    cvWorkChange.notify_all();
+}
+
 bool CTxMemPool::addUnchecked(const uint256& hash, CTransaction &tx)
 {
     {
@@ -537,6 +562,7 @@ bool CTxMemPool::addUnchecked(const uint256& hash, CTransaction &tx)
             mapNextTx[tx.vin[i].prevout] = CInPoint(&mapTx[hash], i);
         nTransactionsUpdated++;
     }
+    NotifyWorkChanged();
     return true;
 }
 
@@ -711,6 +737,36 @@ bool CBlock::ReadFromDisk(const CBlockIndex* pindex, bool fReadTransactions)
     return true;
 }
 
+// The block's bytes as they are on disk, which is also how they go over the
+// wire, for the callers that look at it through a CBlockView or pass it on
+bool ReadRawBlockFromDisk(const CBlockIndex* pindex, vector<unsigned char>& vchBlockRet)
+{
+    vchBlockRet.clear();
+    // The size is written just before the block
+    CAutoFile filein = CAutoFile(OpenBlockFile(pindex->nFile, pindex->nBlockPos - 4, "rb"), SER_DISK, CLIENT_VERSION);
+    if (!filein)
+        return error("ReadRawBlockFromDisk() : OpenBlockFile failed");
+    try {
+        unsigned int nSize;
+        filein >> nSize;
+        if (nSize < 80 || nSize > MAX_BLOCK_SIZE)
+            return error("ReadRawBlockFromDisk() : bad block size %u", nSize);
+        vchBlockRet.resize(nSize);
+        filein.read((char*)&vchBlockRet[0], nSize);
+
+        CBlockView block(&vchBlockRet[0], &vchBlockRet[0] + nSize);
+        if (block.GetHash() != pindex->GetBlockHash())
+            throw std::runtime_error("GetHash() doesn't match index");
+        if (!block.CheckLayout())
+            throw std::runtime_error("transactions don't fit the block");
+    }
+    catch (std::exception &e) {
+        vchBlockRet.clear();
+        return error("ReadRawBlockFromDisk() : %s", e.what());
+    }
+    return true;
+}
+
 uint256 static GetOrphanRoot(const CBlock* pblock)
 {
     while (mapOrphanBlocks.count(pblock->hashPrevBlock))
@@ -1054,6 +1110,13 @@ bool CTransaction::ConnectInputs(MapPrevTx inputs,
 
         }
         
+        // Every input's signature hash is over this same transaction, so
+        // serialize it once for all of them
+        bool fCheckSigs = !(fBlock && (nBestHeight < Checkpoints::GetTotalBlocksEstimate()));
+        auto_ptr<CSignatureHashContext> psighash;
+        if (fCheckSigs)
+            psighash.reset(new CSignatureHashContext(*this));
+
         for (unsigned int i = 0; i < vin.size(); i++)
         {
             COutPoint prevout = vin[i].prevout;
@@ -1066,11 +1129,11 @@ bool CTransaction::ConnectInputs(MapPrevTx inputs,
                 return fMiner ? false : error("ConnectInputs() : %s prev tx already used at %s", GetHash().ToString().substr(0,10).c_str(), txindex.vSpent[prevout.n].ToString().c_str());
 
        
-            if (!(fBlock && (nBestHeight < Checkpoints::GetTotalBlocksEstimate())))
+            if (fCheckSigs)
             {
-                if (!VerifySignature(txPrev, *this, i, fStrictPayToScriptHash, 0))
+                if (!VerifySignature(txPrev, *this, i, fStrictPayToScriptHash, 0, psighash.get()))
                 {
-                    if (fStrictPayToScriptHash && VerifySignature(txPrev, *this, i, false, 0))
+                    if (fStrictPayToScriptHash && VerifySignature(txPrev, *this, i, false, 0, psighash.get()))
                         return error("ConnectInputs() : %s P2SH VerifySignature failed", GetHash().ToString().substr(0,10).c_str());
 
                     return DoS(100,error("ConnectInputs() : %s VerifySignature failed", GetHash().ToString().substr(0,10).c_str()));
@@ -1108,6 +1171,7 @@ bool CTransaction::ClientConnectInputs()
     {
         LOCK(mempool.cs);
         int64 nValueIn = 0;
+        CSignatureHashContext ctx(*this);
         for (unsigned int i = 0; i < vin.size(); i++)
         {
             COutPoint prevout = vin[i].prevout;
@@ -1118,7 +1182,7 @@ bool CTransaction::ClientConnectInputs()
             if (prevout.n >= txPrev.vout.size())
                 return false;
 
-            if (!VerifySignature(txPrev, *this, i, true, 0))
+            if (!VerifySignature(txPrev, *this, i, true, 0, &ctx))
                 return error("ConnectInputs() : VerifySignature failed");
 
            
@@ -1151,6 +1215,8 @@ bool CBlock::DisconnectBlock(CTxDB& txdb, CBlockIndex* pindex)
             return error("DisconnectBlock() : WriteBlockIndex failed");
     }
 
+    DisconnectFromWallets(pindex->GetBlockHash());
+
     return true;
 }
 
@@ -1408,12 +1474,18 @@ bool CBlock::SetBestChain(CTxDB& txdb, CBlockIndex* pindexNew)
         ::SetBestChain(locator);
     }
 
-    hashBestChain = hash;
+    {
+        // Long-polling miners read it holding only csWorkChange
+        boost::lock_guard<CWaitableCriticalSection> lock(csWorkChange);
+        hashBestChain = hash;
+    }
     pindexBest = pindexNew;
     nBestHeight = pindexBest->nHeight;
     bnBestChainWork = pindexNew->bnChainWork;
     nTimeBestReceived = GetTime();
+    FileConnectedTxsInWallets();
     nTransactionsUpdated++;
+    NotifyWorkChanged();
     printf("SetBestChain: new best=%s  height=%d  work=%s  date=%s\n",
       hashBestChain.ToString().substr(0,20).c_str(), nBestHeight, bnBestChainWork.ToString().c_str(),
       DateTimeStrFormat("%x %H:%M:%S", pindexBest->GetBlockTime()).c_str());
@@ -1910,10 +1982,23 @@ bool LoadExternalBlockFile(FILE* fileIn)
                 fseek(blkdat, nPos, SEEK_SET);
                 unsigned int nSize;
                 blkdat >> nSize;
-                if (nSize > 0 && nSize <= MAX_BLOCK_SIZE)
+                // Too short for a header is skipped like any other bad
+                // record, CBlockView would throw and end the whole import
+                if (nSize >= 80 && nSize <= MAX_BLOCK_SIZE)
                 {
+                    vector<unsigned char> vchBlock(nSize);
+                    blkdat.read((char*)&vchBlock[0], nSize);
+                    // Blocks we already have are skipped by their header,
+                    // only new ones are deserialized
+                    CBlockView view(&vchBlock[0], &vchBlock[0] + nSize);
+                    uint256 hash = view.GetHash();
+                    if (mapBlockIndex.count(hash) || mapOrphanBlocks.count(hash))
+                    {
+                        nPos += 4 + nSize;
+                        continue;
+                    }
                     CBlock block;
-                    blkdat >> block;
+                    view.Get(block);
                     if (ProcessBlock(NULL,&block))
                     {
                         nLoaded++;
@@ -2325,9 +2410,10 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv)
                 map<uint256, CBlockIndex*>::iterator mi = mapBlockIndex.find(inv.hash);
                 if (mi != mapBlockIndex.end())
                 {
-                    CBlock block;
-                    block.ReadFromDisk((*mi).second);
-                    pfrom->PushMessage("block", block);
+                    // Sent as it is on disk, without deserializing it
+                    vector<unsigned char> vchBlock;
+                    if (ReadRawBlockFromDisk((*mi).second, vchBlock))
+                        pfrom->PushMessage("block", CFlatData(&vchBlock[0], &vchBlock[0] + vchBlock.size()));
 
                     if (inv.hash == pfrom->hashContinue)
                     {
@@ -2855,20 +2941,18 @@ static const unsigned int pSHA256InitState[8] =
 
 void SHA256Transform(void* pstate, void* pinput, const void* pinit)
 {
-    SHA256_CTX ctx;
+    uint32_t s[8];
     unsigned char data[64];
 
-    SHA256_Init(&ctx);
-
     for (int i = 0; i < 16; i++)
         ((uint32_t*)data)[i] = ByteReverse(((uint32_t*)pinput)[i]);
 
     for (int i = 0; i < 8; i++)
-        ctx.h[i] = ((uint32_t*)pinit)[i];
+        s[i] = ((uint32_t*)pinit)[i];
 
-    SHA256_Update(&ctx, data, sizeof(data));
+    SHA256Compress(s, data, 1);
     for (int i = 0; i < 8; i++)
-        ((uint32_t*)pstate)[i] = ctx.h[i];
+        ((uint32_t*)pstate)[i] = s[i];
 }
 
 
@@ -3058,6 +3142,7 @@ CBlock* CreateNewBlock(CReserveKey& reservekey)
 
     }
     pblock->vtx[0].vout[0].nValue = GetBlockValue(pindexPrev->nHeight+1, nFees);
+    pblock->vtx[0].InvalidateHash();
 
     pblock->hashPrevBlock  = pindexPrev->GetBlockHash();
     pblock->hashMerkleRoot = pblock->BuildMerkleTree();
@@ -3080,6 +3165,7 @@ void IncrementExtraNonce(CBlock* pblock, CBlockIndex* pindexPrev, unsigned int&
     ++nExtraNonce;
     pblock->vtx[0].vin[0].scriptSig = (CScript() << pblock->nTime << CBigNum(nExtraNonce)) + COINBASE_FLAGS;
     assert(pblock->vtx[0].vin[0].scriptSig.size() <= 100);
+    pblock->vtx[0].InvalidateHash();
 
     pblock->hashMerkleRoot = pblock->BuildMerkleTree();
 }
@@ -58,6 +58,8 @@ extern CBigNum bnBestInvalidWork;
 extern uint256 hashBestChain;
 extern CBlockIndex* pindexBest;
 extern unsigned int nTransactionsUpdated;
+extern CWaitableCriticalSection csWorkChange;
+extern CConditionVariable cvWorkChange;
 extern uint64 nLastBlockTx;
 extern uint64 nLastBlockSize;
 extern const std::string strMessageMagic;
@@ -84,6 +86,7 @@ bool ProcessBlock(CNode* pfrom, CBlock* pblock);
 bool CheckDiskSpace(uint64 nAdditionalBytes=0);
 FILE* OpenBlockFile(unsigned int nFile, unsigned int nBlockPos, const char* pszMode="rb");
 FILE* AppendBlockFile(unsigned int& nFileRet);
+bool ReadRawBlockFromDisk(const CBlockIndex* pindex, std::vector<unsigned char>& vchBlockRet);
 bool LoadBlockIndex(bool fAllowNew=true);
 void PrintBlockTree();
 bool ProcessMessages(CNode* pfrom);
@@ -161,6 +164,7 @@ public:
         printf("%s", ToString().c_str());
     }
 };
+SERIALIZE_FLAT(CDiskTxPos);
 
 
 
@@ -215,6 +219,7 @@ public:
         printf("%s\n", ToString().c_str());
     }
 };
+SERIALIZE_FLAT(COutPoint);
 
 
 
@@ -376,13 +381,20 @@ class CTransaction
 public:
     static const int CURRENT_VERSION=1;
     int nVersion;
-    std::vector<CTxIn> vin;
-    std::vector<CTxOut> vout;
+    // Read as part of a block these come out of the block's arena
+    std::vector<CTxIn, arena_allocator<CTxIn> > vin;
+    std::vector<CTxOut, arena_allocator<CTxOut> > vout;
     unsigned int nLockTime;
 
     mutable int nDoS;
     bool DoS(int nDoSIn, bool fIn) const { nDoS += nDoSIn; return fIn; }
 
+    // GetHash() remembers the hash until the transaction is cleared or read
+    // again.  Code that changes a transaction in place once it may have been
+    // hashed calls InvalidateHash().
+    mutable uint256 hashCached;
+    mutable bool fHashCached;
+
     CTransaction()
     {
         SetNull();
@@ -395,6 +407,8 @@ public:
         READWRITE(vin);
         READWRITE(vout);
         READWRITE(nLockTime);
+        if (fRead)
+            fHashCached = false;
     )
 
     void SetNull()
@@ -404,6 +418,12 @@ public:
         vout.clear();
         nLockTime = 0;
         nDoS = 0;  
+        fHashCached = false;
+    }
+
+    void InvalidateHash()
+    {
+        fHashCached = false;
     }
 
     bool IsNull() const
@@ -413,7 +433,14 @@ public:
 
     uint256 GetHash() const
     {
-        return SerializeHash(*this);
+        // Threads racing here all store the same hash.  The release store
+        // and acquire load keep a reader from seeing the flag before it.
+        if (!__atomic_load_n(&fHashCached, __ATOMIC_ACQUIRE))
+        {
+            hashCached = SerializeHash(*this);
+            __atomic_store_n(&fHashCached, true, __ATOMIC_RELEASE);
+        }
+        return hashCached;
     }
 
     bool IsFinal(int nBlockHeight=0, int64 nBlockTime=0) const
@@ -741,7 +768,9 @@ public:
     unsigned int nBits;
     unsigned int nNonce;
 
-    std::vector<CTransaction> vtx;
+    // One CAllocArena holds the transactions and their inputs and outputs
+    // of a block that was read, instead of thousands of small allocations
+    std::vector<CTransaction, arena_allocator<CTransaction> > vtx;
 
     mutable std::vector<uint256> vMerkleTree;
 
@@ -764,7 +793,7 @@ public:
         READWRITE(nNonce);
 
         if (!(nType & (SER_GETHASH|SER_BLOCKHEADERONLY)))
-            READWRITE(vtx);
+            READWRITE_ARENA(vtx, MAX_BLOCK_SIZE);
         else if (fRead)
             const_cast<CBlock*>(this)->vtx.clear();
     )
@@ -815,12 +844,14 @@ public:
         int j = 0;
         for (int nSize = vtx.size(); nSize > 1; nSize = (nSize + 1) / 2)
         {
-            for (int i = 0; i < nSize; i += 2)
-            {
-                int i2 = std::min(i+1, nSize-1);
-                vMerkleTree.push_back(Hash(BEGIN(vMerkleTree[j+i]),  END(vMerkleTree[j+i]),
-                                           BEGIN(vMerkleTree[j+i2]), END(vMerkleTree[j+i2])));
-            }
+            // Neighbouring hashes are already the 64-byte inputs of the next
+            // level, so the whole level goes through SHA256D64 in one call
+            int nPairs = nSize / 2;
+            vMerkleTree.resize(j + nSize + (nSize + 1) / 2);
+            SHA256D64(vMerkleTree[j+nSize].begin(), vMerkleTree[j].begin(), nPairs);
+            if (nSize & 1)
+                vMerkleTree[j+nSize+nPairs] = Hash(BEGIN(vMerkleTree[j+nSize-1]), END(vMerkleTree[j+nSize-1]),
+                                                   BEGIN(vMerkleTree[j+nSize-1]), END(vMerkleTree[j+nSize-1]));
             j += nSize;
         }
         return (vMerkleTree.empty() ? 0 : vMerkleTree.back());
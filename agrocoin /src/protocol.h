@@ -115,5 +115,6 @@ class CInv
         int type;
         uint256 hash;
 };
+SERIALIZE_FLAT(CInv);
 
 #endif 
@@ -59,8 +59,13 @@ Value importprivkey(const Array& params, bool fHelp)
 
         if (!pwalletMain->AddKey(key))
             throw JSONRPCError(-4,"Error adding key to wallet");
+    }
 
-        pwalletMain->ScanForWalletTransactions(pindexGenesisBlock, true);
+    // The rescan locks the wallet a batch of blocks at a time, so the rest
+    // of the wallet stays usable while it runs
+    pwalletMain->ScanForWalletTransactions(pindexGenesisBlock, true);
+    {
+        LOCK(cs_main);
         pwalletMain->ReacceptWalletTransactions();
     }
 
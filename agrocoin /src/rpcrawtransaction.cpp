@@ -268,29 +268,74 @@ Value decoderawtransaction(const Array& params, bool fHelp)
     return result;
 }
 
-Value signrawtransaction(const Array& params, bool fHelp)
+// Previous outputs given to signrawtransaction(s) by the caller
+static void ParsePrevOuts(const Array& prevTxs, map<COutPoint, CScript>& mapPrevOut)
 {
-    if (fHelp || params.size() < 1 || params.size() > 4)
-        throw runtime_error(
-            "signrawtransaction <hex string> [{\"txid\":txid,\"vout\":n,\"scriptPubKey\":hex},...] [<privatekey1>,...] [sighashtype=\"ALL\"]\n"
-            "Sign inputs for raw transaction (serialized, hex-encoded).\n"
-            "Second optional argument is an array of previous transaction outputs that\n"
-            "this transaction depends on but may not yet be in the blockchain.\n"
-            "Third optional argument is an array of base58-encoded private\n"
-            "keys that, if given, will be the only keys used to sign the transaction.\n"
-            "Fourth option is a string that is one of six values; ALL, NONE, SINGLE or\n"
-            "ALL|ANYONECANPAY, NONE|ANYONECANPAY, SINGLE|ANYONECANPAY.\n"
-            "Returns json object with keys:\n"
-            "  hex : raw transaction with signature(s) (hex-encoded string)\n"
-            "  complete : 1 if transaction has a complete set of signature (0 if not)"
-            + HelpRequiringPassphrase());
+    BOOST_FOREACH(const Value& p, prevTxs)
+    {
+        if (p.type() != obj_type)
+            throw JSONRPCError(-22, "expected object with {\"txid'\",\"vout\",\"scriptPubKey\"}");
 
-    if (params.size() < 3)
-        EnsureWalletIsUnlocked();
+        Object prevOut = p.get_obj();
 
-    RPCTypeCheck(params, list_of(str_type)(array_type)(array_type));
+        RPCTypeCheck(prevOut, map_list_of("txid", str_type)("vout", int_type)("scriptPubKey", str_type));
 
-    vector<unsigned char> txData(ParseHex(params[0].get_str()));
+        string txidHex = find_value(prevOut, "txid").get_str();
+        if (!IsHex(txidHex))
+            throw JSONRPCError(-22, "txid must be hexadecimal");
+        uint256 txid;
+        txid.SetHex(txidHex);
+
+        int nOut = find_value(prevOut, "vout").get_int();
+        if (nOut < 0)
+            throw JSONRPCError(-22, "vout must be positive");
+
+        string pkHex = find_value(prevOut, "scriptPubKey").get_str();
+        if (!IsHex(pkHex))
+            throw JSONRPCError(-22, "scriptPubKey must be hexadecimal");
+        vector<unsigned char> pkData(ParseHex(pkHex));
+        mapPrevOut[COutPoint(txid, nOut)] = CScript(pkData.begin(), pkData.end());
+    }
+}
+
+static void ParsePrivKeys(const Array& keys, CBasicKeyStore& keystore)
+{
+    BOOST_FOREACH(const Value& k, keys)
+    {
+        CBitcoinSecret vchSecret;
+        bool fGood = vchSecret.SetString(k.get_str());
+        if (!fGood)
+            throw JSONRPCError(-5,"Invalid private key");
+        CKey key;
+        bool fCompressed;
+        CSecret secret = vchSecret.GetSecret(fCompressed);
+        key.SetSecret(secret, fCompressed);
+        keystore.AddKey(key);
+    }
+}
+
+static int ParseSigHashType(const string& strHashType)
+{
+    static map<string, int> mapSigHashValues =
+        boost::assign::map_list_of
+        (string("ALL"), int(SIGHASH_ALL))
+        (string("ALL|ANYONECANPAY"), int(SIGHASH_ALL|SIGHASH_ANYONECANPAY))
+        (string("NONE"), int(SIGHASH_NONE))
+        (string("NONE|ANYONECANPAY"), int(SIGHASH_NONE|SIGHASH_ANYONECANPAY))
+        (string("SINGLE"), int(SIGHASH_SINGLE))
+        (string("SINGLE|ANYONECANPAY"), int(SIGHASH_SINGLE|SIGHASH_ANYONECANPAY))
+        ;
+    if (!mapSigHashValues.count(strHashType))
+        throw JSONRPCError(-8, "Invalid sighash param");
+    return mapSigHashValues[strHashType];
+}
+
+// Signs one hex-encoded transaction, or several variants of it one after the
+// other whose signatures are merged.  Outputs of the signed transaction are
+// added to mapGivenPrevOut, so a later transaction in a batch can spend them.
+static Object SignRawTransaction(const string& strHex, map<COutPoint, CScript>& mapGivenPrevOut, const CKeyStore& keystore, int nHashType)
+{
+    vector<unsigned char> txData(ParseHex(strHex));
     CDataStream ssData(txData, SER_NETWORK, PROTOCOL_VERSION);
     vector<CTransaction> txVariants;
     while (!ssData.empty())
@@ -328,118 +373,135 @@ Value signrawtransaction(const Array& params, bool fHelp)
         }
     }
 
-    if (params.size() > 1)
+    for (map<COutPoint, CScript>::const_iterator it = mapGivenPrevOut.begin(); it != mapGivenPrevOut.end(); ++it)
     {
-        Array prevTxs = params[1].get_array();
-        BOOST_FOREACH(Value& p, prevTxs)
+        const COutPoint& outpoint = (*it).first;
+        const CScript& scriptPubKey = (*it).second;
+        if (mapPrevOut.count(outpoint))
         {
-            if (p.type() != obj_type)
-                throw JSONRPCError(-22, "expected object with {\"txid'\",\"vout\",\"scriptPubKey\"}");
+            if (mapPrevOut[outpoint] != scriptPubKey)
+            {
+                string err("Previous output scriptPubKey mismatch:\n");
+                err = err + mapPrevOut[outpoint].ToString() + "\nvs:\n"+
+                    scriptPubKey.ToString();
+                throw JSONRPCError(-22, err);
+            }
+        }
+        else
+            mapPrevOut[outpoint] = scriptPubKey;
+    }
+
+    // All inputs are signed together, across cores
+    vector<const CScript*> vpFromPubKeys(mergedTx.vin.size(), (const CScript*)NULL);
+    for (unsigned int i = 0; i < mergedTx.vin.size(); i++)
+    {
+        map<COutPoint, CScript>::const_iterator mi = mapPrevOut.find(mergedTx.vin[i].prevout);
+        if (mi == mapPrevOut.end())
+        {
+            fComplete = false;
+            continue;
+        }
+        vpFromPubKeys[i] = &(*mi).second;
+    }
+    if (!SignSignatures(keystore, vpFromPubKeys, mergedTx, nHashType, &txVariants))
+        fComplete = false;
 
-            Object prevOut = p.get_obj();
+    uint256 hashTx = mergedTx.GetHash();
+    for (unsigned int i = 0; i < mergedTx.vout.size(); i++)
+        mapGivenPrevOut[COutPoint(hashTx, i)] = mergedTx.vout[i].scriptPubKey;
 
-            RPCTypeCheck(prevOut, map_list_of("txid", str_type)("vout", int_type)("scriptPubKey", str_type));
+    Object result;
+    CDataStream ssTx(SER_NETWORK, PROTOCOL_VERSION);
+    ssTx << mergedTx;
+    result.push_back(Pair("hex", HexStr(ssTx.begin(), ssTx.end())));
+    result.push_back(Pair("complete", fComplete));
 
-            string txidHex = find_value(prevOut, "txid").get_str();
-            if (!IsHex(txidHex))
-                throw JSONRPCError(-22, "txid must be hexadecimal");
-            uint256 txid;
-            txid.SetHex(txidHex);
+    return result;
+}
+
+Value signrawtransaction(const Array& params, bool fHelp)
+{
+    if (fHelp || params.size() < 1 || params.size() > 4)
+        throw runtime_error(
+            "signrawtransaction <hex string> [{\"txid\":txid,\"vout\":n,\"scriptPubKey\":hex},...] [<privatekey1>,...] [sighashtype=\"ALL\"]\n"
+            "Sign inputs for raw transaction (serialized, hex-encoded).\n"
+            "Second optional argument is an array of previous transaction outputs that\n"
+            "this transaction depends on but may not yet be in the blockchain.\n"
+            "Third optional argument is an array of base58-encoded private\n"
+            "keys that, if given, will be the only keys used to sign the transaction.\n"
+            "Fourth option is a string that is one of six values; ALL, NONE, SINGLE or\n"
+            "ALL|ANYONECANPAY, NONE|ANYONECANPAY, SINGLE|ANYONECANPAY.\n"
+            "Returns json object with keys:\n"
+            "  hex : raw transaction with signature(s) (hex-encoded string)\n"
+            "  complete : 1 if transaction has a complete set of signature (0 if not)"
+            + HelpRequiringPassphrase());
 
-            int nOut = find_value(prevOut, "vout").get_int();
-            if (nOut < 0)
-                throw JSONRPCError(-22, "vout must be positive");
+    if (params.size() < 3)
+        EnsureWalletIsUnlocked();
 
-            string pkHex = find_value(prevOut, "scriptPubKey").get_str();
-            if (!IsHex(pkHex))
-                throw JSONRPCError(-22, "scriptPubKey must be hexadecimal");
-            vector<unsigned char> pkData(ParseHex(pkHex));
-            CScript scriptPubKey(pkData.begin(), pkData.end());
+    RPCTypeCheck(params, list_of(str_type)(array_type)(array_type));
 
-            COutPoint outpoint(txid, nOut);
-            if (mapPrevOut.count(outpoint))
-            {
-                if (mapPrevOut[outpoint] != scriptPubKey)
-                {
-                    string err("Previous output scriptPubKey mismatch:\n");
-                    err = err + mapPrevOut[outpoint].ToString() + "\nvs:\n"+
-                        scriptPubKey.ToString();
-                    throw JSONRPCError(-22, err);
-                }
-            }
-            else
-                mapPrevOut[outpoint] = scriptPubKey;
-        }
-    }
+    map<COutPoint, CScript> mapGivenPrevOut;
+    if (params.size() > 1)
+        ParsePrevOuts(params[1].get_array(), mapGivenPrevOut);
 
     bool fGivenKeys = false;
     CBasicKeyStore tempKeystore;
     if (params.size() > 2)
     {
         fGivenKeys = true;
-        Array keys = params[2].get_array();
-        BOOST_FOREACH(Value k, keys)
-        {
-            CBitcoinSecret vchSecret;
-            bool fGood = vchSecret.SetString(k.get_str());
-            if (!fGood)
-                throw JSONRPCError(-5,"Invalid private key");
-            CKey key;
-            bool fCompressed;
-            CSecret secret = vchSecret.GetSecret(fCompressed);
-            key.SetSecret(secret, fCompressed);
-            tempKeystore.AddKey(key);
-        }
+        ParsePrivKeys(params[2].get_array(), tempKeystore);
     }
     const CKeyStore& keystore = (fGivenKeys ? tempKeystore : *pwalletMain);
 
     int nHashType = SIGHASH_ALL;
     if (params.size() > 3)
-    {
-        static map<string, int> mapSigHashValues =
-            boost::assign::map_list_of
-            (string("ALL"), int(SIGHASH_ALL))
-            (string("ALL|ANYONECANPAY"), int(SIGHASH_ALL|SIGHASH_ANYONECANPAY))
-            (string("NONE"), int(SIGHASH_NONE))
-            (string("NONE|ANYONECANPAY"), int(SIGHASH_NONE|SIGHASH_ANYONECANPAY))
-            (string("SINGLE"), int(SIGHASH_SINGLE))
-            (string("SINGLE|ANYONECANPAY"), int(SIGHASH_SINGLE|SIGHASH_ANYONECANPAY))
-            ;
-        string strHashType = params[3].get_str();
-        if (mapSigHashValues.count(strHashType))
-            nHashType = mapSigHashValues[strHashType];
-        else
-            throw JSONRPCError(-8, "Invalid sighash param");
-    }
+        nHashType = ParseSigHashType(params[3].get_str());
 
-    for (unsigned int i = 0; i < mergedTx.vin.size(); i++)
-    {
-        CTxIn& txin = mergedTx.vin[i];
-        if (mapPrevOut.count(txin.prevout) == 0)
-        {
-            fComplete = false;
-            continue;
-        }
-        const CScript& prevPubKey = mapPrevOut[txin.prevout];
+    return SignRawTransaction(params[0].get_str(), mapGivenPrevOut, keystore, nHashType);
+}
 
-        txin.scriptSig.clear();
-        SignSignature(keystore, prevPubKey, mergedTx, i, nHashType);
+Value signrawtransactions(const Array& params, bool fHelp)
+{
+    if (fHelp || params.size() < 1 || params.size() > 4)
+        throw runtime_error(
+            "signrawtransactions [<hex string>,...] [{\"txid\":txid,\"vout\":n,\"scriptPubKey\":hex},...] [<privatekey1>,...] [sighashtype=\"ALL\"]\n"
+            "Sign a batch of raw transactions in one call, taking the same arguments\n"
+            "as signrawtransaction for all of them.  Outputs of each transaction can be\n"
+            "spent by the transactions after it in the batch.\n"
+            "Returns an array of json objects with keys hex and complete, in order."
+            + HelpRequiringPassphrase());
 
-        BOOST_FOREACH(const CTransaction& txv, txVariants)
-        {
-            txin.scriptSig = CombineSignatures(prevPubKey, mergedTx, i, txin.scriptSig, txv.vin[i].scriptSig);
-        }
-        if (!VerifyScript(txin.scriptSig, prevPubKey, mergedTx, i, true, 0))
-            fComplete = false;
+    if (params.size() < 3)
+        EnsureWalletIsUnlocked();
+
+    RPCTypeCheck(params, list_of(array_type)(array_type)(array_type));
+
+    map<COutPoint, CScript> mapGivenPrevOut;
+    if (params.size() > 1)
+        ParsePrevOuts(params[1].get_array(), mapGivenPrevOut);
+
+    bool fGivenKeys = false;
+    CBasicKeyStore tempKeystore;
+    if (params.size() > 2)
+    {
+        fGivenKeys = true;
+        ParsePrivKeys(params[2].get_array(), tempKeystore);
     }
+    const CKeyStore& keystore = (fGivenKeys ? tempKeystore : *pwalletMain);
 
-    Object result;
-    CDataStream ssTx(SER_NETWORK, PROTOCOL_VERSION);
-    ssTx << mergedTx;
-    result.push_back(Pair("hex", HexStr(ssTx.begin(), ssTx.end())));
-    result.push_back(Pair("complete", fComplete));
+    int nHashType = SIGHASH_ALL;
+    if (params.size() > 3)
+        nHashType = ParseSigHashType(params[3].get_str());
 
-    return result;
+    Array ret;
+    BOOST_FOREACH(const Value& hex, params[0].get_array())
+    {
+        if (hex.type() != str_type)
+            throw JSONRPCError(-22, "expected an array of hex strings");
+        ret.push_back(SignRawTransaction(hex.get_str(), mapGivenPrevOut, keystore, nHashType));
+    }
+    return ret;
 }
 
 Value sendrawtransaction(const Array& params, bool fHelp)
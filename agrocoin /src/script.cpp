@@ -1,4 +1,6 @@
+#include <boost/bind.hpp>
 #include <boost/foreach.hpp>
+#include <boost/thread.hpp>
 #include <boost/tuple/tuple.hpp>
 
 using namespace std;
@@ -12,29 +14,19 @@ using namespace boost;
 #include "sync.h"
 #include "util.h"
 
-bool CheckSig(vector<unsigned char> vchSig, vector<unsigned char> vchPubKey, CScript scriptCode, const CTransaction& txTo, unsigned int nIn, int nHashType);
+bool CheckSig(vector<unsigned char> vchSig, vector<unsigned char> vchPubKey, CScript scriptCode, const CTransaction& txTo, unsigned int nIn, int nHashType,
+              const CSignatureHashContext* psighash=NULL);
 
 
 
 typedef vector<unsigned char> valtype;
-static const valtype vchFalse(0);
-static const valtype vchZero(0);
-static const valtype vchTrue(1, 1);
-static const CBigNum bnZero(0);
-static const CBigNum bnOne(1);
-static const CBigNum bnFalse(0);
-static const CBigNum bnTrue(1);
-static const size_t nMaxNumSize = 4;
+static const CScriptValue vchFalse;
+static const CScriptValue vchTrue(1, 1);
+static const CScriptNum bnZero(0);
+static const CScriptNum bnOne(1);
 
 
-CBigNum CastToBigNum(const valtype& vch)
-{
-    if (vch.size() > nMaxNumSize)
-        throw runtime_error("CastToBigNum() : overflow");
-    return CBigNum(CBigNum(vch).getvch());
-}
-
-bool CastToBool(const valtype& vch)
+bool CastToBool(const CScriptValue& vch)
 {
     for (unsigned int i = 0; i < vch.size(); i++)
     {
@@ -48,7 +40,7 @@ bool CastToBool(const valtype& vch)
     return false;
 }
 
-void MakeSameSize(valtype& vch1, valtype& vch2)
+void MakeSameSize(CScriptValue& vch1, CScriptValue& vch2)
 {
     if (vch1.size() < vch2.size())
         vch1.resize(vch2.size(), 0);
@@ -61,7 +53,7 @@ void MakeSameSize(valtype& vch1, valtype& vch2)
 
 #define stacktop(i)  (stack.at(stack.size()+(i)))
 #define altstacktop(i)  (altstack.at(altstack.size()+(i)))
-static inline void popstack(vector<valtype>& stack)
+static inline void popstack(CScriptStack& stack)
 {
     if (stack.empty())
         throw runtime_error("popstack() : stack empty");
@@ -212,14 +204,33 @@ const char* GetOpName(opcodetype opcode)
 
 bool EvalScript(vector<vector<unsigned char> >& stack, const CScript& script, const CTransaction& txTo, unsigned int nIn, int nHashType)
 {
-    CAutoBN_CTX pctx;
+    return EvalScript(stack, script, txTo, nIn, nHashType, NULL);
+}
+
+bool EvalScript(vector<vector<unsigned char> >& stack, const CScript& script, const CTransaction& txTo, unsigned int nIn, int nHashType,
+                const CSignatureHashContext* psighash)
+{
+    CScriptStack stackValues;
+    stackValues.reserve(stack.size());
+    BOOST_FOREACH(const valtype& vch, stack)
+        stackValues.push_back(CScriptValue(vch));
+    bool fResult = EvalScript(stackValues, script, txTo, nIn, nHashType, psighash);
+    stack.clear();
+    BOOST_FOREACH(const CScriptValue& vch, stackValues)
+        stack.push_back(vch.getvch());
+    return fResult;
+}
+
+bool EvalScript(CScriptStack& stack, const CScript& script, const CTransaction& txTo, unsigned int nIn, int nHashType,
+                const CSignatureHashContext* psighash)
+{
     CScript::const_iterator pc = script.begin();
     CScript::const_iterator pend = script.end();
     CScript::const_iterator pbegincodehash = script.begin();
     opcodetype opcode;
     valtype vchPushValue;
     vector<bool> vfExec;
-    vector<valtype> altstack;
+    CScriptStack altstack;
     if (script.size() > 10000)
         return false;
     int nOpCount = 0;
@@ -256,7 +267,7 @@ bool EvalScript(vector<vector<unsigned char> >& stack, const CScript& script, co
                 return false;
 
             if (fExec && 0 <= opcode && opcode <= OP_PUSHDATA4)
-                stack.push_back(vchPushValue);
+                stack.push_back(vchPushValue.empty() ? vchFalse : CScriptValue(&vchPushValue[0], &vchPushValue[0] + vchPushValue.size()));
             else if (fExec || (OP_IF <= opcode && opcode <= OP_ENDIF))
             switch (opcode)
             {
@@ -279,7 +290,7 @@ bool EvalScript(vector<vector<unsigned char> >& stack, const CScript& script, co
                 case OP_15:
                 case OP_16:
                 {
-                    CBigNum bn((int)opcode - (int)(OP_1 - 1));
+                    CScriptNum bn((int)opcode - (int)(OP_1 - 1));
                     stack.push_back(bn.getvch());
                 }
                 break;
@@ -299,7 +310,7 @@ bool EvalScript(vector<vector<unsigned char> >& stack, const CScript& script, co
                     {
                         if (stack.size() < 1)
                             return false;
-                        valtype& vch = stacktop(-1);
+                        CScriptValue& vch = stacktop(-1);
                         fValue = CastToBool(vch);
                         if (opcode == OP_NOTIF)
                             fValue = !fValue;
@@ -375,8 +386,8 @@ bool EvalScript(vector<vector<unsigned char> >& stack, const CScript& script, co
                 {
                     if (stack.size() < 2)
                         return false;
-                    valtype vch1 = stacktop(-2);
-                    valtype vch2 = stacktop(-1);
+                    CScriptValue vch1 = stacktop(-2);
+                    CScriptValue vch2 = stacktop(-1);
                     stack.push_back(vch1);
                     stack.push_back(vch2);
                 }
@@ -386,9 +397,9 @@ bool EvalScript(vector<vector<unsigned char> >& stack, const CScript& script, co
                 {
                     if (stack.size() < 3)
                         return false;
-                    valtype vch1 = stacktop(-3);
-                    valtype vch2 = stacktop(-2);
-                    valtype vch3 = stacktop(-1);
+                    CScriptValue vch1 = stacktop(-3);
+                    CScriptValue vch2 = stacktop(-2);
+                    CScriptValue vch3 = stacktop(-1);
                     stack.push_back(vch1);
                     stack.push_back(vch2);
                     stack.push_back(vch3);
@@ -399,8 +410,8 @@ bool EvalScript(vector<vector<unsigned char> >& stack, const CScript& script, co
                 {
                     if (stack.size() < 4)
                         return false;
-                    valtype vch1 = stacktop(-4);
-                    valtype vch2 = stacktop(-3);
+                    CScriptValue vch1 = stacktop(-4);
+                    CScriptValue vch2 = stacktop(-3);
                     stack.push_back(vch1);
                     stack.push_back(vch2);
                 }
@@ -410,8 +421,8 @@ bool EvalScript(vector<vector<unsigned char> >& stack, const CScript& script, co
                 {
                     if (stack.size() < 6)
                         return false;
-                    valtype vch1 = stacktop(-6);
-                    valtype vch2 = stacktop(-5);
+                    CScriptValue vch1 = stacktop(-6);
+                    CScriptValue vch2 = stacktop(-5);
                     stack.erase(stack.end()-6, stack.end()-4);
                     stack.push_back(vch1);
                     stack.push_back(vch2);
@@ -431,7 +442,7 @@ bool EvalScript(vector<vector<unsigned char> >& stack, const CScript& script, co
                 {
                     if (stack.size() < 1)
                         return false;
-                    valtype vch = stacktop(-1);
+                    CScriptValue vch = stacktop(-1);
                     if (CastToBool(vch))
                         stack.push_back(vch);
                 }
@@ -439,7 +450,7 @@ bool EvalScript(vector<vector<unsigned char> >& stack, const CScript& script, co
 
                 case OP_DEPTH:
                 {
-                    CBigNum bn(stack.size());
+                    CScriptNum bn(stack.size());
                     stack.push_back(bn.getvch());
                 }
                 break;
@@ -456,7 +467,7 @@ bool EvalScript(vector<vector<unsigned char> >& stack, const CScript& script, co
                 {
                     if (stack.size() < 1)
                         return false;
-                    valtype vch = stacktop(-1);
+                    CScriptValue vch = stacktop(-1);
                     stack.push_back(vch);
                 }
                 break;
@@ -473,7 +484,7 @@ bool EvalScript(vector<vector<unsigned char> >& stack, const CScript& script, co
                 {
                     if (stack.size() < 2)
                         return false;
-                    valtype vch = stacktop(-2);
+                    CScriptValue vch = stacktop(-2);
                     stack.push_back(vch);
                 }
                 break;
@@ -483,11 +494,11 @@ bool EvalScript(vector<vector<unsigned char> >& stack, const CScript& script, co
                 {
                     if (stack.size() < 2)
                         return false;
-                    int n = CastToBigNum(stacktop(-1)).getint();
+                    int n = CScriptNum(stacktop(-1)).getint();
                     popstack(stack);
                     if (n < 0 || n >= (int)stack.size())
                         return false;
-                    valtype vch = stacktop(-n-1);
+                    CScriptValue vch = stacktop(-n-1);
                     if (opcode == OP_ROLL)
                         stack.erase(stack.end()-n-1);
                     stack.push_back(vch);
@@ -515,7 +526,7 @@ bool EvalScript(vector<vector<unsigned char> >& stack, const CScript& script, co
                 {
                     if (stack.size() < 2)
                         return false;
-                    valtype vch = stacktop(-1);
+                    CScriptValue vch = stacktop(-1);
                     stack.insert(stack.end()-2, vch);
                 }
                 break;
@@ -526,8 +537,8 @@ bool EvalScript(vector<vector<unsigned char> >& stack, const CScript& script, co
                 {
                     if (stack.size() < 2)
                         return false;
-                    valtype& vch1 = stacktop(-2);
-                    valtype& vch2 = stacktop(-1);
+                    CScriptValue& vch1 = stacktop(-2);
+                    CScriptValue& vch2 = stacktop(-1);
                     vch1.insert(vch1.end(), vch2.begin(), vch2.end());
                     popstack(stack);
                     if (stacktop(-1).size() > 520)
@@ -539,9 +550,9 @@ bool EvalScript(vector<vector<unsigned char> >& stack, const CScript& script, co
                 {
                     if (stack.size() < 3)
                         return false;
-                    valtype& vch = stacktop(-3);
-                    int nBegin = CastToBigNum(stacktop(-2)).getint();
-                    int nEnd = nBegin + CastToBigNum(stacktop(-1)).getint();
+                    CScriptValue& vch = stacktop(-3);
+                    int nBegin = CScriptNum(stacktop(-2)).getint();
+                    int nEnd = nBegin + CScriptNum(stacktop(-1)).getint();
                     if (nBegin < 0 || nEnd < nBegin)
                         return false;
                     if (nBegin > (int)vch.size())
@@ -560,8 +571,8 @@ bool EvalScript(vector<vector<unsigned char> >& stack, const CScript& script, co
                 {
                     if (stack.size() < 2)
                         return false;
-                    valtype& vch = stacktop(-2);
-                    int nSize = CastToBigNum(stacktop(-1)).getint();
+                    CScriptValue& vch = stacktop(-2);
+                    int nSize = CScriptNum(stacktop(-1)).getint();
                     if (nSize < 0)
                         return false;
                     if (nSize > (int)vch.size())
@@ -578,7 +589,7 @@ bool EvalScript(vector<vector<unsigned char> >& stack, const CScript& script, co
                 {
                     if (stack.size() < 1)
                         return false;
-                    CBigNum bn(stacktop(-1).size());
+                    CScriptNum bn(stacktop(-1).size());
                     stack.push_back(bn.getvch());
                 }
                 break;
@@ -588,7 +599,7 @@ bool EvalScript(vector<vector<unsigned char> >& stack, const CScript& script, co
                 {
                     if (stack.size() < 1)
                         return false;
-                    valtype& vch = stacktop(-1);
+                    CScriptValue& vch = stacktop(-1);
                     for (unsigned int i = 0; i < vch.size(); i++)
                         vch[i] = ~vch[i];
                 }
@@ -600,8 +611,8 @@ bool EvalScript(vector<vector<unsigned char> >& stack, const CScript& script, co
                 {
                     if (stack.size() < 2)
                         return false;
-                    valtype& vch1 = stacktop(-2);
-                    valtype& vch2 = stacktop(-1);
+                    CScriptValue& vch1 = stacktop(-2);
+                    CScriptValue& vch2 = stacktop(-1);
                     MakeSameSize(vch1, vch2);
                     if (opcode == OP_AND)
                     {
@@ -627,8 +638,8 @@ bool EvalScript(vector<vector<unsigned char> >& stack, const CScript& script, co
                 {
                     if (stack.size() < 2)
                         return false;
-                    valtype& vch1 = stacktop(-2);
-                    valtype& vch2 = stacktop(-1);
+                    CScriptValue& vch1 = stacktop(-2);
+                    CScriptValue& vch2 = stacktop(-1);
                     bool fEqual = (vch1 == vch2);
                     popstack(stack);
                     popstack(stack);
@@ -645,8 +656,6 @@ bool EvalScript(vector<vector<unsigned char> >& stack, const CScript& script, co
 
                 case OP_1ADD:
                 case OP_1SUB:
-                case OP_2MUL:
-                case OP_2DIV:
                 case OP_NEGATE:
                 case OP_ABS:
                 case OP_NOT:
@@ -654,17 +663,15 @@ bool EvalScript(vector<vector<unsigned char> >& stack, const CScript& script, co
                 {
                     if (stack.size() < 1)
                         return false;
-                    CBigNum bn = CastToBigNum(stacktop(-1));
+                    CScriptNum bn(stacktop(-1));
                     switch (opcode)
                     {
                     case OP_1ADD:       bn += bnOne; break;
                     case OP_1SUB:       bn -= bnOne; break;
-                    case OP_2MUL:       bn <<= 1; break;
-                    case OP_2DIV:       bn >>= 1; break;
                     case OP_NEGATE:     bn = -bn; break;
                     case OP_ABS:        if (bn < bnZero) bn = -bn; break;
-                    case OP_NOT:        bn = (bn == bnZero); break;
-                    case OP_0NOTEQUAL:  bn = (bn != bnZero); break;
+                    case OP_NOT:        bn = CScriptNum(bn == bnZero); break;
+                    case OP_0NOTEQUAL:  bn = CScriptNum(bn != bnZero); break;
                     default:            assert(!"invalid opcode"); break;
                     }
                     popstack(stack);
@@ -674,11 +681,6 @@ bool EvalScript(vector<vector<unsigned char> >& stack, const CScript& script, co
 
                 case OP_ADD:
                 case OP_SUB:
-                case OP_MUL:
-                case OP_DIV:
-                case OP_MOD:
-                case OP_LSHIFT:
-                case OP_RSHIFT:
                 case OP_BOOLAND:
                 case OP_BOOLOR:
                 case OP_NUMEQUAL:
@@ -693,9 +695,9 @@ bool EvalScript(vector<vector<unsigned char> >& stack, const CScript& script, co
                 {
                     if (stack.size() < 2)
                         return false;
-                    CBigNum bn1 = CastToBigNum(stacktop(-2));
-                    CBigNum bn2 = CastToBigNum(stacktop(-1));
-                    CBigNum bn;
+                    CScriptNum bn1(stacktop(-2));
+                    CScriptNum bn2(stacktop(-1));
+                    CScriptNum bn(0);
                     switch (opcode)
                     {
                     case OP_ADD:
@@ -706,42 +708,15 @@ bool EvalScript(vector<vector<unsigned char> >& stack, const CScript& script, co
                         bn = bn1 - bn2;
                         break;
 
-                    case OP_MUL:
-                        if (!BN_mul(&bn, &bn1, &bn2, pctx))
-                            return false;
-                        break;
-
-                    case OP_DIV:
-                        if (!BN_div(&bn, NULL, &bn1, &bn2, pctx))
-                            return false;
-                        break;
-
-                    case OP_MOD:
-                        if (!BN_mod(&bn, &bn1, &bn2, pctx))
-                            return false;
-                        break;
-
-                    case OP_LSHIFT:
-                        if (bn2 < bnZero || bn2 > CBigNum(2048))
-                            return false;
-                        bn = bn1 << bn2.getulong();
-                        break;
-
-                    case OP_RSHIFT:
-                        if (bn2 < bnZero || bn2 > CBigNum(2048))
-                            return false;
-                        bn = bn1 >> bn2.getulong();
-                        break;
-
-                    case OP_BOOLAND:             bn = (bn1 != bnZero && bn2 != bnZero); break;
-                    case OP_BOOLOR:              bn = (bn1 != bnZero || bn2 != bnZero); break;
-                    case OP_NUMEQUAL:            bn = (bn1 == bn2); break;
-                    case OP_NUMEQUALVERIFY:      bn = (bn1 == bn2); break;
-                    case OP_NUMNOTEQUAL:         bn = (bn1 != bn2); break;
-                    case OP_LESSTHAN:            bn = (bn1 < bn2); break;
-                    case OP_GREATERTHAN:         bn = (bn1 > bn2); break;
-                    case OP_LESSTHANOREQUAL:     bn = (bn1 <= bn2); break;
-                    case OP_GREATERTHANOREQUAL:  bn = (bn1 >= bn2); break;
+                    case OP_BOOLAND:             bn = CScriptNum(bn1 != bnZero && bn2 != bnZero); break;
+                    case OP_BOOLOR:              bn = CScriptNum(bn1 != bnZero || bn2 != bnZero); break;
+                    case OP_NUMEQUAL:            bn = CScriptNum(bn1 == bn2); break;
+                    case OP_NUMEQUALVERIFY:      bn = CScriptNum(bn1 == bn2); break;
+                    case OP_NUMNOTEQUAL:         bn = CScriptNum(bn1 != bn2); break;
+                    case OP_LESSTHAN:            bn = CScriptNum(bn1 < bn2); break;
+                    case OP_GREATERTHAN:         bn = CScriptNum(bn1 > bn2); break;
+                    case OP_LESSTHANOREQUAL:     bn = CScriptNum(bn1 <= bn2); break;
+                    case OP_GREATERTHANOREQUAL:  bn = CScriptNum(bn1 >= bn2); break;
                     case OP_MIN:                 bn = (bn1 < bn2 ? bn1 : bn2); break;
                     case OP_MAX:                 bn = (bn1 > bn2 ? bn1 : bn2); break;
                     default:                     assert(!"invalid opcode"); break;
@@ -764,9 +739,9 @@ bool EvalScript(vector<vector<unsigned char> >& stack, const CScript& script, co
                 {
                     if (stack.size() < 3)
                         return false;
-                    CBigNum bn1 = CastToBigNum(stacktop(-3));
-                    CBigNum bn2 = CastToBigNum(stacktop(-2));
-                    CBigNum bn3 = CastToBigNum(stacktop(-1));
+                    CScriptNum bn1(stacktop(-3));
+                    CScriptNum bn2(stacktop(-2));
+                    CScriptNum bn3(stacktop(-1));
                     bool fValue = (bn2 <= bn1 && bn1 < bn3);
                     popstack(stack);
                     popstack(stack);
@@ -784,18 +759,19 @@ bool EvalScript(vector<vector<unsigned char> >& stack, const CScript& script, co
                 {
                     if (stack.size() < 1)
                         return false;
-                    valtype& vch = stacktop(-1);
-                    valtype vchHash((opcode == OP_RIPEMD160 || opcode == OP_SHA1 || opcode == OP_HASH160) ? 20 : 32);
+                    CScriptValue& vch = stacktop(-1);
+                    CScriptValue vchHash((opcode == OP_RIPEMD160 || opcode == OP_SHA1 || opcode == OP_HASH160) ? 20 : 32);
                     if (opcode == OP_RIPEMD160)
                         RIPEMD160(&vch[0], vch.size(), &vchHash[0]);
                     else if (opcode == OP_SHA1)
                         SHA1(&vch[0], vch.size(), &vchHash[0]);
                     else if (opcode == OP_SHA256)
-                        SHA256(&vch[0], vch.size(), &vchHash[0]);
+                        CSHA256().Write(&vch[0], vch.size()).Finalize(&vchHash[0]);
                     else if (opcode == OP_HASH160)
                     {
-                        uint160 hash160 = Hash160(vch);
-                        memcpy(&vchHash[0], &hash160, sizeof(hash160));
+                        uint256 hash1;
+                        CSHA256().Write(&vch[0], vch.size()).Finalize((unsigned char*)&hash1);
+                        RIPEMD160((unsigned char*)&hash1, sizeof(hash1), &vchHash[0]);
                     }
                     else if (opcode == OP_HASH256)
                     {
@@ -819,15 +795,15 @@ bool EvalScript(vector<vector<unsigned char> >& stack, const CScript& script, co
                     if (stack.size() < 2)
                         return false;
 
-                    valtype& vchSig    = stacktop(-2);
-                    valtype& vchPubKey = stacktop(-1);
+                    CScriptValue& vchSig    = stacktop(-2);
+                    CScriptValue& vchPubKey = stacktop(-1);
 
 
                     CScript scriptCode(pbegincodehash, pend);
 
-                    scriptCode.FindAndDelete(CScript(vchSig));
+                    scriptCode.FindAndDelete(CScript(vchSig.getvch()));
 
-                    bool fSuccess = CheckSig(vchSig, vchPubKey, scriptCode, txTo, nIn, nHashType);
+                    bool fSuccess = CheckSig(vchSig.getvch(), vchPubKey.getvch(), scriptCode, txTo, nIn, nHashType, psighash);
 
                     popstack(stack);
                     popstack(stack);
@@ -850,7 +826,7 @@ bool EvalScript(vector<vector<unsigned char> >& stack, const CScript& script, co
                     if ((int)stack.size() < i)
                         return false;
 
-                    int nKeysCount = CastToBigNum(stacktop(-i)).getint();
+                    int nKeysCount = CScriptNum(stacktop(-i)).getint();
                     if (nKeysCount < 0 || nKeysCount > 20)
                         return false;
                     nOpCount += nKeysCount;
@@ -861,7 +837,7 @@ bool EvalScript(vector<vector<unsigned char> >& stack, const CScript& script, co
                     if ((int)stack.size() < i)
                         return false;
 
-                    int nSigsCount = CastToBigNum(stacktop(-i)).getint();
+                    int nSigsCount = CScriptNum(stacktop(-i)).getint();
                     if (nSigsCount < 0 || nSigsCount > nKeysCount)
                         return false;
                     int isig = ++i;
@@ -873,17 +849,17 @@ bool EvalScript(vector<vector<unsigned char> >& stack, const CScript& script, co
 
                     for (int k = 0; k < nSigsCount; k++)
                     {
-                        valtype& vchSig = stacktop(-isig-k);
-                        scriptCode.FindAndDelete(CScript(vchSig));
+                        CScriptValue& vchSig = stacktop(-isig-k);
+                        scriptCode.FindAndDelete(CScript(vchSig.getvch()));
                     }
 
                     bool fSuccess = true;
                     while (fSuccess && nSigsCount > 0)
                     {
-                        valtype& vchSig    = stacktop(-isig);
-                        valtype& vchPubKey = stacktop(-ikey);
+                        CScriptValue& vchSig    = stacktop(-isig);
+                        CScriptValue& vchPubKey = stacktop(-ikey);
 
-                        if (CheckSig(vchSig, vchPubKey, scriptCode, txTo, nIn, nHashType))
+                        if (CheckSig(vchSig.getvch(), vchPubKey.getvch(), scriptCode, txTo, nIn, nHashType, psighash))
                         {
                             isig++;
                             nSigsCount--;
@@ -989,6 +965,127 @@ uint256 SignatureHash(CScript scriptCode, const CTransaction& txTo, unsigned int
     return Hash(ss.begin(), ss.end());
 }
 
+// prevout, empty scriptSig, nSequence
+static const unsigned int SIGHASH_INPUT_SIZE = 36 + 1 + 4;
+
+CSignatureHashContext::CSignatureHashContext(const CTransaction& txToIn)
+{
+    ptxTo = &txToIn;
+    const CTransaction& txTo = txToIn;
+
+    CDataStream ssInputs(SER_GETHASH, 0);
+    ssInputs << txTo.nVersion;
+    WriteCompactSize(ssInputs, txTo.vin.size());
+    nInputsBegin = ssInputs.size();
+    BOOST_FOREACH(const CTxIn& txin, txTo.vin)
+        ssInputs << txin.prevout << CScript() << txin.nSequence;
+    vchInputs.assign(ssInputs.begin(), ssInputs.end());
+
+    vchInputsNoSequence = vchInputs;
+    for (unsigned int i = 0; i < txTo.vin.size(); i++)
+        memset(&vchInputsNoSequence[nInputsBegin + SIGHASH_INPUT_SIZE * (i + 1) - 4], 0, 4);
+
+    CDataStream ssOutputs(SER_GETHASH, 0);
+    WriteCompactSize(ssOutputs, txTo.vout.size());
+    BOOST_FOREACH(const CTxOut& txout, txTo.vout)
+    {
+        vOutputBegin.push_back(ssOutputs.size());
+        ssOutputs << txout;
+    }
+    vOutputBegin.push_back(ssOutputs.size());
+    vchOutputs.assign(ssOutputs.begin(), ssOutputs.end());
+
+    CDataStream ssLockTime(SER_GETHASH, 0);
+    ssLockTime << txTo.nLockTime;
+    vchLockTime.assign(ssLockTime.begin(), ssLockTime.end());
+
+    CSHA256 ctx;
+    ctx.Write(&vchInputs[0], nInputsBegin);
+    vMidstates.resize(txTo.vin.size());
+    for (unsigned int i = 0; i < txTo.vin.size(); i++)
+    {
+        vMidstates[i] = ctx;
+        ctx.Write(&vchInputs[nInputsBegin + SIGHASH_INPUT_SIZE * i], SIGHASH_INPUT_SIZE);
+    }
+}
+
+uint256 CSignatureHashContext::SignatureHash(CScript scriptCode, unsigned int nIn, int nHashType) const
+{
+    const CTransaction& txTo = *ptxTo;
+    if (nIn >= txTo.vin.size())
+    {
+        printf("ERROR: SignatureHash() : nIn=%d out of range\n", nIn);
+        return 1;
+    }
+    int nBaseType = nHashType & 0x1f;
+    if (nBaseType == SIGHASH_SINGLE && nIn >= txTo.vout.size())
+    {
+        printf("ERROR: SignatureHash() : nOut=%d out of range\n", nIn);
+        return 1;
+    }
+
+    scriptCode.FindAndDelete(CScript(OP_CODESEPARATOR));
+    CDataStream ssScript(SER_GETHASH, 0);
+    ssScript << scriptCode;
+
+    // The input being signed keeps its own nSequence whatever the hash type
+    unsigned int nInputPos = nInputsBegin + SIGHASH_INPUT_SIZE * nIn;
+    const unsigned char* pinput = &vchInputs[nInputPos];
+    CSHA256 ctx;
+    if (nHashType & SIGHASH_ANYONECANPAY)
+    {
+        // Just nVersion, the input count can take more than one byte
+        unsigned char chOne = 1;
+        ctx.Write(&vchInputs[0], sizeof(txTo.nVersion));
+        ctx.Write(&chOne, 1);
+        ctx.Write(pinput, 36);
+        ctx.Write((const unsigned char*)&ssScript[0], ssScript.size());
+        ctx.Write(pinput + 37, 4);
+    }
+    else
+    {
+        const vector<unsigned char>& vchIn = (nBaseType == SIGHASH_NONE || nBaseType == SIGHASH_SINGLE) ? vchInputsNoSequence : vchInputs;
+        if (&vchIn == &vchInputs)
+            ctx = vMidstates[nIn];
+        else
+            ctx.Write(&vchIn[0], nInputPos);
+        ctx.Write(pinput, 36);
+        ctx.Write((const unsigned char*)&ssScript[0], ssScript.size());
+        ctx.Write(pinput + 37, 4);
+        ctx.Write(&vchIn[0] + nInputPos + SIGHASH_INPUT_SIZE, vchIn.size() - nInputPos - SIGHASH_INPUT_SIZE);
+    }
+
+    if (nBaseType == SIGHASH_NONE)
+    {
+        unsigned char chZero = 0;
+        ctx.Write(&chZero, 1);
+    }
+    else if (nBaseType == SIGHASH_SINGLE)
+    {
+        // Blanked outputs before the one with the same index as the input
+        CDataStream ssOutputs(SER_GETHASH, 0);
+        WriteCompactSize(ssOutputs, nIn + 1);
+        CTxOut txoutNull;
+        for (unsigned int i = 0; i < nIn; i++)
+            ssOutputs << txoutNull;
+        ctx.Write((const unsigned char*)&ssOutputs[0], ssOutputs.size());
+        ctx.Write(&vchOutputs[vOutputBegin[nIn]], vOutputBegin[nIn + 1] - vOutputBegin[nIn]);
+    }
+    else
+        ctx.Write(&vchOutputs[0], vchOutputs.size());
+
+    CDataStream ssHashType(SER_GETHASH, 0);
+    ssHashType << nHashType;
+    ctx.Write(&vchLockTime[0], vchLockTime.size());
+    ctx.Write((const unsigned char*)&ssHashType[0], ssHashType.size());
+
+    uint256 hash1;
+    ctx.Finalize((unsigned char*)&hash1);
+    uint256 hash2;
+    CSHA256().Write((unsigned char*)&hash1, sizeof(hash1)).Finalize((unsigned char*)&hash2);
+    return hash2;
+}
+
 
 class CSignatureCache
 {
@@ -1035,7 +1132,7 @@ public:
 };
 
 bool CheckSig(vector<unsigned char> vchSig, vector<unsigned char> vchPubKey, CScript scriptCode,
-              const CTransaction& txTo, unsigned int nIn, int nHashType)
+              const CTransaction& txTo, unsigned int nIn, int nHashType, const CSignatureHashContext* psighash)
 {
     static CSignatureCache signatureCache;
 
@@ -1047,16 +1144,12 @@ bool CheckSig(vector<unsigned char> vchSig, vector<unsigned char> vchPubKey, CSc
         return false;
     vchSig.pop_back();
 
-    uint256 sighash = SignatureHash(scriptCode, txTo, nIn, nHashType);
+    uint256 sighash = psighash ? psighash->SignatureHash(scriptCode, nIn, nHashType) : SignatureHash(scriptCode, txTo, nIn, nHashType);
 
     if (signatureCache.Get(sighash, vchSig, vchPubKey))
         return true;
 
-    CKey key;
-    if (!key.SetPubKey(vchPubKey))
-        return false;
-
-    if (!key.Verify(sighash, vchSig))
+    if (!CPubKey(vchPubKey).Verify(sighash, vchSig))
         return false;
 
     signatureCache.Set(sighash, vchSig, vchPubKey);
@@ -1072,6 +1165,69 @@ bool CheckSig(vector<unsigned char> vchSig, vector<unsigned char> vchPubKey, CSc
 
 
 
+// Recognizes the usual encodings of the standard templates directly from
+// the bytes: pubkeys and hashes in single-byte pushes, small integers as
+// OP_1..OP_16.  Only claims scripts the template match below would accept
+// with the same solutions; anything else returns false and goes the slow way.
+static bool SolverFast(const CScript& scriptPubKey, txnouttype& typeRet, vector<valtype>& vSolutionsRet)
+{
+    unsigned int nSize = scriptPubKey.size();
+    if (nSize < 3)
+        return false;
+    const unsigned char* pch = &scriptPubKey[0];
+
+    if (nSize == 25 && pch[0] == OP_DUP && pch[1] == OP_HASH160 && pch[2] == 20 &&
+        pch[23] == OP_EQUALVERIFY && pch[24] == OP_CHECKSIG)
+    {
+        vSolutionsRet.clear();
+        vSolutionsRet.push_back(valtype(pch + 3, pch + 23));
+        typeRet = TX_PUBKEYHASH;
+        return true;
+    }
+
+    if ((nSize == 35 && pch[0] == 33) || (nSize == 67 && pch[0] == 65))
+    {
+        if (pch[nSize-1] != OP_CHECKSIG)
+            return false;
+        vSolutionsRet.clear();
+        vSolutionsRet.push_back(valtype(pch + 1, pch + nSize - 1));
+        typeRet = TX_PUBKEY;
+        return true;
+    }
+
+    if (pch[nSize-1] == OP_CHECKMULTISIG && pch[0] >= OP_1 && pch[0] <= OP_16 &&
+        pch[nSize-2] >= OP_1 && pch[nSize-2] <= OP_16)
+    {
+        int m = CScript::DecodeOP_N((opcodetype)pch[0]);
+        int n = CScript::DecodeOP_N((opcodetype)pch[nSize-2]);
+        if (m > n)
+            return false;
+        // n keys of 33 or 65 bytes in between
+        unsigned int nPos = 1;
+        int nKeys = 0;
+        while (nPos < nSize - 2)
+        {
+            if ((pch[nPos] != 33 && pch[nPos] != 65) || nPos + 1 + pch[nPos] > nSize - 2)
+                return false;
+            nPos += 1 + pch[nPos];
+            nKeys++;
+        }
+        if (nKeys != n)
+            return false;
+
+        vSolutionsRet.clear();
+        vSolutionsRet.reserve(n + 2);
+        vSolutionsRet.push_back(valtype(1, (unsigned char)m));
+        for (nPos = 1; nPos < nSize - 2; nPos += 1 + pch[nPos])
+            vSolutionsRet.push_back(valtype(pch + nPos + 1, pch + nPos + 1 + pch[nPos]));
+        vSolutionsRet.push_back(valtype(1, (unsigned char)n));
+        typeRet = TX_MULTISIG;
+        return true;
+    }
+
+    return false;
+}
+
 bool Solver(const CScript& scriptPubKey, txnouttype& typeRet, vector<vector<unsigned char> >& vSolutionsRet)
 {
     static map<txnouttype, CScript> mTemplates;
@@ -1093,6 +1249,9 @@ bool Solver(const CScript& scriptPubKey, txnouttype& typeRet, vector<vector<unsi
         return true;
     }
 
+    if (SolverFast(scriptPubKey, typeRet, vSolutionsRet))
+        return true;
+
     const CScript& script1 = scriptPubKey;
     BOOST_FOREACH(const PAIRTYPE(txnouttype, CScript)& tplate, mTemplates)
     {
@@ -1311,6 +1470,11 @@ bool IsMine(const CKeyStore &keystore, const CTxDestination &dest)
 
 bool IsMine(const CKeyStore &keystore, const CScript& scriptPubKey)
 {
+    // Standard outputs paying somebody else, nearly all of them, are turned
+    // down by one lookup
+    if (!keystore.MayHaveScript(scriptPubKey))
+        return false;
+
     vector<valtype> vSolutions;
     txnouttype whichType;
     if (!Solver(scriptPubKey, whichType, vSolutions))
@@ -1401,12 +1565,18 @@ bool ExtractDestinations(const CScript& scriptPubKey, txnouttype& typeRet, vecto
 bool VerifyScript(const CScript& scriptSig, const CScript& scriptPubKey, const CTransaction& txTo, unsigned int nIn,
                   bool fValidatePayToScriptHash, int nHashType)
 {
-    vector<vector<unsigned char> > stack, stackCopy;
-    if (!EvalScript(stack, scriptSig, txTo, nIn, nHashType))
+    return VerifyScript(scriptSig, scriptPubKey, txTo, nIn, fValidatePayToScriptHash, nHashType, NULL);
+}
+
+bool VerifyScript(const CScript& scriptSig, const CScript& scriptPubKey, const CTransaction& txTo, unsigned int nIn,
+                  bool fValidatePayToScriptHash, int nHashType, const CSignatureHashContext* psighash)
+{
+    CScriptStack stack, stackCopy;
+    if (!EvalScript(stack, scriptSig, txTo, nIn, nHashType, psighash))
         return false;
     if (fValidatePayToScriptHash)
         stackCopy = stack;
-    if (!EvalScript(stack, scriptPubKey, txTo, nIn, nHashType))
+    if (!EvalScript(stack, scriptPubKey, txTo, nIn, nHashType, psighash))
         return false;
     if (stack.empty())
         return false;
@@ -1419,11 +1589,11 @@ bool VerifyScript(const CScript& scriptSig, const CScript& scriptPubKey, const C
         if (!scriptSig.IsPushOnly()) 
             return false;            
 
-        const valtype& pubKeySerialized = stackCopy.back();
+        const CScriptValue& pubKeySerialized = stackCopy.back();
         CScript pubKey2(pubKeySerialized.begin(), pubKeySerialized.end());
         popstack(stackCopy);
 
-        if (!EvalScript(stackCopy, pubKey2, txTo, nIn, nHashType))
+        if (!EvalScript(stackCopy, pubKey2, txTo, nIn, nHashType, psighash))
             return false;
         if (stackCopy.empty())
             return false;
@@ -1434,32 +1604,39 @@ bool VerifyScript(const CScript& scriptSig, const CScript& scriptPubKey, const C
 }
 
 
-bool SignSignature(const CKeyStore &keystore, const CScript& fromPubKey, CTransaction& txTo, unsigned int nIn, int nHashType)
+// Signs input nIn into scriptSigRet, leaving txTo itself alone
+static bool SignSignatureTo(const CKeyStore &keystore, const CScript& fromPubKey, const CTransaction& txTo, unsigned int nIn, int nHashType, CScript& scriptSigRet,
+                            const CSignatureHashContext* psighash)
 {
-    assert(nIn < txTo.vin.size());
-    CTxIn& txin = txTo.vin[nIn];
-
-    
-    uint256 hash = SignatureHash(fromPubKey, txTo, nIn, nHashType);
+    uint256 hash = psighash ? psighash->SignatureHash(fromPubKey, nIn, nHashType) : SignatureHash(fromPubKey, txTo, nIn, nHashType);
 
     txnouttype whichType;
-    if (!Solver(keystore, fromPubKey, hash, nHashType, txin.scriptSig, whichType))
+    if (!Solver(keystore, fromPubKey, hash, nHashType, scriptSigRet, whichType))
         return false;
 
     if (whichType == TX_SCRIPTHASH)
     {
         
-        CScript subscript = txin.scriptSig;
-        uint256 hash2 = SignatureHash(subscript, txTo, nIn, nHashType);
+        CScript subscript = scriptSigRet;
+        uint256 hash2 = psighash ? psighash->SignatureHash(subscript, nIn, nHashType) : SignatureHash(subscript, txTo, nIn, nHashType);
 
         txnouttype subType;
         bool fSolved =
-            Solver(keystore, subscript, hash2, nHashType, txin.scriptSig, subType) && subType != TX_SCRIPTHASH;
-        txin.scriptSig << static_cast<valtype>(subscript);
+            Solver(keystore, subscript, hash2, nHashType, scriptSigRet, subType) && subType != TX_SCRIPTHASH;
+        scriptSigRet << static_cast<valtype>(subscript);
         if (!fSolved) return false;
     }
 
-    return VerifyScript(txin.scriptSig, fromPubKey, txTo, nIn, true, 0);
+    return VerifyScript(scriptSigRet, fromPubKey, txTo, nIn, true, 0, psighash);
+}
+
+bool SignSignature(const CKeyStore &keystore, const CScript& fromPubKey, CTransaction& txTo, unsigned int nIn, int nHashType)
+{
+    assert(nIn < txTo.vin.size());
+    bool fSolved = SignSignatureTo(keystore, fromPubKey, txTo, nIn, nHashType, txTo.vin[nIn].scriptSig, NULL);
+    // Any hash taken while scriptSig was being filled in is stale now
+    txTo.InvalidateHash();
+    return fSolved;
 }
 
 bool SignSignature(const CKeyStore &keystore, const CTransaction& txFrom, CTransaction& txTo, unsigned int nIn, int nHashType)
@@ -1472,7 +1649,83 @@ bool SignSignature(const CKeyStore &keystore, const CTransaction& txFrom, CTrans
     return SignSignature(keystore, txout.scriptPubKey, txTo, nIn, nHashType);
 }
 
+// What the signing threads share.  The transaction stays as it is until all
+// of them are done; each thread only writes the entries of its own inputs.
+struct CSignBatch
+{
+    const CKeyStore* pkeystore;
+    const vector<const CScript*>* pvpFromPubKeys;
+    const CTransaction* ptxTo;
+    int nHashType;
+    const vector<CTransaction>* pvtxMerge;
+    const CSignatureHashContext* psighash;
+    vector<CScript> vScriptSigs;
+    vector<char> vfDone;
+};
+
+static void ThreadSignBatch(CSignBatch* pbatch, unsigned int nFirst, unsigned int nStep)
+{
+    const CTransaction& txTo = *pbatch->ptxTo;
+    for (unsigned int i = nFirst; i < txTo.vin.size(); i += nStep)
+    {
+        const CScript* pfromPubKey = (*pbatch->pvpFromPubKeys)[i];
+        if (!pfromPubKey)
+            continue;
+        CScript& scriptSig = pbatch->vScriptSigs[i];
+        bool fDone = SignSignatureTo(*pbatch->pkeystore, *pfromPubKey, txTo, i, pbatch->nHashType, scriptSig, pbatch->psighash);
+        if (pbatch->pvtxMerge)
+        {
+            BOOST_FOREACH(const CTransaction& txv, *pbatch->pvtxMerge)
+                scriptSig = CombineSignatures(*pfromPubKey, txTo, i, scriptSig, txv.vin[i].scriptSig);
+            fDone = VerifyScript(scriptSig, *pfromPubKey, txTo, i, true, 0, pbatch->psighash);
+        }
+        pbatch->vfDone[i] = fDone;
+    }
+}
+
+bool SignSignatures(const CKeyStore& keystore, const vector<const CScript*>& vpFromPubKeys, CTransaction& txTo, int nHashType, const vector<CTransaction>* pvtxMerge)
+{
+    assert(vpFromPubKeys.size() == txTo.vin.size());
+    CSignBatch batch;
+    batch.pkeystore = &keystore;
+    batch.pvpFromPubKeys = &vpFromPubKeys;
+    batch.ptxTo = &txTo;
+    batch.nHashType = nHashType;
+    batch.pvtxMerge = pvtxMerge;
+    CSignatureHashContext ctx(txTo);
+    batch.psighash = &ctx;
+    batch.vScriptSigs.resize(txTo.vin.size());
+    batch.vfDone.resize(txTo.vin.size(), false);
+
+    // Not worth a thread for fewer than a handful of inputs each
+    int nThreads = min(boost::thread::hardware_concurrency(), (unsigned int)txTo.vin.size() / 8 + 1);
+    nThreads = max(nThreads, 1);
+    boost::thread_group threadGroup;
+    for (int i = 1; i < nThreads; i++)
+        threadGroup.create_thread(boost::bind(&ThreadSignBatch, &batch, i, nThreads));
+    ThreadSignBatch(&batch, 0, nThreads);
+    threadGroup.join_all();
+
+    bool fAllDone = true;
+    for (unsigned int i = 0; i < txTo.vin.size(); i++)
+    {
+        if (!vpFromPubKeys[i])
+            continue;
+        txTo.vin[i].scriptSig.swap(batch.vScriptSigs[i]);
+        if (!batch.vfDone[i])
+            fAllDone = false;
+    }
+    txTo.InvalidateHash();
+    return fAllDone;
+}
+
 bool VerifySignature(const CTransaction& txFrom, const CTransaction& txTo, unsigned int nIn, bool fValidatePayToScriptHash, int nHashType)
+{
+    return VerifySignature(txFrom, txTo, nIn, fValidatePayToScriptHash, nHashType, NULL);
+}
+
+bool VerifySignature(const CTransaction& txFrom, const CTransaction& txTo, unsigned int nIn, bool fValidatePayToScriptHash, int nHashType,
+                     const CSignatureHashContext* psighash)
 {
     assert(nIn < txTo.vin.size());
     const CTxIn& txin = txTo.vin[nIn];
@@ -1483,7 +1736,7 @@ bool VerifySignature(const CTransaction& txFrom, const CTransaction& txTo, unsig
     if (txin.prevout.hash != txFrom.GetHash())
         return false;
 
-    return VerifyScript(txin.scriptSig, txout.scriptPubKey, txTo, nIn, fValidatePayToScriptHash, nHashType);
+    return VerifyScript(txin.scriptSig, txout.scriptPubKey, txTo, nIn, fValidatePayToScriptHash, nHashType, psighash);
 }
 
 static CScript PushAll(const vector<valtype>& values)
@@ -7,6 +7,8 @@
 #include <boost/foreach.hpp>
 #include <boost/variant.hpp>
 
+#include <openssl/sha.h>
+
 #include "keystore.h"
 #include "bignum.h"
 
@@ -188,6 +190,262 @@ inline std::string StackString(const std::vector<std::vector<unsigned char> >& v
 }
 
 
+
+/** A script stack element.
+ *
+ * Behaves like a vector<unsigned char>, but anything up to INLINE_SIZE bytes
+ * is kept in the element itself, which covers signatures, public keys,
+ * hashes and numbers.  Only the odd large push from a script goes to the
+ * heap.
+ */
+class CScriptValue
+{
+public:
+    enum { INLINE_SIZE = 80 };
+
+    typedef unsigned char value_type;
+    typedef unsigned char* iterator;
+    typedef const unsigned char* const_iterator;
+
+private:
+    unsigned int nSize;
+    unsigned int nCapacity;
+    union
+    {
+        unsigned char vchInline[INLINE_SIZE];
+        unsigned char* pchHeap;
+    };
+
+    bool IsInline() const { return nCapacity == INLINE_SIZE; }
+
+    void Reserve(unsigned int nNewCapacity)
+    {
+        if (nNewCapacity <= nCapacity)
+            return;
+        unsigned char* pchNew = (unsigned char*)malloc(nNewCapacity);
+        if (!pchNew)
+            throw std::bad_alloc();
+        memcpy(pchNew, begin(), nSize);
+        if (!IsInline())
+            free(pchHeap);
+        pchHeap = pchNew;
+        nCapacity = nNewCapacity;
+    }
+
+public:
+    CScriptValue() : nSize(0), nCapacity(INLINE_SIZE)
+    {
+    }
+
+    explicit CScriptValue(unsigned int nSizeIn, unsigned char ch=0) : nSize(0), nCapacity(INLINE_SIZE)
+    {
+        resize(nSizeIn, ch);
+    }
+
+    CScriptValue(const unsigned char* pbegin, const unsigned char* pend) : nSize(0), nCapacity(INLINE_SIZE)
+    {
+        assign(pbegin, pend);
+    }
+
+    explicit CScriptValue(const std::vector<unsigned char>& vch) : nSize(0), nCapacity(INLINE_SIZE)
+    {
+        if (!vch.empty())
+            assign(&vch[0], &vch[0] + vch.size());
+    }
+
+    CScriptValue(const CScriptValue& b) : nSize(0), nCapacity(INLINE_SIZE)
+    {
+        assign(b.begin(), b.end());
+    }
+
+    ~CScriptValue()
+    {
+        if (!IsInline())
+            free(pchHeap);
+    }
+
+    CScriptValue& operator=(const CScriptValue& b)
+    {
+        if (this != &b)
+            assign(b.begin(), b.end());
+        return *this;
+    }
+
+    void assign(const unsigned char* pbegin, const unsigned char* pend)
+    {
+        nSize = 0;
+        Reserve(pend - pbegin);
+        nSize = pend - pbegin;
+        if (nSize)
+            memcpy(begin(), pbegin, nSize);
+    }
+
+    iterator begin()                { return IsInline() ? vchInline : pchHeap; }
+    const_iterator begin() const    { return IsInline() ? vchInline : pchHeap; }
+    iterator end()                  { return begin() + nSize; }
+    const_iterator end() const      { return begin() + nSize; }
+
+    unsigned int size() const       { return nSize; }
+    bool empty() const              { return nSize == 0; }
+
+    unsigned char& operator[](unsigned int i)               { return begin()[i]; }
+    const unsigned char& operator[](unsigned int i) const   { return begin()[i]; }
+    unsigned char& back()                                   { return begin()[nSize - 1]; }
+    const unsigned char& back() const                       { return begin()[nSize - 1]; }
+
+    void clear()
+    {
+        nSize = 0;
+    }
+
+    void resize(unsigned int nNewSize, unsigned char ch=0)
+    {
+        Reserve(nNewSize);
+        if (nNewSize > nSize)
+            memset(begin() + nSize, ch, nNewSize - nSize);
+        nSize = nNewSize;
+    }
+
+    void push_back(unsigned char ch)
+    {
+        if (nSize == nCapacity)
+            Reserve(nCapacity * 2);
+        begin()[nSize++] = ch;
+    }
+
+    iterator insert(iterator where, const unsigned char* pbegin, const unsigned char* pend)
+    {
+        unsigned int nPos = where - begin();
+        unsigned int nCount = pend - pbegin;
+        if (nSize + nCount > nCapacity)
+        {
+            // Growing frees the old buffer, which the range may be in
+            std::vector<unsigned char> vchTmp(pbegin, pend);
+            Reserve(std::max(nSize + nCount, nCapacity * 2));
+            memmove(begin() + nPos + nCount, begin() + nPos, nSize - nPos);
+            if (nCount)
+                memcpy(begin() + nPos, &vchTmp[0], nCount);
+        }
+        else
+        {
+            memmove(begin() + nPos + nCount, begin() + nPos, nSize - nPos);
+            memcpy(begin() + nPos, pbegin, nCount);
+        }
+        nSize += nCount;
+        return begin() + nPos;
+    }
+
+    iterator erase(iterator first, iterator last)
+    {
+        memmove(first, last, end() - last);
+        nSize -= last - first;
+        return first;
+    }
+
+    friend bool operator==(const CScriptValue& a, const CScriptValue& b)
+    {
+        return a.nSize == b.nSize && memcmp(a.begin(), b.begin(), a.nSize) == 0;
+    }
+
+    friend bool operator!=(const CScriptValue& a, const CScriptValue& b)
+    {
+        return !(a == b);
+    }
+
+    std::vector<unsigned char> getvch() const
+    {
+        return std::vector<unsigned char>(begin(), end());
+    }
+};
+
+typedef std::vector<CScriptValue> CScriptStack;
+
+
+class scriptnum_error : public std::runtime_error
+{
+public:
+    explicit scriptnum_error(const std::string& str) : std::runtime_error(str) {}
+};
+
+/** A number on the script stack.
+ *
+ * Script numbers are little-endian sign-magnitude, and operands are at most
+ * nMaxNumSize bytes, so results always fit in 64 bits.  Decoding and
+ * encoding give exactly what CBigNum's setvch() and getvch() would, without
+ * going through OpenSSL.
+ */
+class CScriptNum
+{
+private:
+    int64 n;
+
+public:
+    static const unsigned int nMaxNumSize = 4;
+
+    explicit CScriptNum(int64 nIn) : n(nIn)
+    {
+    }
+
+    explicit CScriptNum(const CScriptValue& vch)
+    {
+        if (vch.size() > nMaxNumSize)
+            throw scriptnum_error("CScriptNum() : overflow");
+        n = 0;
+        if (vch.empty())
+            return;
+        for (unsigned int i = 0; i < vch.size(); i++)
+            n |= (int64)vch[i] << (8 * i);
+        // The top bit of the last byte is the sign
+        if (vch.back() & 0x80)
+            n = -(n & ~((int64)0x80 << (8 * (vch.size() - 1))));
+    }
+
+    int getint() const
+    {
+        if (n > std::numeric_limits<int>::max())
+            return std::numeric_limits<int>::max();
+        if (n < std::numeric_limits<int>::min())
+            return std::numeric_limits<int>::min();
+        return (int)n;
+    }
+
+    int64 getint64() const { return n; }
+
+    CScriptValue getvch() const
+    {
+        CScriptValue vch;
+        if (n == 0)
+            return vch;
+        bool fNegative = n < 0;
+        uint64 nAbs = fNegative ? -(uint64)n : (uint64)n;
+        while (nAbs)
+        {
+            vch.push_back(nAbs & 0xff);
+            nAbs >>= 8;
+        }
+        // Add a byte for the sign if the top bit is taken
+        if (vch.back() & 0x80)
+            vch.push_back(fNegative ? 0x80 : 0);
+        else if (fNegative)
+            vch.back() |= 0x80;
+        return vch;
+    }
+
+    CScriptNum operator-() const                        { return CScriptNum(-n); }
+    CScriptNum& operator+=(const CScriptNum& b)         { n += b.n; return *this; }
+    CScriptNum& operator-=(const CScriptNum& b)         { n -= b.n; return *this; }
+
+    friend CScriptNum operator+(const CScriptNum& a, const CScriptNum& b) { return CScriptNum(a.n + b.n); }
+    friend CScriptNum operator-(const CScriptNum& a, const CScriptNum& b) { return CScriptNum(a.n - b.n); }
+    friend bool operator==(const CScriptNum& a, const CScriptNum& b)      { return a.n == b.n; }
+    friend bool operator!=(const CScriptNum& a, const CScriptNum& b)      { return a.n != b.n; }
+    friend bool operator<(const CScriptNum& a, const CScriptNum& b)       { return a.n < b.n; }
+    friend bool operator<=(const CScriptNum& a, const CScriptNum& b)      { return a.n <= b.n; }
+    friend bool operator>(const CScriptNum& a, const CScriptNum& b)       { return a.n > b.n; }
+    friend bool operator>=(const CScriptNum& a, const CScriptNum& b)      { return a.n >= b.n; }
+};
+
+
 class CScript : public std::vector<unsigned char>
 {
 protected:
@@ -526,9 +784,44 @@ public:
 
 
 
+/** The parts of a transaction's signature hash that are the same for every
+ * input, serialized once.  SignatureHash() copies and re-serializes the whole
+ * transaction for each input it is called for, which adds up to quadratic
+ * work for transactions with many inputs.  Here only the bytes are hashed
+ * again, and for SIGHASH_ALL everything before the input comes from a saved
+ * SHA-256 state.  The transaction must outlive the context and not change.
+ */
+class CSignatureHashContext
+{
+private:
+    const CTransaction* ptxTo;
+
+    // nVersion, the input count and then every input with an empty
+    // scriptSig, 41 bytes each from nInputsBegin on
+    std::vector<unsigned char> vchInputs;
+    // The same with nSequence zeroed, for SIGHASH_NONE and SIGHASH_SINGLE
+    std::vector<unsigned char> vchInputsNoSequence;
+    unsigned int nInputsBegin;
+    // The output count and outputs; output i starts at vOutputBegin[i]
+    std::vector<unsigned char> vchOutputs;
+    std::vector<unsigned int> vOutputBegin;
+    std::vector<unsigned char> vchLockTime;
+    // SHA-256 of vchInputs up to input i
+    std::vector<CSHA256> vMidstates;
+
+public:
+    explicit CSignatureHashContext(const CTransaction& txToIn);
 
+    // The same as ::SignatureHash(scriptCode, txTo, nIn, nHashType)
+    uint256 SignatureHash(CScript scriptCode, unsigned int nIn, int nHashType) const;
+};
 
 bool EvalScript(std::vector<std::vector<unsigned char> >& stack, const CScript& script, const CTransaction& txTo, unsigned int nIn, int nHashType);
+bool EvalScript(std::vector<std::vector<unsigned char> >& stack, const CScript& script, const CTransaction& txTo, unsigned int nIn, int nHashType,
+                const CSignatureHashContext* psighash);
+// The interpreter itself; the overloads above copy their stack in and out
+bool EvalScript(CScriptStack& stack, const CScript& script, const CTransaction& txTo, unsigned int nIn, int nHashType,
+                const CSignatureHashContext* psighash);
 bool Solver(const CScript& scriptPubKey, txnouttype& typeRet, std::vector<std::vector<unsigned char> >& vSolutionsRet);
 int ScriptSigArgsExpected(txnouttype t, const std::vector<std::vector<unsigned char> >& vSolutions);
 bool IsStandard(const CScript& scriptPubKey);
@@ -538,9 +831,19 @@ bool ExtractDestination(const CScript& scriptPubKey, CTxDestination& addressRet)
 bool ExtractDestinations(const CScript& scriptPubKey, txnouttype& typeRet, std::vector<CTxDestination>& addressRet, int& nRequiredRet);
 bool SignSignature(const CKeyStore& keystore, const CScript& fromPubKey, CTransaction& txTo, unsigned int nIn, int nHashType=SIGHASH_ALL);
 bool SignSignature(const CKeyStore& keystore, const CTransaction& txFrom, CTransaction& txTo, unsigned int nIn, int nHashType=SIGHASH_ALL);
+// Signs every input of txTo that has a script to spend in vpFromPubKeys (NULL
+// leaves the input as it is), several inputs at a time on all cores.  With
+// pvtxMerge, signatures the input has in any of those transactions are
+// combined in.  True if all those inputs end up with a valid scriptSig.
+bool SignSignatures(const CKeyStore& keystore, const std::vector<const CScript*>& vpFromPubKeys, CTransaction& txTo, int nHashType=SIGHASH_ALL, const std::vector<CTransaction>* pvtxMerge=NULL);
 bool VerifyScript(const CScript& scriptSig, const CScript& scriptPubKey, const CTransaction& txTo, unsigned int nIn,
                   bool fValidatePayToScriptHash, int nHashType);
 bool VerifySignature(const CTransaction& txFrom, const CTransaction& txTo, unsigned int nIn, bool fValidatePayToScriptHash, int nHashType);
+// The same, with the signature hashes taken from a context made for txTo
+bool VerifyScript(const CScript& scriptSig, const CScript& scriptPubKey, const CTransaction& txTo, unsigned int nIn,
+                  bool fValidatePayToScriptHash, int nHashType, const CSignatureHashContext* psighash);
+bool VerifySignature(const CTransaction& txFrom, const CTransaction& txTo, unsigned int nIn, bool fValidatePayToScriptHash, int nHashType,
+                     const CSignatureHashContext* psighash);
 
 CScript CombineSignatures(CScript scriptPubKey, const CTransaction& txTo, unsigned int nIn, const CScript& scriptSig1, const CScript& scriptSig2);
 
@@ -83,6 +83,12 @@ enum
 
 #define READWRITE(obj)      (nSerSize += ::SerReadWrite(s, (obj), nType, nVersion, ser_action))
 
+// READWRITE that reads obj into a CAllocArena of its own: every container
+// in it with an arena_allocator, however deep, ends up in the same region.
+// The arena's first chunk is kept to nMaxFirstChunk unless the first
+// allocation alone needs more.
+#define READWRITE_ARENA(obj, nMaxFirstChunk) (nSerSize += ::SerReadWriteArena(s, (obj), nType, nVersion, ser_action, (nMaxFirstChunk)))
+
 
 
 
@@ -252,6 +258,23 @@ public:
 };
 
 
+//
+// Types that serialize as exactly their sizeof(T) bytes in memory.  Their
+// size is known at compile time, and a vector of them is written and read
+// with a single memcpy.  Fundamental types are flat; a class opts in with
+// SERIALIZE_FLAT after it is declared, which it may only do if it has no
+// padding, no pointers and the same bytes for every nType and nVersion.
+//
+template<typename T> struct is_serialize_flat : boost::is_fundamental<T> { };
+
+#define SERIALIZE_FLAT(T) template<> struct is_serialize_flat<T> : boost::true_type { }
+
+class uint160;
+class uint256;
+SERIALIZE_FLAT(uint160);
+SERIALIZE_FLAT(uint256);
+
+
 template<typename C> unsigned int GetSerializeSize(const std::basic_string<C>& str, int, int=0);
 template<typename Stream, typename C> void Serialize(Stream& os, const std::basic_string<C>& str, int, int=0);
 template<typename Stream, typename C> void Unserialize(Stream& is, std::basic_string<C>& str, int, int=0);
@@ -289,6 +312,8 @@ template<typename Stream, typename K, typename Pred, typename A> void Unserializ
 template<typename T>
 inline unsigned int GetSerializeSize(const T& a, long nType, int nVersion)
 {
+    if (is_serialize_flat<T>::value)
+        return sizeof(T);
     return a.GetSerializeSize((int)nType, nVersion);
 }
 
@@ -351,7 +376,7 @@ unsigned int GetSerializeSize_impl(const std::vector<T, A>& v, int nType, int nV
 template<typename T, typename A>
 inline unsigned int GetSerializeSize(const std::vector<T, A>& v, int nType, int nVersion)
 {
-    return GetSerializeSize_impl(v, nType, nVersion, boost::is_fundamental<T>());
+    return GetSerializeSize_impl(v, nType, nVersion, is_serialize_flat<T>());
 }
 
 
@@ -374,7 +399,7 @@ void Serialize_impl(Stream& os, const std::vector<T, A>& v, int nType, int nVers
 template<typename Stream, typename T, typename A>
 inline void Serialize(Stream& os, const std::vector<T, A>& v, int nType, int nVersion)
 {
-    Serialize_impl(os, v, nType, nVersion, boost::is_fundamental<T>());
+    Serialize_impl(os, v, nType, nVersion, is_serialize_flat<T>());
 }
 
 
@@ -414,7 +439,7 @@ void Unserialize_impl(Stream& is, std::vector<T, A>& v, int nType, int nVersion,
 template<typename Stream, typename T, typename A>
 inline void Unserialize(Stream& is, std::vector<T, A>& v, int nType, int nVersion)
 {
-    Unserialize_impl(is, v, nType, nVersion, boost::is_fundamental<T>());
+    Unserialize_impl(is, v, nType, nVersion, is_serialize_flat<T>());
 }
 
 
@@ -611,6 +636,20 @@ inline unsigned int SerReadWrite(Stream& s, T& obj, int nType, int nVersion, CSe
     return 0;
 }
 
+template<typename Stream, typename T, typename SerAction>
+inline unsigned int SerReadWriteArena(Stream& s, const T& obj, int nType, int nVersion, SerAction ser_action, size_t nMaxFirstChunk)
+{
+    return SerReadWrite(s, obj, nType, nVersion, ser_action);
+}
+
+template<typename Stream, typename T>
+inline unsigned int SerReadWriteArena(Stream& s, T& obj, int nType, int nVersion, CSerActionUnserialize ser_action, size_t nMaxFirstChunk)
+{
+    CAllocArena arena(0, nMaxFirstChunk);
+    ::Unserialize(s, obj, nType, nVersion);
+    return 0;
+}
+
 struct ser_streamplaceholder
 {
     int nType;
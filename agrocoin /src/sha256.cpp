@@ -0,0 +1,562 @@
+#include "sha256.h"
+
+#include <string.h>
+
+// The SIMD code is compiled with per-function target attributes, so the
+// rest of the build needs no special flags and runs on any x86 CPU
+#if (defined(__x86_64__) || defined(__i386__)) && (defined(__clang__) || __GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 9))
+#define USE_SHA256_X86
+#include <cpuid.h>
+#include <immintrin.h>
+#endif
+
+static const uint32_t pSHA256Init[8] =
+{0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19};
+
+static const uint32_t pSHA256K[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2};
+
+static inline uint32_t ReadBE32(const unsigned char* p)
+{
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | (uint32_t)p[3];
+}
+
+static inline void WriteBE32(unsigned char* p, uint32_t x)
+{
+    p[0] = x >> 24;
+    p[1] = x >> 16;
+    p[2] = x >> 8;
+    p[3] = x;
+}
+
+// The second block of a 64-byte message, and the 32-byte message's padding
+static const uint32_t pPad64[16] = {0x80000000, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 512};
+static const uint32_t pPad32[8] = {0x80000000, 0, 0, 0, 0, 0, 0, 256};
+
+
+//
+// Generic implementation
+//
+
+#define ROTR(x, n)      (((x) >> (n)) | ((x) << (32 - (n))))
+#define CH(x, y, z)     ((z) ^ ((x) & ((y) ^ (z))))
+#define MAJ(x, y, z)    (((x) & (y)) | ((z) & ((x) | (y))))
+#define SIGMA0(x)       (ROTR(x, 2) ^ ROTR(x, 13) ^ ROTR(x, 22))
+#define SIGMA1(x)       (ROTR(x, 6) ^ ROTR(x, 11) ^ ROTR(x, 25))
+#define sigma0(x)       (ROTR(x, 7) ^ ROTR(x, 18) ^ ((x) >> 3))
+#define sigma1(x)       (ROTR(x, 17) ^ ROTR(x, 19) ^ ((x) >> 10))
+
+// 64 rounds over the message words w, added into s
+static void CompressGeneric(uint32_t* s, const uint32_t* w16)
+{
+    uint32_t w[64];
+    memcpy(w, w16, sizeof(uint32_t) * 16);
+    for (int i = 16; i < 64; i++)
+        w[i] = sigma1(w[i-2]) + w[i-7] + sigma0(w[i-15]) + w[i-16];
+
+    uint32_t a = s[0], b = s[1], c = s[2], d = s[3], e = s[4], f = s[5], g = s[6], h = s[7];
+    for (int i = 0; i < 64; i++)
+    {
+        uint32_t t1 = h + SIGMA1(e) + CH(e, f, g) + pSHA256K[i] + w[i];
+        uint32_t t2 = SIGMA0(a) + MAJ(a, b, c);
+        h = g;
+        g = f;
+        f = e;
+        e = d + t1;
+        d = c;
+        c = b;
+        b = a;
+        a = t1 + t2;
+    }
+    s[0] += a; s[1] += b; s[2] += c; s[3] += d;
+    s[4] += e; s[5] += f; s[6] += g; s[7] += h;
+}
+
+static void TransformGeneric(uint32_t* s, const unsigned char* chunk, size_t nBlocks)
+{
+    for (; nBlocks > 0; nBlocks--, chunk += 64)
+    {
+        uint32_t w[16];
+        for (int i = 0; i < 16; i++)
+            w[i] = ReadBE32(chunk + 4 * i);
+        CompressGeneric(s, w);
+    }
+}
+
+static void (*pTransform)(uint32_t* s, const unsigned char* chunk, size_t nBlocks) = TransformGeneric;
+
+// One 64-byte input through whatever pTransform is
+static void TransformD64Single(unsigned char* out, const unsigned char* in)
+{
+    uint32_t s[8];
+    memcpy(s, pSHA256Init, sizeof(s));
+    pTransform(s, in, 1);
+    CompressGeneric(s, pPad64);
+
+    unsigned char buf[64];
+    for (int i = 0; i < 8; i++)
+    {
+        WriteBE32(buf + 4 * i, s[i]);
+        WriteBE32(buf + 32 + 4 * i, pPad32[i]);
+    }
+    memcpy(s, pSHA256Init, sizeof(s));
+    pTransform(s, buf, 1);
+    for (int i = 0; i < 8; i++)
+        WriteBE32(out + 4 * i, s[i]);
+}
+
+// The padding block is the same for every 64-byte input, CompressGeneric
+// is as good as any for it; with SHA-NI it goes through pTransform too
+static bool fPadThroughTransform = false;
+
+static void TransformD64(unsigned char* out, const unsigned char* in)
+{
+    if (!fPadThroughTransform)
+    {
+        TransformD64Single(out, in);
+        return;
+    }
+    uint32_t s[8];
+    memcpy(s, pSHA256Init, sizeof(s));
+    unsigned char buf[128];
+    memcpy(buf, in, 64);
+    for (int i = 0; i < 16; i++)
+        WriteBE32(buf + 64 + 4 * i, pPad64[i]);
+    pTransform(s, buf, 2);
+
+    for (int i = 0; i < 8; i++)
+    {
+        WriteBE32(buf + 4 * i, s[i]);
+        WriteBE32(buf + 32 + 4 * i, pPad32[i]);
+    }
+    memcpy(s, pSHA256Init, sizeof(s));
+    pTransform(s, buf, 1);
+    for (int i = 0; i < 8; i++)
+        WriteBE32(out + 4 * i, s[i]);
+}
+
+static void (*pTransformD64x4)(unsigned char* out, const unsigned char* in) = NULL;
+static void (*pTransformD64x8)(unsigned char* out, const unsigned char* in) = NULL;
+
+
+#ifdef USE_SHA256_X86
+//
+// SSE4.1: four inputs at a time, one per 32-bit lane
+//
+
+#define SSE4 __attribute__((target("sse4.1")))
+
+static inline SSE4 __m128i Rotr4(__m128i x, int n) { return _mm_or_si128(_mm_srli_epi32(x, n), _mm_slli_epi32(x, 32 - n)); }
+
+// 64 rounds over the message words w, added into s
+static SSE4 void Compress4(__m128i* s, const __m128i* w16)
+{
+    __m128i w[16];
+    for (int i = 0; i < 16; i++)
+        w[i] = w16[i];
+    __m128i a = s[0], b = s[1], c = s[2], d = s[3], e = s[4], f = s[5], g = s[6], h = s[7];
+    for (int i = 0; i < 64; i++)
+    {
+        if (i >= 16)
+        {
+            __m128i w2 = w[(i - 2) & 15], w15 = w[(i - 15) & 15];
+            __m128i s1 = _mm_xor_si128(_mm_xor_si128(Rotr4(w2, 17), Rotr4(w2, 19)), _mm_srli_epi32(w2, 10));
+            __m128i s0 = _mm_xor_si128(_mm_xor_si128(Rotr4(w15, 7), Rotr4(w15, 18)), _mm_srli_epi32(w15, 3));
+            w[i & 15] = _mm_add_epi32(_mm_add_epi32(s1, w[(i - 7) & 15]), _mm_add_epi32(s0, w[i & 15]));
+        }
+        __m128i S1 = _mm_xor_si128(_mm_xor_si128(Rotr4(e, 6), Rotr4(e, 11)), Rotr4(e, 25));
+        __m128i ch = _mm_xor_si128(g, _mm_and_si128(e, _mm_xor_si128(f, g)));
+        __m128i t1 = _mm_add_epi32(_mm_add_epi32(h, S1), _mm_add_epi32(ch, _mm_add_epi32(_mm_set1_epi32(pSHA256K[i]), w[i & 15])));
+        __m128i S0 = _mm_xor_si128(_mm_xor_si128(Rotr4(a, 2), Rotr4(a, 13)), Rotr4(a, 22));
+        __m128i maj = _mm_or_si128(_mm_and_si128(a, b), _mm_and_si128(c, _mm_or_si128(a, b)));
+        __m128i t2 = _mm_add_epi32(S0, maj);
+        h = g;
+        g = f;
+        f = e;
+        e = _mm_add_epi32(d, t1);
+        d = c;
+        c = b;
+        b = a;
+        a = _mm_add_epi32(t1, t2);
+    }
+    s[0] = _mm_add_epi32(s[0], a); s[1] = _mm_add_epi32(s[1], b);
+    s[2] = _mm_add_epi32(s[2], c); s[3] = _mm_add_epi32(s[3], d);
+    s[4] = _mm_add_epi32(s[4], e); s[5] = _mm_add_epi32(s[5], f);
+    s[6] = _mm_add_epi32(s[6], g); s[7] = _mm_add_epi32(s[7], h);
+}
+
+static SSE4 void TransformD64SSE4(unsigned char* out, const unsigned char* in)
+{
+    __m128i s[8], w[16];
+    for (int i = 0; i < 8; i++)
+        s[i] = _mm_set1_epi32(pSHA256Init[i]);
+    for (int i = 0; i < 16; i++)
+        w[i] = _mm_set_epi32(ReadBE32(in + 192 + 4 * i), ReadBE32(in + 128 + 4 * i), ReadBE32(in + 64 + 4 * i), ReadBE32(in + 4 * i));
+    Compress4(s, w);
+    for (int i = 0; i < 16; i++)
+        w[i] = _mm_set1_epi32(pPad64[i]);
+    Compress4(s, w);
+
+    for (int i = 0; i < 8; i++)
+    {
+        w[i] = s[i];
+        w[i + 8] = _mm_set1_epi32(pPad32[i]);
+        s[i] = _mm_set1_epi32(pSHA256Init[i]);
+    }
+    Compress4(s, w);
+    for (int i = 0; i < 8; i++)
+    {
+        WriteBE32(out + 4 * i, _mm_extract_epi32(s[i], 0));
+        WriteBE32(out + 32 + 4 * i, _mm_extract_epi32(s[i], 1));
+        WriteBE32(out + 64 + 4 * i, _mm_extract_epi32(s[i], 2));
+        WriteBE32(out + 96 + 4 * i, _mm_extract_epi32(s[i], 3));
+    }
+}
+
+
+//
+// AVX2: eight inputs at a time
+//
+
+#define AVX2 __attribute__((target("avx2")))
+
+static inline AVX2 __m256i Rotr8(__m256i x, int n) { return _mm256_or_si256(_mm256_srli_epi32(x, n), _mm256_slli_epi32(x, 32 - n)); }
+
+static AVX2 void Compress8(__m256i* s, const __m256i* w16)
+{
+    __m256i w[16];
+    for (int i = 0; i < 16; i++)
+        w[i] = w16[i];
+    __m256i a = s[0], b = s[1], c = s[2], d = s[3], e = s[4], f = s[5], g = s[6], h = s[7];
+    for (int i = 0; i < 64; i++)
+    {
+        if (i >= 16)
+        {
+            __m256i w2 = w[(i - 2) & 15], w15 = w[(i - 15) & 15];
+            __m256i s1 = _mm256_xor_si256(_mm256_xor_si256(Rotr8(w2, 17), Rotr8(w2, 19)), _mm256_srli_epi32(w2, 10));
+            __m256i s0 = _mm256_xor_si256(_mm256_xor_si256(Rotr8(w15, 7), Rotr8(w15, 18)), _mm256_srli_epi32(w15, 3));
+            w[i & 15] = _mm256_add_epi32(_mm256_add_epi32(s1, w[(i - 7) & 15]), _mm256_add_epi32(s0, w[i & 15]));
+        }
+        __m256i S1 = _mm256_xor_si256(_mm256_xor_si256(Rotr8(e, 6), Rotr8(e, 11)), Rotr8(e, 25));
+        __m256i ch = _mm256_xor_si256(g, _mm256_and_si256(e, _mm256_xor_si256(f, g)));
+        __m256i t1 = _mm256_add_epi32(_mm256_add_epi32(h, S1), _mm256_add_epi32(ch, _mm256_add_epi32(_mm256_set1_epi32(pSHA256K[i]), w[i & 15])));
+        __m256i S0 = _mm256_xor_si256(_mm256_xor_si256(Rotr8(a, 2), Rotr8(a, 13)), Rotr8(a, 22));
+        __m256i maj = _mm256_or_si256(_mm256_and_si256(a, b), _mm256_and_si256(c, _mm256_or_si256(a, b)));
+        __m256i t2 = _mm256_add_epi32(S0, maj);
+        h = g;
+        g = f;
+        f = e;
+        e = _mm256_add_epi32(d, t1);
+        d = c;
+        c = b;
+        b = a;
+        a = _mm256_add_epi32(t1, t2);
+    }
+    s[0] = _mm256_add_epi32(s[0], a); s[1] = _mm256_add_epi32(s[1], b);
+    s[2] = _mm256_add_epi32(s[2], c); s[3] = _mm256_add_epi32(s[3], d);
+    s[4] = _mm256_add_epi32(s[4], e); s[5] = _mm256_add_epi32(s[5], f);
+    s[6] = _mm256_add_epi32(s[6], g); s[7] = _mm256_add_epi32(s[7], h);
+}
+
+static AVX2 void TransformD64AVX2(unsigned char* out, const unsigned char* in)
+{
+    __m256i s[8], w[16];
+    for (int i = 0; i < 8; i++)
+        s[i] = _mm256_set1_epi32(pSHA256Init[i]);
+    for (int i = 0; i < 16; i++)
+        w[i] = _mm256_set_epi32(ReadBE32(in + 448 + 4 * i), ReadBE32(in + 384 + 4 * i), ReadBE32(in + 320 + 4 * i), ReadBE32(in + 256 + 4 * i),
+                                ReadBE32(in + 192 + 4 * i), ReadBE32(in + 128 + 4 * i), ReadBE32(in + 64 + 4 * i), ReadBE32(in + 4 * i));
+    Compress8(s, w);
+    for (int i = 0; i < 16; i++)
+        w[i] = _mm256_set1_epi32(pPad64[i]);
+    Compress8(s, w);
+
+    for (int i = 0; i < 8; i++)
+    {
+        w[i] = s[i];
+        w[i + 8] = _mm256_set1_epi32(pPad32[i]);
+        s[i] = _mm256_set1_epi32(pSHA256Init[i]);
+    }
+    Compress8(s, w);
+    for (int i = 0; i < 8; i++)
+    {
+        uint32_t lanes[8];
+        _mm256_storeu_si256((__m256i*)lanes, s[i]);
+        for (int j = 0; j < 8; j++)
+            WriteBE32(out + 32 * j + 4 * i, lanes[j]);
+    }
+}
+
+
+//
+// SHA-NI: one block at a time, in hardware
+//
+
+#define SHANI __attribute__((target("sha,sse4.1")))
+
+static inline SHANI void QuadRound(__m128i& state0, __m128i& state1, __m128i m, int i)
+{
+    __m128i msg = _mm_add_epi32(m, _mm_loadu_si128((const __m128i*)&pSHA256K[4 * i]));
+    state1 = _mm_sha256rnds2_epu32(state1, state0, msg);
+    state0 = _mm_sha256rnds2_epu32(state0, state1, _mm_shuffle_epi32(msg, 0x0e));
+}
+
+// Next four message words into m2 from m0 (already through msg1) and m1
+static inline SHANI void NextMessage(__m128i m0, __m128i m1, __m128i& m2)
+{
+    m2 = _mm_sha256msg2_epu32(_mm_add_epi32(m2, _mm_alignr_epi8(m1, m0, 4)), m1);
+}
+
+static SHANI void TransformSHANI(uint32_t* s, const unsigned char* chunk, size_t nBlocks)
+{
+    const __m128i mask = _mm_set_epi64x(0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL);
+
+    // The instructions want the state as ABEF and CDGH
+    __m128i t1 = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i*)s), 0xB1);
+    __m128i t2 = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i*)(s + 4)), 0x1B);
+    __m128i state0 = _mm_alignr_epi8(t1, t2, 8);
+    __m128i state1 = _mm_blend_epi16(t2, t1, 0xF0);
+
+    for (; nBlocks > 0; nBlocks--, chunk += 64)
+    {
+        __m128i save0 = state0, save1 = state1;
+        __m128i m[4];
+        for (int i = 0; i < 4; i++)
+            m[i] = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(chunk + 16 * i)), mask);
+
+        QuadRound(state0, state1, m[0], 0);
+        QuadRound(state0, state1, m[1], 1);
+        m[0] = _mm_sha256msg1_epu32(m[0], m[1]);
+        QuadRound(state0, state1, m[2], 2);
+        m[1] = _mm_sha256msg1_epu32(m[1], m[2]);
+        QuadRound(state0, state1, m[3], 3);
+        for (int i = 4; i < 16; i++)
+        {
+            // m[i&3] holds the words four quad-rounds back
+            __m128i& mNext = m[i & 3];
+            NextMessage(m[(i + 2) & 3], m[(i + 3) & 3], mNext);
+            if (i < 14)
+                m[(i + 2) & 3] = _mm_sha256msg1_epu32(m[(i + 2) & 3], m[(i + 3) & 3]);
+            QuadRound(state0, state1, mNext, i);
+        }
+
+        state0 = _mm_add_epi32(state0, save0);
+        state1 = _mm_add_epi32(state1, save1);
+    }
+
+    t1 = _mm_shuffle_epi32(state0, 0x1B);
+    t2 = _mm_shuffle_epi32(state1, 0xB1);
+    _mm_storeu_si128((__m128i*)s, _mm_blend_epi16(t1, t2, 0xF0));
+    _mm_storeu_si128((__m128i*)(s + 4), _mm_alignr_epi8(t2, t1, 8));
+}
+
+
+static uint64_t ReadXCR0()
+{
+    uint32_t a, d;
+    __asm__("xgetbv" : "=a"(a), "=d"(d) : "c"(0));
+    return ((uint64_t)d << 32) | a;
+}
+#endif
+
+
+//
+// Dispatch
+//
+
+// Runs a candidate transform and multi-way hash against the generic code
+static bool SelfTest(void (*pTransformTest)(uint32_t*, const unsigned char*, size_t),
+                     void (*pD64Test)(unsigned char*, const unsigned char*), size_t nWays)
+{
+    unsigned char data[512];
+    for (unsigned int i = 0; i < sizeof(data); i++)
+        data[i] = (i * 7 + 3) ^ (i >> 3);
+
+    if (pTransformTest)
+    {
+        uint32_t s1[8], s2[8];
+        memcpy(s1, pSHA256Init, sizeof(s1));
+        memcpy(s2, pSHA256Init, sizeof(s2));
+        TransformGeneric(s1, data, 8);
+        pTransformTest(s2, data, 8);
+        if (memcmp(s1, s2, sizeof(s1)) != 0)
+            return false;
+    }
+
+    if (pD64Test)
+    {
+        unsigned char out1[256], out2[256];
+        for (size_t i = 0; i < nWays; i++)
+        {
+            uint32_t s[8];
+            memcpy(s, pSHA256Init, sizeof(s));
+            TransformGeneric(s, data + 64 * i, 1);
+            CompressGeneric(s, pPad64);
+            unsigned char buf[64];
+            for (int j = 0; j < 8; j++)
+            {
+                WriteBE32(buf + 4 * j, s[j]);
+                WriteBE32(buf + 32 + 4 * j, pPad32[j]);
+            }
+            memcpy(s, pSHA256Init, sizeof(s));
+            TransformGeneric(s, buf, 1);
+            for (int j = 0; j < 8; j++)
+                WriteBE32(out1 + 32 * i + 4 * j, s[j]);
+        }
+        pD64Test(out2, data);
+        if (memcmp(out1, out2, 32 * nWays) != 0)
+            return false;
+    }
+    return true;
+}
+
+std::string SHA256AutoDetect()
+{
+    std::string strRet = "generic";
+    pTransform = TransformGeneric;
+    fPadThroughTransform = false;
+    pTransformD64x4 = NULL;
+    pTransformD64x8 = NULL;
+
+#ifdef USE_SHA256_X86
+    uint32_t a, b, c, d;
+    bool fSSE4 = false, fAVX2 = false, fSHANI = false;
+    if (__get_cpuid(1, &a, &b, &c, &d))
+    {
+        fSSE4 = (c >> 19) & 1;
+        // AVX needs the OS to save the upper halves of the registers
+        bool fAVX = ((c >> 27) & 1) && ((c >> 28) & 1) && (ReadXCR0() & 6) == 6;
+        if (__get_cpuid_max(0, NULL) >= 7)
+        {
+            __cpuid_count(7, 0, a, b, c, d);
+            fAVX2 = fAVX && ((b >> 5) & 1);
+            fSHANI = fSSE4 && ((b >> 29) & 1);
+        }
+    }
+
+    // Every candidate is checked, even the ones the faster SHA-NI makes
+    // unnecessary, so a broken one shows up on any machine that has it
+    std::string strBroken;
+    if (fSSE4 && !SelfTest(NULL, TransformD64SSE4, 4))
+    {
+        fSSE4 = false;
+        strBroken += " sse4";
+    }
+    if (fAVX2 && !SelfTest(NULL, TransformD64AVX2, 8))
+    {
+        fAVX2 = false;
+        strBroken += " avx2";
+    }
+    if (fSHANI && !SelfTest(TransformSHANI, NULL, 0))
+    {
+        fSHANI = false;
+        strBroken += " shani";
+    }
+
+    if (fSHANI)
+    {
+        pTransform = TransformSHANI;
+        fPadThroughTransform = true;
+        strRet = "shani(1way)";
+    }
+    // Four software lanes are slower than the hardware rounds, eight are
+    // still a little faster for merkle nodes
+    if (fSSE4 && !fSHANI)
+    {
+        pTransformD64x4 = TransformD64SSE4;
+        strRet += " sse4(4way)";
+    }
+    if (fAVX2)
+    {
+        pTransformD64x8 = TransformD64AVX2;
+        strRet += " avx2(8way)";
+    }
+    if (!strBroken.empty())
+        strRet += ", failed self test:" + strBroken;
+#endif
+    return strRet;
+}
+
+
+void SHA256Compress(uint32_t* state, const unsigned char* chunk, size_t nBlocks)
+{
+    pTransform(state, chunk, nBlocks);
+}
+
+void SHA256D64(unsigned char* out, const unsigned char* in, size_t nBlocks)
+{
+    if (pTransformD64x8)
+    {
+        for (; nBlocks >= 8; nBlocks -= 8, out += 256, in += 512)
+            pTransformD64x8(out, in);
+    }
+    if (pTransformD64x4)
+    {
+        for (; nBlocks >= 4; nBlocks -= 4, out += 128, in += 256)
+            pTransformD64x4(out, in);
+    }
+    for (; nBlocks > 0; nBlocks--, out += 32, in += 64)
+        TransformD64(out, in);
+}
+
+
+CSHA256::CSHA256()
+{
+    Reset();
+}
+
+CSHA256& CSHA256::Reset()
+{
+    memcpy(s, pSHA256Init, sizeof(s));
+    nBytes = 0;
+    return *this;
+}
+
+CSHA256& CSHA256::Write(const unsigned char* data, size_t len)
+{
+    const unsigned char* end = data + len;
+    size_t nBufSize = nBytes % 64;
+    if (nBufSize && nBufSize + len >= 64)
+    {
+        // Fill the buffer and process it
+        memcpy(buf + nBufSize, data, 64 - nBufSize);
+        nBytes += 64 - nBufSize;
+        data += 64 - nBufSize;
+        pTransform(s, buf, 1);
+        nBufSize = 0;
+    }
+    if (end - data >= 64)
+    {
+        size_t nBlocks = (end - data) / 64;
+        pTransform(s, data, nBlocks);
+        data += 64 * nBlocks;
+        nBytes += 64 * nBlocks;
+    }
+    if (end > data)
+    {
+        // Keep the rest for later
+        memcpy(buf + nBufSize, data, end - data);
+        nBytes += end - data;
+    }
+    return *this;
+}
+
+void CSHA256::Finalize(unsigned char hash[OUTPUT_SIZE])
+{
+    static const unsigned char pad[64] = {0x80};
+    unsigned char sizedesc[8];
+    unsigned long long nBits = nBytes << 3;
+    for (int i = 0; i < 8; i++)
+        sizedesc[i] = nBits >> (56 - 8 * i);
+    Write(pad, 1 + ((119 - (nBytes % 64)) % 64));
+    Write(sizedesc, 8);
+    for (int i = 0; i < 8; i++)
+        WriteBE32(hash + 4 * i, s[i]);
+}
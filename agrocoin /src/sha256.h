@@ -0,0 +1,40 @@
+#ifndef BITCOIN_SHA256_H
+#define BITCOIN_SHA256_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+
+/** SHA-256 hasher.  The compression function is the fastest one this CPU
+ * runs, see SHA256AutoDetect(). */
+class CSHA256
+{
+private:
+    uint32_t s[8];
+    unsigned char buf[64];
+    unsigned long long nBytes;
+
+public:
+    static const size_t OUTPUT_SIZE = 32;
+
+    CSHA256();
+    CSHA256& Write(const unsigned char* data, size_t len);
+    void Finalize(unsigned char hash[OUTPUT_SIZE]);
+    CSHA256& Reset();
+};
+
+/** Runs the compression function over nBlocks 64-byte blocks, for callers
+ * that keep their own midstate */
+void SHA256Compress(uint32_t* state, const unsigned char* chunk, size_t nBlocks);
+
+/** Double SHA-256 of nBlocks separate 64-byte inputs, 32 bytes of output
+ * each: merkle tree inner nodes, computed several at a time where the CPU
+ * has the instructions for it */
+void SHA256D64(unsigned char* out, const unsigned char* in, size_t nBlocks);
+
+/** Checks the SHA-NI, AVX2 and SSE4 code the CPU supports against the
+ * generic implementation and switches to the fastest that passes.  Returns
+ * a description of what is used. */
+std::string SHA256AutoDetect();
+
+#endif
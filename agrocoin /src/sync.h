@@ -12,6 +12,7 @@
 typedef boost::recursive_mutex CCriticalSection;
 
 typedef boost::mutex CWaitableCriticalSection;
+typedef boost::condition_variable CConditionVariable;
 
 #ifdef DEBUG_LOCKORDER
 void EnterCritical(const char* pszName, const char* pszFile, int nLine, void* cs, bool fTry = false);
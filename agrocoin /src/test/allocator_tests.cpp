@@ -0,0 +1,144 @@
+#include <vector>
+#include <boost/test/unit_test.hpp>
+#include <boost/thread.hpp>
+
+#include "main.h"
+#include "allocators.h"
+
+using namespace std;
+
+BOOST_AUTO_TEST_SUITE(allocator_tests)
+
+typedef vector<int, arena_allocator<int> > CArenaInts;
+
+BOOST_AUTO_TEST_CASE(arena_basics)
+{
+    BOOST_CHECK(!CAllocArena::IsActive());
+
+    // Without an arena the allocator is just the heap
+    CArenaInts vHeap(100, 7);
+    BOOST_CHECK_EQUAL(vHeap[99], 7);
+
+    vector<CArenaInts> vv(50);
+    {
+        CAllocArena arena(65536);
+        BOOST_CHECK(CAllocArena::IsActive());
+        for (unsigned int i = 0; i < vv.size(); i++)
+            vv[i].assign(i + 1, i);
+        {
+            CAllocArena inner;
+            CArenaInts v(10, 1);
+            BOOST_CHECK_EQUAL(v[9], 1);
+        }
+        BOOST_CHECK(CAllocArena::IsActive());
+    }
+    BOOST_CHECK(!CAllocArena::IsActive());
+
+    // Consecutive allocations come one after the other in the chunk
+    for (unsigned int i = 1; i < vv.size(); i++)
+    {
+        BOOST_CHECK((char*)&vv[i][0] > (char*)&vv[i-1][0]);
+        BOOST_CHECK((char*)&vv[i][0] - (char*)&vv[i-1][0] < 1024);
+    }
+
+    // The vectors outlive the arena and still grow, shrink and free normally
+    for (unsigned int i = 0; i < vv.size(); i++)
+    {
+        BOOST_CHECK_EQUAL(vv[i].size(), i + 1);
+        BOOST_CHECK_EQUAL(vv[i].back(), (int)i);
+        vv[i].resize(1000, 3);
+    }
+    vv.clear();
+}
+
+BOOST_AUTO_TEST_CASE(arena_first_chunk)
+{
+    // The first chunk leaves room after the first allocation, but no more
+    // than the cap allows
+    for (int fCapped = 0; fCapped < 2; fCapped++)
+    {
+        CAllocArena arena(0, fCapped ? 8192 : (size_t)-1);
+        CArenaInts v1(3000), v2(10);
+        ptrdiff_t nGap = (char*)&v2[0] - (char*)(&v1[0] + v1.size());
+        BOOST_CHECK_EQUAL(nGap >= 0 && nGap < 16, !fCapped);
+    }
+}
+
+static void FreeVectors(vector<CArenaInts>* pvv)
+{
+    pvv->clear();
+}
+
+BOOST_AUTO_TEST_CASE(arena_threads)
+{
+    // Chunks are freed by whichever thread lets go of the last allocation
+    for (int nRound = 0; nRound < 20; nRound++)
+    {
+        vector<CArenaInts> vv1(200), vv2(200);
+        {
+            CAllocArena arena(256);
+            for (unsigned int i = 0; i < vv1.size(); i++)
+            {
+                vv1[i].assign(10, i);
+                vv2[i].assign(10, i);
+            }
+        }
+        boost::thread t(FreeVectors, &vv1);
+        vv2.clear();
+        t.join();
+        BOOST_CHECK(vv1.empty());
+    }
+}
+
+BOOST_AUTO_TEST_CASE(arena_block)
+{
+    CBlock block;
+    block.vtx.resize(50);
+    for (unsigned int i = 0; i < block.vtx.size(); i++)
+    {
+        CTransaction& tx = block.vtx[i];
+        tx.vin.resize(1 + i % 3);
+        tx.vout.resize(1 + i % 4);
+        for (unsigned int j = 0; j < tx.vin.size(); j++)
+        {
+            tx.vin[j].prevout = COutPoint(GetRandHash(), j);
+            tx.vin[j].scriptSig << vector<unsigned char>(72, i);
+        }
+        for (unsigned int j = 0; j < tx.vout.size(); j++)
+        {
+            tx.vout[j].nValue = i * COIN + j;
+            tx.vout[j].scriptPubKey << OP_TRUE;
+        }
+    }
+    block.hashMerkleRoot = block.BuildMerkleTree();
+
+    CDataStream ss(SER_DISK, CLIENT_VERSION);
+    ss << block;
+    string strBlock = ss.str();
+
+    CBlock block2;
+    ss >> block2;
+    BOOST_CHECK(!CAllocArena::IsActive());
+    BOOST_CHECK(block2.BuildMerkleTree() == block.hashMerkleRoot);
+
+    // The transactions' inputs and outputs are close to the transactions
+    char* pBegin = (char*)&block2.vtx[0];
+    for (unsigned int i = 0; i < block2.vtx.size(); i++)
+    {
+        BOOST_CHECK((char*)&block2.vtx[i].vin[0] - pBegin < 1000000);
+        BOOST_CHECK((char*)&block2.vtx[i].vout[0] - pBegin < 1000000);
+    }
+
+    // A copy made afterwards still works when the original is gone, and
+    // writes the same bytes
+    CBlock* pblock3 = new CBlock(block2);
+    block2.SetNull();
+    pblock3->vtx[7].vout.push_back(CTxOut(1, CScript()));
+    pblock3->vtx[7].vout.pop_back();
+    CDataStream ss3(SER_DISK, CLIENT_VERSION);
+    ss3 << *pblock3;
+    BOOST_CHECK(ss3.str() == strBlock);
+    delete pblock3;
+}
+
+BOOST_AUTO_TEST_SUITE_END()
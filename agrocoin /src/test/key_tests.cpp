@@ -4,6 +4,8 @@
 #include <vector>
 
 #include "key.h"
+#include "keystore.h"
+#include "script.h"
 #include "base58.h"
 #include "uint256.h"
 #include "util.h"
@@ -22,6 +24,54 @@ static const CBitcoinAddress addr2C("Lgb6tdqmdW3n5E12johSuEAqRMt4kAr7yu");
 
 static const string strAddressBad("LRjyUS2uuieEPkhZNdQz8hE5YycxVEqSXA");
 
+// What CheckSig used to do with every signature
+static bool VerifyOpenSSL(const vector<unsigned char>& vchPubKey, uint256 hash, const vector<unsigned char>& vchSig)
+{
+    CKey key;
+    return key.SetPubKey(CPubKey(vchPubKey)) && key.Verify(hash, vchSig);
+}
+
+static vector<unsigned char> EncodeDER(const vector<unsigned char>& vchR, const vector<unsigned char>& vchS)
+{
+    vector<unsigned char> vchSig;
+    vchSig.push_back(0x30);
+    vchSig.push_back(4 + vchR.size() + vchS.size());
+    vchSig.push_back(0x02);
+    vchSig.push_back(vchR.size());
+    vchSig.insert(vchSig.end(), vchR.begin(), vchR.end());
+    vchSig.push_back(0x02);
+    vchSig.push_back(vchS.size());
+    vchSig.insert(vchSig.end(), vchS.begin(), vchS.end());
+    return vchSig;
+}
+
+// The same signature with S replaced by n - S
+static vector<unsigned char> NegateS(const vector<unsigned char>& vchSig)
+{
+    static const unsigned char pchOrder[32] = {
+        0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xfe,
+        0xba,0xae,0xdc,0xe6,0xaf,0x48,0xa0,0x3b,0xbf,0xd2,0x5e,0x8c,0xd0,0x36,0x41,0x41 };
+    unsigned int nLenR = vchSig[3];
+    vector<unsigned char> vchR(vchSig.begin() + 4, vchSig.begin() + 4 + nLenR);
+    vector<unsigned char> vchS(vchSig.begin() + 6 + nLenR, vchSig.end());
+    while (vchS.size() > 32)
+        vchS.erase(vchS.begin());
+    vchS.insert(vchS.begin(), 32 - vchS.size(), 0);
+
+    int nBorrow = 0;
+    for (int i = 31; i >= 0; i--)
+    {
+        int n = pchOrder[i] - vchS[i] - nBorrow;
+        nBorrow = n < 0;
+        vchS[i] = n & 0xff;
+    }
+    while (vchS.size() > 1 && vchS[0] == 0 && !(vchS[1] & 0x80))
+        vchS.erase(vchS.begin());
+    if (vchS[0] & 0x80)
+        vchS.insert(vchS.begin(), 0);
+    return EncodeDER(vchR, vchS);
+}
+
 
 #ifdef KEY_TESTS_DUMPINFO
 void dumpKeyInfo(uint256 privkey)
@@ -144,4 +194,228 @@ BOOST_AUTO_TEST_CASE(key_test1)
     }
 }
 
+class CTestCryptoKeyStore : public CCryptoKeyStore
+{
+public:
+    bool EncryptKeys(CKeyingMaterial& vMasterKeyIn) { return CCryptoKeyStore::EncryptKeys(vMasterKeyIn); }
+    bool Unlock(const CKeyingMaterial& vMasterKeyIn) { return CCryptoKeyStore::Unlock(vMasterKeyIn); }
+};
+
+BOOST_AUTO_TEST_CASE(key_crypted_cache)
+{
+    CKey key;
+    key.MakeNewKey(true);
+    bool fCompressed;
+    CSecret secret = key.GetSecret(fCompressed);
+    CKeyID keyid = key.GetPubKey().GetID();
+
+    CTestCryptoKeyStore keystore;
+    BOOST_CHECK(keystore.AddKey(key));
+    CKeyingMaterial vMasterKey(WALLET_CRYPTO_KEY_SIZE, 1);
+    BOOST_CHECK(keystore.EncryptKeys(vMasterKey));
+    BOOST_CHECK(keystore.Unlock(vMasterKey));
+
+    CKey keyOut;
+    BOOST_CHECK(keystore.GetKey(keyid, keyOut));
+
+    // Once decrypted the key comes from the cache, so it is still there
+    // after its encrypted secret is swapped for one that won't decrypt
+    vector<unsigned char> vchCryptedSecret;
+    BOOST_CHECK(EncryptSecret(vMasterKey, secret, key.GetPubKey().GetHash(), vchCryptedSecret));
+    BOOST_CHECK(keystore.AddCryptedKey(key.GetPubKey(), vector<unsigned char>()));
+    for (int i = 0; i < 2; i++)
+    {
+        CKey keyOut;
+        BOOST_CHECK(keystore.GetKey(keyid, keyOut));
+        BOOST_CHECK(keyOut.GetPubKey() == key.GetPubKey());
+        BOOST_CHECK(keyOut.GetSecret(fCompressed) == secret);
+    }
+
+    // and is gone once locked, so after unlocking again it is decrypted
+    // from whatever encrypted secret is there
+    BOOST_CHECK(keystore.Lock());
+    BOOST_CHECK(!keystore.GetKey(keyid, keyOut));
+    BOOST_CHECK(keystore.AddCryptedKey(key.GetPubKey(), vchCryptedSecret));
+    BOOST_CHECK(keystore.Unlock(vMasterKey));
+    BOOST_CHECK(keystore.AddCryptedKey(key.GetPubKey(), vector<unsigned char>()));
+    BOOST_CHECK(!keystore.GetKey(keyid, keyOut));
+    BOOST_CHECK(keystore.AddCryptedKey(key.GetPubKey(), vchCryptedSecret));
+    BOOST_CHECK(keystore.GetKey(keyid, keyOut));
+    BOOST_CHECK(keyOut.GetSecret(fCompressed) == secret);
+}
+
+BOOST_AUTO_TEST_CASE(key_raw)
+{
+    for (int nCompressed = 0; nCompressed < 2; nCompressed++)
+    {
+        CKey key;
+        key.MakeNewKey(nCompressed != 0);
+        bool fCompressed;
+        CSecret secret = key.GetSecret(fCompressed);
+
+        // The key made from the raw one signs like the original
+        CRawKey rawkey(key);
+        BOOST_CHECK(rawkey.GetPubKey() == key.GetPubKey());
+        BOOST_CHECK(rawkey.GetSecret() == secret);
+        BOOST_CHECK_EQUAL(rawkey.IsCompressed(), nCompressed != 0);
+        CKey keyOut;
+        BOOST_CHECK(rawkey.GetKey(keyOut));
+        BOOST_CHECK(keyOut.GetPubKey() == key.GetPubKey());
+        BOOST_CHECK(keyOut.GetSecret(fCompressed) == secret);
+        BOOST_CHECK_EQUAL(fCompressed, nCompressed != 0);
+        BOOST_CHECK(keyOut.IsValid());
+        uint256 hash = GetRandHash();
+        vector<unsigned char> vchSig;
+        BOOST_CHECK(keyOut.Sign(hash, vchSig));
+        BOOST_CHECK(key.GetPubKey().Verify(hash, vchSig));
+
+        // Key stores hand out the public key and secret without a CKey
+        CBasicKeyStore keystore;
+        BOOST_CHECK(keystore.AddKey(key));
+        CPubKey pubkey;
+        BOOST_CHECK(keystore.GetPubKey(key.GetPubKey().GetID(), pubkey));
+        BOOST_CHECK(pubkey == key.GetPubKey());
+        CSecret secretOut;
+        BOOST_CHECK(keystore.GetSecret(key.GetPubKey().GetID(), secretOut, fCompressed));
+        BOOST_CHECK(secretOut == secret);
+        BOOST_CHECK_EQUAL(fCompressed, nCompressed != 0);
+        BOOST_CHECK(!keystore.GetPubKey(CKeyID(), pubkey));
+    }
+}
+
+BOOST_AUTO_TEST_CASE(keystore_fingerprints)
+{
+    // Grows through several tables and still finds everything
+    CFingerprintSet set;
+    for (uint64 n = 1; n <= 5000; n++)
+        set.Insert(n * 0x9e3779b97f4a7c15ULL);
+    for (uint64 n = 1; n <= 5000; n++)
+    {
+        BOOST_CHECK(set.Contains(n * 0x9e3779b97f4a7c15ULL));
+        BOOST_CHECK(!set.Contains(n * 0x9e3779b97f4a7c15ULL + 1));
+    }
+
+    CBasicKeyStore keystore;
+    CTestCryptoKeyStore keystoreCrypted;
+    CKey key[4];
+    for (int i = 0; i < 4; i++)
+        key[i].MakeNewKey(i % 2 == 0);
+    for (int i = 0; i < 2; i++)
+    {
+        keystore.AddKey(key[i]);
+        keystoreCrypted.AddKey(key[i]);
+    }
+    CKeyingMaterial vMasterKey(WALLET_CRYPTO_KEY_SIZE, 1);
+    BOOST_CHECK(keystoreCrypted.EncryptKeys(vMasterKey));
+
+    CScript scriptMultisig;
+    scriptMultisig << OP_1 << key[0].GetPubKey() << key[1].GetPubKey() << OP_2 << OP_CHECKMULTISIG;
+    CScript scriptOther;
+    scriptOther << OP_1 << key[2].GetPubKey() << OP_1 << OP_CHECKMULTISIG;
+    keystore.AddCScript(scriptMultisig);
+    keystore.AddCScript(scriptOther);
+
+    // Standard outputs to keys and scripts that aren't ours are turned down
+    // straight away, IsMine agrees on all of them
+    for (int i = 0; i < 4; i++)
+    {
+        CScript scriptPubKeyHash, scriptPubKey;
+        scriptPubKeyHash.SetDestination(key[i].GetPubKey().GetID());
+        scriptPubKey << key[i].GetPubKey() << OP_CHECKSIG;
+        BOOST_CHECK_EQUAL(keystore.MayHaveScript(scriptPubKeyHash), i < 2);
+        BOOST_CHECK_EQUAL(keystore.MayHaveScript(scriptPubKey), i < 2);
+        BOOST_CHECK_EQUAL(keystoreCrypted.MayHaveScript(scriptPubKeyHash), i < 2);
+        BOOST_CHECK_EQUAL(IsMine(keystore, scriptPubKeyHash), i < 2);
+        BOOST_CHECK_EQUAL(IsMine(keystore, scriptPubKey), i < 2);
+        BOOST_CHECK_EQUAL(IsMine(keystoreCrypted, scriptPubKey), i < 2);
+    }
+
+    CScript scriptHash;
+    scriptHash.SetDestination(scriptMultisig.GetID());
+    BOOST_CHECK(keystore.MayHaveScript(scriptHash));
+    BOOST_CHECK(IsMine(keystore, scriptHash));
+    // A script we have whose keys we don't
+    scriptHash.SetDestination(scriptOther.GetID());
+    BOOST_CHECK(keystore.MayHaveScript(scriptHash));
+    BOOST_CHECK(!IsMine(keystore, scriptHash));
+    scriptHash.SetDestination(scriptMultisig.GetID());
+    BOOST_CHECK(!keystoreCrypted.MayHaveScript(scriptHash));
+
+    // Anything else is left to IsMine
+    BOOST_CHECK(keystore.MayHaveScript(scriptOther));
+    BOOST_CHECK(IsMine(keystore, scriptMultisig));
+}
+
+BOOST_AUTO_TEST_CASE(pubkey_verify)
+{
+    // CPubKey::Verify may take a faster path, but has to give OpenSSL's
+    // answer for every odd encoding
+    for (int nCompressed = 0; nCompressed < 2; nCompressed++)
+    {
+        CKey key;
+        key.MakeNewKey(nCompressed != 0);
+        vector<unsigned char> vchPubKey = key.GetPubKey().Raw();
+        for (int n = 0; n < 8; n++)
+        {
+            uint256 hash = GetRandHash();
+            vector<unsigned char> vchSig;
+            BOOST_CHECK(key.Sign(hash, vchSig));
+
+            vector<vector<unsigned char> > vSigs;
+            vSigs.push_back(vchSig);
+            vSigs.push_back(NegateS(vchSig));
+            unsigned int nLenR = vchSig[3];
+            vector<unsigned char> vchR(vchSig.begin() + 4, vchSig.begin() + 4 + nLenR);
+            vector<unsigned char> vchS(vchSig.begin() + 6 + nLenR, vchSig.end());
+            vector<unsigned char> vchPadded(vchR);
+            vchPadded.insert(vchPadded.begin(), 0);
+            vSigs.push_back(EncodeDER(vchPadded, vchS));
+            vSigs.push_back(EncodeDER(vchS, vchR));
+            vector<unsigned char> vchSigLong(vchSig);
+            vchSigLong.push_back(0);
+            vSigs.push_back(vchSigLong);
+            vSigs.push_back(vector<unsigned char>(vchSig.begin(), vchSig.end() - 1));
+            vector<unsigned char> vchSigBadLen(vchSig);
+            vchSigBadLen[1]++;
+            vSigs.push_back(vchSigBadLen);
+
+            vector<vector<unsigned char> > vPubKeys;
+            vPubKeys.push_back(vchPubKey);
+            vector<unsigned char> vchHybrid(vchPubKey);
+            if (vchHybrid.size() == 65)
+                vchHybrid[0] = 0x06 | (vchHybrid[64] & 1);
+            vPubKeys.push_back(vchHybrid);
+            vector<unsigned char> vchBadKey(vchPubKey);
+            vchBadKey[0] = 0x05;
+            vPubKeys.push_back(vchBadKey);
+            vPubKeys.push_back(vector<unsigned char>(vchPubKey.begin(), vchPubKey.end() - 1));
+
+            BOOST_CHECK(CPubKey(vchPubKey).Verify(hash, vSigs[0]));
+            BOOST_CHECK(CPubKey(vchPubKey).Verify(hash, vSigs[1]));
+            BOOST_CHECK(!CPubKey(vchPubKey).Verify(~hash, vSigs[0]));
+#ifdef USE_SECP256K1
+            // libsecp256k1 answers for strict signatures itself, high S too
+            BOOST_CHECK_EQUAL(CPubKey(vchPubKey).VerifySecp256k1(hash, vSigs[0]), 1);
+            BOOST_CHECK_EQUAL(CPubKey(vchPubKey).VerifySecp256k1(hash, vSigs[1]), 1);
+            BOOST_CHECK_EQUAL(CPubKey(vchPubKey).VerifySecp256k1(~hash, vSigs[0]), 0);
+#endif
+            BOOST_FOREACH(const vector<unsigned char>& vchKey, vPubKeys)
+                BOOST_FOREACH(const vector<unsigned char>& vchTry, vSigs)
+                {
+                    BOOST_CHECK_EQUAL(CPubKey(vchKey).Verify(hash, vchTry), VerifyOpenSSL(vchKey, hash, vchTry));
+                    BOOST_CHECK_EQUAL(CPubKey(vchKey).Verify(~hash, vchTry), VerifyOpenSSL(vchKey, ~hash, vchTry));
+#ifdef USE_SECP256K1
+                    // and whenever it does, OpenSSL agrees
+                    int nResult = CPubKey(vchKey).VerifySecp256k1(hash, vchTry);
+                    if (nResult >= 0)
+                        BOOST_CHECK_EQUAL(nResult == 1, VerifyOpenSSL(vchKey, hash, vchTry));
+                    nResult = CPubKey(vchKey).VerifySecp256k1(~hash, vchTry);
+                    if (nResult >= 0)
+                        BOOST_CHECK_EQUAL(nResult == 1, VerifyOpenSSL(vchKey, ~hash, vchTry));
+#endif
+                }
+        }
+    }
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -3,6 +3,7 @@
 
 #include "base58.h"
 #include "util.h"
+#include "main.h"
 #include "bitcoinrpc.h"
 
 using namespace std;
@@ -66,4 +67,113 @@ BOOST_FIXTURE_TEST_CASE(rpc_addmultisig, TestNetFixture)
     BOOST_CHECK_THROW(addmultisig(createArgs(2, short2.c_str()), false), runtime_error);
 }
 
+BOOST_AUTO_TEST_CASE(rpc_streamwriter)
+{
+    // Streamed output must match what json_spirit writes for the same tree
+    Object obj;
+    obj.push_back(Pair("name", "a \"quoted\" string"));
+    obj.push_back(Pair("amount", 1.5));
+    obj.push_back(Pair("empty", Array()));
+    Array inner;
+    inner.push_back(1);
+    inner.push_back(Value::null);
+    inner.push_back(Object());
+    obj.push_back(Pair("list", inner));
+
+    // and so must the tree built in place, and raw JSON spliced into either
+    ostringstream ss;
+    Value value;
+    CJSONStreamWriter writerText(ss);
+    CJSONStreamWriter writerValue(value);
+    CJSONStreamWriter* writers[] = { &writerText, &writerValue };
+    BOOST_FOREACH(CJSONStreamWriter* pwriter, writers)
+    {
+        CJSONStreamWriter& writer = *pwriter;
+        writer.BeginObject();
+        writer.Write("name", "a \"quoted\" string");
+        writer.Write("amount", 1.5);
+        writer.Key("empty");
+        writer.BeginArray();
+        writer.EndArray();
+        writer.Key("list");
+        writer.BeginArray();
+        writer.Write(1);
+        writer.WriteRaw("null");
+        writer.BeginObject();
+        writer.EndObject();
+        writer.EndArray();
+        writer.EndObject();
+    }
+
+    BOOST_CHECK_EQUAL(ss.str(), write_string(Value(obj), false));
+    BOOST_CHECK_EQUAL(write_string(value, false), write_string(Value(obj), false));
+}
+
+BOOST_AUTO_TEST_CASE(rpc_streamtovalue)
+{
+    // Help text of streaming commands still reaches the caller
+    rpcfn_type getrawmempool = tableRPC["getrawmempool"]->actor;
+    BOOST_CHECK_THROW(getrawmempool(Array(), true), runtime_error);
+}
+
+BOOST_AUTO_TEST_CASE(rpc_readjson)
+{
+    // The fast reader must agree with json_spirit, including on the
+    // documents it hands back to json_spirit
+    const char* docs[] = {
+        "{\"method\":\"getwork\",\"params\":[],\"id\":1}",
+        "[1, -2, 3.25, -0.5e-3, 1E5, 18446744073709551615, -9223372036854775808]",
+        "{\"a\" : [true, false, null, {}, []], \"b\": \"x\\n\\\"y\\u0041\"}",
+        "\"\\u00e9\"",
+        "[0123]",
+        "[123456789012345678901]",
+        "[1.000000000000000000001]",
+        "{\"a\":1",
+        "[1,]",
+        "",
+    };
+    for (unsigned int i = 0; i < sizeof(docs)/sizeof(docs[0]); i++)
+    {
+        string str = docs[i];
+        Value fast, spirit;
+        bool fFast = ReadJSON(str, fast);
+        bool fSpirit = read_string(str, spirit);
+        BOOST_CHECK_EQUAL(fFast, fSpirit);
+        if (fFast && fSpirit)
+            BOOST_CHECK_EQUAL(write_string(fast, false), write_string(spirit, false));
+    }
+}
+
+BOOST_AUTO_TEST_CASE(rpc_longpoll_newblock)
+{
+    // A new best chain ends a getwork long-poll straight away, not after
+    // the minute a memory pool change has to wait.  The tip keeps moving
+    // until the poll returns, in case the poller only copied it after the
+    // first move.
+    uint256 hashBestChainOld = hashBestChain;
+    boost::thread threadPoll(WaitForNewGetWork);
+    bool fReturned = false;
+    for (int i = 0; i < 50 && !fReturned; i++)
+    {
+        {
+            LOCK(cs_main);
+            boost::lock_guard<CWaitableCriticalSection> lock(csWorkChange);
+            hashBestChain = GetRandHash();
+        }
+        cvWorkChange.notify_all();
+        fReturned = threadPoll.timed_join(boost::posix_time::milliseconds(100));
+    }
+    BOOST_CHECK(fReturned);
+    if (!fReturned)
+    {
+        fShutdown = true;
+        cvWorkChange.notify_all();
+        threadPoll.join();
+        fShutdown = false;
+    }
+    LOCK(cs_main);
+    boost::lock_guard<CWaitableCriticalSection> lock(csWorkChange);
+    hashBestChain = hashBestChainOld;
+}
+
 BOOST_AUTO_TEST_SUITE_END()
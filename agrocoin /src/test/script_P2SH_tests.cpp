@@ -114,6 +114,58 @@ BOOST_AUTO_TEST_CASE(sign)
         }
 }
 
+BOOST_AUTO_TEST_CASE(sign_bulk)
+{
+    // SignSignatures() signs many inputs at once, straight and P2SH alike
+    CBasicKeyStore keystore;
+    CKey key[2];
+    for (int i = 0; i < 2; i++)
+    {
+        key[i].MakeNewKey(i == 0);
+        keystore.AddKey(key[i]);
+    }
+    CScript standardScript;
+    standardScript.SetDestination(key[0].GetPubKey().GetID());
+    keystore.AddCScript(standardScript);
+
+    CTransaction txFrom;
+    txFrom.vout.resize(4);
+    txFrom.vout[0].scriptPubKey = standardScript;
+    txFrom.vout[1].scriptPubKey << key[1].GetPubKey() << OP_CHECKSIG;
+    txFrom.vout[2].scriptPubKey.SetDestination(standardScript.GetID());
+    txFrom.vout[3].scriptPubKey << OP_TRUE;
+
+    CTransaction txTo;
+    txTo.vin.resize(60);
+    txTo.vout.resize(1);
+    txTo.vout[0].nValue = 1;
+    vector<const CScript*> vpFromPubKeys;
+    for (unsigned int i = 0; i < txTo.vin.size(); i++)
+    {
+        txTo.vin[i].prevout.hash = txFrom.GetHash();
+        txTo.vin[i].prevout.n = i % 3;
+        vpFromPubKeys.push_back(&txFrom.vout[i % 3].scriptPubKey);
+    }
+    // One input left alone
+    txTo.vin[7].scriptSig << OP_1;
+    vpFromPubKeys[7] = NULL;
+
+    BOOST_CHECK(SignSignatures(keystore, vpFromPubKeys, txTo));
+    for (unsigned int i = 0; i < txTo.vin.size(); i++)
+    {
+        if (i == 7)
+            BOOST_CHECK(txTo.vin[i].scriptSig == CScript() << OP_1);
+        else
+            BOOST_CHECK_MESSAGE(VerifySignature(txFrom, txTo, i, true, 0), strprintf("VerifySignature %u", i));
+    }
+
+    // An input that can't be signed makes the whole thing incomplete
+    txTo.vin[9].prevout.n = 3;
+    vpFromPubKeys[9] = &txFrom.vout[3].scriptPubKey;
+    BOOST_CHECK(!SignSignatures(keystore, vpFromPubKeys, txTo));
+    BOOST_CHECK(VerifySignature(txFrom, txTo, 10, true, 0));
+}
+
 BOOST_AUTO_TEST_CASE(norecurse)
 {
     // Make sure only the outer pay-to-script-hash does the
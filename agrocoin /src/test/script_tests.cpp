@@ -19,6 +19,8 @@ using namespace std;
 using namespace json_spirit;
 using namespace boost::algorithm;
 
+typedef vector<unsigned char> valtype;
+
 extern uint256 SignatureHash(CScript scriptCode, const CTransaction& txTo, unsigned int nIn, int nHashType);
 extern bool VerifyScript(const CScript& scriptSig, const CScript& scriptPubKey, const CTransaction& txTo, unsigned int nIn,
                          bool fValidatePayToScriptHash, int nHashType);
@@ -196,6 +198,154 @@ BOOST_AUTO_TEST_CASE(script_PushData)
     BOOST_CHECK(pushdata4Stack == directStack);
 }
 
+BOOST_AUTO_TEST_CASE(script_num)
+{
+    // Decoding and encoding have to match CBigNum exactly, including for
+    // non-minimal encodings and negative zero
+    vector<valtype> vvch;
+    vvch.push_back(valtype());
+    for (int i = 0; i < 2000; i++)
+    {
+        valtype vch(1 + GetRand(CScriptNum::nMaxNumSize));
+        for (unsigned int j = 0; j < vch.size(); j++)
+            vch[j] = GetRandInt(256);
+        vvch.push_back(vch);
+    }
+    static const unsigned char special[][4] = {
+        { 0x80 }, { 0x00, 0x80 }, { 0x00, 0x00, 0x00, 0x80 }, { 0xff, 0xff, 0xff, 0x7f }, { 0xff, 0xff, 0xff, 0xff },
+    };
+    static const unsigned int nSpecialSizes[] = { 1, 2, 4, 4, 4 };
+    for (int i = 0; i < 5; i++)
+        vvch.push_back(valtype(special[i], special[i] + nSpecialSizes[i]));
+
+    BOOST_FOREACH(const valtype& vch, vvch)
+    {
+        CScriptNum num((CScriptValue(vch)));
+        CBigNum bn(vch);
+        BOOST_CHECK_EQUAL(num.getint(), bn.getint());
+        BOOST_CHECK(num.getvch().getvch() == bn.getvch());
+
+        // Sums of two operands can take five bytes
+        CScriptNum sum = num + num;
+        BOOST_CHECK(sum.getvch().getvch() == (bn + bn).getvch());
+        BOOST_CHECK((-num).getvch().getvch() == (-bn).getvch());
+    }
+
+    BOOST_CHECK_THROW(CScriptNum(CScriptValue(5, 1)), scriptnum_error);
+}
+
+BOOST_AUTO_TEST_CASE(script_Solver_encodings)
+{
+    // The usual encodings are recognized from their bytes; others of the
+    // same templates have to come out the same through the full match
+    CKey key[3];
+    for (int i = 0; i < 3; i++)
+        key[i].MakeNewKey(i != 1);
+    valtype vchPubKey = key[1].GetPubKey().Raw();
+    CKeyID keyID = key[1].GetPubKey().GetID();
+    valtype vchKeyID(keyID.begin(), keyID.end());
+
+    vector<CScript> vScripts;
+    vector<txnouttype> vTypes;
+
+    CScript s;
+    s << vchPubKey << OP_CHECKSIG;
+    vScripts.push_back(s); vTypes.push_back(TX_PUBKEY);
+    s.clear();
+    s.push_back(OP_PUSHDATA1);
+    s.push_back(vchPubKey.size());
+    s.insert(s.end(), vchPubKey.begin(), vchPubKey.end());
+    s << OP_CHECKSIG;
+    vScripts.push_back(s); vTypes.push_back(TX_PUBKEY);
+
+    s.clear();
+    s << OP_DUP << OP_HASH160 << keyID << OP_EQUALVERIFY << OP_CHECKSIG;
+    vScripts.push_back(s); vTypes.push_back(TX_PUBKEYHASH);
+    s.clear();
+    s << OP_DUP << OP_HASH160;
+    s.push_back(OP_PUSHDATA1);
+    s.push_back(20);
+    s.insert(s.end(), vchKeyID.begin(), vchKeyID.end());
+    s << OP_EQUALVERIFY << OP_CHECKSIG;
+    vScripts.push_back(s); vTypes.push_back(TX_PUBKEYHASH);
+
+    s.clear();
+    s << OP_2 << key[0].GetPubKey() << key[1].GetPubKey() << key[2].GetPubKey() << OP_3 << OP_CHECKMULTISIG;
+    vScripts.push_back(s); vTypes.push_back(TX_MULTISIG);
+    s.clear();
+    s << OP_2 << key[0].GetPubKey();
+    s.push_back(OP_PUSHDATA1);
+    s.push_back(vchPubKey.size());
+    s.insert(s.end(), vchPubKey.begin(), vchPubKey.end());
+    s << key[2].GetPubKey() << OP_3 << OP_CHECKMULTISIG;
+    vScripts.push_back(s); vTypes.push_back(TX_MULTISIG);
+
+    for (unsigned int i = 0; i < vScripts.size(); i += 2)
+    {
+        vector<valtype> vSolutions1, vSolutions2;
+        txnouttype type1, type2;
+        BOOST_CHECK(Solver(vScripts[i], type1, vSolutions1));
+        BOOST_CHECK(Solver(vScripts[i+1], type2, vSolutions2));
+        BOOST_CHECK_EQUAL(type1, vTypes[i]);
+        BOOST_CHECK_EQUAL(type2, vTypes[i]);
+        BOOST_CHECK(vSolutions1 == vSolutions2);
+    }
+
+    // Not quite a template
+    vector<valtype> vSolutions;
+    txnouttype whichType;
+    s = vScripts[0];
+    s.push_back(OP_NOP);
+    BOOST_CHECK(!Solver(s, whichType, vSolutions));
+    s = vScripts[2];
+    s[24] = OP_CHECKSIGVERIFY;
+    BOOST_CHECK(!Solver(s, whichType, vSolutions));
+    s = vScripts[4];
+    s.erase(s.begin() + 40);
+    BOOST_CHECK(!Solver(s, whichType, vSolutions));
+    s = vScripts[4];
+    s[0] = OP_4;
+    BOOST_CHECK(!Solver(s, whichType, vSolutions));
+    s = vScripts[4];
+    s[s.size()-2] = OP_2;
+    BOOST_CHECK(!Solver(s, whichType, vSolutions));
+    BOOST_CHECK(!IsStandard(s));
+}
+
+BOOST_AUTO_TEST_CASE(script_value)
+{
+    // Short values stay inline, long ones move to the heap and back
+    CScriptValue vch(3, 7);
+    valtype vchLong(CScriptValue::INLINE_SIZE + 50);
+    for (unsigned int i = 0; i < vchLong.size(); i++)
+        vchLong[i] = i;
+    CScriptValue vchCopy(vchLong);
+    vch.insert(vch.end(), vchCopy.begin(), vchCopy.end());
+    BOOST_CHECK_EQUAL(vch.size(), vchLong.size() + 3);
+    BOOST_CHECK(valtype(vch.begin() + 3, vch.end()) == vchLong);
+
+    vch.erase(vch.begin(), vch.begin() + 3);
+    BOOST_CHECK(vch == vchCopy);
+    vch.resize(2);
+    BOOST_CHECK(vch.getvch() == valtype(vchLong.begin(), vchLong.begin() + 2));
+
+    CScriptValue vchShort(vch);
+    vch = vchCopy;
+    BOOST_CHECK(vch == vchCopy);
+    BOOST_CHECK(vchShort != vch);
+    BOOST_CHECK_EQUAL(vchShort.size(), 2U);
+
+    // Stack elements still behave through the vector overload of EvalScript
+    vector<valtype> stack;
+    stack.push_back(vchLong);
+    CScript script;
+    script << OP_DUP << OP_SIZE << 1 << OP_ADD;
+    BOOST_CHECK(EvalScript(stack, script, CTransaction(), 0, 0));
+    BOOST_CHECK_EQUAL(stack.size(), 3U);
+    BOOST_CHECK(stack[1] == vchLong);
+    BOOST_CHECK(stack[2] == CBigNum(vchLong.size() + 1).getvch());
+}
+
 CScript
 sign_multisig(CScript scriptPubKey, std::vector<CKey> keys, CTransaction transaction)
 {
@@ -442,4 +592,48 @@ BOOST_AUTO_TEST_CASE(script_combineSigs)
     BOOST_CHECK(combined == partial3c);
 }
 
+BOOST_AUTO_TEST_CASE(script_sighash_context)
+{
+    // CSignatureHashContext gives the same hashes as SignatureHash() for
+    // every input and hash type, out of range SIGHASH_SINGLE included.
+    // The last two have enough inputs for a three byte input count.
+    int nHashTypes[] = { SIGHASH_ALL, SIGHASH_NONE, SIGHASH_SINGLE, 0, 4 };
+    for (int nTest = 0; nTest < 22; nTest++)
+    {
+        CTransaction txTo;
+        txTo.nVersion = GetRandInt(3);
+        txTo.nLockTime = GetRandInt(2) ? 0 : GetRandInt(1000000);
+        txTo.vin.resize(nTest < 20 ? GetRandInt(40) + 1 : 253 + GetRandInt(50));
+        txTo.vout.resize(GetRandInt(40));
+        for (unsigned int i = 0; i < txTo.vin.size(); i++)
+        {
+            txTo.vin[i].prevout = COutPoint(GetRandHash(), GetRandInt(5));
+            txTo.vin[i].scriptSig << GetRandInt(1000);
+            txTo.vin[i].nSequence = GetRandInt(2) ? UINT_MAX : GetRandInt(1000);
+        }
+        for (unsigned int i = 0; i < txTo.vout.size(); i++)
+        {
+            txTo.vout[i].nValue = GetRand(50 * COIN);
+            txTo.vout[i].scriptPubKey << OP_DUP << GetRandHash() << i;
+        }
+        CScript scriptCode;
+        scriptCode << OP_1 << OP_CODESEPARATOR << GetRandInt(1000) << OP_CHECKSIG;
+
+        CSignatureHashContext ctx(txTo);
+        for (unsigned int nIn = 0; nIn < txTo.vin.size(); nIn++)
+        {
+            BOOST_FOREACH(int nHashType, nHashTypes)
+            {
+                for (int fAnyoneCanPay = 0; fAnyoneCanPay < 2; fAnyoneCanPay++)
+                {
+                    int nType = nHashType | (fAnyoneCanPay ? SIGHASH_ANYONECANPAY : 0);
+                    BOOST_CHECK_MESSAGE(ctx.SignatureHash(scriptCode, nIn, nType) == SignatureHash(scriptCode, txTo, nIn, nType),
+                                        strprintf("test %d input %u type %d", nTest, nIn, nType));
+                }
+            }
+        }
+        BOOST_CHECK(ctx.SignatureHash(scriptCode, txTo.vin.size(), SIGHASH_ALL) == 1);
+    }
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,94 @@
+#include <vector>
+#include <boost/test/unit_test.hpp>
+
+#include "main.h"
+#include "protocol.h"
+
+using namespace std;
+
+BOOST_AUTO_TEST_SUITE(serialize_tests)
+
+// A flat type's vector has to come out byte for byte as the element by
+// element loop would write it, and read back the same
+template<typename T>
+static void CheckFlatVector(const vector<T>& v)
+{
+    BOOST_CHECK(is_serialize_flat<T>::value);
+    BOOST_CHECK_EQUAL(sizeof(T), v[0].GetSerializeSize(SER_NETWORK, PROTOCOL_VERSION));
+    BOOST_CHECK_EQUAL(sizeof(T), ::GetSerializeSize(v[0], SER_NETWORK, PROTOCOL_VERSION));
+
+    CDataStream ssLoop(SER_NETWORK, PROTOCOL_VERSION);
+    WriteCompactSize(ssLoop, v.size());
+    for (unsigned int i = 0; i < v.size(); i++)
+        v[i].Serialize(ssLoop, SER_NETWORK, PROTOCOL_VERSION);
+
+    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+    ss << v;
+    BOOST_CHECK(ss.str() == ssLoop.str());
+    BOOST_CHECK_EQUAL(::GetSerializeSize(v, SER_NETWORK, PROTOCOL_VERSION), ss.size());
+
+    vector<T> v2;
+    ss >> v2;
+    BOOST_CHECK(ss.empty());
+    BOOST_CHECK(v2.size() == v.size());
+    CDataStream ss2(SER_NETWORK, PROTOCOL_VERSION);
+    ss2 << v2;
+    BOOST_CHECK(ss2.str() == ssLoop.str());
+}
+
+BOOST_AUTO_TEST_CASE(flat_vectors)
+{
+    // Past 253 entries so the count takes a three byte compact size
+    vector<uint256> vHash;
+    vector<uint160> vHash160;
+    vector<COutPoint> vOutPoint;
+    vector<CInv> vInv;
+    vector<CDiskTxPos> vPos;
+    for (unsigned int i = 0; i < 300; i++)
+    {
+        uint256 hash = GetRandHash();
+        uint160 hash160;
+        memcpy(hash160.begin(), hash.begin(), hash160.size());
+        vHash.push_back(hash);
+        vHash160.push_back(hash160);
+        vOutPoint.push_back(COutPoint(hash, i));
+        vInv.push_back(CInv(MSG_TX, hash));
+        vPos.push_back(CDiskTxPos(i, i * 1000, i * 1000 + 81));
+    }
+    CheckFlatVector(vHash);
+    CheckFlatVector(vHash160);
+    CheckFlatVector(vOutPoint);
+    CheckFlatVector(vInv);
+    CheckFlatVector(vPos);
+
+    BOOST_CHECK(!is_serialize_flat<CTxIn>::value);
+    BOOST_CHECK(!is_serialize_flat<CTransaction>::value);
+}
+
+BOOST_AUTO_TEST_CASE(flat_sizes)
+{
+    // Sizes worked out without serializing still match what is written
+    CTransaction tx;
+    tx.vin.resize(3);
+    tx.vout.resize(2);
+    for (unsigned int i = 0; i < tx.vin.size(); i++)
+    {
+        tx.vin[i].prevout = COutPoint(GetRandHash(), i);
+        tx.vin[i].scriptSig << vector<unsigned char>(70 + i * 100, i);
+    }
+    tx.vout[0].scriptPubKey << OP_TRUE;
+    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+    ss << tx;
+    BOOST_CHECK_EQUAL(::GetSerializeSize(tx, SER_NETWORK, PROTOCOL_VERSION), ss.size());
+
+    CTxIndex txindex(CDiskTxPos(1, 2, 3), 40);
+    txindex.vSpent[7] = CDiskTxPos(4, 5, 6);
+    CDataStream ssIndex(SER_DISK, CLIENT_VERSION);
+    ssIndex << txindex;
+    BOOST_CHECK_EQUAL(::GetSerializeSize(txindex, SER_DISK, CLIENT_VERSION), ssIndex.size());
+    CTxIndex txindex2;
+    ssIndex >> txindex2;
+    BOOST_CHECK(txindex2 == txindex);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
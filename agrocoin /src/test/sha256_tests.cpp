@@ -0,0 +1,104 @@
+#include <vector>
+#include <boost/test/unit_test.hpp>
+
+#include "main.h"
+#include "sha256.h"
+#include "util.h"
+
+#include <openssl/sha.h>
+
+using namespace std;
+
+BOOST_AUTO_TEST_SUITE(sha256_tests)
+
+static string SHA256Hex(const string& str)
+{
+    unsigned char hash[CSHA256::OUTPUT_SIZE];
+    CSHA256().Write((const unsigned char*)str.data(), str.size()).Finalize(hash);
+    return HexStr(hash, hash + sizeof(hash));
+}
+
+BOOST_AUTO_TEST_CASE(sha256_vectors)
+{
+    BOOST_CHECK_EQUAL(SHA256Hex(""), "e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b855");
+    BOOST_CHECK_EQUAL(SHA256Hex("abc"), "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad");
+    BOOST_CHECK_EQUAL(SHA256Hex("abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq"),
+                      "248d6a61d20638b8e5c026930c3e6039a33ce45964ff2167f6ecedd419db06c1");
+    BOOST_CHECK_EQUAL(SHA256Hex(string(1000000, 'a')), "cdc76e5c9914fb9281a1c7e284d73e67f1809a48a497200e046d39ccc7112cd0");
+}
+
+BOOST_AUTO_TEST_CASE(sha256_openssl)
+{
+    // Every length across a few block boundaries, written in uneven pieces
+    vector<unsigned char> vch(300);
+    for (unsigned int i = 0; i < vch.size(); i++)
+        vch[i] = i * 37 + 11;
+    for (unsigned int nLen = 0; nLen <= vch.size(); nLen++)
+    {
+        unsigned char hash1[32], hash2[32];
+        SHA256(&vch[0], nLen, hash1);
+        CSHA256 ctx;
+        for (unsigned int nPos = 0; nPos < nLen; )
+        {
+            unsigned int n = min(nLen - nPos, nPos % 71 + 1);
+            ctx.Write(&vch[nPos], n);
+            nPos += n;
+        }
+        ctx.Finalize(hash2);
+        BOOST_CHECK_MESSAGE(memcmp(hash1, hash2, 32) == 0, strprintf("length %u", nLen));
+    }
+}
+
+BOOST_AUTO_TEST_CASE(sha256_d64)
+{
+    BOOST_CHECK(SHA256AutoDetect().find("failed") == string::npos);
+
+    // Batch sizes that use every combination of 8-way, 4-way and single
+    vector<unsigned char> vchIn(64 * 20);
+    for (unsigned int i = 0; i < vchIn.size(); i++)
+        vchIn[i] = GetRand(256);
+    for (unsigned int nBlocks = 0; nBlocks <= 20; nBlocks++)
+    {
+        vector<unsigned char> vchOut(32 * nBlocks + 1, 0xee);
+        SHA256D64(&vchOut[0], &vchIn[0], nBlocks);
+        for (unsigned int i = 0; i < nBlocks; i++)
+        {
+            uint256 hash = Hash(vchIn.begin() + 64 * i, vchIn.begin() + 64 * (i + 1));
+            BOOST_CHECK(memcmp(&vchOut[32 * i], &hash, 32) == 0);
+        }
+        BOOST_CHECK(vchOut[32 * nBlocks] == 0xee);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(sha256_merkle)
+{
+    for (unsigned int nTx = 1; nTx <= 33; nTx++)
+    {
+        CBlock block;
+        block.vtx.resize(nTx);
+        for (unsigned int i = 0; i < nTx; i++)
+            block.vtx[i].nLockTime = i;
+
+        // The tree the way it was built before SHA256D64
+        vector<uint256> vTree;
+        for (unsigned int i = 0; i < nTx; i++)
+            vTree.push_back(block.vtx[i].GetHash());
+        int j = 0;
+        for (int nSize = nTx; nSize > 1; nSize = (nSize + 1) / 2)
+        {
+            for (int i = 0; i < nSize; i += 2)
+            {
+                int i2 = min(i+1, nSize-1);
+                vTree.push_back(Hash(BEGIN(vTree[j+i]), END(vTree[j+i]), BEGIN(vTree[j+i2]), END(vTree[j+i2])));
+            }
+            j += nSize;
+        }
+
+        BOOST_CHECK(block.BuildMerkleTree() == vTree.back());
+        BOOST_CHECK(block.vMerkleTree == vTree);
+        for (unsigned int i = 0; i < nTx; i++)
+            BOOST_CHECK(CBlock::CheckMerkleBranch(block.vtx[i].GetHash(), block.GetMerkleBranch(i), i) == vTree.back());
+    }
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -14,6 +14,7 @@ struct TestingSetup {
     TestingSetup() {
         fPrintToConsole = true; // don't want to write to debug.log file
         noui_connect();
+        SHA256AutoDetect();
         pwalletMain = new CWallet();
         RegisterWallet(pwalletMain);
     }
@@ -117,4 +117,49 @@ BOOST_AUTO_TEST_CASE(test_GetThrow)
     BOOST_CHECK_THROW(t1.GetValueIn(missingInputs), runtime_error);
 }
 
+BOOST_AUTO_TEST_CASE(transaction_hash_cache)
+{
+    CTransaction tx;
+    tx.vin.resize(1);
+    tx.vin[0].prevout = COutPoint(GetRandHash(), 0);
+    tx.vout.resize(1);
+    tx.vout[0].nValue = COIN;
+    uint256 hash = tx.GetHash();
+    BOOST_CHECK(hash == SerializeHash(tx));
+    BOOST_CHECK(tx.GetHash() == hash);
+
+    // Copies keep it, in-place changes need InvalidateHash()
+    CTransaction txCopy(tx);
+    BOOST_CHECK(txCopy.GetHash() == hash);
+    txCopy.vin[0].scriptSig << OP_1;
+    txCopy.InvalidateHash();
+    BOOST_CHECK(txCopy.GetHash() != hash);
+    BOOST_CHECK(txCopy.GetHash() == SerializeHash(txCopy));
+
+    // Reading over a hashed transaction and clearing it forget it
+    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+    ss << txCopy;
+    ss >> tx;
+    BOOST_CHECK(tx.GetHash() == txCopy.GetHash());
+    tx.SetNull();
+    BOOST_CHECK(tx.GetHash() == SerializeHash(CTransaction()));
+
+    // Signing changes the transaction it signs
+    CBasicKeyStore keystore;
+    CKey key;
+    key.MakeNewKey(true);
+    keystore.AddKey(key);
+    CTransaction txFrom;
+    txFrom.vout.resize(1);
+    txFrom.vout[0].scriptPubKey.SetDestination(key.GetPubKey().GetID());
+    CTransaction txTo;
+    txTo.vin.resize(1);
+    txTo.vin[0].prevout = COutPoint(txFrom.GetHash(), 0);
+    txTo.vout.resize(1);
+    hash = txTo.GetHash();
+    BOOST_CHECK(SignSignature(keystore, txFrom, txTo, 0));
+    BOOST_CHECK(txTo.GetHash() != hash);
+    BOOST_CHECK(txTo.GetHash() == SerializeHash(txTo));
+}
+
 BOOST_AUTO_TEST_SUITE_END()
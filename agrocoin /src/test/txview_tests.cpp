@@ -0,0 +1,144 @@
+#include <vector>
+#include <boost/test/unit_test.hpp>
+#include <boost/foreach.hpp>
+
+#include "main.h"
+#include "txview.h"
+
+using namespace std;
+
+BOOST_AUTO_TEST_SUITE(txview_tests)
+
+static CBlock MakeViewBlock()
+{
+    CBlock block;
+    block.nVersion = 1;
+    block.hashPrevBlock = GetRandHash();
+    block.nTime = 1350000000;
+    block.nBits = 0x1d00ffff;
+    block.nNonce = 12345;
+    block.vtx.resize(20);
+    block.vtx[0].vin.resize(1);
+    block.vtx[0].vin[0].prevout.SetNull();
+    block.vtx[0].vin[0].scriptSig << 486604799 << 4;
+    block.vtx[0].vout.resize(1);
+    block.vtx[0].vout[0].nValue = 50 * COIN;
+    block.vtx[0].vout[0].scriptPubKey << OP_TRUE;
+    for (unsigned int i = 1; i < block.vtx.size(); i++)
+    {
+        CTransaction& tx = block.vtx[i];
+        tx.nLockTime = i;
+        // Scripts both sides of the one and three byte compact sizes
+        tx.vin.resize(i % 3);
+        for (unsigned int j = 0; j < tx.vin.size(); j++)
+        {
+            tx.vin[j].prevout = COutPoint(GetRandHash(), i + j);
+            tx.vin[j].scriptSig = CScript() << vector<unsigned char>(i * 20, j);
+            tx.vin[j].nSequence = i;
+        }
+        tx.vout.resize(i % 4);
+        for (unsigned int j = 0; j < tx.vout.size(); j++)
+        {
+            tx.vout[j].nValue = i * COIN + j;
+            tx.vout[j].scriptPubKey = CScript() << vector<unsigned char>(j * 100, i);
+        }
+    }
+    block.hashMerkleRoot = block.BuildMerkleTree();
+    return block;
+}
+
+BOOST_AUTO_TEST_CASE(txview_fields)
+{
+    CBlock block = MakeViewBlock();
+    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+    ss << block;
+    vector<unsigned char> vch(ss.begin(), ss.end());
+
+    CBlockView view(&vch[0], &vch[0] + vch.size());
+    BOOST_CHECK(view.CheckLayout());
+    BOOST_CHECK(view.GetHash() == block.GetHash());
+    BOOST_CHECK_EQUAL(view.GetVersion(), block.nVersion);
+    BOOST_CHECK(view.GetPrevBlock() == block.hashPrevBlock);
+    BOOST_CHECK(view.GetMerkleRoot() == block.hashMerkleRoot);
+    BOOST_CHECK_EQUAL(view.GetBlockTime(), block.GetBlockTime());
+    BOOST_CHECK_EQUAL(view.GetBits(), block.nBits);
+    BOOST_CHECK_EQUAL(view.GetNonce(), block.nNonce);
+    BOOST_CHECK_EQUAL(view.size(), vch.size());
+    BOOST_CHECK_EQUAL(view.GetTransactionCount(), block.vtx.size());
+
+    unsigned int i = 0;
+    BOOST_FOREACH(const CTransactionView& txview, view)
+    {
+        const CTransaction& tx = block.vtx[i++];
+        BOOST_CHECK(txview.GetHash() == tx.GetHash());
+        BOOST_CHECK_EQUAL(txview.GetVersion(), tx.nVersion);
+        BOOST_CHECK_EQUAL(txview.GetLockTime(), tx.nLockTime);
+        BOOST_CHECK_EQUAL(txview.IsCoinBase(), tx.IsCoinBase());
+        BOOST_CHECK_EQUAL(txview.size(), ::GetSerializeSize(tx, SER_NETWORK, PROTOCOL_VERSION));
+
+        BOOST_CHECK_EQUAL(txview.GetInputs().size(), tx.vin.size());
+        unsigned int j = 0;
+        BOOST_FOREACH(const CTxInView& txin, txview.GetInputs())
+        {
+            BOOST_CHECK(txin.GetPrevoutHash() == tx.vin[j].prevout.hash);
+            BOOST_CHECK_EQUAL(txin.GetPrevoutN(), tx.vin[j].prevout.n);
+            BOOST_CHECK(CScript(txin.ScriptBegin(), txin.ScriptEnd()) == tx.vin[j].scriptSig);
+            BOOST_CHECK_EQUAL(txin.GetSequence(), tx.vin[j].nSequence);
+            j++;
+        }
+        BOOST_CHECK_EQUAL(j, tx.vin.size());
+
+        BOOST_CHECK_EQUAL(txview.GetOutputs().size(), tx.vout.size());
+        j = 0;
+        BOOST_FOREACH(const CTxOutView& txout, txview.GetOutputs())
+        {
+            BOOST_CHECK_EQUAL(txout.GetValue(), tx.vout[j].nValue);
+            BOOST_CHECK(CScript(txout.ScriptBegin(), txout.ScriptEnd()) == tx.vout[j].scriptPubKey);
+            j++;
+        }
+        BOOST_CHECK_EQUAL(j, tx.vout.size());
+
+        CTransaction tx2;
+        txview.Get(tx2);
+        BOOST_CHECK(tx2 == tx);
+    }
+    BOOST_CHECK_EQUAL(i, block.vtx.size());
+
+    CBlock block2;
+    view.Get(block2);
+    BOOST_CHECK(block2.GetHash() == block.GetHash());
+    BOOST_CHECK(block2.BuildMerkleTree() == block.hashMerkleRoot);
+}
+
+BOOST_AUTO_TEST_CASE(txview_truncated)
+{
+    CBlock block = MakeViewBlock();
+    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+    ss << block.vtx[5];
+    vector<unsigned char> vch(ss.begin(), ss.end());
+
+    // Every prefix is rejected, and nothing past the end is read
+    for (unsigned int nSize = 0; nSize < vch.size(); nSize++)
+    {
+        vector<unsigned char> vchShort(vch.begin(), vch.begin() + nSize);
+        vchShort.push_back(0);
+        BOOST_CHECK_THROW(CTransactionView(&vchShort[0], &vchShort[0] + nSize), std::ios_base::failure);
+    }
+    CTransactionView txview(&vch[0], &vch[0] + vch.size());
+    BOOST_CHECK(txview.end() == &vch[0] + vch.size());
+
+    // Sizes beyond MAX_SIZE are refused like ReadCompactSize does
+    unsigned char pchHuge[] = {1, 0, 0, 0, 0xfe, 0xff, 0xff, 0xff, 0xff};
+    BOOST_CHECK_THROW(CTransactionView(pchHuge, pchHuge + sizeof(pchHuge)), std::ios_base::failure);
+
+    ss.clear();
+    ss << block;
+    vch.assign(ss.begin(), ss.end());
+    BOOST_CHECK(CBlockView(&vch[0], &vch[0] + vch.size()).CheckLayout());
+    BOOST_CHECK(!CBlockView(&vch[0], &vch[0] + vch.size() - 1).CheckLayout());
+    vch.push_back(0);
+    BOOST_CHECK(!CBlockView(&vch[0], &vch[0] + vch.size()).CheckLayout());
+    BOOST_CHECK_THROW(CBlockView(&vch[0], &vch[0] + 79), std::ios_base::failure);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
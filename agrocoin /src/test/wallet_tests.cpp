@@ -292,4 +292,216 @@ BOOST_AUTO_TEST_CASE(coin_selection_tests)
     }
 }
 
+BOOST_AUTO_TEST_CASE(coin_selection_large_wallet)
+{
+    static CoinSet setCoinsRet;
+    static int64 nValueRet;
+
+    // 10000 distinct coins; an amount some of them add up to exactly
+    // should be matched exactly, without change
+    empty_wallet();
+    for (int i = 0; i < 10000; i++)
+        add_coin(1000 + i * 7919);
+
+    int64 nTarget = (1000 + 17 * 7919) + (1000 + 4242 * 7919) + (1000 + 9000 * 7919);
+    BOOST_CHECK( wallet.SelectCoinsMinConf(nTarget, 1, 6, vCoins, setCoinsRet, nValueRet));
+    BOOST_CHECK_EQUAL(nValueRet, nTarget);
+
+    // and so should the total of all of them
+    int64 nTotal = 0;
+    BOOST_FOREACH(const COutput& output, vCoins)
+        nTotal += output.tx->vout[output.i].nValue;
+    BOOST_CHECK( wallet.SelectCoinsMinConf(nTotal, 1, 6, vCoins, setCoinsRet, nValueRet));
+    BOOST_CHECK_EQUAL(nValueRet, nTotal);
+    BOOST_CHECK(!wallet.SelectCoinsMinConf(nTotal + 1, 1, 6, vCoins, setCoinsRet, nValueRet));
+    empty_wallet();
+}
+
+BOOST_AUTO_TEST_CASE(ordered_accounting_entries)
+{
+    CWallet wallet;
+    const char* pszAccounts[] = { "a", "b", "a", "c", "b", "a" };
+    int64 nTimes[] = { 50, 10, 30, 20, 40, 60 };
+    for (int i = 0; i < 6; i++)
+    {
+        CAccountingEntry acentry;
+        acentry.strAccount = pszAccounts[i];
+        acentry.nTime = nTimes[i];
+        acentry.nCreditDebit = i;
+        wallet.AddAccountingEntry(acentry);
+    }
+
+    // Everything, oldest first
+    const TxItems& txAll = wallet.GetOrderedTxItems("*");
+    BOOST_CHECK_EQUAL(txAll.size(), 6U);
+    int64 nLastTime = 0;
+    for (TxItems::const_iterator it = txAll.begin(); it != txAll.end(); ++it)
+    {
+        BOOST_CHECK((*it).second.first == NULL);
+        BOOST_CHECK((*it).first >= nLastTime);
+        nLastTime = (*it).first;
+    }
+
+    // and per account
+    const TxItems& txA = wallet.GetOrderedTxItems("a");
+    BOOST_CHECK_EQUAL(txA.size(), 3U);
+    BOOST_CHECK_EQUAL(txA.begin()->second.second->nCreditDebit, 2);
+    BOOST_CHECK_EQUAL(txA.rbegin()->second.second->nCreditDebit, 5);
+    BOOST_CHECK_EQUAL(wallet.GetOrderedTxItems("c").size(), 1U);
+    BOOST_CHECK(wallet.GetOrderedTxItems("d").empty());
+}
+
+BOOST_AUTO_TEST_CASE(account_tally)
+{
+    map<string, CAccountTally> mapTally;
+
+    // Received at heights 100 and 105 and unconfirmed, sent at 105
+    CTxTally txA, txB, txC;
+    txA.nHeight = 100;
+    txA.mapReceived["a"] = 10 * COIN;
+    txA.mapReceived[""] = 1 * COIN;
+    txB.nHeight = 105;
+    txB.mapReceived["a"] = 5 * COIN;
+    txB.strSentAccount = "a";
+    txB.nDebit = 3 * COIN;
+    txC.mapReceived["a"] = 2 * COIN;
+    txA.AddTo(mapTally, 1);
+    txB.AddTo(mapTally, 1);
+    txC.AddTo(mapTally, 1);
+    mapTally["a"].nMoves -= 4 * COIN;
+    mapTally["b"].nMoves += 4 * COIN;
+
+    const CAccountTally& tallyA = mapTally["a"];
+    BOOST_CHECK_EQUAL(tallyA.GetBalance(0, 105, true), 10 * COIN);
+    BOOST_CHECK_EQUAL(tallyA.GetBalance(1, 105, true), 8 * COIN);
+    BOOST_CHECK_EQUAL(tallyA.GetBalance(6, 105, true), 3 * COIN);
+    BOOST_CHECK_EQUAL(tallyA.GetBalance(6, 110, true), 8 * COIN);
+    BOOST_CHECK_EQUAL(tallyA.GetBalance(1, 105, false), 12 * COIN);
+    BOOST_CHECK_EQUAL(mapTally["b"].GetBalance(1, 105, true), 4 * COIN);
+
+    // Coinbase credit only counts once it is mature
+    CTxTally txGen;
+    txGen.nHeight = 104;
+    txGen.nGenerated = 50 * COIN;
+    txGen.AddTo(mapTally, 1);
+    BOOST_CHECK_EQUAL(mapTally[""].GetBalance(1, 105, true), 1 * COIN);
+    BOOST_CHECK_EQUAL(mapTally[""].GetBalance(1, 104 + COINBASE_MATURITY + 14, true), 51 * COIN);
+
+    // Taking transactions back out leaves nothing behind
+    txB.AddTo(mapTally, -1);
+    txGen.AddTo(mapTally, -1);
+    BOOST_CHECK_EQUAL(mapTally["a"].GetBalance(1, 105, true), 6 * COIN);
+    BOOST_CHECK(mapTally["a"].mapReceived.size() == 1);
+    BOOST_CHECK(mapTally[""].mapGenerated.empty());
+}
+
+BOOST_AUTO_TEST_CASE(file_tx_by_connected_block)
+{
+    CWallet wallet;
+    CKey key;
+    key.MakeNewKey(true);
+    wallet.AddKey(key);
+
+    CBlock block;
+    block.vtx.resize(2);
+    block.vtx[0].vin.resize(1);
+    block.vtx[0].vin[0].prevout.SetNull();
+    block.vtx[0].vout.resize(1);
+    block.vtx[1].vin.resize(1);
+    block.vtx[1].vin[0].prevout = COutPoint(GetRandHash(), 0);
+    block.vtx[1].vout.resize(1);
+    block.vtx[1].vout[0].nValue = 5 * COIN;
+    block.vtx[1].vout[0].scriptPubKey.SetDestination(key.GetPubKey().GetID());
+    block.hashMerkleRoot = block.BuildMerkleTree();
+
+    // A one block chain, with the block connected but not yet the best
+    // block, the way ConnectBlock hands its transactions to the wallets
+    CBlockIndex* pindexBestOld = pindexBest;
+    int nBestHeightOld = nBestHeight;
+    CBlockIndex indexPrev;
+    CBlockIndex index(0, 0, block);
+    index.pprev = &indexPrev;
+    index.nHeight = 1;
+    index.phashBlock = &mapBlockIndex.insert(make_pair(block.GetHash(), &index)).first->first;
+    pindexBest = &indexPrev;
+    nBestHeight = 0;
+
+    CWalletTx wtx(&wallet, block.vtx[1]);
+    wtx.SetMerkleBranch(&block);
+    const CWalletTx* pwtx = &wallet.mapWallet.insert(make_pair(wtx.GetHash(), wtx)).first->second;
+    wallet.ReindexTransactions();
+    BOOST_CHECK(wallet.GetFiledBlock(pwtx) == 0);
+    BOOST_CHECK_EQUAL(wallet.GetAccountBalance("", 0), 5 * COIN);
+    BOOST_CHECK_EQUAL(wallet.GetAccountBalance("", 1), 0);
+
+    // SetBestChain links it in, then has it filed again
+    indexPrev.pnext = &index;
+    pindexBest = &index;
+    nBestHeight = 1;
+    wallet.FileConnectedTxs();
+    BOOST_CHECK(wallet.GetFiledBlock(pwtx) == block.GetHash());
+    vector<const CWalletTx*> vwtx;
+    wallet.GetTransactionsSinceHeight(0, vwtx);
+    BOOST_CHECK(vwtx.size() == 1 && vwtx[0] == pwtx);
+    BOOST_CHECK_EQUAL(wallet.GetAccountBalance("", 1), 5 * COIN);
+    BOOST_CHECK_EQUAL(wallet.GetAccountBalance("", 2), 0);
+    map<string, int64> mapBalances;
+    wallet.GetAccountBalances(1, mapBalances);
+    BOOST_CHECK_EQUAL(mapBalances[""], 5 * COIN);
+
+    // and back out when it is disconnected
+    wallet.DisconnectBlock(block.GetHash());
+    BOOST_CHECK(wallet.GetFiledBlock(pwtx) == 0);
+    BOOST_CHECK_EQUAL(wallet.GetAccountBalance("", 1), 0);
+
+    mapBlockIndex.erase(block.GetHash());
+    pindexBest = pindexBestOld;
+    nBestHeight = nBestHeightOld;
+}
+
+BOOST_AUTO_TEST_CASE(balance_time_locked)
+{
+    CWallet wallet;
+    CKey key;
+    key.MakeNewKey(true);
+    wallet.AddKey(key);
+
+    // A payment in the best block, locked until a minute from now
+    int64 nNow = GetAdjustedTime();
+    CBlock block;
+    block.vtx.resize(2);
+    block.vtx[0].vin.resize(1);
+    block.vtx[0].vin[0].prevout.SetNull();
+    block.vtx[0].vout.resize(1);
+    block.vtx[1].vin.resize(1);
+    block.vtx[1].vin[0].prevout = COutPoint(GetRandHash(), 0);
+    block.vtx[1].vin[0].nSequence = 0;
+    block.vtx[1].vout.resize(1);
+    block.vtx[1].vout[0].nValue = 5 * COIN;
+    block.vtx[1].vout[0].scriptPubKey.SetDestination(key.GetPubKey().GetID());
+    block.vtx[1].nLockTime = nNow + 60;
+    block.hashMerkleRoot = block.BuildMerkleTree();
+
+    CBlockIndex* pindexBestOld = pindexBest;
+    CBlockIndex index(0, 0, block);
+    index.phashBlock = &mapBlockIndex.insert(make_pair(block.GetHash(), &index)).first->first;
+    pindexBest = &index;
+
+    CWalletTx wtx(&wallet, block.vtx[1]);
+    wtx.SetMerkleBranch(&block);
+    wallet.mapWallet.insert(make_pair(wtx.GetHash(), wtx));
+    wallet.ReindexUnspent();
+    BOOST_CHECK_EQUAL(wallet.GetBalance(), 0);
+    BOOST_CHECK_EQUAL(wallet.GetUnconfirmedBalance(), 5 * COIN);
+
+    // Nothing but the clock moves, and the payment becomes spendable
+    SetMockTime(nNow + 120);
+    BOOST_CHECK_EQUAL(wallet.GetBalance(), 5 * COIN);
+    BOOST_CHECK_EQUAL(wallet.GetUnconfirmedBalance(), 0);
+    SetMockTime(0);
+
+    mapBlockIndex.erase(block.GetHash());
+    pindexBest = pindexBestOld;
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,48 @@
+#include <boost/test/unit_test.hpp>
+
+#include "walletjournal.h"
+
+using namespace std;
+
+BOOST_AUTO_TEST_SUITE(walletjournal_tests)
+
+BOOST_AUTO_TEST_CASE(walletjournal_replay)
+{
+    vector<char> vch;
+    CWalletJournal::SerializeRecord(false, "a", "1", vch);
+    CWalletJournal::SerializeRecord(false, "b", "2", vch);
+    CWalletJournal::SerializeRecord(false, "a", "3", vch);
+    CWalletJournal::SerializeRecord(true, "b", "", vch);
+    unsigned int nComplete = vch.size();
+    CWalletJournal::SerializeRecord(false, "c", "4", vch);
+
+    // Later records win, erases are kept as erases
+    JournalMap mapRecords;
+    BOOST_CHECK_EQUAL(CWalletJournal::ReplayRecords(vch, mapRecords), vch.size());
+    BOOST_CHECK_EQUAL(mapRecords.size(), 3U);
+    BOOST_CHECK(mapRecords["a"] == make_pair(false, string("3")));
+    BOOST_CHECK(mapRecords["b"].first);
+    BOOST_CHECK(mapRecords["c"] == make_pair(false, string("4")));
+
+    // A torn last record is dropped, whatever was cut off
+    for (unsigned int nCut = 1; nCut < vch.size() - nComplete; nCut++)
+    {
+        vector<char> vchTorn(vch.begin(), vch.end() - nCut);
+        mapRecords.clear();
+        BOOST_CHECK_EQUAL(CWalletJournal::ReplayRecords(vchTorn, mapRecords), nComplete);
+        BOOST_CHECK_EQUAL(mapRecords.size(), 2U);
+        BOOST_CHECK(!mapRecords.count("c"));
+    }
+
+    // So is everything from a corrupt record on
+    vector<char> vchBad(vch);
+    vchBad[nComplete - 1] ^= 1;
+    mapRecords.clear();
+    unsigned int nValid = CWalletJournal::ReplayRecords(vchBad, mapRecords);
+    BOOST_CHECK(nValid < nComplete);
+    BOOST_CHECK(mapRecords["a"] == make_pair(false, string("3")));
+    BOOST_CHECK(!mapRecords["b"].first);
+    BOOST_CHECK(!mapRecords.count("c"));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,99 @@
+#include <boost/test/unit_test.hpp>
+
+#include "workcache.h"
+
+using namespace std;
+
+BOOST_AUTO_TEST_SUITE(workcache_tests)
+
+static boost::shared_ptr<const CWorkTemplate> MakeTemplate(int nTx)
+{
+    CBlock block;
+    for (int i = 0; i < nTx; i++)
+    {
+        CTransaction tx;
+        tx.vin.resize(1);
+        tx.vin[0].prevout.n = i;
+        tx.vout.resize(1);
+        tx.vout[0].nValue = i + 1;
+        block.vtx.push_back(tx);
+    }
+    block.vtx[0].vin[0].prevout.SetNull();
+    block.hashMerkleRoot = block.BuildMerkleTree();
+    return boost::shared_ptr<const CWorkTemplate>(new CWorkTemplate(block));
+}
+
+static CWork MakeWork(boost::shared_ptr<const CWorkTemplate> ptemplate, int nExtraNonce)
+{
+    CWork work;
+    work.ptemplate = ptemplate;
+    work.scriptSig = CScript() << CBigNum(nExtraNonce);
+    work.nBits = ptemplate->block.nBits;
+    return work;
+}
+
+BOOST_AUTO_TEST_CASE(workcache_merkleroot)
+{
+    // The coinbase branch gives the same root as rebuilding the whole tree
+    boost::shared_ptr<const CWorkTemplate> ptemplate = MakeTemplate(7);
+    for (int i = 1; i < 5; i++)
+    {
+        CWork work = MakeWork(ptemplate, i);
+        CBlock block;
+        work.GetBlock(block);
+        BOOST_CHECK(block.vtx[0].vin[0].scriptSig == work.scriptSig);
+        BOOST_CHECK(work.GetMerkleRoot() == block.hashMerkleRoot);
+        BOOST_CHECK(work.GetMerkleRoot() != ptemplate->block.hashMerkleRoot);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(workcache_addget)
+{
+    CWorkCache cache;
+    boost::shared_ptr<const CWorkTemplate> ptemplate = MakeTemplate(3);
+    vector<uint256> vRoots;
+    for (int i = 1; i <= 50; i++)
+    {
+        CWork work = MakeWork(ptemplate, i);
+        vRoots.push_back(work.GetMerkleRoot());
+        cache.Add(vRoots.back(), work);
+    }
+    BOOST_CHECK_EQUAL(cache.size(), 50U);
+
+    // All units share the one template
+    BOOST_CHECK_EQUAL(ptemplate.use_count(), 51);
+
+    CWork work;
+    BOOST_CHECK(cache.Get(vRoots[10], work));
+    BOOST_CHECK(work.GetMerkleRoot() == vRoots[10]);
+    BOOST_CHECK(work.ptemplate == ptemplate);
+    BOOST_CHECK(!cache.Get(ptemplate->block.hashMerkleRoot, work));
+
+    cache.Clear();
+    work = CWork();
+    BOOST_CHECK_EQUAL(cache.size(), 0U);
+    BOOST_CHECK(!cache.Get(vRoots[10], work));
+    BOOST_CHECK_EQUAL(ptemplate.use_count(), 1);
+}
+
+BOOST_AUTO_TEST_CASE(workcache_bounded)
+{
+    CWorkCache cache(160);
+    boost::shared_ptr<const CWorkTemplate> ptemplate = MakeTemplate(2);
+    vector<uint256> vRoots;
+    for (int i = 1; i <= 2000; i++)
+    {
+        CWork work = MakeWork(ptemplate, i);
+        vRoots.push_back(work.GetMerkleRoot());
+        cache.Add(vRoots.back(), work);
+    }
+    BOOST_CHECK(cache.size() <= 160);
+    BOOST_CHECK(cache.size() > 100);
+
+    // Oldest work goes first
+    CWork work;
+    BOOST_CHECK(!cache.Get(vRoots[0], work));
+    BOOST_CHECK(cache.Get(vRoots.back(), work));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
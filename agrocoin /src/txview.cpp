@@ -0,0 +1,81 @@
+#include "txview.h"
+
+using namespace std;
+
+// Skips n bytes, or throws if they aren't all there
+static inline void ViewSkip(const unsigned char*& p, const unsigned char* pend, size_t n)
+{
+    if ((size_t)(pend - p) < n)
+        throw ios_base::failure("CTransactionView() : end of data");
+    p += n;
+}
+
+static unsigned int ViewReadCompactSize(const unsigned char*& p, const unsigned char* pend)
+{
+    if (p == pend)
+        throw ios_base::failure("CTransactionView() : end of data");
+    const unsigned char* pstart = p;
+    unsigned char chSize = *p;
+    ViewSkip(p, pend, chSize < 253 ? 1 : chSize == 253 ? 3 : chSize == 254 ? 5 : 9);
+    uint64 nSize = chSize;
+    if (chSize >= 253)
+    {
+        nSize = 0;
+        memcpy(&nSize, pstart + 1, p - pstart - 1);
+    }
+    if (nSize > (uint64)MAX_SIZE)
+        throw ios_base::failure("ReadCompactSize() : size too large");
+    return (unsigned int)nSize;
+}
+
+CTransactionView::CTransactionView(const unsigned char* pbeginIn, const unsigned char* pendIn)
+{
+    const unsigned char* p = pbeginIn;
+    pbegin = p;
+    ViewSkip(p, pendIn, 4);
+
+    nInputs = ViewReadCompactSize(p, pendIn);
+    pinputs = p;
+    for (unsigned int i = 0; i < nInputs; i++)
+    {
+        ViewSkip(p, pendIn, 36);
+        unsigned int nScriptSize = ViewReadCompactSize(p, pendIn);
+        ViewSkip(p, pendIn, nScriptSize);
+        ViewSkip(p, pendIn, 4);
+    }
+    pinputsEnd = p;
+
+    nOutputs = ViewReadCompactSize(p, pendIn);
+    poutputs = p;
+    for (unsigned int i = 0; i < nOutputs; i++)
+    {
+        ViewSkip(p, pendIn, 8);
+        unsigned int nScriptSize = ViewReadCompactSize(p, pendIn);
+        ViewSkip(p, pendIn, nScriptSize);
+    }
+    plockTime = p;
+    ViewSkip(p, pendIn, 4);
+}
+
+CBlockView::CBlockView(const unsigned char* pbeginIn, const unsigned char* pendIn) : pbegin(pbeginIn), pend(pendIn)
+{
+    const unsigned char* p = pbegin;
+    ViewSkip(p, pend, 80);
+    nTx = ViewReadCompactSize(p, pend);
+    ptx = p;
+}
+
+bool CBlockView::CheckLayout() const
+{
+    try
+    {
+        const unsigned char* p = ptx;
+        for (iterator it = begin(); it != end(); ++it)
+            p = it->end();
+        return p == pend;
+    }
+    catch (ios_base::failure& e)
+    {
+        return false;
+    }
+}
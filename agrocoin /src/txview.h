@@ -0,0 +1,348 @@
+#ifndef BITCOIN_TXVIEW_H
+#define BITCOIN_TXVIEW_H
+
+#include "serialize.h"
+#include "uint256.h"
+#include "util.h"
+
+#include <iterator>
+#include <string.h>
+
+// Read-only views of serialized transactions and blocks, used where the
+// bytes are and parsed only as far as they are asked for.  Nothing is
+// copied, so the bytes have to outlive every view of them.
+
+// Reads a compact size that a view has already checked
+inline unsigned int ViewCompactSize(const unsigned char*& p)
+{
+    unsigned char chSize = *p++;
+    if (chSize < 253)
+        return chSize;
+    if (chSize == 253)
+    {
+        unsigned short n;
+        memcpy(&n, p, 2);
+        p += 2;
+        return n;
+    }
+    // Checked to be at most MAX_SIZE, the low four bytes are all of it
+    unsigned int n;
+    memcpy(&n, p, 4);
+    p += (chSize == 254 ? 4 : 8);
+    return n;
+}
+
+/** One input of a CTransactionView */
+class CTxInView
+{
+private:
+    const unsigned char* pbegin;
+    const unsigned char* pscript;
+    unsigned int nScriptSize;
+
+public:
+    CTxInView() : pbegin(NULL), pscript(NULL), nScriptSize(0) { }
+
+    explicit CTxInView(const unsigned char* p) : pbegin(p)
+    {
+        p += 36;
+        nScriptSize = ViewCompactSize(p);
+        pscript = p;
+    }
+
+    uint256 GetPrevoutHash() const
+    {
+        uint256 hash;
+        memcpy(hash.begin(), pbegin, 32);
+        return hash;
+    }
+
+    unsigned int GetPrevoutN() const
+    {
+        unsigned int n;
+        memcpy(&n, pbegin + 32, 4);
+        return n;
+    }
+
+    const unsigned char* ScriptBegin() const { return pscript; }
+    const unsigned char* ScriptEnd() const { return pscript + nScriptSize; }
+
+    unsigned int GetSequence() const
+    {
+        unsigned int n;
+        memcpy(&n, ScriptEnd(), 4);
+        return n;
+    }
+
+    const unsigned char* begin() const { return pbegin; }
+    const unsigned char* end() const { return ScriptEnd() + 4; }
+};
+
+/** One output of a CTransactionView */
+class CTxOutView
+{
+private:
+    const unsigned char* pbegin;
+    const unsigned char* pscript;
+    unsigned int nScriptSize;
+
+public:
+    CTxOutView() : pbegin(NULL), pscript(NULL), nScriptSize(0) { }
+
+    explicit CTxOutView(const unsigned char* p) : pbegin(p)
+    {
+        p += 8;
+        nScriptSize = ViewCompactSize(p);
+        pscript = p;
+    }
+
+    int64 GetValue() const
+    {
+        int64 n;
+        memcpy(&n, pbegin, 8);
+        return n;
+    }
+
+    const unsigned char* ScriptBegin() const { return pscript; }
+    const unsigned char* ScriptEnd() const { return pscript + nScriptSize; }
+
+    const unsigned char* begin() const { return pbegin; }
+    const unsigned char* end() const { return ScriptEnd(); }
+};
+
+/** Forward iterator over the inputs or outputs of a CTransactionView, each
+ * one parsed as it is reached */
+template<typename TView>
+class CTxViewIterator
+{
+private:
+    const unsigned char* p;
+    const unsigned char* pend;
+    TView view;
+
+public:
+    typedef std::forward_iterator_tag iterator_category;
+    typedef TView value_type;
+    typedef ptrdiff_t difference_type;
+    typedef const TView* pointer;
+    typedef const TView& reference;
+
+    CTxViewIterator(const unsigned char* pIn, const unsigned char* pendIn) : p(pIn), pend(pendIn)
+    {
+        if (p != pend)
+            view = TView(p);
+    }
+
+    reference operator*() const { return view; }
+    pointer operator->() const { return &view; }
+
+    CTxViewIterator& operator++()
+    {
+        p = view.end();
+        if (p != pend)
+            view = TView(p);
+        return *this;
+    }
+
+    CTxViewIterator operator++(int)
+    {
+        CTxViewIterator ret = *this;
+        ++*this;
+        return ret;
+    }
+
+    bool operator==(const CTxViewIterator& it) const { return p == it.p; }
+    bool operator!=(const CTxViewIterator& it) const { return p != it.p; }
+};
+
+/** The inputs or outputs of a CTransactionView, for BOOST_FOREACH */
+template<typename TView>
+class CTxViewRange
+{
+private:
+    const unsigned char* pbegin;
+    const unsigned char* pend;
+    unsigned int nSize;
+
+public:
+    typedef CTxViewIterator<TView> iterator;
+    typedef CTxViewIterator<TView> const_iterator;
+
+    CTxViewRange(const unsigned char* pbeginIn, const unsigned char* pendIn, unsigned int nSizeIn) : pbegin(pbeginIn), pend(pendIn), nSize(nSizeIn) { }
+
+    iterator begin() const { return iterator(pbegin, pend); }
+    iterator end() const { return iterator(pend, pend); }
+    unsigned int size() const { return nSize; }
+    bool empty() const { return nSize == 0; }
+};
+
+/** A serialized transaction.  Constructing one walks the bytes once to find
+ * where the inputs, outputs and the transaction itself end. */
+class CTransactionView
+{
+private:
+    const unsigned char* pbegin;
+    const unsigned char* pinputs;
+    const unsigned char* pinputsEnd;
+    const unsigned char* poutputs;
+    const unsigned char* plockTime;
+    unsigned int nInputs;
+    unsigned int nOutputs;
+
+public:
+    CTransactionView() : pbegin(NULL), pinputs(NULL), pinputsEnd(NULL), poutputs(NULL), plockTime(NULL), nInputs(0), nOutputs(0) { }
+
+    // The transaction starting at pbeginIn, which must end by pendIn;
+    // throws std::ios_base::failure where a stream reading it would
+    CTransactionView(const unsigned char* pbeginIn, const unsigned char* pendIn);
+
+    int GetVersion() const
+    {
+        int n;
+        memcpy(&n, pbegin, 4);
+        return n;
+    }
+
+    unsigned int GetLockTime() const
+    {
+        unsigned int n;
+        memcpy(&n, plockTime, 4);
+        return n;
+    }
+
+    CTxViewRange<CTxInView> GetInputs() const { return CTxViewRange<CTxInView>(pinputs, pinputsEnd, nInputs); }
+    CTxViewRange<CTxOutView> GetOutputs() const { return CTxViewRange<CTxOutView>(poutputs, plockTime, nOutputs); }
+
+    bool IsCoinBase() const
+    {
+        if (nInputs != 1)
+            return false;
+        CTxInView txin(pinputs);
+        return txin.GetPrevoutN() == (unsigned int)-1 && txin.GetPrevoutHash() == 0;
+    }
+
+    uint256 GetHash() const
+    {
+        return Hash(begin(), end());
+    }
+
+    const unsigned char* begin() const { return pbegin; }
+    const unsigned char* end() const { return plockTime + 4; }
+    unsigned int size() const { return end() - begin(); }
+
+    // Deserializes the transaction, into a CTransaction or anything read
+    // the same way
+    template<typename T>
+    void Get(T& obj) const
+    {
+        CDataStream ss((const char*)begin(), (const char*)end(), SER_NETWORK, PROTOCOL_VERSION);
+        ss >> obj;
+    }
+};
+
+/** Iterator over the transactions of a CBlockView, each one checked as it
+ * is reached */
+class CBlockViewIterator
+{
+private:
+    const unsigned char* pend;
+    unsigned int nLeft;
+    CTransactionView tx;
+
+public:
+    typedef std::forward_iterator_tag iterator_category;
+    typedef CTransactionView value_type;
+    typedef ptrdiff_t difference_type;
+    typedef const CTransactionView* pointer;
+    typedef const CTransactionView& reference;
+
+    CBlockViewIterator(const unsigned char* p, const unsigned char* pendIn, unsigned int nLeftIn) : pend(pendIn), nLeft(nLeftIn)
+    {
+        if (nLeft > 0)
+            tx = CTransactionView(p, pend);
+    }
+
+    reference operator*() const { return tx; }
+    pointer operator->() const { return &tx; }
+
+    CBlockViewIterator& operator++()
+    {
+        if (--nLeft > 0)
+            tx = CTransactionView(tx.end(), pend);
+        return *this;
+    }
+
+    bool operator==(const CBlockViewIterator& it) const { return nLeft == it.nLeft; }
+    bool operator!=(const CBlockViewIterator& it) const { return nLeft != it.nLeft; }
+};
+
+/** A serialized block.  Only the header and the transaction count are read
+ * up front, the transactions as they are iterated. */
+class CBlockView
+{
+private:
+    const unsigned char* pbegin;
+    const unsigned char* pend;
+    const unsigned char* ptx;
+    unsigned int nTx;
+
+    unsigned int ReadHeader32(int nOffset) const
+    {
+        unsigned int n;
+        memcpy(&n, pbegin + nOffset, 4);
+        return n;
+    }
+
+public:
+    typedef CBlockViewIterator iterator;
+    typedef CBlockViewIterator const_iterator;
+
+    // The block in [pbeginIn, pendIn); throws std::ios_base::failure if
+    // even the header doesn't fit
+    CBlockView(const unsigned char* pbeginIn, const unsigned char* pendIn);
+
+    int GetVersion() const { return (int)ReadHeader32(0); }
+
+    uint256 GetPrevBlock() const
+    {
+        uint256 hash;
+        memcpy(hash.begin(), pbegin + 4, 32);
+        return hash;
+    }
+
+    uint256 GetMerkleRoot() const
+    {
+        uint256 hash;
+        memcpy(hash.begin(), pbegin + 36, 32);
+        return hash;
+    }
+
+    int64 GetBlockTime() const { return (int64)ReadHeader32(68); }
+    unsigned int GetBits() const { return ReadHeader32(72); }
+    unsigned int GetNonce() const { return ReadHeader32(76); }
+
+    uint256 GetHash() const
+    {
+        return Hash(pbegin, pbegin + 80);
+    }
+
+    unsigned int GetTransactionCount() const { return nTx; }
+    iterator begin() const { return iterator(ptx, pend, nTx); }
+    iterator end() const { return iterator(pend, pend, 0); }
+
+    // Walks every transaction: true if together they are exactly the rest
+    // of the block
+    bool CheckLayout() const;
+
+    unsigned int size() const { return pend - pbegin; }
+
+    // Deserializes the whole block
+    template<typename T>
+    void Get(T& obj) const
+    {
+        CDataStream ss((const char*)pbegin, (const char*)pend, SER_NETWORK, PROTOCOL_VERSION);
+        ss >> obj;
+    }
+};
+
+#endif
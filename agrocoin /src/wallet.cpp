@@ -4,6 +4,9 @@
 #include "crypter.h"
 #include "ui_interface.h"
 #include "base58.h"
+#include "txview.h"
+
+#include <boost/bind.hpp>
 
 using namespace std;
 
@@ -18,6 +21,15 @@ struct CompareValueOnly
     }
 };
 
+struct CompareValueGreater
+{
+    bool operator()(const pair<int64, pair<const CWalletTx*, unsigned int> >& t1,
+                    const pair<int64, pair<const CWalletTx*, unsigned int> >& t2) const
+    {
+        return t1.first > t2.first;
+    }
+};
+
 CPubKey CWallet::GenerateNewKey()
 {
     bool fCompressed = CanSupportFeature(FEATURE_COMPRPUBKEY); 
@@ -288,6 +300,7 @@ void CWallet::WalletUpdateSpent(const CTransaction &tx)
                     printf("WalletUpdateSpent found spent coin %sbc %s\n", FormatMoney(wtx.GetCredit()).c_str(), wtx.GetHash().ToString().c_str());
                     wtx.MarkSpent(txin.prevout.n);
                     wtx.WriteToDisk();
+                    UpdateUnspent(txin.prevout.hash, wtx);
                     NotifyTransactionChanged(this, txin.prevout.hash, CT_UPDATED);
                 }
             }
@@ -301,7 +314,431 @@ void CWallet::MarkDirty()
         LOCK(cs_wallet);
         BOOST_FOREACH(PAIRTYPE(const uint256, CWalletTx)& item, mapWallet)
             item.second.MarkDirty();
+
+        // Whatever made the cached credits stale (usually new keys) can
+        // also change which outputs are ours
+        ReindexUnspent();
+        fAccountOrderedDirty = true;
+    }
+}
+
+// Keep mapUnspent in step with a transaction that was added, changed or had
+// outputs spent.  Call with cs_wallet held.
+void CWallet::UpdateUnspent(const uint256& hash, const CWalletTx& wtx)
+{
+    fBalancesCached = false;
+    for (unsigned int i = 0; i < wtx.vout.size(); i++)
+    {
+        if (!wtx.IsSpent(i) && IsMine(wtx.vout[i]))
+        {
+            mapUnspent[hash] = &wtx;
+            return;
+        }
+    }
+    mapUnspent.erase(hash);
+}
+
+void CWallet::ReindexUnspent()
+{
+    {
+        LOCK(cs_wallet);
+        mapUnspent.clear();
+        BOOST_FOREACH(PAIRTYPE(const uint256, CWalletTx)& item, mapWallet)
+            UpdateUnspent(item.first, item.second);
+        fBalancesCached = false;
+    }
+}
+
+// Accounts whose listtransactions output can include wtx
+static void GetTxAccounts(const CWallet* pwallet, const CWalletTx& wtx, set<string>& setAccounts, set<CTxDestination>& setDestinations)
+{
+    int64 nGeneratedImmature, nGeneratedMature, nFee;
+    string strSentAccount;
+    list<pair<CTxDestination, int64> > listReceived;
+    list<pair<CTxDestination, int64> > listSent;
+    wtx.GetAmounts(nGeneratedImmature, nGeneratedMature, listReceived, listSent, nFee, strSentAccount);
+
+    if (wtx.IsCoinBase())
+        setAccounts.insert("");
+    if (!listSent.empty() || nFee != 0)
+        setAccounts.insert(strSentAccount);
+    BOOST_FOREACH(const PAIRTYPE(CTxDestination, int64)& r, listReceived)
+    {
+        map<CTxDestination, string>::const_iterator mi = pwallet->mapAddressBook.find(r.first);
+        setAccounts.insert(mi != pwallet->mapAddressBook.end() ? (*mi).second : "");
+        setDestinations.insert(r.first);
+    }
+}
+
+static void EraseTxItem(TxItems& txItems, int64 nTime, const TxPair& item)
+{
+    pair<TxItems::iterator, TxItems::iterator> range = txItems.equal_range(nTime);
+    for (TxItems::iterator it = range.first; it != range.second; ++it)
+    {
+        if ((*it).second == item)
+        {
+            txItems.erase(it);
+            return;
+        }
+    }
+}
+
+// The ordered and by-block indexes below are all updated with cs_wallet held
+void CWallet::OrderTx(CWalletTx* pwtx)
+{
+    TxPair item(pwtx, (CAccountingEntry*)0);
+    wtxOrdered.insert(make_pair(pwtx->GetTxTime(), item));
+
+    set<string>& setAccounts = mapTxAccounts[pwtx];
+    GetTxAccounts(this, *pwtx, setAccounts, setOrderedDestinations);
+    BOOST_FOREACH(const string& strAccount, setAccounts)
+        mapAccountOrdered[strAccount].insert(make_pair(pwtx->GetTxTime(), item));
+}
+
+void CWallet::UnorderTx(CWalletTx* pwtx)
+{
+    TxPair item(pwtx, (CAccountingEntry*)0);
+    EraseTxItem(wtxOrdered, pwtx->GetTxTime(), item);
+
+    map<const CWalletTx*, set<string> >::iterator mi = mapTxAccounts.find(pwtx);
+    if (mi == mapTxAccounts.end())
+        return;
+    BOOST_FOREACH(const string& strAccount, (*mi).second)
+        EraseTxItem(mapAccountOrdered[strAccount], pwtx->GetTxTime(), item);
+    mapTxAccounts.erase(mi);
+}
+
+void CWallet::OrderAccountingEntry(CAccountingEntry* pacentry)
+{
+    TxPair item((CWalletTx*)0, pacentry);
+    wtxOrdered.insert(make_pair(pacentry->nTime, item));
+    mapAccountOrdered[pacentry->strAccount].insert(make_pair(pacentry->nTime, item));
+}
+
+// True if the transaction moved to another block, or in or out of the chain
+bool CWallet::FileTxByBlock(const CWalletTx* pwtx)
+{
+    uint256 hashBlock = 0;
+    if (pwtx->hashBlock != 0 && pwtx->nIndex != -1)
+    {
+        map<uint256, CBlockIndex*>::iterator mi = mapBlockIndex.find(pwtx->hashBlock);
+        if (mi != mapBlockIndex.end() && (*mi).second->IsInMainChain())
+            hashBlock = pwtx->hashBlock;
+    }
+
+    map<const CWalletTx*, uint256>::iterator mi = mapTxBlock.find(pwtx);
+    if (mi != mapTxBlock.end())
+    {
+        if ((*mi).second == hashBlock)
+            return false;
+        mapTxByBlock[(*mi).second].erase(pwtx);
+        if (mapTxByBlock[(*mi).second].empty())
+            mapTxByBlock.erase((*mi).second);
+    }
+    mapTxBlock[pwtx] = hashBlock;
+    mapTxByBlock[hashBlock].insert(pwtx);
+    return true;
+}
+
+static void AddAtHeight(map<int, int64>& mapByHeight, int nHeight, int64 nValue)
+{
+    int64& nTotal = mapByHeight[nHeight];
+    nTotal += nValue;
+    if (nTotal == 0)
+        mapByHeight.erase(nHeight);
+}
+
+// Sum of the amounts at heights above nHeight
+static int64 SumAbove(const map<int, int64>& mapByHeight, int nHeight)
+{
+    int64 nSum = 0;
+    for (map<int, int64>::const_reverse_iterator it = mapByHeight.rbegin(); it != mapByHeight.rend() && (*it).first > nHeight; ++it)
+        nSum += (*it).second;
+    return nSum;
+}
+
+int64 CAccountTally::GetBalance(int nMinDepth, int nBestHeightIn, bool fIncludeMoves) const
+{
+    // A block at height h has nBestHeight - h + 1 confirmations, so only the
+    // few most recent heights ever need looking at
+    int64 nBalance = nReceived - SumAbove(mapReceived, nBestHeightIn - nMinDepth + 1);
+    if (nMinDepth <= 0)
+        nBalance += nReceivedUnconfirmed;
+    nBalance += nGenerated - SumAbove(mapGenerated, nBestHeightIn - (COINBASE_MATURITY+15) + 1);
+    nBalance -= nDebit;
+    if (fIncludeMoves)
+        nBalance += nMoves;
+    return nBalance;
+}
+
+void CTxTally::AddTo(map<string, CAccountTally>& mapTally, int nSign) const
+{
+    if (nGenerated != 0 && nHeight >= 0)
+    {
+        CAccountTally& tally = mapTally[""];
+        tally.nGenerated += nSign * nGenerated;
+        AddAtHeight(tally.mapGenerated, nHeight, nSign * nGenerated);
+    }
+    if (nDebit != 0)
+        mapTally[strSentAccount].nDebit += nSign * nDebit;
+    for (map<string, int64>::const_iterator it = mapReceived.begin(); it != mapReceived.end(); ++it)
+    {
+        CAccountTally& tally = mapTally[(*it).first];
+        if (nHeight >= 0)
+        {
+            tally.nReceived += nSign * (*it).second;
+            AddAtHeight(tally.mapReceived, nHeight, nSign * (*it).second);
+        }
+        else
+            tally.nReceivedUnconfirmed += nSign * (*it).second;
+    }
+}
+
+// The same split of amounts over accounts as CWalletTx::GetAccountAmounts
+void CWallet::MakeTxTally(const CWalletTx* pwtx, CTxTally& txTally) const
+{
+    map<const CWalletTx*, uint256>::const_iterator mi = mapTxBlock.find(pwtx);
+    if (mi != mapTxBlock.end() && (*mi).second != 0)
+    {
+        map<uint256, CBlockIndex*>::iterator miIndex = mapBlockIndex.find((*mi).second);
+        if (miIndex != mapBlockIndex.end())
+            txTally.nHeight = (*miIndex).second->nHeight;
+    }
+    txTally.strSentAccount = pwtx->strFromAccount;
+
+    if (pwtx->IsCoinBase())
+    {
+        // Whether it is mature yet is up to the height it is looked at
+        txTally.nGenerated = GetCredit(*pwtx);
+        return;
+    }
+
+    int64 nGeneratedImmature, nGeneratedMature, nFee;
+    string strSentAccount;
+    list<pair<CTxDestination, int64> > listReceived;
+    list<pair<CTxDestination, int64> > listSent;
+    pwtx->GetAmounts(nGeneratedImmature, nGeneratedMature, listReceived, listSent, nFee, strSentAccount);
+    txTally.nDebit = nFee;
+    BOOST_FOREACH(const PAIRTYPE(CTxDestination, int64)& s, listSent)
+        txTally.nDebit += s.second;
+    BOOST_FOREACH(const PAIRTYPE(CTxDestination, int64)& r, listReceived)
+    {
+        map<CTxDestination, string>::const_iterator mi = mapAddressBook.find(r.first);
+        txTally.mapReceived[mi != mapAddressBook.end() ? (*mi).second : ""] += r.second;
+    }
+}
+
+void CWallet::TallyTx(const CWalletTx* pwtx)
+{
+    UntallyTx(pwtx);
+    if (!pwtx->IsFinal())
+    {
+        setTallyNonFinal.insert(pwtx);
+        return;
+    }
+    CTxTally& txTally = mapTxTally[pwtx];
+    MakeTxTally(pwtx, txTally);
+    txTally.AddTo(mapAccountTally, 1);
+}
+
+void CWallet::UntallyTx(const CWalletTx* pwtx)
+{
+    setTallyNonFinal.erase(pwtx);
+    map<const CWalletTx*, CTxTally>::iterator mi = mapTxTally.find(pwtx);
+    if (mi == mapTxTally.end())
+        return;
+    (*mi).second.AddTo(mapAccountTally, -1);
+    mapTxTally.erase(mi);
+}
+
+// Tallies of the transactions that were not final when added but are now
+void CWallet::TallyNowFinal(map<string, CAccountTally>& mapTallyRet) const
+{
+    BOOST_FOREACH(const CWalletTx* pwtx, setTallyNonFinal)
+    {
+        if (!pwtx->IsFinal())
+            continue;
+        CTxTally txTally;
+        MakeTxTally(pwtx, txTally);
+        txTally.AddTo(mapTallyRet, 1);
+    }
+}
+
+void CWallet::ReindexAccounts()
+{
+    mapAccountOrdered.clear();
+    mapTxAccounts.clear();
+    setOrderedDestinations.clear();
+    mapAccountTally.clear();
+    mapTxTally.clear();
+    setTallyNonFinal.clear();
+    for (TxItems::iterator it = wtxOrdered.begin(); it != wtxOrdered.end(); ++it)
+    {
+        if (CWalletTx* pwtx = (*it).second.first)
+        {
+            set<string>& setAccounts = mapTxAccounts[pwtx];
+            GetTxAccounts(this, *pwtx, setAccounts, setOrderedDestinations);
+            BOOST_FOREACH(const string& strAccount, setAccounts)
+                mapAccountOrdered[strAccount].insert(*it);
+            TallyTx(pwtx);
+        }
+        if (CAccountingEntry* pacentry = (*it).second.second)
+        {
+            mapAccountOrdered[pacentry->strAccount].insert(*it);
+            mapAccountTally[pacentry->strAccount].nMoves += pacentry->nCreditDebit;
+        }
+    }
+    fAccountOrderedDirty = false;
+}
+
+void CWallet::ReindexTransactions()
+{
+    {
+        LOCK(cs_wallet);
+        wtxOrdered.clear();
+        mapTxByBlock.clear();
+        mapTxBlock.clear();
+        for (map<uint256, CWalletTx>::iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
+        {
+            CWalletTx* pwtx = &(*it).second;
+            wtxOrdered.insert(make_pair(pwtx->GetTxTime(), TxPair(pwtx, (CAccountingEntry*)0)));
+            FileTxByBlock(pwtx);
+        }
+        BOOST_FOREACH(CAccountingEntry& entry, laccentries)
+            wtxOrdered.insert(make_pair(entry.nTime, TxPair((CWalletTx*)0, &entry)));
+        ReindexAccounts();
+    }
+}
+
+void CWallet::AddAccountingEntry(const CAccountingEntry& acentry)
+{
+    {
+        LOCK(cs_wallet);
+        laccentries.push_back(acentry);
+        OrderAccountingEntry(&laccentries.back());
+        mapAccountTally[acentry.strAccount].nMoves += acentry.nCreditDebit;
+    }
+}
+
+const TxItems& CWallet::GetOrderedTxItems(const string& strAccount)
+{
+    static const TxItems txItemsEmpty;
+    LOCK(cs_wallet);
+    if (strAccount == "*")
+        return wtxOrdered;
+    if (fAccountOrderedDirty)
+        ReindexAccounts();
+    map<string, TxItems>::const_iterator mi = mapAccountOrdered.find(strAccount);
+    if (mi == mapAccountOrdered.end())
+        return txItemsEmpty;
+    return (*mi).second;
+}
+
+void CWallet::GetTransactionsSinceHeight(int nHeight, vector<const CWalletTx*>& vwtxRet) const
+{
+    {
+        LOCK(cs_wallet);
+        int nDepth = 1 + nBestHeight - nHeight;
+        map<uint256, set<const CWalletTx*> >::const_iterator mi;
+        for (CBlockIndex* pindex = pindexBest; pindex && pindex->nHeight > nHeight; pindex = pindex->pprev)
+            if ((mi = mapTxByBlock.find(pindex->GetBlockHash())) != mapTxByBlock.end())
+                vwtxRet.insert(vwtxRet.end(), (*mi).second.begin(), (*mi).second.end());
+        reverse(vwtxRet.begin(), vwtxRet.end());
+
+        // Not in the main chain as far as the index knows; a reorganization
+        // that failed half way can leave some here that are, so check
+        if ((mi = mapTxByBlock.find(0)) != mapTxByBlock.end())
+        {
+            BOOST_FOREACH(const CWalletTx* pwtx, (*mi).second)
+                if (pwtx->GetDepthInMainChain() < nDepth)
+                    vwtxRet.push_back(pwtx);
+        }
+    }
+}
+
+void CWallet::DisconnectBlock(const uint256& hashBlock)
+{
+    {
+        LOCK(cs_wallet);
+        map<uint256, set<const CWalletTx*> >::iterator mi = mapTxByBlock.find(hashBlock);
+        if (mi == mapTxByBlock.end())
+            return;
+        set<const CWalletTx*> setTx;
+        setTx.swap((*mi).second);
+        mapTxByBlock.erase(mi);
+        BOOST_FOREACH(const CWalletTx* pwtx, setTx)
+        {
+            mapTxBlock[pwtx] = 0;
+            mapTxByBlock[0].insert(pwtx);
+            TallyTx(pwtx);
+        }
+    }
+}
+
+void CWallet::FileConnectedTxs()
+{
+    {
+        LOCK(cs_wallet);
+        map<uint256, set<const CWalletTx*> >::iterator mi = mapTxByBlock.find(0);
+        if (mi == mapTxByBlock.end())
+            return;
+        // Filing them takes them out of the set being walked.  The account
+        // tallies take their height from where they are filed, so those
+        // that moved are tallied again.
+        vector<const CWalletTx*> vwtx((*mi).second.begin(), (*mi).second.end());
+        BOOST_FOREACH(const CWalletTx* pwtx, vwtx)
+            if (pwtx->hashBlock != 0 && FileTxByBlock(pwtx))
+                TallyTx(pwtx);
+    }
+}
+
+uint256 CWallet::GetFiledBlock(const CWalletTx* pwtx) const
+{
+    LOCK(cs_wallet);
+    map<const CWalletTx*, uint256>::const_iterator mi = mapTxBlock.find(pwtx);
+    if (mi == mapTxBlock.end())
+        return 0;
+    return (*mi).second;
+}
+
+int64 CWallet::GetAccountBalance(const string& strAccount, int nMinDepth)
+{
+    LOCK(cs_wallet);
+    if (fAccountOrderedDirty)
+        ReindexAccounts();
+
+    map<string, CAccountTally> mapNowFinal;
+    TallyNowFinal(mapNowFinal);
+    const map<string, CAccountTally>* vTallies[] = { &mapAccountTally, &mapNowFinal };
+    int64 nBalance = 0;
+    for (int i = 0; i < 2; i++)
+    {
+        const map<string, CAccountTally>* pmapTally = vTallies[i];
+        if (strAccount == "*")
+        {
+            for (map<string, CAccountTally>::const_iterator it = pmapTally->begin(); it != pmapTally->end(); ++it)
+                nBalance += (*it).second.GetBalance(nMinDepth, nBestHeight, false);
+            continue;
+        }
+        map<string, CAccountTally>::const_iterator mi = pmapTally->find(strAccount);
+        if (mi != pmapTally->end())
+            nBalance += (*mi).second.GetBalance(nMinDepth, nBestHeight, true);
     }
+    return nBalance;
+}
+
+void CWallet::GetAccountBalances(int nMinDepth, map<string, int64>& mapBalancesRet)
+{
+    LOCK(cs_wallet);
+    if (fAccountOrderedDirty)
+        ReindexAccounts();
+
+    map<string, CAccountTally> mapNowFinal;
+    TallyNowFinal(mapNowFinal);
+    const map<string, CAccountTally>* vTallies[] = { &mapAccountTally, &mapNowFinal };
+    for (int i = 0; i < 2; i++)
+        for (map<string, CAccountTally>::const_iterator it = vTallies[i]->begin(); it != vTallies[i]->end(); ++it)
+            mapBalancesRet[(*it).first] += (*it).second.GetBalance(nMinDepth, nBestHeight, true);
 }
 
 bool CWallet::AddToWallet(const CWalletTx& wtxIn)
@@ -337,6 +774,14 @@ bool CWallet::AddToWallet(const CWalletTx& wtxIn)
             }
             fUpdated |= wtx.UpdateSpent(wtxIn.vfSpent);
         }
+        UpdateUnspent(hash, wtx);
+        if (fInsertedNew || fUpdated)
+        {
+            UnorderTx(&wtx);
+            OrderTx(&wtx);
+        }
+        if (FileTxByBlock(&wtx) || fInsertedNew || fUpdated)
+            TallyTx(&wtx);
 
         printf("AddToWallet %s  %s%s\n", wtxIn.GetHash().ToString().substr(0,10).c_str(), (fInsertedNew ? "new" : ""), (fUpdated ? "update" : ""));
 
@@ -393,6 +838,21 @@ bool CWallet::EraseFromWallet(uint256 hash)
         return false;
     {
         LOCK(cs_wallet);
+        mapUnspent.erase(hash);
+        fBalancesCached = false;
+        map<uint256, CWalletTx>::iterator mi = mapWallet.find(hash);
+        if (mi != mapWallet.end())
+        {
+            CWalletTx* pwtx = &(*mi).second;
+            UnorderTx(pwtx);
+            UntallyTx(pwtx);
+            map<const CWalletTx*, uint256>::iterator miBlock = mapTxBlock.find(pwtx);
+            if (miBlock != mapTxBlock.end())
+            {
+                mapTxByBlock[(*miBlock).second].erase(pwtx);
+                mapTxBlock.erase(miBlock);
+            }
+        }
         if (mapWallet.erase(hash))
             CWalletDB(strWalletFile).EraseTx(hash);
     }
@@ -635,25 +1095,118 @@ bool CWalletTx::WriteToDisk()
 }
 
 
+// Blocks each rescan thread reads ahead of the wallet
+static const int RESCAN_BLOCKS_PER_THREAD = 32;
+
+struct CRescanBlock
+{
+    CBlockIndex* pindex;
+    vector<unsigned char> vchBlock;
+    vector<uint256> vHashes;    // per transaction
+    vector<bool> vfPaysMe;      // per transaction: some output is ours
+};
+
+// Reads every nStep'th block of the batch starting at nFirst.  Blocks are
+// only looked at through a CBlockView here, nearly all of them have nothing
+// for the wallet and are never deserialized.
+static void ThreadRescanRead(const CKeyStore* pkeystore, vector<CRescanBlock>* pvBlocks, unsigned int nFirst, unsigned int nStep)
+{
+    CScript scriptPubKey;
+    for (unsigned int i = nFirst; i < pvBlocks->size(); i += nStep)
+    {
+        CRescanBlock& rescan = (*pvBlocks)[i];
+        if (!ReadRawBlockFromDisk(rescan.pindex, rescan.vchBlock))
+            continue;
+        CBlockView block(&rescan.vchBlock[0], &rescan.vchBlock[0] + rescan.vchBlock.size());
+        // Hashes all the transactions, the wallet pass looks them up by hash
+        rescan.vfPaysMe.resize(block.GetTransactionCount());
+        unsigned int j = 0;
+        for (CBlockView::iterator it = block.begin(); it != block.end(); ++it, j++)
+        {
+            rescan.vHashes.push_back(it->GetHash());
+            BOOST_FOREACH(const CTxOutView& txout, it->GetOutputs())
+            {
+                // Reuses the script's buffer from output to output
+                scriptPubKey.assign(txout.ScriptBegin(), txout.ScriptEnd());
+                if (IsMine(*pkeystore, scriptPubKey))
+                {
+                    rescan.vfPaysMe[j] = true;
+                    break;
+                }
+            }
+        }
+    }
+}
+
+// Blocks are read and checked against the wallet's keys by -rescanthreads
+// threads a batch at a time, then handed to the wallet in chain order.  The
+// wallet is only locked while a batch is applied, and the last finished
+// block is saved now and then so an interrupted rescan can pick up again.
 int CWallet::ScanForWalletTransactions(CBlockIndex* pindexStart, bool fUpdate)
 {
     int ret = 0;
 
+    int nThreads = GetArg("-rescanthreads", boost::thread::hardware_concurrency());
+    nThreads = max(1, min(nThreads, 16));
+    int64 nLastProgress = GetTime();
+
     CBlockIndex* pindex = pindexStart;
+    while (pindex && !fShutdown)
     {
-        LOCK(cs_wallet);
-        while (pindex)
+        vector<CRescanBlock> vBlocks(nThreads * RESCAN_BLOCKS_PER_THREAD);
+        {
+            LOCK(cs_main);
+            unsigned int n = 0;
+            for (; n < vBlocks.size() && pindex; n++)
+            {
+                vBlocks[n].pindex = pindex;
+                pindex = pindex->pnext;
+            }
+            vBlocks.resize(n);
+        }
+
+        boost::thread_group threadGroup;
+        for (int i = 1; i < nThreads; i++)
+            threadGroup.create_thread(boost::bind(&ThreadRescanRead, this, &vBlocks, i, nThreads));
+        ThreadRescanRead(this, &vBlocks, 0, nThreads);
+        threadGroup.join_all();
+
         {
-            CBlock block;
-            block.ReadFromDisk(pindex, true);
-            BOOST_FOREACH(CTransaction& tx, block.vtx)
+            LOCK2(cs_main, cs_wallet);
+            BOOST_FOREACH(CRescanBlock& rescan, vBlocks)
+            {
+                if (rescan.vchBlock.empty())
+                    continue;
+                CBlockView view(&rescan.vchBlock[0], &rescan.vchBlock[0] + rescan.vchBlock.size());
+                // Deserialized the first time one of its transactions is ours
+                CBlock block;
+                unsigned int j = 0;
+                for (CBlockView::iterator it = view.begin(); it != view.end(); ++it, j++)
+                {
+                    bool fInvolvesMe = rescan.vfPaysMe[j] || (fUpdate && mapWallet.count(rescan.vHashes[j]));
+                    CTxViewRange<CTxInView> inputs = it->GetInputs();
+                    for (CTxViewRange<CTxInView>::iterator in = inputs.begin(); in != inputs.end() && !fInvolvesMe; ++in)
+                        fInvolvesMe = mapWallet.count(in->GetPrevoutHash()) > 0;
+                    if (!fInvolvesMe)
+                        continue;
+                    if (block.vtx.empty())
+                        view.Get(block);
+                    if (AddToWalletIfInvolvingMe(block.vtx[j], &block, fUpdate))
+                        ret++;
+                }
+            }
+
+            if (fFileBacked && !vBlocks.empty() && (fShutdown || GetTime() - nLastProgress >= 10))
             {
-                if (AddToWalletIfInvolvingMe(tx, &block, fUpdate))
-                    ret++;
+                printf("Rescan reached block %d\n", vBlocks.back().pindex->nHeight);
+                CWalletDB(strWalletFile).WriteRescanProgress(CBlockLocator(vBlocks.back().pindex));
+                nLastProgress = GetTime();
             }
-            pindex = pindex->pnext;
         }
     }
+
+    if (fFileBacked && !fShutdown)
+        CWalletDB(strWalletFile).EraseRescanProgress();
     return ret;
 }
 
@@ -672,48 +1225,52 @@ void CWallet::ReacceptWalletTransactions()
     bool fRepeat = true;
     while (fRepeat)
     {
-        LOCK(cs_wallet);
         fRepeat = false;
         vector<CDiskTxPos> vMissingTx;
-        BOOST_FOREACH(PAIRTYPE(const uint256, CWalletTx)& item, mapWallet)
         {
-            CWalletTx& wtx = item.second;
-            if (wtx.IsCoinBase() && wtx.IsSpent(0))
-                continue;
-
-            CTxIndex txindex;
-            bool fUpdated = false;
-            if (txdb.ReadTxIndex(wtx.GetHash(), txindex))
+            LOCK(cs_wallet);
+            BOOST_FOREACH(PAIRTYPE(const uint256, CWalletTx)& item, mapWallet)
             {
-                if (txindex.vSpent.size() != wtx.vout.size())
-                {
-                    printf("ERROR: ReacceptWalletTransactions() : txindex.vSpent.size() %d != wtx.vout.size() %d\n", txindex.vSpent.size(), wtx.vout.size());
+                CWalletTx& wtx = item.second;
+                if (wtx.IsCoinBase() && wtx.IsSpent(0))
                     continue;
-                }
-                for (unsigned int i = 0; i < txindex.vSpent.size(); i++)
+
+                CTxIndex txindex;
+                bool fUpdated = false;
+                if (txdb.ReadTxIndex(wtx.GetHash(), txindex))
                 {
-                    if (wtx.IsSpent(i))
+                    if (txindex.vSpent.size() != wtx.vout.size())
+                    {
+                        printf("ERROR: ReacceptWalletTransactions() : txindex.vSpent.size() %d != wtx.vout.size() %d\n", txindex.vSpent.size(), wtx.vout.size());
                         continue;
-                    if (!txindex.vSpent[i].IsNull() && IsMine(wtx.vout[i]))
+                    }
+                    for (unsigned int i = 0; i < txindex.vSpent.size(); i++)
                     {
-                        wtx.MarkSpent(i);
-                        fUpdated = true;
-                        vMissingTx.push_back(txindex.vSpent[i]);
+                        if (wtx.IsSpent(i))
+                            continue;
+                        if (!txindex.vSpent[i].IsNull() && IsMine(wtx.vout[i]))
+                        {
+                            wtx.MarkSpent(i);
+                            fUpdated = true;
+                            vMissingTx.push_back(txindex.vSpent[i]);
+                        }
+                    }
+                    if (fUpdated)
+                    {
+                        printf("ReacceptWalletTransactions found spent coin %sbc %s\n", FormatMoney(wtx.GetCredit()).c_str(), wtx.GetHash().ToString().c_str());
+                        wtx.MarkDirty();
+                        wtx.WriteToDisk();
+                        UpdateUnspent(item.first, wtx);
                     }
                 }
-                if (fUpdated)
+                else
                 {
-                    printf("ReacceptWalletTransactions found spent coin %sbc %s\n", FormatMoney(wtx.GetCredit()).c_str(), wtx.GetHash().ToString().c_str());
-                    wtx.MarkDirty();
-                    wtx.WriteToDisk();
+                    if (!wtx.IsCoinBase())
+                        wtx.AcceptWalletTransaction(txdb, false);
                 }
             }
-            else
-            {
-                if (!wtx.IsCoinBase())
-                    wtx.AcceptWalletTransaction(txdb, false);
-            }
         }
+        // The rescan takes cs_main, so not with cs_wallet held
         if (!vMissingTx.empty())
         {
             if (ScanForWalletTransactions(pindexGenesisBlock))
@@ -789,50 +1346,77 @@ void CWallet::ResendWalletTransactions()
 
 
 
-int64 CWallet::GetBalance() const
+// Whether IsConfirmed() on an unconfirmed coin may change as time passes:
+// it or one of the transactions it spends is locked until a timestamp.
+static bool IsTimeLocked(const CWalletTx* pcoin)
 {
-    int64 nTotal = 0;
+    if (pcoin->nLockTime >= LOCKTIME_THRESHOLD)
+        return true;
+    BOOST_FOREACH(const CMerkleTx& tx, pcoin->vtxPrev)
+        if (tx.nLockTime >= LOCKTIME_THRESHOLD)
+            return true;
+    return false;
+}
+
+// Work out all three balances in one pass over mapUnspent.  They only
+// change when a wallet transaction does (which clears fBalancesCached) or
+// when blocks are connected or disconnected, which moves pindexBest and
+// with it confirmations and coinbase maturity.  Coins held back by a
+// timestamp lock time can also become final as the clock moves, so while
+// there are any the balances are only kept for the second they were
+// worked out in.  Call with cs_wallet held.
+void CWallet::CacheBalances() const
+{
+    if (fBalancesCached && pindexBalances == pindexBest &&
+        (nTimeBalances == 0 || nTimeBalances == GetAdjustedTime()))
+        return;
+
+    int64 nBalance = 0;
+    int64 nUnconfirmed = 0;
+    int64 nImmature = 0;
+    bool fTimeLocked = false;
+    for (map<uint256, const CWalletTx*>::const_iterator it = mapUnspent.begin(); it != mapUnspent.end(); ++it)
     {
-        LOCK(cs_wallet);
-        for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
+        const CWalletTx* pcoin = (*it).second;
+        if (pcoin->IsFinal() && pcoin->IsConfirmed())
+            nBalance += pcoin->GetAvailableCredit();
+        else
         {
-            const CWalletTx* pcoin = &(*it).second;
-            if (pcoin->IsFinal() && pcoin->IsConfirmed())
-                nTotal += pcoin->GetAvailableCredit();
+            nUnconfirmed += pcoin->GetAvailableCredit();
+            if (!fTimeLocked)
+                fTimeLocked = IsTimeLocked(pcoin);
         }
+        if (pcoin->IsCoinBase() && pcoin->GetBlocksToMaturity() > 0 && pcoin->GetDepthInMainChain() >= 2)
+            nImmature += GetCredit(*pcoin);
     }
 
-    return nTotal;
+    nBalanceCached = nBalance;
+    nUnconfirmedBalanceCached = nUnconfirmed;
+    nImmatureBalanceCached = nImmature;
+    pindexBalances = pindexBest;
+    nTimeBalances = fTimeLocked ? GetAdjustedTime() : 0;
+    fBalancesCached = true;
+}
+
+int64 CWallet::GetBalance() const
+{
+    LOCK(cs_wallet);
+    CacheBalances();
+    return nBalanceCached;
 }
 
 int64 CWallet::GetUnconfirmedBalance() const
 {
-    int64 nTotal = 0;
-    {
-        LOCK(cs_wallet);
-        for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
-        {
-            const CWalletTx* pcoin = &(*it).second;
-            if (!pcoin->IsFinal() || !pcoin->IsConfirmed())
-                nTotal += pcoin->GetAvailableCredit();
-        }
-    }
-    return nTotal;
+    LOCK(cs_wallet);
+    CacheBalances();
+    return nUnconfirmedBalanceCached;
 }
 
 int64 CWallet::GetImmatureBalance() const
 {
-    int64 nTotal = 0;
-    {
-        LOCK(cs_wallet);
-        for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
-        {
-            const CWalletTx& pcoin = (*it).second;
-            if (pcoin.IsCoinBase() && pcoin.GetBlocksToMaturity() > 0 && pcoin.GetDepthInMainChain() >= 2)
-                nTotal += GetCredit(pcoin);
-        }
-    }
-    return nTotal;
+    LOCK(cs_wallet);
+    CacheBalances();
+    return nImmatureBalanceCached;
 }
 
 void CWallet::AvailableCoins(vector<COutput>& vCoins, bool fOnlyConfirmed) const
@@ -841,9 +1425,9 @@ void CWallet::AvailableCoins(vector<COutput>& vCoins, bool fOnlyConfirmed) const
 
     {
         LOCK(cs_wallet);
-        for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
+        for (map<uint256, const CWalletTx*>::const_iterator it = mapUnspent.begin(); it != mapUnspent.end(); ++it)
         {
-            const CWalletTx* pcoin = &(*it).second;
+            const CWalletTx* pcoin = (*it).second;
 
             if (!pcoin->IsFinal())
                 continue;
@@ -861,45 +1445,76 @@ void CWallet::AvailableCoins(vector<COutput>& vCoins, bool fOnlyConfirmed) const
     }
 }
 
-static void ApproximateBestSubset(vector<pair<int64, pair<const CWalletTx*,unsigned int> > >vValue, int64 nTotalLower, int64 nTargetValue,
-                                  vector<char>& vfBest, int64& nBest, int iterations = 1000)
-{
-    vector<char> vfIncluded;
-
-    vfBest.assign(vValue.size(), true);
+// Smallest subset of vValue (sorted by decreasing value) adding up to at
+// least nTargetValue, by depth-first branch and bound.  At each step any
+// one coin at least as big as what is still needed completes a subset, and
+// the smallest such coin is the best way to do it, so only the coins below
+// it are branched on, largest first.  Coins of equal value are
+// interchangeable, so leaving one out leaves out the rest of its run too.
+// Gives up after nMaxTries steps with the best subset found so far, which
+// is never worse than taking every coin.
+static void BranchAndBoundSubset(const vector<pair<int64, pair<const CWalletTx*,unsigned int> > >& vValue, int64 nTotalLower, int64 nTargetValue,
+                                 vector<char>& vfBest, int64& nBest, int nMaxTries = 100000)
+{
+    unsigned int nCoins = vValue.size();
+    vfBest.assign(nCoins, true);
     nBest = nTotalLower;
 
-    for (int nRep = 0; nRep < iterations && nBest != nTargetValue; nRep++)
+    // vRemaining[i]: total of coins i and after
+    vector<int64> vRemaining(nCoins + 1, 0);
+    for (unsigned int i = nCoins; i > 0; i--)
+        vRemaining[i-1] = vRemaining[i] + vValue[i-1].first;
+
+    // Coins taken so far always add up to less than nTargetValue
+    vector<unsigned int> vSelected;
+    vector<unsigned int> vSelectedBest;
+    bool fFound = false;
+    int64 nTotal = 0;
+    unsigned int i = 0;
+    for (int nTries = 0; nTries < nMaxTries && nBest != nTargetValue; nTries++)
     {
-        vfIncluded.assign(vValue.size(), false);
-        int64 nTotal = 0;
-        bool fReachedTarget = false;
-        for (int nPass = 0; nPass < 2 && !fReachedTarget; nPass++)
+        if (i < nCoins)
         {
-            for (unsigned int i = 0; i < vValue.size(); i++)
+            pair<int64, pair<const CWalletTx*,unsigned int> > needed(nTargetValue - nTotal, make_pair((const CWalletTx*)NULL, 0));
+            unsigned int nSmaller = upper_bound(vValue.begin() + i, vValue.end(), needed, CompareValueGreater()) - vValue.begin();
+            if (nSmaller > i && nTotal + vValue[nSmaller-1].first < nBest)
             {
-                if (nPass == 0 ? rand() % 2 : !vfIncluded[i])
-                {
-                    nTotal += vValue[i].first;
-                    vfIncluded[i] = true;
-                    if (nTotal >= nTargetValue)
-                    {
-                        fReachedTarget = true;
-                        if (nTotal < nBest)
-                        {
-                            nBest = nTotal;
-                            vfBest = vfIncluded;
-                        }
-                        nTotal -= vValue[i].first;
-                        vfIncluded[i] = false;
-                    }
-                }
+                nBest = nTotal + vValue[nSmaller-1].first;
+                vSelectedBest = vSelected;
+                vSelectedBest.push_back(nSmaller-1);
+                fFound = true;
             }
+            i = nSmaller;
+        }
+
+        if (i >= nCoins || nTotal + vRemaining[i] < nTargetValue)
+        {
+            // Drop the last coin taken and carry on past its equals
+            if (vSelected.empty())
+                break;
+            unsigned int j = vSelected.back();
+            vSelected.pop_back();
+            nTotal -= vValue[j].first;
+            for (i = j + 1; i < nCoins && vValue[i].first == vValue[j].first; i++)
+                ;
+        }
+        else
+        {
+            vSelected.push_back(i);
+            nTotal += vValue[i].first;
+            i++;
         }
     }
+
+    if (fFound)
+    {
+        vfBest.assign(nCoins, false);
+        BOOST_FOREACH(unsigned int j, vSelectedBest)
+            vfBest[j] = true;
+    }
 }
 
-bool CWallet::SelectCoinsMinConf(int64 nTargetValue, int nConfMine, int nConfTheirs, vector<COutput> vCoins,
+bool CWallet::SelectCoinsMinConf(int64 nTargetValue, int nConfMine, int nConfTheirs, const vector<COutput>& vCoins,
                                  set<pair<const CWalletTx*,unsigned int> >& setCoinsRet, int64& nValueRet) const
 {
     setCoinsRet.clear();
@@ -908,12 +1523,12 @@ bool CWallet::SelectCoinsMinConf(int64 nTargetValue, int nConfMine, int nConfThe
     pair<int64, pair<const CWalletTx*,unsigned int> > coinLowestLarger;
     coinLowestLarger.first = std::numeric_limits<int64>::max();
     coinLowestLarger.second.first = NULL;
+    vector<pair<int64, pair<const CWalletTx*,unsigned int> > > vEligible;
     vector<pair<int64, pair<const CWalletTx*,unsigned int> > > vValue;
     int64 nTotalLower = 0;
 
-    random_shuffle(vCoins.begin(), vCoins.end(), GetRandInt);
-
-    BOOST_FOREACH(COutput output, vCoins)
+    vEligible.reserve(vCoins.size());
+    BOOST_FOREACH(const COutput& output, vCoins)
     {
         const CWalletTx *pcoin = output.tx;
 
@@ -921,9 +1536,16 @@ bool CWallet::SelectCoinsMinConf(int64 nTargetValue, int nConfMine, int nConfThe
             continue;
 
         int i = output.i;
-        int64 n = pcoin->vout[i].nValue;
+        vEligible.push_back(make_pair(pcoin->vout[i].nValue, make_pair(pcoin, i)));
+    }
+
+    // Coins of the same value are picked in random order
+    random_shuffle(vEligible.begin(), vEligible.end(), GetRandInt);
 
-        pair<int64,pair<const CWalletTx*,unsigned int> > coin = make_pair(n,make_pair(pcoin, i));
+    for (unsigned int nCoin = 0; nCoin < vEligible.size(); nCoin++)
+    {
+        const pair<int64,pair<const CWalletTx*,unsigned int> >& coin = vEligible[nCoin];
+        int64 n = coin.first;
 
         if (n == nTargetValue)
         {
@@ -961,13 +1583,13 @@ bool CWallet::SelectCoinsMinConf(int64 nTargetValue, int nConfMine, int nConfThe
         return true;
     }
 
-    sort(vValue.rbegin(), vValue.rend(), CompareValueOnly());
+    stable_sort(vValue.rbegin(), vValue.rend(), CompareValueOnly());
     vector<char> vfBest;
     int64 nBest;
 
-    ApproximateBestSubset(vValue, nTotalLower, nTargetValue, vfBest, nBest, 1000);
+    BranchAndBoundSubset(vValue, nTotalLower, nTargetValue, vfBest, nBest);
     if (nBest != nTargetValue && nTotalLower >= nTargetValue + CENT)
-        ApproximateBestSubset(vValue, nTotalLower, nTargetValue + CENT, vfBest, nBest, 1000);
+        BranchAndBoundSubset(vValue, nTotalLower, nTargetValue + CENT, vfBest, nBest);
 
     if (coinLowestLarger.second.first &&
         ((nBest != nTargetValue && nBest < nTargetValue + CENT) || coinLowestLarger.first <= nBest))
@@ -983,11 +1605,7 @@ bool CWallet::SelectCoinsMinConf(int64 nTargetValue, int nConfMine, int nConfThe
                 nValueRet += vValue[i].first;
             }
 
-        printf("SelectCoins() best subset: ");
-        for (unsigned int i = 0; i < vValue.size(); i++)
-            if (vfBest[i])
-                printf("%s ", FormatMoney(vValue[i].first).c_str());
-        printf("total %s\n", FormatMoney(nBest).c_str());
+        printf("SelectCoins() best subset: %d coins, total %s\n", (int)setCoinsRet.size(), FormatMoney(nBest).c_str());
     }
 
     return true;
@@ -1062,7 +1680,7 @@ bool CWallet::CreateTransaction(const vector<pair<CScript, int64> >& vecSend, CW
                     CScript scriptChange;
                     scriptChange.SetDestination(vchPubKey.GetID());
 
-                    vector<CTxOut>::iterator position = wtxNew.vout.begin()+GetRandInt(wtxNew.vout.size());
+                    vector<CTxOut, arena_allocator<CTxOut> >::iterator position = wtxNew.vout.begin()+GetRandInt(wtxNew.vout.size());
                     wtxNew.vout.insert(position, CTxOut(nChange, scriptChange));
                 }
                 else
@@ -1071,10 +1689,11 @@ bool CWallet::CreateTransaction(const vector<pair<CScript, int64> >& vecSend, CW
                 BOOST_FOREACH(const PAIRTYPE(const CWalletTx*,unsigned int)& coin, setCoins)
                     wtxNew.vin.push_back(CTxIn(coin.first->GetHash(),coin.second));
 
-                int nIn = 0;
+                vector<const CScript*> vpFromPubKeys;
                 BOOST_FOREACH(const PAIRTYPE(const CWalletTx*,unsigned int)& coin, setCoins)
-                    if (!SignSignature(*this, *coin.first, wtxNew, nIn++))
-                        return false;
+                    vpFromPubKeys.push_back(&coin.first->vout[coin.second].scriptPubKey);
+                if (!SignSignatures(*this, vpFromPubKeys, wtxNew))
+                    return false;
 
                 unsigned int nBytes = ::GetSerializeSize(*(CTransaction*)&wtxNew, SER_NETWORK, PROTOCOL_VERSION);
                 if (nBytes >= MAX_BLOCK_SIZE_GEN/5)
@@ -1127,6 +1746,7 @@ bool CWallet::CommitTransaction(CWalletTx& wtxNew, CReserveKey& reservekey)
                 coin.BindWallet(this);
                 coin.MarkSpent(txin.prevout.n);
                 coin.WriteToDisk();
+                UpdateUnspent(txin.prevout.hash, coin);
                 NotifyTransactionChanged(this, coin.GetHash(), CT_UPDATED);
             }
 
@@ -1218,6 +1838,9 @@ int CWallet::LoadWallet(bool& fFirstRunRet)
         return nLoadWalletRet;
     fFirstRunRet = !vchDefaultKey.IsValid();
 
+    ReindexUnspent();
+    ReindexTransactions();
+
     CreateThread(ThreadFlushWalletDB, &strWalletFile);
     return DB_LOAD_OK;
 }
@@ -1226,6 +1849,11 @@ int CWallet::LoadWallet(bool& fFirstRunRet)
 bool CWallet::SetAddressBookName(const CTxDestination& address, const string& strName)
 {
     std::map<CTxDestination, std::string>::iterator mi = mapAddressBook.find(address);
+    {
+        LOCK(cs_wallet);
+        if (setOrderedDestinations.count(address) && (mi == mapAddressBook.end() || (*mi).second != strName))
+            fAccountOrderedDirty = true;
+    }
     mapAddressBook[address] = strName;
     NotifyAddressBookChanged(this, address, strName, ::IsMine(*this, address), (mi == mapAddressBook.end()) ? CT_NEW : CT_UPDATED);
     if (!fFileBacked)
@@ -1235,6 +1863,11 @@ bool CWallet::SetAddressBookName(const CTxDestination& address, const string& st
 
 bool CWallet::DelAddressBookName(const CTxDestination& address)
 {
+    {
+        LOCK(cs_wallet);
+        if (setOrderedDestinations.count(address))
+            fAccountOrderedDirty = true;
+    }
     mapAddressBook.erase(address);
     NotifyAddressBookChanged(this, address, "", ::IsMine(*this, address), CT_DELETED);
     if (!fFileBacked)
@@ -1313,7 +1946,48 @@ bool CWallet::NewKeyPool()
     return true;
 }
 
-bool CWallet::TopUpKeyPool()
+// Makes every nStep'th key of vKeys starting at nFirst, and its DER private
+// key if vPrivKeys isn't empty
+static void ThreadGenerateKeys(vector<CRawKey>* pvKeys, vector<CPrivKey>* pvPrivKeys, bool fCompressed, unsigned int nFirst, unsigned int nStep)
+{
+    for (unsigned int i = nFirst; i < pvKeys->size(); i += nStep)
+    {
+        CKey key;
+        key.MakeNewKey(fCompressed);
+        (*pvKeys)[i] = CRawKey(key);
+        if (!pvPrivKeys->empty())
+            (*pvPrivKeys)[i] = key.GetPrivKey();
+    }
+}
+
+// Keys written to the wallet file per database transaction
+static const unsigned int KEYPOOL_TXN_KEYS = 1000;
+
+// Points a CWalletDB* at a database for as long as it is in scope, so it
+// isn't left dangling if writing through it throws
+class CWalletDBScope
+{
+private:
+    CWalletDB*& pwalletdb;
+
+public:
+    CWalletDBScope(CWalletDB*& pwalletdbIn, CWalletDB* pwalletdbSet) : pwalletdb(pwalletdbIn)
+    {
+        pwalletdb = pwalletdbSet;
+    }
+
+    ~CWalletDBScope()
+    {
+        pwalletdb = NULL;
+    }
+};
+
+// Keys are generated in parallel and written, together with their pool
+// entries, KEYPOOL_TXN_KEYS to a database transaction.  That keeps each
+// transaction well inside the lock table db.cpp sets up, however large
+// -keypool is.  A transaction that fails takes its keys back out of memory,
+// so nothing is left in the pool that isn't in the wallet file.
+bool CWallet::TopUpKeyPool(unsigned int nSize)
 {
     {
         LOCK(cs_wallet);
@@ -1321,19 +1995,67 @@ bool CWallet::TopUpKeyPool()
         if (IsLocked())
             return false;
 
+        unsigned int nTargetSize = nSize;
+        if (nTargetSize == 0)
+            nTargetSize = max(GetArg("-keypool", 100), 0LL);
+        if (setKeyPool.size() >= nTargetSize + 1)
+            return true;
+
+        bool fCompressed = CanSupportFeature(FEATURE_COMPRPUBKEY);
+        RandAddSeedPerfmon();
+        vector<CRawKey> vKeys(nTargetSize + 1 - setKeyPool.size());
+        vector<CPrivKey> vPrivKeys(IsCrypted() ? 0 : vKeys.size());
+        int nThreads = min(boost::thread::hardware_concurrency(), (unsigned int)vKeys.size() / 64 + 1);
+        nThreads = max(nThreads, 1);
+        boost::thread_group threadGroup;
+        for (int i = 1; i < nThreads; i++)
+            threadGroup.create_thread(boost::bind(&ThreadGenerateKeys, &vKeys, &vPrivKeys, fCompressed, i, nThreads));
+        ThreadGenerateKeys(&vKeys, &vPrivKeys, fCompressed, 0, nThreads);
+        threadGroup.join_all();
+
         CWalletDB walletdb(strWalletFile);
+        if (fCompressed)
+            SetMinVersion(FEATURE_COMPRPUBKEY, &walletdb);
 
-        unsigned int nTargetSize = max(GetArg("-keypool", 100), 0LL);
-        while (setKeyPool.size() < (nTargetSize + 1))
+        int64 nEnd = 1;
+        if (!setKeyPool.empty())
+            nEnd = *(--setKeyPool.end()) + 1;
+        for (unsigned int nBegin = 0; nBegin < vKeys.size(); nBegin += KEYPOOL_TXN_KEYS)
         {
-            int64 nEnd = 1;
-            if (!setKeyPool.empty())
-                nEnd = *(--setKeyPool.end()) + 1;
-            if (!walletdb.WritePool(nEnd, CKeyPool(GenerateNewKey())))
-                throw runtime_error("TopUpKeyPool() : writing generated key failed");
-            setKeyPool.insert(nEnd);
-            printf("keypool added key %"PRI64d", size=%d\n", nEnd, setKeyPool.size());
+            unsigned int nChunkEnd = min(nBegin + KEYPOOL_TXN_KEYS, (unsigned int)vKeys.size());
+            if (!walletdb.TxnBegin())
+                throw runtime_error("TopUpKeyPool() : couldn't start database transaction");
+
+            try
+            {
+                // AddCryptedKey writes through pwalletdbEncryption when it is set
+                CWalletDBScope scope(pwalletdbEncryption, &walletdb);
+                for (unsigned int i = nBegin; i < nChunkEnd; i++)
+                {
+                    const CPubKey& pubkey = vKeys[i].GetPubKey();
+                    bool fOk = CCryptoKeyStore::AddRawKey(vKeys[i]);
+                    if (fOk && !IsCrypted())
+                        fOk = walletdb.WriteKey(pubkey, vPrivKeys[i]);
+                    if (fOk)
+                        fOk = walletdb.WritePool(nEnd + i - nBegin, CKeyPool(pubkey));
+                    if (!fOk)
+                        throw runtime_error("TopUpKeyPool() : writing generated key failed");
+                }
+                if (!walletdb.TxnCommit())
+                    throw runtime_error("TopUpKeyPool() : committing generated keys failed");
+            }
+            catch (...)
+            {
+                walletdb.TxnAbort();
+                for (unsigned int i = nBegin; i < nChunkEnd; i++)
+                    RemoveKey(vKeys[i].GetPubKey().GetID());
+                throw;
+            }
+
+            for (unsigned int i = nBegin; i < nChunkEnd; i++)
+                setKeyPool.insert(nEnd++);
         }
+        printf("keypool added %d keys, size=%d\n", (int)vKeys.size(), (int)setKeyPool.size());
     }
     return true;
 }
@@ -12,6 +12,10 @@ class CWalletTx;
 class CReserveKey;
 class CWalletDB;
 class COutput;
+class CAccountingEntry;
+
+typedef std::pair<CWalletTx*, CAccountingEntry*> TxPair;
+typedef std::multimap<int64, TxPair> TxItems;
 
 enum WalletFeature
 {
@@ -50,6 +54,83 @@ public:
     )
 };
 
+class CAccountingEntry
+{
+public:
+    std::string strAccount;
+    int64 nCreditDebit;
+    int64 nTime;
+    std::string strOtherAccount;
+    std::string strComment;
+
+    CAccountingEntry()
+    {
+        SetNull();
+    }
+
+    void SetNull()
+    {
+        nCreditDebit = 0;
+        nTime = 0;
+        strAccount.clear();
+        strOtherAccount.clear();
+        strComment.clear();
+    }
+
+    IMPLEMENT_SERIALIZE
+    (
+        if (!(nType & SER_GETHASH))
+            READWRITE(nVersion);
+        READWRITE(nCreditDebit);
+        READWRITE(nTime);
+        READWRITE(strOtherAccount);
+        READWRITE(strComment);
+    )
+};
+
+/** Running totals for one account, so getbalance and listaccounts don't have
+ * to look at every wallet transaction.  Amounts that only count from some
+ * depth on are also kept by the height of the block they are in.
+ */
+class CAccountTally
+{
+public:
+    int64 nMoves;                       // accounting entries
+    int64 nDebit;                       // sent, fees included
+    int64 nReceived;                    // received in main chain blocks
+    int64 nReceivedUnconfirmed;
+    int64 nGenerated;                   // coinbase credit in main chain blocks
+    std::map<int, int64> mapReceived;   // nReceived by height
+    std::map<int, int64> mapGenerated;  // nGenerated by height
+
+    CAccountTally()
+    {
+        nMoves = nDebit = nReceived = nReceivedUnconfirmed = nGenerated = 0;
+    }
+
+    // What getbalance counts with the best chain at nBestHeightIn
+    int64 GetBalance(int nMinDepth, int nBestHeightIn, bool fIncludeMoves) const;
+};
+
+/** What one transaction puts in the account tallies */
+class CTxTally
+{
+public:
+    int nHeight;                        // of its main chain block, -1 if none
+    std::string strSentAccount;
+    int64 nDebit;
+    int64 nGenerated;
+    std::map<std::string, int64> mapReceived;
+
+    CTxTally()
+    {
+        nHeight = -1;
+        nDebit = nGenerated = 0;
+    }
+
+    void AddTo(std::map<std::string, CAccountTally>& mapTally, int nSign) const;
+};
+
 
 class CWallet : public CCryptoKeyStore
 {
@@ -62,6 +143,57 @@ private:
 
     int nWalletMaxVersion;
 
+    // Transactions in mapWallet that still have an unspent output of ours.
+    // Fully spent history is never looked at again for balances or coin
+    // selection, so those only walk this.
+    std::map<uint256, const CWalletTx*> mapUnspent;
+
+    // GetBalance/GetUnconfirmedBalance/GetImmatureBalance, valid while
+    // fBalancesCached and the best chain is still pindexBalances, and if
+    // nTimeBalances is set, while the adjusted time is still nTimeBalances
+    mutable bool fBalancesCached;
+    mutable CBlockIndex* pindexBalances;
+    mutable int64 nTimeBalances;
+    mutable int64 nBalanceCached;
+    mutable int64 nUnconfirmedBalanceCached;
+    mutable int64 nImmatureBalanceCached;
+
+    void UpdateUnspent(const uint256& hash, const CWalletTx& wtx);
+    void CacheBalances() const;
+
+    // Transactions and accounting entries by time, for listtransactions,
+    // both all together and per account.  The per-account lists are
+    // rebuilt when an address that already has transactions is relabeled.
+    std::list<CAccountingEntry> laccentries;
+    TxItems wtxOrdered;
+    std::map<std::string, TxItems> mapAccountOrdered;
+    std::map<const CWalletTx*, std::set<std::string> > mapTxAccounts;
+    std::set<CTxDestination> setOrderedDestinations;
+    bool fAccountOrderedDirty;
+
+    // Transactions by the main chain block they are in, or 0, for
+    // listsinceblock
+    std::map<uint256, std::set<const CWalletTx*> > mapTxByBlock;
+    std::map<const CWalletTx*, uint256> mapTxBlock;
+
+    // Per-account totals for getbalance and listaccounts, and what each
+    // transaction put in them.  Non-final transactions stay out of the
+    // totals and are looked at on every call instead.  Rebuilt along with
+    // the per-account lists above.
+    std::map<std::string, CAccountTally> mapAccountTally;
+    std::map<const CWalletTx*, CTxTally> mapTxTally;
+    std::set<const CWalletTx*> setTallyNonFinal;
+
+    void OrderTx(CWalletTx* pwtx);
+    void UnorderTx(CWalletTx* pwtx);
+    void OrderAccountingEntry(CAccountingEntry* pacentry);
+    bool FileTxByBlock(const CWalletTx* pwtx);
+    void MakeTxTally(const CWalletTx* pwtx, CTxTally& txTally) const;
+    void TallyTx(const CWalletTx* pwtx);
+    void UntallyTx(const CWalletTx* pwtx);
+    void TallyNowFinal(std::map<std::string, CAccountTally>& mapTallyRet) const;
+    void ReindexAccounts();
+
 public:
     mutable CCriticalSection cs_wallet;
 
@@ -82,6 +214,10 @@ public:
         fFileBacked = false;
         nMasterKeyMaxID = 0;
         pwalletdbEncryption = NULL;
+        fBalancesCached = false;
+        pindexBalances = NULL;
+        nTimeBalances = 0;
+        fAccountOrderedDirty = false;
     }
     CWallet(std::string strWalletFileIn)
     {
@@ -91,6 +227,10 @@ public:
         fFileBacked = true;
         nMasterKeyMaxID = 0;
         pwalletdbEncryption = NULL;
+        fBalancesCached = false;
+        pindexBalances = NULL;
+        nTimeBalances = 0;
+        fAccountOrderedDirty = false;
     }
 
     std::map<uint256, CWalletTx> mapWallet;
@@ -103,7 +243,7 @@ public:
     bool CanSupportFeature(enum WalletFeature wf) { return nWalletMaxVersion >= wf; }
 
     void AvailableCoins(std::vector<COutput>& vCoins, bool fOnlyConfirmed=true) const;
-    bool SelectCoinsMinConf(int64 nTargetValue, int nConfMine, int nConfTheirs, std::vector<COutput> vCoins, std::set<std::pair<const CWalletTx*,unsigned int> >& setCoinsRet, int64& nValueRet) const;
+    bool SelectCoinsMinConf(int64 nTargetValue, int nConfMine, int nConfTheirs, const std::vector<COutput>& vCoins, std::set<std::pair<const CWalletTx*,unsigned int> >& setCoinsRet, int64& nValueRet) const;
 
     CPubKey GenerateNewKey();
     bool AddKey(const CKey& key);
@@ -121,6 +261,25 @@ public:
     bool EncryptWallet(const SecureString& strWalletPassphrase);
 
     void MarkDirty();
+    void ReindexUnspent();
+    void ReindexTransactions();
+    void AddAccountingEntry(const CAccountingEntry& acentry);
+    // Items for one account, or "*" for all, oldest first
+    const TxItems& GetOrderedTxItems(const std::string& strAccount);
+    // Transactions in main chain blocks above nHeight, or not in the main
+    // chain at all
+    void GetTransactionsSinceHeight(int nHeight, std::vector<const CWalletTx*>& vwtxRet) const;
+    void DisconnectBlock(const uint256& hashBlock);
+    // Blocks are connected before they join the main chain, so their
+    // transactions are filed again once the best chain has moved
+    void FileConnectedTxs();
+    // The main chain block pwtx is filed under, 0 if none
+    uint256 GetFiledBlock(const CWalletTx* pwtx) const;
+    // Balance of an account as getbalance <account> counts it, or of all of
+    // them together for "*", which leaves out moves between accounts
+    int64 GetAccountBalance(const std::string& strAccount, int nMinDepth);
+    // Balances of every account that has had a transaction or a move
+    void GetAccountBalances(int nMinDepth, std::map<std::string, int64>& mapBalancesRet);
     bool AddToWallet(const CWalletTx& wtxIn);
     bool AddToWalletIfInvolvingMe(const CTransaction& tx, const CBlock* pblock, bool fUpdate = false, bool fFindBlock = false);
     bool EraseFromWallet(uint256 hash);
@@ -139,7 +298,7 @@ public:
     std::string SendMoneyToDestination(const CTxDestination &address, int64 nValue, CWalletTx& wtxNew, bool fAskFee=false);
 
     bool NewKeyPool();
-    bool TopUpKeyPool();
+    bool TopUpKeyPool(unsigned int nSize = 0);
     int64 AddReserveKey(const CKeyPool& keypool);
     void ReserveKeyFromKeyPool(int64& nIndex, CKeyPool& keypool);
     void KeepKey(int64 nIndex);
@@ -654,40 +813,6 @@ public:
 
 
 
-class CAccountingEntry
-{
-public:
-    std::string strAccount;
-    int64 nCreditDebit;
-    int64 nTime;
-    std::string strOtherAccount;
-    std::string strComment;
-
-    CAccountingEntry()
-    {
-        SetNull();
-    }
-
-    void SetNull()
-    {
-        nCreditDebit = 0;
-        nTime = 0;
-        strAccount.clear();
-        strOtherAccount.clear();
-        strComment.clear();
-    }
-
-    IMPLEMENT_SERIALIZE
-    (
-        if (!(nType & SER_GETHASH))
-            READWRITE(nVersion);
-        READWRITE(nCreditDebit);
-        READWRITE(nTime);
-        READWRITE(strOtherAccount);
-        READWRITE(strComment);
-    )
-};
-
 bool GetWalletFile(CWallet* pwallet, std::string &strWalletFileOut);
 
 #endif
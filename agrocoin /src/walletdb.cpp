@@ -9,34 +9,38 @@ using namespace boost;
 
 static uint64 nAccountingEntryNumber = 0;
 
+// Log size at which the flush thread compacts the wallet journal even
+// while the wallet is busy
+static const unsigned int WALLET_JOURNAL_COMPACT_SIZE = 4 * 1024 * 1024;
+
 
 
 bool CWalletDB::WriteName(const string& strAddress, const string& strName)
 {
     nWalletDBUpdated++;
-    return Write(make_pair(string("name"), strAddress), strName);
+    return WriteJournaled(make_pair(string("name"), strAddress), strName);
 }
 
 bool CWalletDB::EraseName(const string& strAddress)
 {
     nWalletDBUpdated++;
-    return Erase(make_pair(string("name"), strAddress));
+    return EraseJournaled(make_pair(string("name"), strAddress));
 }
 
 bool CWalletDB::ReadAccount(const string& strAccount, CAccount& account)
 {
     account.SetNull();
-    return Read(make_pair(string("acc"), strAccount), account);
+    return ReadJournaled(make_pair(string("acc"), strAccount), account);
 }
 
 bool CWalletDB::WriteAccount(const string& strAccount, const CAccount& account)
 {
-    return Write(make_pair(string("acc"), strAccount), account);
+    return WriteJournaled(make_pair(string("acc"), strAccount), account);
 }
 
 bool CWalletDB::WriteAccountingEntry(const CAccountingEntry& acentry)
 {
-    return Write(boost::make_tuple(string("acentry"), acentry.strAccount, ++nAccountingEntryNumber), acentry);
+    return WriteJournaled(boost::make_tuple(string("acentry"), acentry.strAccount, ++nAccountingEntryNumber), acentry);
 }
 
 int64 CWalletDB::GetAccountCreditDebit(const string& strAccount)
@@ -55,6 +59,10 @@ void CWalletDB::ListAccountCreditDebit(const string& strAccount, list<CAccountin
 {
     bool fAllAccounts = (strAccount == "*");
 
+    // The cursor only sees what is in the database
+    if (!CompactWalletJournal(strFile))
+        throw runtime_error("CWalletDB::ListAccountCreditDebit() : cannot compact wallet journal");
+
     Dbc* pcursor = GetCursor();
     if (!pcursor)
         throw runtime_error("CWalletDB::ListAccountCreditDebit() : cannot create DB cursor");
@@ -99,6 +107,10 @@ int CWalletDB::LoadWallet(CWallet* pwallet)
     vector<uint256> vWalletUpgrade;
     bool fIsEncrypted = false;
 
+    // Replays any journal left behind by a crash
+    if (!CompactWalletJournal(strFile))
+        return DB_LOAD_FAIL;
+
     {
         LOCK(pwallet->cs_wallet);
         int nMinVersion = 0;
@@ -177,6 +189,11 @@ int CWalletDB::LoadWallet(CWallet* pwallet)
                 ssKey >> nNumber;
                 if (nNumber > nAccountingEntryNumber)
                     nAccountingEntryNumber = nNumber;
+
+                CAccountingEntry acentry;
+                ssValue >> acentry;
+                acentry.strAccount = strAccount;
+                pwallet->AddAccountingEntry(acentry);
             }
             else if (strType == "key" || strType == "wkey")
             {
@@ -323,6 +340,17 @@ void ThreadFlushWalletDB(void* parg)
             nLastWalletUpdate = GetTime();
         }
 
+        // Sync batched journal appends, and fold the journal into the
+        // wallet file once the wallet goes quiet or the log gets long
+        CWalletJournal* pjournal = GetWalletJournal(strFile);
+        if (pjournal)
+        {
+            pjournal->Sync();
+            if (pjournal->GetLogSize() >= WALLET_JOURNAL_COMPACT_SIZE ||
+                (nLastFlushed != nWalletDBUpdated && GetTime() - nLastWalletUpdate >= 2))
+                pjournal->Compact();
+        }
+
         if (nLastFlushed != nWalletDBUpdated && GetTime() - nLastWalletUpdate >= 2)
         {
             TRY_LOCK(bitdb.cs_db,lockDb);
@@ -361,6 +389,8 @@ bool BackupWallet(const CWallet& wallet, const string& strDest)
 {
     if (!wallet.fFileBacked)
         return false;
+    if (!CompactWalletJournal(wallet.strWalletFile))
+        return false;
     while (!fShutdown)
     {
         {
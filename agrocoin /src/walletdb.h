@@ -4,6 +4,7 @@
 
 #include "db.h"
 #include "base58.h"
+#include "walletjournal.h"
 
 class CKeyPool;
 class CAccount;
@@ -27,11 +28,80 @@ public:
 private:
     CWalletDB(const CWalletDB&);
     void operator=(const CWalletDB&);
+
+    // Records that change often go through the wallet journal, except
+    // inside a database transaction
+    template<typename K, typename T>
+    bool WriteJournaled(const K& key, const T& value)
+    {
+        CWalletJournal* pjournal = activeTxn ? NULL : GetWalletJournal(strFile);
+        if (!pjournal)
+            return Write(key, value);
+        if (fReadOnly)
+            assert(!"Write called on database in read-only mode");
+
+        CDataStream ssKey(SER_DISK, CLIENT_VERSION);
+        ssKey << key;
+        CDataStream ssValue(SER_DISK, CLIENT_VERSION);
+        ssValue.reserve(10000);
+        ssValue << value;
+        return pjournal->Write(ssKey, ssValue);
+    }
+
+    template<typename K>
+    bool EraseJournaled(const K& key)
+    {
+        CWalletJournal* pjournal = activeTxn ? NULL : GetWalletJournal(strFile);
+        if (!pjournal)
+            return Erase(key);
+        if (fReadOnly)
+            assert(!"Erase called on database in read-only mode");
+
+        CDataStream ssKey(SER_DISK, CLIENT_VERSION);
+        ssKey << key;
+        return pjournal->Erase(ssKey);
+    }
+
+    template<typename K, typename T>
+    bool ReadJournaled(const K& key, T& value)
+    {
+        CWalletJournal* pjournal = GetWalletJournal(strFile);
+        if (pjournal)
+        {
+            CDataStream ssKey(SER_DISK, CLIENT_VERSION);
+            ssKey << key;
+            CDataStream ssValue(SER_DISK, CLIENT_VERSION);
+            bool fErased;
+            if (pjournal->Read(ssKey, ssValue, fErased))
+            {
+                if (fErased)
+                    return false;
+                try {
+                    ssValue >> value;
+                }
+                catch (std::exception &e) {
+                    return false;
+                }
+                return true;
+            }
+        }
+        return Read(key, value);
+    }
+
 public:
+    // Writes made inside a transaction bypass the journal, so it is
+    // compacted first to keep them ordered after it
+    bool TxnBegin()
+    {
+        if (!CompactWalletJournal(strFile))
+            return false;
+        return CDB::TxnBegin();
+    }
+
     bool ReadName(const std::string& strAddress, std::string& strName)
     {
         strName = "";
-        return Read(std::make_pair(std::string("name"), strAddress), strName);
+        return ReadJournaled(std::make_pair(std::string("name"), strAddress), strName);
     }
 
     bool WriteName(const std::string& strAddress, const std::string& strName);
@@ -40,19 +110,19 @@ public:
 
     bool ReadTx(uint256 hash, CWalletTx& wtx)
     {
-        return Read(std::make_pair(std::string("tx"), hash), wtx);
+        return ReadJournaled(std::make_pair(std::string("tx"), hash), wtx);
     }
 
     bool WriteTx(uint256 hash, const CWalletTx& wtx)
     {
         nWalletDBUpdated++;
-        return Write(std::make_pair(std::string("tx"), hash), wtx);
+        return WriteJournaled(std::make_pair(std::string("tx"), hash), wtx);
     }
 
     bool EraseTx(uint256 hash)
     {
         nWalletDBUpdated++;
-        return Erase(std::make_pair(std::string("tx"), hash));
+        return EraseJournaled(std::make_pair(std::string("tx"), hash));
     }
 
     bool ReadKey(const CPubKey& vchPubKey, CPrivKey& vchPrivKey)
@@ -101,12 +171,30 @@ public:
     bool WriteBestBlock(const CBlockLocator& locator)
     {
         nWalletDBUpdated++;
-        return Write(std::string("bestblock"), locator);
+        return WriteJournaled(std::string("bestblock"), locator);
     }
 
     bool ReadBestBlock(CBlockLocator& locator)
     {
-        return Read(std::string("bestblock"), locator);
+        return ReadJournaled(std::string("bestblock"), locator);
+    }
+
+    // Last block a rescan finished, kept until the rescan completes
+    bool WriteRescanProgress(const CBlockLocator& locator)
+    {
+        nWalletDBUpdated++;
+        return Write(std::string("rescanprogress"), locator);
+    }
+
+    bool ReadRescanProgress(CBlockLocator& locator)
+    {
+        return Read(std::string("rescanprogress"), locator);
+    }
+
+    bool EraseRescanProgress()
+    {
+        nWalletDBUpdated++;
+        return Erase(std::string("rescanprogress"));
     }
 
     bool ReadDefaultKey(std::vector<unsigned char>& vchPubKey)
@@ -0,0 +1,347 @@
+#include "walletjournal.h"
+#include "db.h"
+#include "util.h"
+
+#include <boost/filesystem.hpp>
+
+using namespace std;
+using namespace boost;
+
+/** Writes journal records straight into the wallet database */
+class CWalletJournalDB : public CDB
+{
+public:
+    explicit CWalletJournalDB(const string& strFile) : CDB(strFile.c_str(), "cr+")
+    {
+    }
+
+    bool Apply(const JournalMap& mapRecords)
+    {
+        if (!pdb || !TxnBegin())
+            return false;
+        BOOST_FOREACH(const JournalMap::value_type& item, mapRecords)
+        {
+            Dbt datKey((void*)item.first.data(), item.first.size());
+            int ret;
+            if (item.second.first)
+            {
+                ret = pdb->del(activeTxn, &datKey, 0);
+                if (ret == DB_NOTFOUND)
+                    ret = 0;
+            }
+            else
+            {
+                Dbt datValue((void*)item.second.second.data(), item.second.second.size());
+                ret = pdb->put(activeTxn, &datKey, &datValue, 0);
+            }
+            if (ret != 0)
+            {
+                TxnAbort();
+                return false;
+            }
+        }
+        return TxnCommit();
+    }
+};
+
+static bool ReadWholeFile(const filesystem::path& path, vector<char>& vch)
+{
+    vch.clear();
+    FILE* file = fopen(path.string().c_str(), "rb");
+    if (!file)
+        return false;
+    char buf[65536];
+    size_t n;
+    while ((n = fread(buf, 1, sizeof(buf), file)) > 0)
+        vch.insert(vch.end(), buf, buf + n);
+    fclose(file);
+    return true;
+}
+
+CWalletJournal::CWalletJournal(const string& strFileIn)
+{
+    strFile = strFileIn;
+    pathLog = GetDataDir() / (strFile + ".journal");
+    pathOld = GetDataDir() / (strFile + ".journal.old");
+    file = NULL;
+    nLogSize = 0;
+    fDirty = false;
+    nLastSync = 0;
+    nSyncMillis = max(GetArg("-walletjournalsync", 100), (int64)0);
+}
+
+CWalletJournal::~CWalletJournal()
+{
+    if (file)
+    {
+        FileCommit(file);
+        fclose(file);
+    }
+}
+
+void CWalletJournal::SerializeRecord(bool fErase, const string& strKey, const string& strValue, vector<char>& vchOut)
+{
+    CDataStream ssRecord(SER_DISK, CLIENT_VERSION);
+    ssRecord << (unsigned char)fErase << strKey << strValue;
+    uint256 hash = Hash(ssRecord.begin(), ssRecord.end());
+    unsigned int nChecksum = 0;
+    memcpy(&nChecksum, &hash, sizeof(nChecksum));
+
+    CDataStream ssHeader(SER_DISK, CLIENT_VERSION);
+    ssHeader << (unsigned int)ssRecord.size() << nChecksum;
+    vchOut.insert(vchOut.end(), ssHeader.begin(), ssHeader.end());
+    vchOut.insert(vchOut.end(), ssRecord.begin(), ssRecord.end());
+}
+
+unsigned int CWalletJournal::ReplayRecords(const vector<char>& vch, JournalMap& mapRecords)
+{
+    unsigned int nPos = 0;
+    while (vch.size() - nPos >= 8)
+    {
+        unsigned int nSize, nChecksum;
+        CDataStream ssHeader(&vch[nPos], &vch[nPos] + 8, SER_DISK, CLIENT_VERSION);
+        ssHeader >> nSize >> nChecksum;
+        if (nSize > vch.size() - nPos - 8)
+            break;
+
+        const char* pbegin = &vch[nPos] + 8;
+        uint256 hash = Hash(pbegin, pbegin + nSize);
+        if (memcmp(&hash, &nChecksum, sizeof(nChecksum)) != 0)
+            break;
+
+        unsigned char fErase;
+        string strKey, strValue;
+        try {
+            CDataStream ssRecord(pbegin, pbegin + nSize, SER_DISK, CLIENT_VERSION);
+            ssRecord >> fErase >> strKey >> strValue;
+        }
+        catch (std::exception &e) {
+            break;
+        }
+        mapRecords[strKey] = make_pair(fErase != 0, strValue);
+        nPos += 8 + nSize;
+    }
+    return nPos;
+}
+
+bool CWalletJournal::WriteLog(const filesystem::path& path, const JournalMap& mapRecords)
+{
+    vector<char> vch;
+    BOOST_FOREACH(const JournalMap::value_type& item, mapRecords)
+        SerializeRecord(item.second.first, item.first, item.second.second, vch);
+
+    FILE* fileOut = fopen(path.string().c_str(), "wb");
+    if (!fileOut)
+        return error("CWalletJournal::WriteLog() : can't open %s", path.string().c_str());
+    bool fOk = vch.empty() || fwrite(&vch[0], 1, vch.size(), fileOut) == vch.size();
+    FileCommit(fileOut);
+    fclose(fileOut);
+    return fOk;
+}
+
+bool CWalletJournal::Open()
+{
+    JournalMap mapRecords;
+    bool fFound = false;
+    filesystem::path vPaths[] = { pathOld, pathLog };
+    BOOST_FOREACH(const filesystem::path& path, vPaths)
+    {
+        vector<char> vch;
+        if (!ReadWholeFile(path, vch))
+            continue;
+        fFound = true;
+        unsigned int nValid = ReplayRecords(vch, mapRecords);
+        if (nValid < vch.size())
+            printf("CWalletJournal::Open() : ignoring %u incomplete bytes at the end of %s\n", (unsigned int)vch.size() - nValid, path.string().c_str());
+    }
+    if (!fFound)
+        return true;
+    printf("Replaying %d records from the %s journal\n", (int)mapRecords.size(), strFile.c_str());
+
+    // Merge both logs into one before anything else, so that a crash from
+    // here on replays the same records
+    filesystem::path pathNew = GetDataDir() / (strFile + ".journal.new");
+    if (!WriteLog(pathNew, mapRecords) || !RenameOver(pathNew, pathLog))
+        return error("CWalletJournal::Open() : can't rewrite %s", pathLog.string().c_str());
+    filesystem::remove(pathOld);
+
+    {
+        LOCK(cs);
+        mapPending.swap(mapRecords);
+        nLogSize = filesystem::file_size(pathLog);
+    }
+    return Compact();
+}
+
+bool CWalletJournal::Append(bool fErase, const string& strKey, const string& strValue)
+{
+    vector<char> vch;
+    SerializeRecord(fErase, strKey, strValue, vch);
+
+    LOCK(cs);
+    if (!file)
+    {
+        file = fopen(pathLog.string().c_str(), "ab");
+        if (!file)
+            return error("CWalletJournal::Append() : can't open %s", pathLog.string().c_str());
+    }
+    if (fwrite(&vch[0], 1, vch.size(), file) != vch.size())
+        return error("CWalletJournal::Append() : write to %s failed", pathLog.string().c_str());
+    mapPending[strKey] = make_pair(fErase, strValue);
+    nLogSize += vch.size();
+
+    int64 nNow = GetTimeMillis();
+    if (nNow - nLastSync >= nSyncMillis)
+    {
+        FileCommit(file);
+        nLastSync = nNow;
+        fDirty = false;
+    }
+    else
+        fDirty = true;
+    return true;
+}
+
+bool CWalletJournal::Write(const CDataStream& ssKey, const CDataStream& ssValue)
+{
+    return Append(false, string(ssKey.begin(), ssKey.end()), string(ssValue.begin(), ssValue.end()));
+}
+
+bool CWalletJournal::Erase(const CDataStream& ssKey)
+{
+    return Append(true, string(ssKey.begin(), ssKey.end()), string());
+}
+
+bool CWalletJournal::Read(const CDataStream& ssKey, CDataStream& ssValueRet, bool& fErasedRet)
+{
+    string strKey(ssKey.begin(), ssKey.end());
+    LOCK(cs);
+    JournalMap::const_iterator mi = mapPending.find(strKey);
+    if (mi == mapPending.end())
+    {
+        mi = mapCompacting.find(strKey);
+        if (mi == mapCompacting.end())
+            return false;
+    }
+    fErasedRet = mi->second.first;
+    if (!fErasedRet)
+        ssValueRet.write(mi->second.second.data(), mi->second.second.size());
+    return true;
+}
+
+void CWalletJournal::Sync()
+{
+    LOCK(cs);
+    if (fDirty && file)
+    {
+        FileCommit(file);
+        nLastSync = GetTimeMillis();
+        fDirty = false;
+    }
+}
+
+unsigned int CWalletJournal::GetLogSize()
+{
+    LOCK(cs);
+    return nLogSize;
+}
+
+bool CWalletJournal::Compact()
+{
+    LOCK(cs_compact);
+    {
+        LOCK(cs);
+        if (mapPending.empty())
+            return true;
+        if (file)
+        {
+            FileCommit(file);
+            fclose(file);
+            file = NULL;
+        }
+        if (!RenameOver(pathLog, pathOld))
+            return error("CWalletJournal::Compact() : can't move %s aside", pathLog.string().c_str());
+        mapCompacting.swap(mapPending);
+        nLogSize = 0;
+        fDirty = false;
+    }
+
+    // Appends carry on into a new log meanwhile, and reads still find the
+    // records being compacted in mapCompacting
+    bool fOk = CWalletJournalDB(strFile).Apply(mapCompacting);
+
+    {
+        LOCK(cs);
+        if (!fOk)
+        {
+            // Put the old log back in front of the new one
+            if (file)
+            {
+                fclose(file);
+                file = NULL;
+            }
+            vector<char> vch;
+            ReadWholeFile(pathLog, vch);
+            FILE* fileOld = fopen(pathOld.string().c_str(), "ab");
+            if (fileOld)
+            {
+                if (!vch.empty())
+                    fwrite(&vch[0], 1, vch.size(), fileOld);
+                FileCommit(fileOld);
+                fclose(fileOld);
+                RenameOver(pathOld, pathLog);
+                nLogSize = filesystem::file_size(pathLog);
+            }
+            BOOST_FOREACH(const JournalMap::value_type& item, mapCompacting)
+                mapPending.insert(item);
+            mapCompacting.clear();
+            return error("CWalletJournal::Compact() : writing to %s failed", strFile.c_str());
+        }
+        filesystem::remove(pathOld);
+        mapCompacting.clear();
+        return true;
+    }
+}
+
+
+static CCriticalSection cs_mapJournals;
+static map<string, CWalletJournal*> mapJournals;
+static bool fJournalsFlushed = false;
+
+CWalletJournal* GetWalletJournal(const string& strFile)
+{
+    if (!GetBoolArg("-walletjournal", true))
+        return NULL;
+
+    LOCK(cs_mapJournals);
+    if (fJournalsFlushed)
+        return NULL;
+    map<string, CWalletJournal*>::iterator mi = mapJournals.find(strFile);
+    if (mi != mapJournals.end())
+        return (*mi).second;
+
+    CWalletJournal* pjournal = new CWalletJournal(strFile);
+    if (!pjournal->Open())
+    {
+        delete pjournal;
+        throw runtime_error("GetWalletJournal() : can't recover the " + strFile + " journal");
+    }
+    mapJournals[strFile] = pjournal;
+    return pjournal;
+}
+
+bool CompactWalletJournal(const string& strFile)
+{
+    CWalletJournal* pjournal = GetWalletJournal(strFile);
+    return !pjournal || pjournal->Compact();
+}
+
+void FlushWalletJournals()
+{
+    // The journals themselves stay around, the flush thread may still be
+    // looking at one; from here on writes go straight to the database
+    LOCK(cs_mapJournals);
+    fJournalsFlushed = true;
+    for (map<string, CWalletJournal*>::iterator mi = mapJournals.begin(); mi != mapJournals.end(); ++mi)
+        (*mi).second->Compact();
+}
@@ -0,0 +1,87 @@
+#ifndef BITCOIN_WALLETJOURNAL_H
+#define BITCOIN_WALLETJOURNAL_H
+
+#include "serialize.h"
+#include "sync.h"
+
+#include <map>
+#include <string>
+#include <vector>
+#include <boost/filesystem/path.hpp>
+
+// serialized key -> (erased, serialized value)
+typedef std::map<std::string, std::pair<bool, std::string> > JournalMap;
+
+/** Append-only log in front of a wallet database file.
+ *
+ * Records that change all the time (transactions, address book, accounts,
+ * accounting entries, best block) are appended to <file>.journal instead of
+ * each costing a BDB transaction on the wallet file.  Pending records are
+ * kept in memory so reads see them, and Compact() folds them into the wallet
+ * file in a single transaction; the wallet flush thread does that in the
+ * background.
+ *
+ * Compaction first moves the log aside to <file>.journal.old and only
+ * deletes it once the database transaction has committed.  On startup both
+ * logs are replayed in order, stopping at the first incomplete or corrupt
+ * record, so a crash at any point recovers to the same state.
+ *
+ * Appends are synced to disk at most every -walletjournalsync milliseconds
+ * (0 syncs every append); Sync() covers appends since the last one.
+ */
+class CWalletJournal
+{
+private:
+    // Guards the log file and the in-memory maps
+    CCriticalSection cs;
+    // Held for a whole compaction
+    CCriticalSection cs_compact;
+
+    std::string strFile;
+    boost::filesystem::path pathLog;
+    boost::filesystem::path pathOld;
+    FILE* file;
+    unsigned int nLogSize;
+    bool fDirty;
+    int64 nLastSync;
+    int64 nSyncMillis;
+
+    JournalMap mapPending;          // in the current log
+    JournalMap mapCompacting;       // in the old log, being written to the database
+
+    bool Append(bool fErase, const std::string& strKey, const std::string& strValue);
+    bool WriteLog(const boost::filesystem::path& path, const JournalMap& mapRecords);
+
+public:
+    explicit CWalletJournal(const std::string& strFileIn);
+    ~CWalletJournal();
+
+    // Replays whatever logs a previous run left behind
+    bool Open();
+
+    bool Write(const CDataStream& ssKey, const CDataStream& ssValue);
+    bool Erase(const CDataStream& ssKey);
+
+    // True if the key has a pending record; fErasedRet tells whether that
+    // record is an erase, otherwise ssValueRet gets the value
+    bool Read(const CDataStream& ssKey, CDataStream& ssValueRet, bool& fErasedRet);
+
+    void Sync();
+    bool Compact();
+    unsigned int GetLogSize();
+
+    // Record format: size, checksum, then the serialized record
+    static void SerializeRecord(bool fErase, const std::string& strKey, const std::string& strValue, std::vector<char>& vchOut);
+    // Applies records in order until the first bad one; returns the number
+    // of bytes that were valid
+    static unsigned int ReplayRecords(const std::vector<char>& vch, JournalMap& mapRecords);
+};
+
+// NULL when -walletjournal=0
+CWalletJournal* GetWalletJournal(const std::string& strFile);
+// Brings the wallet file up to date with its journal, if it has one
+bool CompactWalletJournal(const std::string& strFile);
+// Compacts and closes all journals, on shutdown
+void FlushWalletJournals();
+
+#endif
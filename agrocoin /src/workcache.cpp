@@ -0,0 +1,86 @@
+#include "workcache.h"
+
+using namespace std;
+
+uint256 CWork::GetMerkleRoot() const
+{
+    CTransaction txCoinbase = ptemplate->block.vtx[0];
+    txCoinbase.vin[0].scriptSig = scriptSig;
+    txCoinbase.InvalidateHash();
+    return CBlock::CheckMerkleBranch(txCoinbase.GetHash(), ptemplate->vCoinbaseBranch, 0);
+}
+
+void CWork::GetBlock(CBlock& blockRet) const
+{
+    blockRet = ptemplate->block;
+    blockRet.vtx[0].vin[0].scriptSig = scriptSig;
+    blockRet.vtx[0].InvalidateHash();
+    blockRet.nBits = nBits;
+    blockRet.hashMerkleRoot = blockRet.BuildMerkleTree();
+}
+
+CWorkCache::CWorkCache(size_t nMaxWork)
+{
+    nMaxPerShard = max(nMaxWork / NUM_SHARDS, (size_t)1);
+}
+
+void CWorkCache::Add(const uint256& hashMerkleRoot, const CWork& work)
+{
+    CWork workEvicted;
+    CShard& shard = GetShard(hashMerkleRoot);
+    {
+        LOCK(shard.cs);
+        if (!shard.mapWork.insert(make_pair(hashMerkleRoot, work)).second)
+            return;
+        shard.queueWork.push_back(hashMerkleRoot);
+        if (shard.queueWork.size() > nMaxPerShard)
+        {
+            map<uint256, CWork>::iterator mi = shard.mapWork.find(shard.queueWork.front());
+            if (mi != shard.mapWork.end())
+            {
+                // Dropping the last reference to a template frees a whole
+                // block; do that after releasing the lock
+                workEvicted = mi->second;
+                shard.mapWork.erase(mi);
+            }
+            shard.queueWork.pop_front();
+        }
+    }
+}
+
+bool CWorkCache::Get(const uint256& hashMerkleRoot, CWork& workRet) const
+{
+    CShard& shard = GetShard(hashMerkleRoot);
+    LOCK(shard.cs);
+    map<uint256, CWork>::const_iterator mi = shard.mapWork.find(hashMerkleRoot);
+    if (mi == shard.mapWork.end())
+        return false;
+    workRet = mi->second;
+    return true;
+}
+
+void CWorkCache::Clear()
+{
+    for (int i = 0; i < NUM_SHARDS; i++)
+    {
+        // Swap the contents out so they are destroyed without the lock held
+        map<uint256, CWork> mapWork;
+        deque<uint256> queueWork;
+        {
+            LOCK(vShards[i].cs);
+            vShards[i].mapWork.swap(mapWork);
+            vShards[i].queueWork.swap(queueWork);
+        }
+    }
+}
+
+size_t CWorkCache::size() const
+{
+    size_t nSize = 0;
+    for (int i = 0; i < NUM_SHARDS; i++)
+    {
+        LOCK(vShards[i].cs);
+        nSize += vShards[i].mapWork.size();
+    }
+    return nSize;
+}
@@ -0,0 +1,77 @@
+#ifndef BITCOIN_WORKCACHE_H
+#define BITCOIN_WORKCACHE_H
+
+#include "main.h"
+#include "sync.h"
+
+#include <deque>
+#include <boost/shared_ptr.hpp>
+
+/** Block template that getwork units are cut from.  Never modified once
+ * handed out, so any number of units (and threads) can share one copy. */
+class CWorkTemplate
+{
+public:
+    CBlock block;
+    std::vector<uint256> vCoinbaseBranch;   // merkle branch of vtx[0]
+
+    explicit CWorkTemplate(const CBlock& blockIn) : block(blockIn)
+    {
+        vCoinbaseBranch = block.GetMerkleBranch(0);
+    }
+};
+
+/** One unit of work: a template plus its own coinbase scriptSig */
+class CWork
+{
+public:
+    boost::shared_ptr<const CWorkTemplate> ptemplate;
+    CScript scriptSig;
+    unsigned int nBits;     // can differ from the template's on testnet
+
+    CWork() : nBits(0) {}
+
+    // Merkle root of the template with this unit's coinbase
+    uint256 GetMerkleRoot() const;
+
+    // Copy of the full block this unit describes
+    void GetBlock(CBlock& blockRet) const;
+};
+
+/** Work handed out by getwork/getworkex, keyed by merkle root.
+ *
+ * Entries are spread over independently locked shards so concurrent RPC
+ * workers rarely contend, and each shard forgets its oldest work once it
+ * holds its share of nMaxWork units.  Templates are reference counted and
+ * go away with the last unit that uses them.
+ */
+class CWorkCache
+{
+private:
+    enum { NUM_SHARDS = 16 };
+
+    struct CShard
+    {
+        CCriticalSection cs;
+        std::map<uint256, CWork> mapWork;
+        std::deque<uint256> queueWork;  // insertion order, for eviction
+    };
+
+    mutable CShard vShards[NUM_SHARDS];
+    size_t nMaxPerShard;
+
+    CShard& GetShard(const uint256& hashMerkleRoot) const
+    {
+        return vShards[hashMerkleRoot.Get64() % NUM_SHARDS];
+    }
+
+public:
+    explicit CWorkCache(size_t nMaxWork = 100000);
+
+    void Add(const uint256& hashMerkleRoot, const CWork& work);
+    bool Get(const uint256& hashMerkleRoot, CWork& workRet) const;
+    void Clear();
+    size_t size() const;
+};
+
+#endif